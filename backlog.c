@@ -0,0 +1,341 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "try_catch.h"
+#include "backlog.h"
+
+
+#define BACKLOG_MAX_FRAME_SIZE      (PROTOCOL_HEADER_SIZE + PROTOCOL_MAX_PAYLOAD_SIZE)
+#define BACKLOG_SPILL_GROWTH        (16 * 1024 * 1024)
+
+
+static int      hasRoomInMemory(Backlog* pBacklog, size_t frameSize);
+static void     spillFrame(Backlog* pBacklog, uint8_t type, uint8_t flags, uint16_t channel,
+                           const void* pPayload, size_t length);
+static int      hasRoomInSpill(Backlog* pBacklog, uint64_t length);
+static void     prepareSpill(Backlog* pBacklog, uint64_t length);
+static void     allocateMemory(Backlog* pBacklog);
+static void     createSpillFile(Backlog* pBacklog);
+static void     growSpillFile(Backlog* pBacklog, uint64_t neededSize);
+static void     resetSpillFile(Backlog* pBacklog);
+static void     compactRegion(BacklogRegion* pRegion);
+static int      isSpilling(Backlog* pBacklog);
+static uint64_t regionUsed(const BacklogRegion* pRegion);
+static uint64_t regionFree(const BacklogRegion* pRegion);
+static void     writeFrame(BacklogRegion* pRegion, uint8_t type, uint8_t flags, uint16_t channel,
+                           const void* pPayload, size_t length);
+static BacklogRegion* regionToRead(Backlog* pBacklog);
+
+
+void Backlog_Init(Backlog* pBacklog, uint64_t spillLimit)
+{
+    memset(pBacklog, 0, sizeof(*pBacklog));
+    pBacklog->spillLimit = spillLimit;
+    pBacklog->spillFileDescriptor = -1;
+}
+
+void Backlog_Uninit(Backlog* pBacklog)
+{
+    free(pBacklog->memory.pBase);
+    if (pBacklog->spill.pBase)
+        munmap(pBacklog->spill.pBase, pBacklog->spillLimit);
+    if (pBacklog->spillFileDescriptor >= 0)
+        close(pBacklog->spillFileDescriptor);
+    memset(pBacklog, 0, sizeof(*pBacklog));
+    pBacklog->spillFileDescriptor = -1;
+}
+
+int Backlog_IsEmpty(Backlog* pBacklog)
+{
+    return regionUsed(&pBacklog->memory) == 0 && regionUsed(&pBacklog->spill) == 0;
+}
+
+int Backlog_IsFull(Backlog* pBacklog)
+{
+    /* Full means the largest frame (and the trace frame that can follow it) might not fit. */
+    uint64_t needed = 2 * BACKLOG_MAX_FRAME_SIZE;
+
+    if (!isSpilling(pBacklog) &&
+        BACKLOG_MEMORY_SIZE - regionUsed(&pBacklog->memory) >= needed)
+    {
+        return 0;
+    }
+    return !hasRoomInSpill(pBacklog, needed);
+}
+
+static int hasRoomInSpill(Backlog* pBacklog, uint64_t length)
+{
+    __try
+        prepareSpill(pBacklog, length);
+    __catch
+    {
+        clearExceptionCode();
+        return 0;
+    }
+    return 1;
+}
+
+void Backlog_AppendFrame(Backlog* pBacklog, uint8_t type, uint8_t flags, uint16_t channel,
+                         const void* pPayload, size_t length)
+{
+    size_t frameSize = PROTOCOL_HEADER_SIZE + length;
+
+    __try
+    {
+        if (!isSpilling(pBacklog) && hasRoomInMemory(pBacklog, frameSize))
+            writeFrame(&pBacklog->memory, type, flags, channel, pPayload, length);
+        else
+            spillFrame(pBacklog, type, flags, channel, pPayload, length);
+    }
+    __catch
+    {
+        __rethrow;
+    }
+
+    if (Backlog_GetSize(pBacklog) > pBacklog->peakBytes)
+        pBacklog->peakBytes = Backlog_GetSize(pBacklog);
+}
+
+static int hasRoomInMemory(Backlog* pBacklog, size_t frameSize)
+{
+    if (!pBacklog->memory.pBase)
+    {
+        __try
+            allocateMemory(pBacklog);
+        __catch
+            __rethrow_and_return(0);
+    }
+    if (regionFree(&pBacklog->memory) < frameSize)
+        compactRegion(&pBacklog->memory);
+    return regionFree(&pBacklog->memory) >= frameSize;
+}
+
+static void spillFrame(Backlog* pBacklog, uint8_t type, uint8_t flags, uint16_t channel,
+                       const void* pPayload, size_t length)
+{
+    size_t frameSize = PROTOCOL_HEADER_SIZE + length;
+
+    __try
+        prepareSpill(pBacklog, frameSize);
+    __catch
+        __rethrow;
+
+    writeFrame(&pBacklog->spill, type, flags, channel, pPayload, length);
+    pBacklog->totalSpilledBytes += frameSize;
+}
+
+static void prepareSpill(Backlog* pBacklog, uint64_t length)
+{
+    BacklogRegion* pSpill = &pBacklog->spill;
+
+    __try
+    {
+        if (!pSpill->pBase)
+        {
+            __throwing_func( createSpillFile(pBacklog) );
+        }
+        /* Moving the waiting frames down costs no more than the bytes already drained in front of them. */
+        if (pSpill->readOffset >= regionUsed(pSpill))
+            compactRegion(pSpill);
+        __throwing_func( growSpillFile(pBacklog, pSpill->writeOffset + length) );
+    }
+    __catch
+    {
+        __rethrow;
+    }
+}
+
+static void allocateMemory(Backlog* pBacklog)
+{
+    pBacklog->memory.pBase = malloc(BACKLOG_MEMORY_SIZE);
+    if (!pBacklog->memory.pBase)
+        __throw(outOfMemoryException);
+    pBacklog->memory.size = BACKLOG_MEMORY_SIZE;
+}
+
+static void createSpillFile(Backlog* pBacklog)
+{
+    const char* pDirectory = getenv("TMPDIR");
+    char        path[4096];
+    void*       pMapping = NULL;
+    int         savedErrno;
+
+    if (pBacklog->spillLimit == 0)
+    {
+        errno = ENOSPC;
+        __throw(fileException);
+    }
+    snprintf(path, sizeof(path), "%s/remote-backlog-XXXXXX", pDirectory && *pDirectory ? pDirectory : "/tmp");
+    pBacklog->spillFileDescriptor = mkstemp(path);
+    if (pBacklog->spillFileDescriptor < 0)
+        __throw(fileException);
+    unlink(path);
+
+    /* Reserve address space for the whole limit up front; the file itself only grows as it is needed. */
+    pMapping = mmap(NULL, pBacklog->spillLimit, PROT_READ | PROT_WRITE, MAP_SHARED, pBacklog->spillFileDescriptor, 0);
+    if (pMapping == MAP_FAILED)
+    {
+        savedErrno = errno;
+        close(pBacklog->spillFileDescriptor);
+        pBacklog->spillFileDescriptor = -1;
+        errno = savedErrno;
+        __throw(fileException);
+    }
+    pBacklog->spill.pBase = pMapping;
+    pBacklog->spill.size = pBacklog->spillLimit;
+}
+
+static void growSpillFile(Backlog* pBacklog, uint64_t neededSize)
+{
+    uint64_t newSize;
+    int      result;
+
+    if (neededSize <= pBacklog->spillFileSize)
+        return;
+    if (neededSize > pBacklog->spillLimit)
+    {
+        errno = ENOSPC;
+        __throw(fileException);
+    }
+
+    newSize = (neededSize + BACKLOG_SPILL_GROWTH - 1) / BACKLOG_SPILL_GROWTH * BACKLOG_SPILL_GROWTH;
+    if (newSize > pBacklog->spillLimit)
+        newSize = pBacklog->spillLimit;
+    result = posix_fallocate(pBacklog->spillFileDescriptor, pBacklog->spillFileSize, newSize - pBacklog->spillFileSize);
+    if (result != 0)
+    {
+        errno = result;
+        __throw(fileException);
+    }
+    pBacklog->spillFileSize = newSize;
+}
+
+static void resetSpillFile(Backlog* pBacklog)
+{
+    pBacklog->spill.readOffset = 0;
+    pBacklog->spill.writeOffset = 0;
+
+    /* Hand the drained blocks back to the filesystem. */
+    if (pBacklog->spillFileSize > 0 && ftruncate(pBacklog->spillFileDescriptor, 0) == 0)
+        pBacklog->spillFileSize = 0;
+}
+
+static void compactRegion(BacklogRegion* pRegion)
+{
+    uint64_t used = regionUsed(pRegion);
+
+    if (pRegion->readOffset == 0)
+        return;
+    memmove(pRegion->pBase, pRegion->pBase + pRegion->readOffset, used);
+    pRegion->readOffset = 0;
+    pRegion->writeOffset = used;
+}
+
+static int isSpilling(Backlog* pBacklog)
+{
+    return regionUsed(&pBacklog->spill) > 0;
+}
+
+static uint64_t regionUsed(const BacklogRegion* pRegion)
+{
+    return pRegion->writeOffset - pRegion->readOffset;
+}
+
+static uint64_t regionFree(const BacklogRegion* pRegion)
+{
+    return pRegion->size - pRegion->writeOffset;
+}
+
+static void writeFrame(BacklogRegion* pRegion, uint8_t type, uint8_t flags, uint16_t channel,
+                       const void* pPayload, size_t length)
+{
+    FrameHeader header;
+    char*       pDest = pRegion->pBase + pRegion->writeOffset;
+
+    header.length = length;
+    header.type = type;
+    header.flags = flags;
+    header.channel = channel;
+    Protocol_EncodeHeader(pDest, &header);
+    memcpy(pDest + PROTOCOL_HEADER_SIZE, pPayload, length);
+    pRegion->writeOffset += PROTOCOL_HEADER_SIZE + length;
+}
+
+int Backlog_PeekFrame(Backlog* pBacklog, FrameHeader* pHeader, char** ppPayload)
+{
+    BacklogRegion* pRegion = regionToRead(pBacklog);
+    char*          pFrame = NULL;
+
+    if (!pRegion)
+        return 0;
+    pFrame = pRegion->pBase + pRegion->readOffset;
+    Protocol_DecodeHeader(pHeader, pFrame);
+    *ppPayload = pFrame + PROTOCOL_HEADER_SIZE;
+    return 1;
+}
+
+void Backlog_ConsumeFrame(Backlog* pBacklog)
+{
+    BacklogRegion* pRegion = regionToRead(pBacklog);
+    FrameHeader    header;
+
+    if (!pRegion)
+        return;
+    Protocol_DecodeHeader(&header, pRegion->pBase + pRegion->readOffset);
+    pRegion->readOffset += PROTOCOL_HEADER_SIZE + header.length;
+
+    if (regionUsed(pRegion) > 0)
+        return;
+    if (pRegion == &pBacklog->spill)
+    {
+        resetSpillFile(pBacklog);
+    }
+    else
+    {
+        pRegion->readOffset = 0;
+        pRegion->writeOffset = 0;
+    }
+}
+
+static BacklogRegion* regionToRead(Backlog* pBacklog)
+{
+    /* Memory always holds frames older than any in the spill file. */
+    if (regionUsed(&pBacklog->memory) > 0)
+        return &pBacklog->memory;
+    if (regionUsed(&pBacklog->spill) > 0)
+        return &pBacklog->spill;
+    return NULL;
+}
+
+uint64_t Backlog_GetSize(Backlog* pBacklog)
+{
+    return regionUsed(&pBacklog->memory) + regionUsed(&pBacklog->spill);
+}
+
+uint64_t Backlog_GetPeakSize(Backlog* pBacklog)
+{
+    return pBacklog->peakBytes;
+}
+
+uint64_t Backlog_GetSpilledBytes(Backlog* pBacklog)
+{
+    return pBacklog->totalSpilledBytes;
+}
@@ -0,0 +1,63 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef _BACKLOG_H_
+#define _BACKLOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "protocol.h"
+
+/* A FIFO of complete frames waiting for the server to accept them.  Frames are held in memory until
+   BACKLOG_MEMORY_SIZE is used and then spill to an unlinked, memory-mapped file in $TMPDIR (or /tmp) which can grow
+   to the limit given at initialization.  Once a spill has started new frames keep going to the file until it has
+   drained so that frames always leave in the order they arrived.  File blocks are allocated before they are mapped
+   in so that a full disk shows up as a full backlog instead of SIGBUS, and the frames still waiting are moved back
+   to the start of the file once more has been drained than is left so that a spill which never quite empties
+   doesn't walk off the end of the limit. */
+#define BACKLOG_MEMORY_SIZE         (8 * 1024 * 1024)
+#define BACKLOG_DEFAULT_SPILL_LIMIT (1024ULL * 1024 * 1024)
+
+typedef struct
+{
+    char*    pBase;
+    uint64_t size;
+    uint64_t readOffset;
+    uint64_t writeOffset;
+} BacklogRegion;
+
+typedef struct
+{
+    BacklogRegion memory;
+    BacklogRegion spill;
+    uint64_t      spillLimit;
+    uint64_t      spillFileSize;
+    uint64_t      peakBytes;
+    uint64_t      totalSpilledBytes;
+    int           spillFileDescriptor;
+} Backlog;
+
+void     Backlog_Init(Backlog* pBacklog, uint64_t spillLimit);
+void     Backlog_Uninit(Backlog* pBacklog);
+int      Backlog_IsEmpty(Backlog* pBacklog);
+int      Backlog_IsFull(Backlog* pBacklog);
+void     Backlog_AppendFrame(Backlog* pBacklog, uint8_t type, uint8_t flags, uint16_t channel,
+                             const void* pPayload, size_t length);
+int      Backlog_PeekFrame(Backlog* pBacklog, FrameHeader* pHeader, char** ppPayload);
+void     Backlog_ConsumeFrame(Backlog* pBacklog);
+uint64_t Backlog_GetSize(Backlog* pBacklog);
+uint64_t Backlog_GetPeakSize(Backlog* pBacklog);
+uint64_t Backlog_GetSpilledBytes(Backlog* pBacklog);
+
+#endif /* _BACKLOG_H_ */
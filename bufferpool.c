@@ -0,0 +1,184 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "bufferpool.h"
+
+
+static int  classFor(size_t size);
+static size_t classSize(int sizeClass);
+static int  chargeBudget(BufferPool* pPool, size_t size);
+static void creditBudget(BufferPool* pPool, size_t size);
+static void releaseFreeBuffers(BufferPool* pPool, size_t bytesNeeded);
+
+
+void BufferBudget_Init(BufferBudget* pBudget, uint64_t limit)
+{
+    pBudget->limit = limit;
+    pBudget->bytesCharged = 0;
+    pBudget->refusals = 0;
+}
+
+uint64_t BufferBudget_GetBytesCharged(BufferBudget* pBudget)
+{
+    return __atomic_load_n(&pBudget->bytesCharged, __ATOMIC_RELAXED);
+}
+
+uint64_t BufferBudget_GetRefusals(BufferBudget* pBudget)
+{
+    return __atomic_load_n(&pBudget->refusals, __ATOMIC_RELAXED);
+}
+
+void BufferPool_Init(BufferPool* pPool, BufferBudget* pBudget, uint64_t sessionQuota)
+{
+    memset(pPool, 0, sizeof(*pPool));
+    pPool->pBudget = pBudget;
+    pPool->sessionQuota = sessionQuota ? sessionQuota : BUFFER_POOL_MAX_SIZE;
+}
+
+void BufferPool_Uninit(BufferPool* pPool)
+{
+    releaseFreeBuffers(pPool, (size_t)-1);
+    memset(pPool, 0, sizeof(*pPool));
+}
+
+size_t BufferPool_SizeFor(BufferPool* pPool, size_t minimumSize)
+{
+    int sizeClass = classFor(minimumSize);
+
+    if (sizeClass < 0)
+        return 0;
+    return classSize(sizeClass);
+}
+
+static int classFor(size_t size)
+{
+    int sizeClass;
+
+    for (sizeClass = 0 ; sizeClass < BUFFER_POOL_CLASS_COUNT ; sizeClass++)
+    {
+        if (size <= classSize(sizeClass))
+            return sizeClass;
+    }
+    return -1;
+}
+
+static size_t classSize(int sizeClass)
+{
+    size_t size = (size_t)BUFFER_POOL_MIN_SIZE << sizeClass;
+
+    return size < BUFFER_POOL_MAX_SIZE ? size : BUFFER_POOL_MAX_SIZE;
+}
+
+char* BufferPool_Allocate(BufferPool* pPool, size_t size)
+{
+    int              sizeClass = classFor(size);
+    BufferPoolEntry* pEntry = NULL;
+    char*            pBuffer = NULL;
+
+    if (sizeClass < 0 || classSize(sizeClass) > pPool->sessionQuota)
+        return NULL;
+    size = classSize(sizeClass);
+
+    pEntry = pPool->pFreeLists[sizeClass];
+    if (pEntry)
+    {
+        pPool->pFreeLists[sizeClass] = pEntry->pNext;
+        pPool->bytesFree -= size;
+        pPool->bytesInUse += size;
+        pPool->reuses++;
+        return (char*)pEntry;
+    }
+
+    if (!chargeBudget(pPool, size))
+        return NULL;
+    pBuffer = malloc(size);
+    if (!pBuffer)
+    {
+        creditBudget(pPool, size);
+        return NULL;
+    }
+    pPool->bytesInUse += size;
+    pPool->allocations++;
+    return pBuffer;
+}
+
+static int chargeBudget(BufferPool* pPool, size_t size)
+{
+    BufferBudget* pBudget = pPool->pBudget;
+    uint64_t      charged = __atomic_add_fetch(&pBudget->bytesCharged, size, __ATOMIC_RELAXED);
+
+    if (pBudget->limit == 0 || charged <= pBudget->limit)
+        return 1;
+
+    /* Make room by giving this pool's idle buffers back to the system before refusing. */
+    creditBudget(pPool, size);
+    releaseFreeBuffers(pPool, charged - pBudget->limit);
+    charged = __atomic_add_fetch(&pBudget->bytesCharged, size, __ATOMIC_RELAXED);
+    if (charged <= pBudget->limit)
+        return 1;
+
+    creditBudget(pPool, size);
+    __atomic_add_fetch(&pBudget->refusals, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static void creditBudget(BufferPool* pPool, size_t size)
+{
+    __atomic_sub_fetch(&pPool->pBudget->bytesCharged, size, __ATOMIC_RELAXED);
+}
+
+static void releaseFreeBuffers(BufferPool* pPool, size_t bytesNeeded)
+{
+    size_t bytesReleased = 0;
+    int    sizeClass;
+
+    /* Largest buffers first so that the fewest buffers are given up. */
+    for (sizeClass = BUFFER_POOL_CLASS_COUNT - 1 ; sizeClass >= 0 && bytesReleased < bytesNeeded ; sizeClass--)
+    {
+        size_t size = classSize(sizeClass);
+
+        while (pPool->pFreeLists[sizeClass] && bytesReleased < bytesNeeded)
+        {
+            BufferPoolEntry* pEntry = pPool->pFreeLists[sizeClass];
+
+            pPool->pFreeLists[sizeClass] = pEntry->pNext;
+            free(pEntry);
+            pPool->bytesFree -= size;
+            creditBudget(pPool, size);
+            bytesReleased += size;
+        }
+    }
+}
+
+void BufferPool_Free(BufferPool* pPool, char* pBuffer, size_t size)
+{
+    int              sizeClass = classFor(size);
+    BufferPoolEntry* pEntry = (BufferPoolEntry*)pBuffer;
+
+    if (!pBuffer)
+        return;
+
+    pPool->bytesInUse -= size;
+    if (pPool->bytesFree + size > BUFFER_POOL_MAX_FREE_BYTES)
+    {
+        free(pBuffer);
+        creditBudget(pPool, size);
+        return;
+    }
+    pEntry->pNext = pPool->pFreeLists[sizeClass];
+    pPool->pFreeLists[sizeClass] = pEntry;
+    pPool->bytesFree += size;
+}
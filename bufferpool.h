@@ -0,0 +1,67 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef _BUFFERPOOL_H_
+#define _BUFFERPOOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "protocol.h"
+
+/* Receive buffers for remotesvr sessions.  Every buffer is one of BUFFER_POOL_CLASS_COUNT sizes, doubling from
+   BUFFER_POOL_MIN_SIZE up to the largest frame, and freed buffers go on a free list for their size class so they are
+   reused exactly instead of fragmenting the heap.  Each shard owns a pool, so there is no locking on the fast path,
+   while all of the pools charge one BufferBudget which caps the buffer memory held across the whole server.  Buffers
+   sitting on a free list stay charged; they are returned to the system when a pool holds more than
+   BUFFER_POOL_MAX_FREE_BYTES of them or when another allocation needs the room.  A pool also caps the largest buffer
+   any one session may hold. */
+#define BUFFER_POOL_MIN_SIZE        (16 * 1024)
+#define BUFFER_POOL_MAX_SIZE        (PROTOCOL_HEADER_SIZE + PROTOCOL_MAX_PAYLOAD_SIZE)
+#define BUFFER_POOL_CLASS_COUNT     6
+#define BUFFER_POOL_MAX_FREE_BYTES  (4 * 1024 * 1024)
+
+typedef struct
+{
+    uint64_t limit;
+    uint64_t bytesCharged;
+    uint64_t refusals;
+} BufferBudget;
+
+typedef struct BufferPoolEntry
+{
+    struct BufferPoolEntry* pNext;
+} BufferPoolEntry;
+
+typedef struct BufferPool
+{
+    BufferBudget*    pBudget;
+    BufferPoolEntry* pFreeLists[BUFFER_POOL_CLASS_COUNT];
+    uint64_t         sessionQuota;
+    uint64_t         bytesInUse;
+    uint64_t         bytesFree;
+    uint64_t         allocations;
+    uint64_t         reuses;
+} BufferPool;
+
+void     BufferBudget_Init(BufferBudget* pBudget, uint64_t limit);
+uint64_t BufferBudget_GetBytesCharged(BufferBudget* pBudget);
+uint64_t BufferBudget_GetRefusals(BufferBudget* pBudget);
+
+void     BufferPool_Init(BufferPool* pPool, BufferBudget* pBudget, uint64_t sessionQuota);
+void     BufferPool_Uninit(BufferPool* pPool);
+size_t   BufferPool_SizeFor(BufferPool* pPool, size_t minimumSize);
+char*    BufferPool_Allocate(BufferPool* pPool, size_t size);
+void     BufferPool_Free(BufferPool* pPool, char* pBuffer, size_t size);
+
+#endif /* _BUFFERPOOL_H_ */
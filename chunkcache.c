@@ -0,0 +1,266 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "try_catch.h"
+#include "chunkcache.h"
+
+
+/* Chunks average a few kilobytes so this gives roughly one bucket per chunk that fits in the cache. */
+#define CHUNK_CACHE_BYTES_PER_BUCKET    4096
+#define CHUNK_CACHE_MIN_BUCKETS         1024
+#define CHUNK_CACHE_MAX_BUCKETS         (1 << 22)
+
+static uint32_t          bucketCountFor(uint64_t limit);
+static ChunkCacheEntry** bucketFor(ChunkCache* pCache, const uint8_t* pHash);
+static ChunkCacheEntry*  findEntry(ChunkCache* pCache, const uint8_t* pHash, uint32_t length);
+static ChunkCacheEntry*  allocateEntry(const uint8_t* pHash, const char* pData, uint32_t length);
+static uint64_t          entrySize(const ChunkCacheEntry* pEntry);
+static void              addEntry(ChunkCache* pCache, ChunkCacheEntry* pEntry);
+static void              evictOldestEntries(ChunkCache* pCache);
+static void              removeEntry(ChunkCache* pCache, ChunkCacheEntry* pEntry);
+static void              unlinkFromRecencyList(ChunkCache* pCache, ChunkCacheEntry* pEntry);
+static void              linkAsNewest(ChunkCache* pCache, ChunkCacheEntry* pEntry);
+
+
+void ChunkCache_Init(ChunkCache* pCache, uint64_t limit)
+{
+    uint32_t bucketCount = limit ? bucketCountFor(limit) : 0;
+
+    memset(pCache, 0, sizeof(*pCache));
+    pthread_mutex_init(&pCache->mutex, NULL);
+    pCache->stats.limit = limit;
+    if (bucketCount == 0)
+        return;
+
+    pCache->ppBuckets = calloc(bucketCount, sizeof(*pCache->ppBuckets));
+    if (!pCache->ppBuckets)
+        __throw(outOfMemoryException);
+    pCache->bucketMask = bucketCount - 1;
+}
+
+static uint32_t bucketCountFor(uint64_t limit)
+{
+    uint32_t bucketCount = CHUNK_CACHE_MIN_BUCKETS;
+
+    while (bucketCount < CHUNK_CACHE_MAX_BUCKETS && (uint64_t)bucketCount * CHUNK_CACHE_BYTES_PER_BUCKET < limit)
+        bucketCount *= 2;
+    return bucketCount;
+}
+
+void ChunkCache_Uninit(ChunkCache* pCache)
+{
+    ChunkCacheEntry* pEntry = pCache->pNewest;
+
+    /* Only called once no session can still hold a pinned chunk. */
+    while (pEntry)
+    {
+        ChunkCacheEntry* pOlder = pEntry->pOlder;
+
+        free(pEntry);
+        pEntry = pOlder;
+    }
+    free(pCache->ppBuckets);
+    pthread_mutex_destroy(&pCache->mutex);
+    memset(pCache, 0, sizeof(*pCache));
+}
+
+int ChunkCache_IsEnabled(ChunkCache* pCache)
+{
+    return pCache->ppBuckets != NULL;
+}
+
+ChunkCacheEntry* ChunkCache_Lookup(ChunkCache* pCache, const uint8_t* pHash, uint32_t length)
+{
+    ChunkCacheEntry* pEntry = NULL;
+
+    if (!ChunkCache_IsEnabled(pCache))
+        return NULL;
+
+    pthread_mutex_lock(&pCache->mutex);
+    pEntry = findEntry(pCache, pHash, length);
+    if (pEntry)
+    {
+        pEntry->pinCount++;
+        unlinkFromRecencyList(pCache, pEntry);
+        linkAsNewest(pCache, pEntry);
+        pCache->stats.hits++;
+        pCache->stats.bytesSaved += length;
+    }
+    else
+    {
+        pCache->stats.misses++;
+    }
+    pthread_mutex_unlock(&pCache->mutex);
+
+    return pEntry;
+}
+
+static ChunkCacheEntry** bucketFor(ChunkCache* pCache, const uint8_t* pHash)
+{
+    /* The hash is already uniformly distributed so any of its bits make a good bucket index. */
+    uint32_t index = ((uint32_t)pHash[0] << 24) | ((uint32_t)pHash[1] << 16) | ((uint32_t)pHash[2] << 8) | pHash[3];
+
+    return &pCache->ppBuckets[index & pCache->bucketMask];
+}
+
+static ChunkCacheEntry* findEntry(ChunkCache* pCache, const uint8_t* pHash, uint32_t length)
+{
+    ChunkCacheEntry* pEntry = *bucketFor(pCache, pHash);
+
+    while (pEntry && (pEntry->length != length || memcmp(pEntry->hash, pHash, DEDUP_HASH_SIZE) != 0))
+        pEntry = pEntry->pNextInBucket;
+    return pEntry;
+}
+
+ChunkCacheEntry* ChunkCache_Insert(ChunkCache* pCache, const uint8_t* pHash, const char* pData, uint32_t length)
+{
+    ChunkCacheEntry* pEntry = NULL;
+
+    if (!ChunkCache_IsEnabled(pCache))
+    {
+        pEntry = allocateEntry(pHash, pData, length);
+        if (!pEntry)
+            __throw_and_return(outOfMemoryException, NULL);
+        return pEntry;
+    }
+
+    pthread_mutex_lock(&pCache->mutex);
+    pEntry = findEntry(pCache, pHash, length);
+    if (pEntry)
+    {
+        pEntry->pinCount++;
+        unlinkFromRecencyList(pCache, pEntry);
+        linkAsNewest(pCache, pEntry);
+        pthread_mutex_unlock(&pCache->mutex);
+        return pEntry;
+    }
+
+    pEntry = allocateEntry(pHash, pData, length);
+    if (pEntry)
+    {
+        addEntry(pCache, pEntry);
+        evictOldestEntries(pCache);
+    }
+    pthread_mutex_unlock(&pCache->mutex);
+
+    if (!pEntry)
+        __throw_and_return(outOfMemoryException, NULL);
+    return pEntry;
+}
+
+static ChunkCacheEntry* allocateEntry(const uint8_t* pHash, const char* pData, uint32_t length)
+{
+    ChunkCacheEntry* pEntry = malloc(sizeof(*pEntry) + length);
+
+    if (!pEntry)
+        return NULL;
+    memset(pEntry, 0, sizeof(*pEntry));
+    memcpy(pEntry->hash, pHash, DEDUP_HASH_SIZE);
+    memcpy(pEntry->data, pData, length);
+    pEntry->length = length;
+    pEntry->pinCount = 1;
+
+    return pEntry;
+}
+
+static uint64_t entrySize(const ChunkCacheEntry* pEntry)
+{
+    return sizeof(*pEntry) + pEntry->length;
+}
+
+static void addEntry(ChunkCache* pCache, ChunkCacheEntry* pEntry)
+{
+    ChunkCacheEntry** ppBucket = bucketFor(pCache, pEntry->hash);
+
+    pEntry->pNextInBucket = *ppBucket;
+    *ppBucket = pEntry;
+    pEntry->isCached = 1;
+    linkAsNewest(pCache, pEntry);
+    pCache->stats.bytesCached += entrySize(pEntry);
+    pCache->stats.chunkCount++;
+    pCache->stats.insertions++;
+}
+
+static void evictOldestEntries(ChunkCache* pCache)
+{
+    while (pCache->stats.bytesCached > pCache->stats.limit && pCache->pOldest)
+    {
+        ChunkCacheEntry* pOldest = pCache->pOldest;
+
+        removeEntry(pCache, pOldest);
+        pCache->stats.evictions++;
+        if (pOldest->pinCount == 0)
+            free(pOldest);
+    }
+}
+
+static void removeEntry(ChunkCache* pCache, ChunkCacheEntry* pEntry)
+{
+    ChunkCacheEntry** ppLink = bucketFor(pCache, pEntry->hash);
+
+    while (*ppLink != pEntry)
+        ppLink = &(*ppLink)->pNextInBucket;
+    *ppLink = pEntry->pNextInBucket;
+    unlinkFromRecencyList(pCache, pEntry);
+    pEntry->isCached = 0;
+    pCache->stats.bytesCached -= entrySize(pEntry);
+    pCache->stats.chunkCount--;
+}
+
+static void unlinkFromRecencyList(ChunkCache* pCache, ChunkCacheEntry* pEntry)
+{
+    if (pEntry->pNewer)
+        pEntry->pNewer->pOlder = pEntry->pOlder;
+    else
+        pCache->pNewest = pEntry->pOlder;
+    if (pEntry->pOlder)
+        pEntry->pOlder->pNewer = pEntry->pNewer;
+    else
+        pCache->pOldest = pEntry->pNewer;
+    pEntry->pNewer = NULL;
+    pEntry->pOlder = NULL;
+}
+
+static void linkAsNewest(ChunkCache* pCache, ChunkCacheEntry* pEntry)
+{
+    pEntry->pOlder = pCache->pNewest;
+    pEntry->pNewer = NULL;
+    if (pCache->pNewest)
+        pCache->pNewest->pNewer = pEntry;
+    else
+        pCache->pOldest = pEntry;
+    pCache->pNewest = pEntry;
+}
+
+void ChunkCache_Release(ChunkCache* pCache, ChunkCacheEntry* pEntry)
+{
+    int shouldFree = 0;
+
+    pthread_mutex_lock(&pCache->mutex);
+    pEntry->pinCount--;
+    shouldFree = pEntry->pinCount == 0 && !pEntry->isCached;
+    pthread_mutex_unlock(&pCache->mutex);
+
+    if (shouldFree)
+        free(pEntry);
+}
+
+void ChunkCache_GetStats(ChunkCache* pCache, ChunkCacheStats* pStats)
+{
+    pthread_mutex_lock(&pCache->mutex);
+    *pStats = pCache->stats;
+    pthread_mutex_unlock(&pCache->mutex);
+}
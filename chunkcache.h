@@ -0,0 +1,70 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef _CHUNKCACHE_H_
+#define _CHUNKCACHE_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include "protocol.h"
+
+/* Output chunks shared by every shard of a remotesvr so that a chunk sent by one client can be referenced by any
+   other.  Chunks are found by their SHA-256 hash and the least recently used are evicted once the cache holds more
+   than its limit.  A chunk returned by ChunkCache_Lookup() or ChunkCache_Insert() is pinned until it is given to
+   ChunkCache_Release(), so its data stays valid while a session waits to display it even if it is evicted in the
+   meantime.  Every function takes the cache's lock and so may be called from any shard.  A cache with a limit of 0 is
+   disabled: lookups always miss and inserted chunks are only kept until released. */
+typedef struct ChunkCacheEntry
+{
+    struct ChunkCacheEntry* pNextInBucket;
+    struct ChunkCacheEntry* pNewer;
+    struct ChunkCacheEntry* pOlder;
+    uint32_t                length;
+    uint32_t                pinCount;
+    int                     isCached;
+    uint8_t                 hash[DEDUP_HASH_SIZE];
+    char                    data[];
+} ChunkCacheEntry;
+
+typedef struct
+{
+    uint64_t limit;
+    uint64_t bytesCached;
+    uint64_t chunkCount;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t bytesSaved;
+    uint64_t insertions;
+    uint64_t evictions;
+} ChunkCacheStats;
+
+typedef struct
+{
+    pthread_mutex_t   mutex;
+    ChunkCacheEntry** ppBuckets;
+    ChunkCacheEntry*  pNewest;
+    ChunkCacheEntry*  pOldest;
+    ChunkCacheStats   stats;
+    uint32_t          bucketMask;
+} ChunkCache;
+
+void             ChunkCache_Init(ChunkCache* pCache, uint64_t limit);
+void             ChunkCache_Uninit(ChunkCache* pCache);
+int              ChunkCache_IsEnabled(ChunkCache* pCache);
+ChunkCacheEntry* ChunkCache_Lookup(ChunkCache* pCache, const uint8_t* pHash, uint32_t length);
+ChunkCacheEntry* ChunkCache_Insert(ChunkCache* pCache, const uint8_t* pHash, const char* pData, uint32_t length);
+void             ChunkCache_Release(ChunkCache* pCache, ChunkCacheEntry* pEntry);
+void             ChunkCache_GetStats(ChunkCache* pCache, ChunkCacheStats* pStats);
+
+#endif /* _CHUNKCACHE_H_ */
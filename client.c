@@ -21,7 +21,9 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include "try_catch.h"
+#include "timestamp.h"
 #include "client.h"
+#include "sha256.h"
 
 
 static int g_childHasSignalled = 0;
@@ -29,17 +31,26 @@ static int g_controlCSignalled = 0;
 
 
 static void flagStructureAsUninitialized(Client* pClient);
-static void connectToServer(Client* pClient, Parameters* pParameters);
-static void createSocket(Client* pClient);
-static struct sockaddr_in lookupServerAddress(Client* pClient, Parameters* pParameters);
-static void connectSocket(Client* pClient);
-static void closeSocket(int socket);
+static void connectToServers(Client* pClient, Parameters* pParameters);
+static void connectToMirror(Client* pClient, const char* pMirror, Parameters* pParameters);
+static void connectToDestination(Client* pClient, const char* pHost, uint16_t port, Parameters* pParameters,
+                                 int canControl);
+static Destination* primaryDestination(Client* pClient);
+static int isPrimaryDestination(Client* pClient, Destination* pDestination);
+static void dropMirror(Client* pClient, Destination* pDestination, const char* pReason);
 static void setChildProcess(Client* pClient, Process* pChildProcess);
 static void registerSignalHandlersToNotifyOnCtrlCAndChildExit(void);
 static void childSignalHandler(int childPid);
 static void controlCSignalHandler(int value);
+static void drainChildAndServers(Client* pClient);
+static int  isChildOutputOpen(Client* pClient);
+static int  isDrainComplete(Client* pClient);
+static int  haveAllServersAcknowledgedExit(Client* pClient);
 static void moveDataBetweenChildAndServer(Client* pClient);
+static void dropMirrorsWhichFellBehind(Client* pClient);
 static int waitForInputFromChildServerOrConsole(Client* pClient);
+static struct timeval calculateSelectTimeout(Client* pClient);
+static int spinUntilReadyOrBudgetExhausted(Client* pClient);
 static int isUnexpectedError(int selectResult);
 static int wasInterrupted(int selectResult);
 static int didTimeoutOccurAfterChildProcessSignalled(int selectResult);
@@ -47,11 +58,39 @@ static void processReadyData(Client* pClient);
 static int doesChildStdoutHaveDataToRead(Client* pClient);
 static int doesChildStderrHaveDataToRead(Client* pClient);
 static int doesConsoleHaveDataToRead(Client* pClient);
-static int doesServerHaveDataToRead(Client* pClient);
-static void sendDataFromChildToServerAndConsole(Client* pClient, int fileDescriptor);
+static void receiveFromServers(Client* pClient);
+static void sendBacklogsToServers(Client* pClient);
+static void sendDataFromChildToServerAndConsole(Client* pClient, int fileDescriptor, StreamType stream);
+static void closeChildStream(Client* pClient, StreamType stream);
 static void sendDataFromConsoleToServerAndChild(Client* pClient);
-static void sendDataFromServerToConsoleAndChild(Client* pClient);
+static void sendDataFromServerToConsoleAndChild(Client* pClient, Destination* pDestination);
+static void processFrameFromServer(Client* pClient, Destination* pDestination, const FrameHeader* pHeader,
+                                   const char* pPayload);
+static void interruptChild(Client* pClient);
+static void sendChildDataToServer(Client* pClient, const char* pBuffer, size_t length, StreamType stream);
+static void sendChildOutputToServer(Client* pClient, const char* pBuffer, size_t length, StreamType stream);
+static int  isDedupActive(Client* pClient);
+static void sendChildChunksToServer(Client* pClient, const char* pBuffer, size_t length, StreamType stream);
+static void sendChildChunkToServer(Client* pClient, StreamType stream, const char* pChunk, size_t length, int isCut,
+                                   int isTraceEnabled);
+static DedupTail* dedupTailForStream(Client* pClient, StreamType stream);
+static void flushDedupTail(Client* pClient, StreamType stream);
+static void flushIdleDedupTails(Client* pClient);
+static int  isChildOutputReady(Client* pClient);
+static void sendChildLinesToServer(Client* pClient, const char* pBuffer, size_t length, StreamType stream);
+static void flushChildLinesToServer(Client* pClient, StreamType stream);
+static LineFramer* lineFramerForStream(Client* pClient, StreamType stream);
+static void sendChildFrameToServer(Client* pClient, FrameType type, StreamType stream, const char* pPayload,
+                                   size_t length);
+static void sendFrameToServers(Client* pClient, uint8_t type, uint8_t flags, const void* pPayload, size_t length);
+static void replyToClockRequest(Destination* pDestination, const char* pPayload, size_t length);
+static void updateOutputFilter(Client* pClient, const char* pRuleText, size_t length);
+static void flushOutputFilter(Client* pClient, LineFilter* pFilter, StreamType stream);
 static void notifyServerIfControlCWasPressed(Client* pClient);
+static int  doesChildHaveExitToReap(Client* pClient);
+static void reapChildAndNotifyServer(Client* pClient);
+static void sendExitReportToServers(Client* pClient);
+static void sendExitReportToServer(Client* pClient, Destination* pDestination);
 static void setHighestReadFileDescriptorNumber(Client* pClient);
 static int max(int val1, int val2);
 
@@ -60,13 +99,36 @@ void Client_Init(Client* pClient, Parameters* pParameters)
 {
     flagStructureAsUninitialized(pClient);
     
+    pClient->destinationCount = 0;
+    FrameWriter_Init(&pClient->transferWriter, -1, 0);
+    TransferSet_Init(&pClient->transfers, &pClient->transferWriter, 0, 1);
+    FilterRules_Init(&pClient->filterRules);
+    LineFilter_Init(&pClient->stdoutFilter, &pClient->filterRules);
+    LineFilter_Init(&pClient->stderrFilter, &pClient->filterRules);
+    LineFramer_Init(&pClient->stdoutFramer, &pClient->filterRules);
+    LineFramer_Init(&pClient->stderrFramer, &pClient->filterRules);
+    pClient->stdoutTail.length = 0;
+    pClient->stderrTail.length = 0;
+    pClient->isLineMode = Parameters_IsLineMode(pParameters);
+    pClient->isTraceEnabled = Parameters_IsTraceEnabled(pParameters);
+    pClient->drainTimeout = (uint64_t)Parameters_GetDrainSeconds(pParameters) * TIMESTAMP_NANOSECONDS_PER_SECOND;
+    LowLatency_Init(&pClient->lowLatency, Parameters_GetBusyPollCpu(pParameters),
+                    Parameters_GetSpinMicroseconds(pParameters));
+    
     __try
-        connectToServer(pClient, pParameters);
+    {
+        __throwing_func( LocalEcho_Init(&pClient->echo, Parameters_GetEchoPath(pParameters)) );
+        __throwing_func( connectToServers(pClient, pParameters) );
+    }
     __catch
+    {
         __rethrow;
+    }
         
+    FrameWriter_Init(&pClient->transferWriter, primaryDestination(pClient)->socket, 0);
+    TransferSet_Init(&pClient->transfers, &pClient->transferWriter, 0, 1);
+    LowLatency_ConfigureSocket(&pClient->lowLatency, primaryDestination(pClient)->socket);
     pClient->stdin = fileno(stdin);
-    pClient->stdout = fileno(stdout);
 }
 
 static void flagStructureAsUninitialized(Client* pClient)
@@ -74,76 +136,165 @@ static void flagStructureAsUninitialized(Client* pClient)
     memset(pClient, 0xff, sizeof(*pClient));
 }
 
-static void connectToServer(Client* pClient, Parameters* pParameters)
+static void connectToServers(Client* pClient, Parameters* pParameters)
 {
+    int i;
+    
     __try
+        connectToDestination(pClient, Parameters_GetAddress(pParameters), Parameters_GetPortNumber(pParameters),
+                             pParameters, 1);
+    __catch
+        __rethrow;
+    
+    for (i = 0 ; i < Parameters_GetMirrorCount(pParameters) ; i++)
     {
-        __throwing_func( createSocket(pClient) );
-        __throwing_func( pClient->serverAddress = lookupServerAddress(pClient, pParameters) );
-        __throwing_func( connectSocket(pClient) );
+        __try
+            connectToMirror(pClient, Parameters_GetMirror(pParameters, i), pParameters);
+        __catch
+            __rethrow;
+    }
+}
+
+static void connectToMirror(Client* pClient, const char* pMirror, Parameters* pParameters)
+{
+    const char* pColon = strrchr(pMirror, ':');
+    char        host[128];
+    size_t      hostLength = pColon - pMirror;
+    
+    if (hostLength >= sizeof(host))
+        __throw(dnsLookupException);
+    memcpy(host, pMirror, hostLength);
+    host[hostLength] = '\0';
+    
+    connectToDestination(pClient, host, (uint16_t)strtoul(pColon + 1, NULL, 10), pParameters,
+                         Parameters_CanMirrorsControl(pParameters));
+}
+
+static void connectToDestination(Client* pClient, const char* pHost, uint16_t port, Parameters* pParameters,
+                                 int canControl)
+{
+    Destination* pDestination = &pClient->destinations[pClient->destinationCount];
+    
+    __try
+    {
+        __throwing_func( Destination_Init(pDestination, pHost, port, Parameters_GetBacklogLimit(pParameters),
+                                          canControl) );
+        if (Parameters_IsDedupEnabled(pParameters))
+        {
+            __throwing_func( Destination_EnableDedup(pDestination) );
+        }
     }
     __catch
     {
+        Destination_Uninit(pDestination);
         __rethrow;
     }
+    pClient->destinationCount++;
 }
 
-static void createSocket(Client* pClient)
+static Destination* primaryDestination(Client* pClient)
 {
-    pClient->clientSocket = socket(PF_INET, SOCK_STREAM, 0);
-    if (pClient->clientSocket < 0)
-        __throw(socketException);
+    return &pClient->destinations[0];
 }
 
-static struct sockaddr_in lookupServerAddress(Client* pClient, Parameters* pParameters)
+static int isPrimaryDestination(Client* pClient, Destination* pDestination)
 {
-    struct hostent*     pHostEntry = NULL;
-    struct sockaddr_in  address;
-    
-    pHostEntry = gethostbyname(Parameters_GetAddress(pParameters));
-    if (!pHostEntry)
-        __throw_and_return(dnsLookupException, address);
-
-    memset(&address, 0, sizeof(address));
-    address.sin_family = AF_INET;
-    memcpy(&address.sin_addr.s_addr, pHostEntry->h_addr_list[0], sizeof(address.sin_addr.s_addr));
-    address.sin_port = htons(Parameters_GetPortNumber(pParameters));
-    
-    return address;
+    return pDestination == primaryDestination(pClient);
 }
 
-static void connectSocket(Client* pClient)
+static void dropMirror(Client* pClient, Destination* pDestination, const char* pReason)
 {
-    int result = -1;
-    
-    result = connect(pClient->clientSocket, 
-                     (const struct sockaddr*)&pClient->serverAddress, sizeof(pClient->serverAddress));
-    if (result < 0)
-        __throw(socketException);
+    clearExceptionCode();
+    printf("Mirror %s %s and has been dropped.\n", pDestination->name, pReason);
+    fflush(stdout);
+    Destination_Disconnect(pDestination);
 }
 
 void Client_Uninit(Client* pClient)
 {
-    closeSocket(pClient->clientSocket);
+    int i;
+    
+    TransferSet_Uninit(&pClient->transfers);
+    FilterRules_Uninit(&pClient->filterRules);
+    for (i = 0 ; i < pClient->destinationCount ; i++)
+        Destination_Uninit(&pClient->destinations[i]);
+    LocalEcho_Uninit(&pClient->echo);
 
     flagStructureAsUninitialized(pClient);
 }
 
-static void closeSocket(int socket)
-{
-    if (socket >= 0)
-        close(socket);
-}
-
 void Client_Run(Client* pClient, Process* pChildProcess)
 {
     pClient->exitRunLoop = 0;
+    pClient->isDraining = 0;
+    pClient->isStdoutOpen = 1;
+    pClient->isStderrOpen = 1;
     setChildProcess(pClient, pChildProcess);
     registerSignalHandlersToNotifyOnCtrlCAndChildExit();
     setHighestReadFileDescriptorNumber(pClient);
+    /* Pinned only now so that the child doesn't inherit the core. */
+    LowLatency_PinToCpu(&pClient->lowLatency);
     
     while (!pClient->exitRunLoop)
         moveDataBetweenChildAndServer(pClient);
+    
+    drainChildAndServers(pClient);
+}
+
+static void drainChildAndServers(Client* pClient)
+{
+    /* Shutdown runs as a sequence: stop taking console input, let the child finish (asking it to with SIGTERM if
+       its output is still open), send its remaining output and then its exit report, and wait for each server to
+       acknowledge that report so that nothing is lost when the connection closes.  The whole sequence is bounded by
+       the --drain time and whatever is left after that is abandoned to Process_Uninit(). */
+    pClient->isDraining = 1;
+    pClient->drainDeadline = Timestamp_Now() + pClient->drainTimeout;
+    if (isChildOutputOpen(pClient))
+        Process_Terminate(pClient->pChildProcess);
+    
+    while (!isDrainComplete(pClient))
+    {
+        __try
+            moveDataBetweenChildAndServer(pClient);
+        __catch
+            __rethrow;
+        if (!isChildOutputOpen(pClient) && Process_TryReap(pClient->pChildProcess))
+            sendExitReportToServers(pClient);
+    }
+    if (Timestamp_Now() >= pClient->drainDeadline && Destination_IsConnected(primaryDestination(pClient)))
+    {
+        fprintf(stderr, "remote: gave up draining after %u seconds.\n",
+                (unsigned int)(pClient->drainTimeout / TIMESTAMP_NANOSECONDS_PER_SECOND));
+    }
+}
+
+static int isChildOutputOpen(Client* pClient)
+{
+    return pClient->isStdoutOpen || pClient->isStderrOpen;
+}
+
+static int isDrainComplete(Client* pClient)
+{
+    if (!Destination_IsConnected(primaryDestination(pClient)))
+        return 1;
+    if (Timestamp_Now() >= pClient->drainDeadline)
+        return 1;
+    return !isChildOutputOpen(pClient) && Process_HasExited(pClient->pChildProcess) &&
+           haveAllServersAcknowledgedExit(pClient);
+}
+
+static int haveAllServersAcknowledgedExit(Client* pClient)
+{
+    int i;
+    
+    for (i = 0 ; i < pClient->destinationCount ; i++)
+    {
+        Destination* pDestination = &pClient->destinations[i];
+        
+        if (Destination_IsConnected(pDestination) && !pDestination->hasExitReportBeenAcknowledged)
+            return 0;
+    }
+    return 1;
 }
 
 static void setChildProcess(Client* pClient, Process* pChildProcess)
@@ -174,7 +325,15 @@ static void moveDataBetweenChildAndServer(Client* pClient)
 {
     int     selectResult = -1;
     
-    notifyServerIfControlCWasPressed(pClient);
+    __try
+        notifyServerIfControlCWasPressed(pClient);
+    __catch
+        __rethrow;
+    dropMirrorsWhichFellBehind(pClient);
+    __try
+        flushIdleDedupTails(pClient);
+    __catch
+        __rethrow;
 
     selectResult = waitForInputFromChildServerOrConsole(pClient);
     if (isUnexpectedError(selectResult))
@@ -189,22 +348,114 @@ static void moveDataBetweenChildAndServer(Client* pClient)
     }
     
     if (didTimeoutOccurAfterChildProcessSignalled(selectResult))
+    {
+        pClient->isStdoutOpen = 0;
+        pClient->isStderrOpen = 0;
         pClient->exitRunLoop = 1;
+    }
+}
+
+static void dropMirrorsWhichFellBehind(Client* pClient)
+{
+    int i;
+    
+    /* Only the primary server may hold up the child.  A mirror which can't keep up is let go instead. */
+    for (i = 1 ; i < pClient->destinationCount ; i++)
+    {
+        Destination* pDestination = &pClient->destinations[i];
+        
+        if (Destination_IsConnected(pDestination) && Backlog_IsFull(&pDestination->backlog))
+            dropMirror(pClient, pDestination, "fell too far behind");
+    }
 }
 
 static int waitForInputFromChildServerOrConsole(Client* pClient)
 {
-    static const struct timeval oneSecondTimeout = { 1, 0 };
-    struct timeval              selectTimeout;
+    struct timeval selectTimeout;
+    int            i;
     
     FD_ZERO(&pClient->selectReadSet);
-    FD_SET(pClient->pChildProcess->stdout, &pClient->selectReadSet);
-    FD_SET(pClient->pChildProcess->stderr, &pClient->selectReadSet);
-    FD_SET(pClient->stdin, &pClient->selectReadSet);
-    FD_SET(pClient->clientSocket, &pClient->selectReadSet);
+    FD_ZERO(&pClient->selectWriteSet);
+    if (!Backlog_IsFull(&primaryDestination(pClient)->backlog))
+    {
+        if (pClient->isStdoutOpen)
+            FD_SET(pClient->pChildProcess->stdout, &pClient->selectReadSet);
+        if (pClient->isStderrOpen)
+            FD_SET(pClient->pChildProcess->stderr, &pClient->selectReadSet);
+    }
+    for (i = 0 ; i < pClient->destinationCount ; i++)
+    {
+        Destination* pDestination = &pClient->destinations[i];
+        
+        if (!Destination_IsConnected(pDestination))
+            continue;
+        FD_SET(pDestination->socket, &pClient->selectReadSet);
+        if (!Backlog_IsEmpty(&pDestination->backlog))
+            FD_SET(pDestination->socket, &pClient->selectWriteSet);
+    }
+    if (!pClient->isDraining)
+        FD_SET(pClient->stdin, &pClient->selectReadSet);
+    if (pClient->pChildProcess->pidFileDescriptor >= 0 && !Process_HasExited(pClient->pChildProcess))
+        FD_SET(pClient->pChildProcess->pidFileDescriptor, &pClient->selectReadSet);
 
-    selectTimeout = oneSecondTimeout;
-    return select(pClient->highestReadFileDescriptor + 1, &pClient->selectReadSet, NULL, NULL, &selectTimeout);
+    if (LowLatency_IsEnabled(&pClient->lowLatency))
+    {
+        int spinResult = spinUntilReadyOrBudgetExhausted(pClient);
+        
+        if (spinResult != 0)
+            return spinResult;
+    }
+
+    selectTimeout = calculateSelectTimeout(pClient);
+    return select(pClient->highestReadFileDescriptor + 1, &pClient->selectReadSet, &pClient->selectWriteSet, NULL,
+                  &selectTimeout);
+}
+
+static struct timeval calculateSelectTimeout(Client* pClient)
+{
+    static const struct timeval oneSecondTimeout = { 1, 0 };
+    struct timeval              timeout;
+    uint64_t                    now;
+    uint64_t                    remaining;
+    
+    if (!pClient->isDraining)
+        return oneSecondTimeout;
+    now = Timestamp_Now();
+    remaining = now < pClient->drainDeadline ? pClient->drainDeadline - now : 0;
+    if (remaining >= TIMESTAMP_NANOSECONDS_PER_SECOND)
+        return oneSecondTimeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = remaining / TIMESTAMP_NANOSECONDS_PER_MICROSECOND;
+    return timeout;
+}
+
+static int spinUntilReadyOrBudgetExhausted(Client* pClient)
+{
+    fd_set   readSet = pClient->selectReadSet;
+    fd_set   writeSet = pClient->selectWriteSet;
+    uint64_t spinEndTime = LowLatency_SpinEndTime(&pClient->lowLatency, Timestamp_Now());
+    int      selectResult = -1;
+    
+    do
+    {
+        struct timeval noTimeout = { 0, 0 };
+        
+        pClient->selectReadSet = readSet;
+        pClient->selectWriteSet = writeSet;
+        selectResult = select(pClient->highestReadFileDescriptor + 1, &pClient->selectReadSet,
+                              &pClient->selectWriteSet, NULL, &noTimeout);
+    } while (selectResult == 0 && Timestamp_Now() < spinEndTime);
+    
+    if (selectResult != 0)
+    {
+        LowLatency_RecordWakeup(&pClient->lowLatency, 1);
+        return selectResult;
+    }
+    /* Budget used up so put back the sets which the last select() cleared and go to sleep. */
+    pClient->selectReadSet = readSet;
+    pClient->selectWriteSet = writeSet;
+    LowLatency_RecordWakeup(&pClient->lowLatency, 0);
+    return 0;
 }
 
 static int isUnexpectedError(int selectResult)
@@ -219,24 +470,33 @@ static int wasInterrupted(int selectResult)
 
 static int didTimeoutOccurAfterChildProcessSignalled(int selectResult)
 {
+    /* A grandchild may still hold the output pipes open after the child has exited so stop waiting for them. */
     return selectResult == 0 && g_childHasSignalled;
 }
 
 static void processReadyData(Client* pClient)
 {
+    /* Control frames and interactive input are handled before bulk child output. */
     __try
     {
-        if (doesChildStdoutHaveDataToRead(pClient))
-            __throwing_func( sendDataFromChildToServerAndConsole(pClient, pClient->pChildProcess->stdout) );
-
-        if (doesChildStderrHaveDataToRead(pClient))
-            __throwing_func( sendDataFromChildToServerAndConsole(pClient, pClient->pChildProcess->stderr) );
-
+        __throwing_func( receiveFromServers(pClient) );
         if (doesConsoleHaveDataToRead(pClient))
+        {
             __throwing_func( sendDataFromConsoleToServerAndChild(pClient) );
-
-        if (doesServerHaveDataToRead(pClient))
-            __throwing_func( sendDataFromServerToConsoleAndChild(pClient) );
+        }
+        if (doesChildHaveExitToReap(pClient))
+        {
+            __throwing_func( reapChildAndNotifyServer(pClient) );
+        }
+        __throwing_func( sendBacklogsToServers(pClient) );
+        if (doesChildStdoutHaveDataToRead(pClient))
+        {
+            __throwing_func( sendDataFromChildToServerAndConsole(pClient, pClient->pChildProcess->stdout, STREAM_STDOUT) );
+        }
+        if (doesChildStderrHaveDataToRead(pClient))
+        {
+            __throwing_func( sendDataFromChildToServerAndConsole(pClient, pClient->pChildProcess->stderr, STREAM_STDERR) );
+        }
     }
     __catch
     {
@@ -246,12 +506,14 @@ static void processReadyData(Client* pClient)
 
 static int doesChildStdoutHaveDataToRead(Client* pClient)
 {
-    return FD_ISSET(pClient->pChildProcess->stdout, &pClient->selectReadSet);
+    return !Backlog_IsFull(&primaryDestination(pClient)->backlog) &&
+           FD_ISSET(pClient->pChildProcess->stdout, &pClient->selectReadSet);
 }
 
 static int doesChildStderrHaveDataToRead(Client* pClient)
 {
-    return FD_ISSET(pClient->pChildProcess->stderr, &pClient->selectReadSet);
+    return !Backlog_IsFull(&primaryDestination(pClient)->backlog) &&
+           FD_ISSET(pClient->pChildProcess->stderr, &pClient->selectReadSet);
 }
 
 static int doesConsoleHaveDataToRead(Client* pClient)
@@ -259,31 +521,407 @@ static int doesConsoleHaveDataToRead(Client* pClient)
     return FD_ISSET(pClient->stdin, &pClient->selectReadSet);
 }
 
-static int doesServerHaveDataToRead(Client* pClient)
+static void receiveFromServers(Client* pClient)
+{
+    int i;
+    
+    for (i = 0 ; i < pClient->destinationCount ; i++)
+    {
+        Destination* pDestination = &pClient->destinations[i];
+        
+        if (!Destination_IsConnected(pDestination) || !FD_ISSET(pDestination->socket, &pClient->selectReadSet))
+            continue;
+        __try
+            sendDataFromServerToConsoleAndChild(pClient, pDestination);
+        __catch
+        {
+            if (isPrimaryDestination(pClient, pDestination))
+                __rethrow;
+            dropMirror(pClient, pDestination, "failed");
+        }
+    }
+}
+
+static void sendBacklogsToServers(Client* pClient)
+{
+    int i;
+    
+    for (i = 0 ; i < pClient->destinationCount ; i++)
+    {
+        Destination* pDestination = &pClient->destinations[i];
+        
+        if (!Destination_IsConnected(pDestination) || !FD_ISSET(pDestination->socket, &pClient->selectWriteSet))
+            continue;
+        __try
+            Destination_SendBacklog(pDestination);
+        __catch
+        {
+            if (isPrimaryDestination(pClient, pDestination))
+                __rethrow;
+            dropMirror(pClient, pDestination, "failed");
+        }
+    }
+}
+
+static int doesChildHaveExitToReap(Client* pClient)
+{
+    int pidFileDescriptor = pClient->pChildProcess->pidFileDescriptor;
+    
+    if (Process_HasExited(pClient->pChildProcess))
+        return 0;
+    if (pidFileDescriptor >= 0)
+        return FD_ISSET(pidFileDescriptor, &pClient->selectReadSet);
+    return g_childHasSignalled;
+}
+
+static void reapChildAndNotifyServer(Client* pClient)
+{
+    if (!Process_TryReap(pClient->pChildProcess))
+        return;
+    /* The report must follow all of the child's output so it waits for both pipes to close and for each server's
+       backlog to empty, with drainChildAndServers() sending whatever is still outstanding. */
+    if (!isChildOutputOpen(pClient))
+        sendExitReportToServers(pClient);
+}
+
+static void sendExitReportToServers(Client* pClient)
 {
-    return FD_ISSET(pClient->clientSocket, &pClient->selectReadSet);
+    int i;
+    
+    for (i = 0 ; i < pClient->destinationCount ; i++)
+    {
+        Destination* pDestination = &pClient->destinations[i];
+        
+        if (!Destination_IsConnected(pDestination))
+            continue;
+        if (!Backlog_IsEmpty(&pDestination->backlog))
+            continue;
+        __try
+            sendExitReportToServer(pClient, pDestination);
+        __catch
+            clearExceptionCode();
+    }
 }
 
-static void sendDataFromChildToServerAndConsole(Client* pClient, int fileDescriptor)
+static void sendExitReportToServer(Client* pClient, Destination* pDestination)
 {
-    char buffer[1];
+    ExitReport report;
+    char       payload[EXIT_REPORT_SIZE];
+    
+    if (pDestination->hasSentExitReport)
+        return;
+    
+    Process_GetExitReport(pClient->pChildProcess, &report);
+    ExitReport_Encode(&report, payload);
+    __try
+        Destination_SendFrame(pDestination, FRAME_EXIT, 0, payload, sizeof(payload));
+    __catch
+        __rethrow;
+    pDestination->hasSentExitReport = 1;
+}
+
+static void sendDataFromChildToServerAndConsole(Client* pClient, int fileDescriptor, StreamType stream)
+{
+    char buffer[16 * 1024];
     
     int bytesRead = read(fileDescriptor, buffer, sizeof(buffer));
     if (bytesRead < 0)
         __throw(childException);
+    if (pClient->isTraceEnabled)
+        pClient->chunkReadTime = Timestamp_Now();
     if (bytesRead == 0)
     {
+        if (pClient->isLineMode)
+            flushChildLinesToServer(pClient, stream);
+        __try
+            flushDedupTail(pClient, stream);
+        __catch
+            __rethrow;
+        closeChildStream(pClient, stream);
+        return;
+    }
+
+    LocalEcho_Write(&pClient->echo, buffer, bytesRead);
+    sendChildDataToServer(pClient, buffer, bytesRead, stream);
+}
+
+static void closeChildStream(Client* pClient, StreamType stream)
+{
+    /* Wait for both streams since the child's last words are often on stderr after stdout has closed. */
+    if (stream == STREAM_STDOUT)
+        pClient->isStdoutOpen = 0;
+    else
+        pClient->isStderrOpen = 0;
+    if (!isChildOutputOpen(pClient))
         pClient->exitRunLoop = 1;
+}
+
+static void sendChildDataToServer(Client* pClient, const char* pBuffer, size_t length, StreamType stream)
+{
+    LineFilter* pFilter = (stream == STREAM_STDERR) ? &pClient->stderrFilter : &pClient->stdoutFilter;
+    size_t      filteredLength = 0;
+    
+    if (pClient->isLineMode)
+    {
+        sendChildLinesToServer(pClient, pBuffer, length, stream);
+        return;
+    }
+    if (!FilterRules_IsActive(&pClient->filterRules))
+    {
+        sendChildOutputToServer(pClient, pBuffer, length, stream);
+        return;
+    }
+    
+    filteredLength = LineFilter_Process(pFilter, pBuffer, length, pClient->filteredBuffer);
+    if (filteredLength > 0)
+        sendChildOutputToServer(pClient, pClient->filteredBuffer, filteredLength, stream);
+}
+
+static void sendChildOutputToServer(Client* pClient, const char* pBuffer, size_t length, StreamType stream)
+{
+    if (isDedupActive(pClient))
+    {
+        sendChildChunksToServer(pClient, pBuffer, length, stream);
+        return;
+    }
+    __try
+        flushDedupTail(pClient, stream);
+    __catch
+        __rethrow;
+    sendChildFrameToServer(pClient, FRAME_DATA, stream, pBuffer, length);
+}
+
+static int isDedupActive(Client* pClient)
+{
+    int i;
+    
+    for (i = 0 ; i < pClient->destinationCount ; i++)
+    {
+        Destination* pDestination = &pClient->destinations[i];
+        
+        if (Destination_IsConnected(pDestination) && DedupSender_IsActive(&pDestination->dedup))
+            return 1;
+    }
+    return 0;
+}
+
+static void sendChildChunksToServer(Client* pClient, const char* pBuffer, size_t length, StreamType stream)
+{
+    DedupTail* pTail = dedupTailForStream(pClient, stream);
+    
+    /* The output after the last cut point is held back until the rest of its chunk arrives so that the same output
+       is cut in the same places no matter how the child's writes were split into reads. */
+    if (pTail->length > 0)
+    {
+        size_t heldLength = pTail->length;
+        size_t copyLength = sizeof(pTail->data) - heldLength;
+        size_t chunkLength = 0;
+        int    isCut;
+        
+        if (copyLength > length)
+            copyLength = length;
+        memcpy(pTail->data + heldLength, pBuffer, copyLength);
+        isCut = Dedup_FindChunk(pTail->data, heldLength + copyLength, &chunkLength);
+        if (!isCut && chunkLength < DEDUP_MAX_CHUNK_SIZE)
+        {
+            pTail->length += copyLength;
+            return;
+        }
+        
+        pTail->length = 0;
+        __try
+            sendChildChunkToServer(pClient, stream, pTail->data, chunkLength, isCut,
+                                   pClient->isTraceEnabled && chunkLength - heldLength == length);
+        __catch
+            __rethrow;
+        pBuffer += chunkLength - heldLength;
+        length -= chunkLength - heldLength;
+    }
+    
+    while (length > 0)
+    {
+        size_t chunkLength = 0;
+        int    isCut = Dedup_FindChunk(pBuffer, length, &chunkLength);
+        
+        if (!isCut && chunkLength < DEDUP_MAX_CHUNK_SIZE)
+        {
+            memcpy(pTail->data, pBuffer, length);
+            pTail->length = length;
+            return;
+        }
+        __try
+            sendChildChunkToServer(pClient, stream, pBuffer, chunkLength, isCut,
+                                   pClient->isTraceEnabled && chunkLength == length);
+        __catch
+            __rethrow;
+        pBuffer += chunkLength;
+        length -= chunkLength;
+    }
+}
+
+static void sendChildChunkToServer(Client* pClient, StreamType stream, const char* pChunk, size_t length, int isCut,
+                                   int isTraceEnabled)
+{
+    uint8_t hash[DEDUP_HASH_SIZE];
+    int     i;
+    
+    /* Each chunk is hashed once here and then sent to every server, by reference or not as each one decides.  Only
+       chunks ending at a cut point are worth referencing since they are the ones another client's output will
+       repeat. */
+    if (isCut)
+        Sha256_Compute(pChunk, length, hash);
+    for (i = 0 ; i < pClient->destinationCount ; i++)
+    {
+        Destination* pDestination = &pClient->destinations[i];
+        
+        if (!Destination_IsConnected(pDestination))
+            continue;
+        __try
+            Destination_SendChunk(pDestination, stream, pChunk, length, isCut ? hash : NULL, isTraceEnabled,
+                                  pClient->chunkReadTime);
+        __catch
+        {
+            if (isPrimaryDestination(pClient, pDestination))
+                __rethrow;
+            dropMirror(pClient, pDestination, "failed");
+        }
+    }
+}
+
+static DedupTail* dedupTailForStream(Client* pClient, StreamType stream)
+{
+    return (stream == STREAM_STDERR) ? &pClient->stderrTail : &pClient->stdoutTail;
+}
+
+static void flushDedupTail(Client* pClient, StreamType stream)
+{
+    DedupTail* pTail = dedupTailForStream(pClient, stream);
+    size_t     length = pTail->length;
+    
+    if (length == 0)
         return;
+    pTail->length = 0;
+    __try
+        sendChildChunkToServer(pClient, stream, pTail->data, length, 0, pClient->isTraceEnabled);
+    __catch
+        __rethrow;
+}
+
+static void flushIdleDedupTails(Client* pClient)
+{
+    /* Held output goes out as plain data once the child stops writing so that it is never left waiting for more. */
+    if (pClient->stdoutTail.length == 0 && pClient->stderrTail.length == 0)
+        return;
+    if (Backlog_IsFull(&primaryDestination(pClient)->backlog) || isChildOutputReady(pClient))
+        return;
+    __try
+    {
+        __throwing_func( flushDedupTail(pClient, STREAM_STDOUT) );
+        __throwing_func( flushDedupTail(pClient, STREAM_STDERR) );
+    }
+    __catch
+    {
+        __rethrow;
+    }
+}
+
+static int isChildOutputReady(Client* pClient)
+{
+    struct timeval noTimeout = { 0, 0 };
+    fd_set         readSet;
+    int            highestFileDescriptor = -1;
+    
+    FD_ZERO(&readSet);
+    if (pClient->isStdoutOpen)
+    {
+        FD_SET(pClient->pChildProcess->stdout, &readSet);
+        highestFileDescriptor = max(highestFileDescriptor, pClient->pChildProcess->stdout);
+    }
+    if (pClient->isStderrOpen)
+    {
+        FD_SET(pClient->pChildProcess->stderr, &readSet);
+        highestFileDescriptor = max(highestFileDescriptor, pClient->pChildProcess->stderr);
     }
+    if (highestFileDescriptor < 0)
+        return 0;
+    return select(highestFileDescriptor + 1, &readSet, NULL, NULL, &noTimeout) > 0;
+}
+
+static void sendChildLinesToServer(Client* pClient, const char* pBuffer, size_t length, StreamType stream)
+{
+    static char batchBuffer[LINE_FRAMER_BATCH_SIZE(16 * 1024)];
+    LineBatch   batch;
+    
+    LineBatch_Init(&batch, batchBuffer, sizeof(batchBuffer));
+    LineFramer_Process(lineFramerForStream(pClient, stream), pBuffer, length, Timestamp_Now(), &batch);
+    if (batch.recordCount > 0)
+        sendChildFrameToServer(pClient, FRAME_LINES, stream, batch.pBuffer, batch.length);
+}
+
+static void flushChildLinesToServer(Client* pClient, StreamType stream)
+{
+    char      batchBuffer[LINE_FRAMER_MAX_LINE_LENGTH + LINE_RECORD_HEADER_SIZE];
+    LineBatch batch;
+    
+    LineBatch_Init(&batch, batchBuffer, sizeof(batchBuffer));
+    LineFramer_Flush(lineFramerForStream(pClient, stream), Timestamp_Now(), &batch);
+    if (batch.recordCount > 0)
+        sendChildFrameToServer(pClient, FRAME_LINES, stream, batch.pBuffer, batch.length);
+}
 
-    send(pClient->clientSocket, buffer, bytesRead, 0);
-    write(pClient->stdout, buffer, bytesRead);
+static LineFramer* lineFramerForStream(Client* pClient, StreamType stream)
+{
+    return (stream == STREAM_STDERR) ? &pClient->stderrFramer : &pClient->stdoutFramer;
+}
+
+static void sendChildFrameToServer(Client* pClient, FrameType type, StreamType stream, const char* pPayload,
+                                   size_t length)
+{
+    int i;
+    
+    /* Every server is sent the same buffer.  It is only copied for a server which can't take it right away. */
+    for (i = 0 ; i < pClient->destinationCount ; i++)
+    {
+        Destination* pDestination = &pClient->destinations[i];
+        
+        if (!Destination_IsConnected(pDestination))
+            continue;
+        __try
+            Destination_SendOutput(pDestination, type, stream, pPayload, length,
+                                   pClient->isTraceEnabled, pClient->chunkReadTime);
+        __catch
+        {
+            if (isPrimaryDestination(pClient, pDestination))
+                __rethrow;
+            dropMirror(pClient, pDestination, "failed");
+        }
+    }
+}
+
+static void sendFrameToServers(Client* pClient, uint8_t type, uint8_t flags, const void* pPayload, size_t length)
+{
+    int i;
+    
+    for (i = 0 ; i < pClient->destinationCount ; i++)
+    {
+        Destination* pDestination = &pClient->destinations[i];
+        
+        if (!Destination_IsConnected(pDestination))
+            continue;
+        __try
+            Destination_SendFrame(pDestination, type, flags, pPayload, length);
+        __catch
+        {
+            if (isPrimaryDestination(pClient, pDestination))
+                __rethrow;
+            dropMirror(pClient, pDestination, "failed");
+        }
+    }
 }
 
 static void sendDataFromConsoleToServerAndChild(Client* pClient)
 {
-    char buffer[1];
+    char buffer[4096];
     
     int bytesRead = read(pClient->stdin, buffer, sizeof(buffer));
     if (bytesRead < 0)
@@ -295,34 +933,123 @@ static void sendDataFromConsoleToServerAndChild(Client* pClient)
     }
 
     write(pClient->pChildProcess->stdin, buffer, bytesRead);
-    send(pClient->clientSocket, buffer, bytesRead, 0);
+    sendFrameToServers(pClient, FRAME_DATA, STREAM_CONSOLE, buffer, bytesRead);
 }
 
-static void sendDataFromServerToConsoleAndChild(Client* pClient)
+static void sendDataFromServerToConsoleAndChild(Client* pClient, Destination* pDestination)
 {
-    char buffer[1];
+    FrameHeader header;
+    const char* pPayload = NULL;
+    int         bytesRead = -1;
     
-    int bytesRead = recv(pClient->clientSocket, buffer, sizeof(buffer), 0);
+    __try
+        bytesRead = Destination_Receive(pDestination);
+    __catch
+        __rethrow;
     if (bytesRead < 0)
-        __throw(serverException);
+        return;
     if (bytesRead == 0)
     {
-        pClient->exitRunLoop = 1;
+        if (isPrimaryDestination(pClient, pDestination))
+            pClient->exitRunLoop = 1;
+        else
+            dropMirror(pClient, pDestination, "disconnected");
         return;
     }
 
-    if (buffer[0] == 0x03)
+    while (FrameReader_NextFrame(&pDestination->frameReader, &header, &pPayload))
     {
-        static const char controlC[2] = "^C";
-        
-        kill(pClient->pChildProcess->pid, SIGINT);
-        write(pClient->stdout, controlC, sizeof(controlC));
+        __try
+            processFrameFromServer(pClient, pDestination, &header, pPayload);
+        __catch
+            __rethrow;
     }
-    else
+}
+
+static void processFrameFromServer(Client* pClient, Destination* pDestination, const FrameHeader* pHeader,
+                                   const char* pPayload)
+{
+    if (pHeader->type == FRAME_TRACE)
+    {
+        if (pHeader->flags == TRACE_CLOCK_REQUEST)
+            replyToClockRequest(pDestination, pPayload, pHeader->length);
+        return;
+    }
+    if (pHeader->type == FRAME_CONTROL && pHeader->flags == CONTROL_PING)
+    {
+        Destination_SendFrame(pDestination, FRAME_CONTROL, CONTROL_PONG, NULL, 0);
+        return;
+    }
+    if (pHeader->type == FRAME_CONTROL && pHeader->flags == CONTROL_EXIT_ACK)
     {
-        write(pClient->pChildProcess->stdin, buffer, bytesRead);
-        write(pClient->stdout, buffer, bytesRead);
+        pDestination->hasExitReportBeenAcknowledged = 1;
+        return;
+    }
+    if (pHeader->type == FRAME_DEDUP)
+    {
+        __try
+            Destination_ProcessDedupFrame(pDestination, pHeader, pPayload);
+        __catch
+            __rethrow;
+        return;
     }
+    if (!pDestination->canControl)
+        return;
+    
+    switch (pHeader->type)
+    {
+    case FRAME_INPUT:
+        write(pClient->pChildProcess->stdin, pPayload, pHeader->length);
+        LowLatency_RecordInput(&pClient->lowLatency, pDestination->kernelReceiveTime);
+        LocalEcho_Write(&pClient->echo, pPayload, pHeader->length);
+        break;
+    case FRAME_CONTROL:
+        if (pHeader->flags == CONTROL_INTERRUPT)
+            interruptChild(pClient);
+        break;
+    case FRAME_FILTER:
+        updateOutputFilter(pClient, pPayload, pHeader->length);
+        break;
+    default:
+        /* File transfers run over the primary server's connection only. */
+        if (isPrimaryDestination(pClient, pDestination) && TransferSet_IsTransferFrame(pHeader))
+            TransferSet_ProcessFrame(&pClient->transfers, pHeader, pPayload);
+        break;
+    }
+}
+
+static void replyToClockRequest(Destination* pDestination, const char* pPayload, size_t length)
+{
+    char reply[TRACE_CLOCK_REPLY_SIZE];
+    
+    if (length < TRACE_CLOCK_REQUEST_SIZE)
+        return;
+    Trace_EncodeClockReply(reply, pPayload, pDestination->lastReceiveTime, Timestamp_Now());
+    Destination_SendFrame(pDestination, FRAME_TRACE, TRACE_CLOCK_REPLY, reply, sizeof(reply));
+}
+
+static void updateOutputFilter(Client* pClient, const char* pRuleText, size_t length)
+{
+    flushOutputFilter(pClient, &pClient->stdoutFilter, STREAM_STDOUT);
+    flushOutputFilter(pClient, &pClient->stderrFilter, STREAM_STDERR);
+    FilterRules_Parse(&pClient->filterRules, pRuleText, length);
+}
+
+static void flushOutputFilter(Client* pClient, LineFilter* pFilter, StreamType stream)
+{
+    char   pendingLine[FILTER_MAX_LINE_LENGTH];
+    size_t length = LineFilter_Flush(pFilter, pendingLine);
+
+    if (length > 0)
+        sendChildOutputToServer(pClient, pendingLine, length, stream);
+}
+
+static void interruptChild(Client* pClient)
+{
+    static const char controlC[2] = "^C";
+    
+    kill(pClient->pChildProcess->pid, SIGINT);
+    LocalEcho_Write(&pClient->echo, controlC, sizeof(controlC));
 }
 
 static void notifyServerIfControlCWasPressed(Client* pClient)
@@ -332,18 +1059,21 @@ static void notifyServerIfControlCWasPressed(Client* pClient)
     if (g_controlCSignalled == 0)
         return;
         
-    send(pClient->clientSocket, controlC, sizeof(controlC), 0);
     g_controlCSignalled = 0;
+    sendFrameToServers(pClient, FRAME_DATA, STREAM_CONSOLE, controlC, sizeof(controlC));
 }
 
 static void setHighestReadFileDescriptorNumber(Client* pClient)
 {
     int highest = 0;
+    int i;
     
-    highest = max(highest, pClient->clientSocket);
+    for (i = 0 ; i < pClient->destinationCount ; i++)
+        highest = max(highest, pClient->destinations[i].socket);
     highest = max(highest, pClient->stdin);
     highest = max(highest, pClient->pChildProcess->stdout);
     highest = max(highest, pClient->pChildProcess->stderr);
+    highest = max(highest, pClient->pChildProcess->pidFileDescriptor);
     
     pClient->highestReadFileDescriptor = highest;
 }
@@ -15,19 +15,50 @@
 #ifndef _CLIENT_H_
 #define _CLIENT_H_
 
-#include <netdb.h>
+#include <sys/select.h>
 #include "parameters.h"
 #include "process.h"
+#include "protocol.h"
+#include "transfer.h"
+#include "filter.h"
+#include "lineframer.h"
+#include "trace.h"
+#include "destination.h"
+#include "lowlatency.h"
+#include "localecho.h"
+
+/* The first destination is the server given on the command line and the rest are its --mirror servers. */
+#define CLIENT_MAX_DESTINATIONS (1 + PARAMETERS_MAX_MIRRORS)
 
 typedef struct
 {
     Process*            pChildProcess;
-    struct sockaddr_in  serverAddress;
+    Destination         destinations[CLIENT_MAX_DESTINATIONS];
+    FrameWriter         transferWriter;
+    TransferSet         transfers;
+    LowLatency          lowLatency;
+    LocalEcho           echo;
+    FilterRules         filterRules;
+    LineFilter          stdoutFilter;
+    LineFilter          stderrFilter;
+    LineFramer          stdoutFramer;
+    LineFramer          stderrFramer;
+    DedupTail           stdoutTail;
+    DedupTail           stderrTail;
+    char                filteredBuffer[16 * 1024 + FILTER_MAX_LINE_LENGTH];
     fd_set              selectReadSet;
-    int                 clientSocket;
-    int                 stdout;
+    fd_set              selectWriteSet;
+    uint64_t            chunkReadTime;
+    uint64_t            drainTimeout;
+    uint64_t            drainDeadline;
+    int                 destinationCount;
     int                 stdin;
     int                 exitRunLoop;
+    int                 isDraining;
+    int                 isStdoutOpen;
+    int                 isStderrOpen;
+    int                 isLineMode;
+    int                 isTraceEnabled;
     int                 highestReadFileDescriptor;
 } Client;
 
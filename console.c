@@ -0,0 +1,241 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "try_catch.h"
+#include "console.h"
+#include "timestamp.h"
+
+
+#define CONSOLE_TAIL_SIZE           (64 * 1024)
+/* A write to stdout which blocks for longer than this means the terminal has fallen behind. */
+#define CONSOLE_MAX_WRITE_STALL_NS  (20 * 1000 * 1000ULL)
+/* Summaries stop once less than this much output arrives during an interval. */
+#define CONSOLE_RESUME_BYTES        (64 * 1024)
+
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+    const char*     pRecordPath;
+    uint64_t        lastSummaryTime;
+    uint64_t        intervalBytes;
+    size_t          tailLength;
+    int             recordFileDescriptor;
+    int             isAdaptive;
+    int             isSummarizing;
+    char            tail[CONSOLE_TAIL_SIZE];
+} Console;
+
+static Console g_console = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0, -1, 0, 0, { 0 } };
+
+
+static void writeAdaptive(const char* pBuffer, size_t length);
+static int  writeToStdoutWithoutStalling(const char* pBuffer, size_t length);
+static void startSummarizing(void);
+static void appendToTail(const char* pBuffer, size_t length);
+static void displaySummaryIfDue(uint64_t now);
+static void displaySummary(void);
+static size_t findStartOfTailLines(void);
+static int  isStdoutWritable(void);
+static void writeAll(int fileDescriptor, const char* pBuffer, size_t length);
+
+
+void Console_Init(int isAdaptive, const char* pRecordPath, int shouldAppend)
+{
+    g_console.isAdaptive = isAdaptive;
+    g_console.isSummarizing = 0;
+    g_console.tailLength = 0;
+    g_console.pRecordPath = pRecordPath;
+    if (!pRecordPath)
+        return;
+
+    g_console.recordFileDescriptor = open(pRecordPath, O_WRONLY | O_CREAT | (shouldAppend ? O_APPEND : O_TRUNC), 0644);
+    if (g_console.recordFileDescriptor < 0)
+        __throw(fileException);
+}
+
+void Console_Uninit(void)
+{
+    pthread_mutex_lock(&g_console.mutex);
+    if (g_console.isSummarizing)
+        displaySummary();
+    if (g_console.recordFileDescriptor >= 0)
+        close(g_console.recordFileDescriptor);
+    g_console.recordFileDescriptor = -1;
+    g_console.isSummarizing = 0;
+    pthread_mutex_unlock(&g_console.mutex);
+}
+
+void Console_Write(const void* pBuffer, size_t length)
+{
+    pthread_mutex_lock(&g_console.mutex);
+    if (g_console.recordFileDescriptor >= 0)
+        writeAll(g_console.recordFileDescriptor, pBuffer, length);
+    if (g_console.isAdaptive)
+        writeAdaptive(pBuffer, length);
+    else
+        writeAll(STDOUT_FILENO, pBuffer, length);
+    pthread_mutex_unlock(&g_console.mutex);
+}
+
+static void writeAdaptive(const char* pBuffer, size_t length)
+{
+    if (!g_console.isSummarizing && writeToStdoutWithoutStalling(pBuffer, length))
+        return;
+
+    if (!g_console.isSummarizing)
+        startSummarizing();
+    appendToTail(pBuffer, length);
+    g_console.intervalBytes += length;
+    displaySummaryIfDue(Timestamp_Now());
+}
+
+static int writeToStdoutWithoutStalling(const char* pBuffer, size_t length)
+{
+    uint64_t startTime;
+
+    if (!isStdoutWritable())
+        return 0;
+
+    startTime = Timestamp_Now();
+    writeAll(STDOUT_FILENO, pBuffer, length);
+    if (Timestamp_Now() - startTime > CONSOLE_MAX_WRITE_STALL_NS)
+        startSummarizing();
+    return 1;
+}
+
+static void startSummarizing(void)
+{
+    g_console.isSummarizing = 1;
+    g_console.lastSummaryTime = Timestamp_Now();
+    g_console.intervalBytes = 0;
+    g_console.tailLength = 0;
+}
+
+static void appendToTail(const char* pBuffer, size_t length)
+{
+    size_t overflow;
+
+    if (length >= sizeof(g_console.tail))
+    {
+        memcpy(g_console.tail, pBuffer + length - sizeof(g_console.tail), sizeof(g_console.tail));
+        g_console.tailLength = sizeof(g_console.tail);
+        return;
+    }
+
+    if (g_console.tailLength + length > sizeof(g_console.tail))
+    {
+        overflow = g_console.tailLength + length - sizeof(g_console.tail);
+        memmove(g_console.tail, g_console.tail + overflow, g_console.tailLength - overflow);
+        g_console.tailLength -= overflow;
+    }
+    memcpy(g_console.tail + g_console.tailLength, pBuffer, length);
+    g_console.tailLength += length;
+}
+
+static void displaySummaryIfDue(uint64_t now)
+{
+    uint64_t interval = CONSOLE_SUMMARY_INTERVAL_MS * (TIMESTAMP_NANOSECONDS_PER_SECOND / 1000);
+
+    if (now - g_console.lastSummaryTime < interval || !isStdoutWritable())
+        return;
+
+    displaySummary();
+    if (g_console.intervalBytes < CONSOLE_RESUME_BYTES)
+        g_console.isSummarizing = 0;
+    g_console.lastSummaryTime = now;
+    g_console.intervalBytes = 0;
+    g_console.tailLength = 0;
+}
+
+static void displaySummary(void)
+{
+    static const double bytesPerMegabyte = 1024.0 * 1024.0;
+    size_t              tailStart = findStartOfTailLines();
+    size_t              shownLength = g_console.tailLength - tailStart;
+    char                marker[256];
+    int                 markerLength;
+
+    if (g_console.intervalBytes > shownLength)
+    {
+        markerLength = snprintf(marker, sizeof(marker), "\n[... %.1f MB skipped%s%s ...]\n",
+                                (g_console.intervalBytes - shownLength) / bytesPerMegabyte,
+                                g_console.pRecordPath ? ", recorded in " : "",
+                                g_console.pRecordPath ? g_console.pRecordPath : "");
+        writeAll(STDOUT_FILENO, marker, markerLength);
+    }
+    writeAll(STDOUT_FILENO, g_console.tail + tailStart, shownLength);
+}
+
+static size_t findStartOfTailLines(void)
+{
+    size_t lineCount = 0;
+    size_t i = g_console.tailLength;
+
+    /* A trailing newline ends the last line rather than starting another. */
+    if (i > 0 && g_console.tail[i - 1] == '\n')
+        i--;
+    while (i > 0)
+    {
+        if (g_console.tail[i - 1] == '\n' && ++lineCount == CONSOLE_TAIL_LINES)
+            return i;
+        i--;
+    }
+    return 0;
+}
+
+void Console_Service(void)
+{
+    if (!g_console.isAdaptive)
+        return;
+    pthread_mutex_lock(&g_console.mutex);
+    if (g_console.isSummarizing)
+        displaySummaryIfDue(Timestamp_Now());
+    pthread_mutex_unlock(&g_console.mutex);
+}
+
+int Console_GetServiceTimeout(void)
+{
+    return g_console.isAdaptive ? CONSOLE_SUMMARY_INTERVAL_MS : -1;
+}
+
+static int isStdoutWritable(void)
+{
+    struct pollfd pollDescriptor;
+
+    pollDescriptor.fd = STDOUT_FILENO;
+    pollDescriptor.events = POLLOUT;
+    pollDescriptor.revents = 0;
+    return poll(&pollDescriptor, 1, 0) == 1 && (pollDescriptor.revents & POLLOUT);
+}
+
+static void writeAll(int fileDescriptor, const char* pBuffer, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t bytesWritten = write(fileDescriptor, pBuffer, length);
+
+        if (bytesWritten <= 0)
+            return;
+        pBuffer += bytesWritten;
+        length -= bytesWritten;
+    }
+}
@@ -0,0 +1,34 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef _CONSOLE_H_
+#define _CONSOLE_H_
+
+#include <stddef.h>
+
+/* All client output shown by remotesvr goes through the console.  In direct mode it is simply written to stdout.
+   In adaptive mode everything is also recorded to a file and, whenever stdout stops keeping up, the console
+   switches to a summary every CONSOLE_SUMMARY_INTERVAL_MS showing how much output was skipped followed by the last
+   CONSOLE_TAIL_LINES lines.  It goes back to writing everything once the output rate drops again. */
+#define CONSOLE_SUMMARY_INTERVAL_MS 500
+#define CONSOLE_TAIL_LINES          20
+#define CONSOLE_DEFAULT_RECORD_PATH "remotesvr.log"
+
+void Console_Init(int isAdaptive, const char* pRecordPath, int shouldAppend);
+void Console_Uninit(void);
+void Console_Write(const void* pBuffer, size_t length);
+void Console_Service(void);
+int  Console_GetServiceTimeout(void);
+
+#endif /* _CONSOLE_H_ */
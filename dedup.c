@@ -0,0 +1,199 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "try_catch.h"
+#include "dedup.h"
+
+
+#define DEDUP_CHUNK_MASK        (~0ULL << (64 - DEDUP_CHUNK_MASK_BITS))
+/* The miss rate is measured over roughly the last this many references. */
+#define DEDUP_RECENT_WINDOW     64
+
+
+static pthread_once_t g_gearTableOnce = PTHREAD_ONCE_INIT;
+static uint64_t       g_gearTable[256];
+
+
+static void     initGearTable(void);
+static uint64_t nextRandomNumber(uint64_t* pState);
+static void     retainChunk(DedupSender* pSender, const char* pChunk, size_t length);
+static void     freeRetainedChunks(DedupSender* pSender);
+static int      isSequenceAtOrBefore(uint32_t sequence, uint32_t limit);
+
+
+int Dedup_FindChunk(const char* pData, size_t length, size_t* pChunkLength)
+{
+    const uint64_t* pGear = g_gearTable;
+    size_t          maximum = length < DEDUP_MAX_CHUNK_SIZE ? length : DEDUP_MAX_CHUNK_SIZE;
+    uint64_t        hash = 0;
+    size_t          i;
+
+    pthread_once(&g_gearTableOnce, initGearTable);
+    /* Bytes before the minimum chunk size can't end a chunk but the last 64 of them still feed the hash. */
+    for (i = DEDUP_MIN_CHUNK_SIZE > 64 ? DEDUP_MIN_CHUNK_SIZE - 64 : 0 ; i < maximum ; i++)
+    {
+        hash = (hash << 1) + pGear[(uint8_t)pData[i]];
+        if (i + 1 >= DEDUP_MIN_CHUNK_SIZE && (hash & DEDUP_CHUNK_MASK) == 0)
+        {
+            *pChunkLength = i + 1;
+            return 1;
+        }
+    }
+    *pChunkLength = maximum;
+    return 0;
+}
+
+static void     initGearTable(void)
+{
+    uint64_t state = 0x72656d6f74652d31ULL;
+    int      i;
+
+    /* Every client must cut chunks in the same places so the table comes from a fixed seed. */
+    for (i = 0 ; i < 256 ; i++)
+        g_gearTable[i] = nextRandomNumber(&state);
+}
+
+static uint64_t nextRandomNumber(uint64_t* pState)
+{
+    /* splitmix64 */
+    uint64_t value = (*pState += 0x9e3779b97f4a7c15ULL);
+
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+void DedupSender_Init(DedupSender* pSender, int isRequested)
+{
+    memset(pSender, 0, sizeof(*pSender));
+    pSender->isRequested = isRequested;
+}
+
+void DedupSender_Uninit(DedupSender* pSender)
+{
+    freeRetainedChunks(pSender);
+    memset(pSender, 0, sizeof(*pSender));
+}
+
+static void     freeRetainedChunks(DedupSender* pSender)
+{
+    while (pSender->pOldestRetained)
+    {
+        DedupRetainedChunk* pNext = pSender->pOldestRetained->pNext;
+
+        free(pSender->pOldestRetained);
+        pSender->pOldestRetained = pNext;
+    }
+    pSender->pNewestRetained = NULL;
+    pSender->retainedBytes = 0;
+}
+
+void DedupSender_Accept(DedupSender* pSender)
+{
+    pSender->isAccepted = pSender->isRequested;
+}
+
+int DedupSender_IsActive(DedupSender* pSender)
+{
+    return pSender->isRequested && pSender->isAccepted;
+}
+
+int DedupSender_ShouldReference(DedupSender* pSender, size_t length)
+{
+    uint64_t chunkNumber = pSender->chunkCount++;
+
+    pSender->chunkBytes += length;
+    if (pSender->retainedBytes + length > DEDUP_MAX_RETAINED_BYTES)
+        return 0;
+    if (chunkNumber % DEDUP_PROBE_INTERVAL == 0)
+        return 1;
+    return pSender->recentMisses * 2 <= pSender->recentReferences;
+}
+
+void DedupSender_EncodeReference(DedupSender* pSender, const char* pChunk, size_t length, const uint8_t* pHash,
+                                 char* pReference)
+{
+    __try
+        retainChunk(pSender, pChunk, length);
+    __catch
+        __rethrow;
+
+    Protocol_PutUint32(pReference, pSender->pNewestRetained->sequence);
+    Protocol_PutUint32(pReference + DEDUP_SEQUENCE_SIZE, (uint32_t)length);
+    memcpy(pReference + DEDUP_SEQUENCE_SIZE + 4, pHash, DEDUP_HASH_SIZE);
+
+    pSender->referenceCount++;
+    pSender->referencedBytes += length;
+    if (++pSender->recentReferences > DEDUP_RECENT_WINDOW)
+    {
+        pSender->recentReferences /= 2;
+        pSender->recentMisses /= 2;
+    }
+}
+
+static void     retainChunk(DedupSender* pSender, const char* pChunk, size_t length)
+{
+    DedupRetainedChunk* pRetained = malloc(sizeof(*pRetained) + length);
+
+    if (!pRetained)
+        __throw(outOfMemoryException);
+    pRetained->pNext = NULL;
+    pRetained->sequence = pSender->nextSequence++;
+    pRetained->length = (uint32_t)length;
+    memcpy(pRetained->data, pChunk, length);
+
+    if (pSender->pNewestRetained)
+        pSender->pNewestRetained->pNext = pRetained;
+    else
+        pSender->pOldestRetained = pRetained;
+    pSender->pNewestRetained = pRetained;
+    pSender->retainedBytes += length;
+}
+
+const DedupRetainedChunk* DedupSender_ProcessMiss(DedupSender* pSender, uint32_t sequence)
+{
+    DedupRetainedChunk* pRetained = pSender->pOldestRetained;
+
+    while (pRetained && pRetained->sequence != sequence)
+        pRetained = pRetained->pNext;
+    if (!pRetained)
+        return NULL;
+
+    pSender->missCount++;
+    pSender->missedBytes += pRetained->length;
+    pSender->recentMisses++;
+    return pRetained;
+}
+
+void DedupSender_ProcessAcknowledgement(DedupSender* pSender, uint32_t sequence)
+{
+    while (pSender->pOldestRetained && isSequenceAtOrBefore(pSender->pOldestRetained->sequence, sequence))
+    {
+        DedupRetainedChunk* pNext = pSender->pOldestRetained->pNext;
+
+        pSender->retainedBytes -= pSender->pOldestRetained->length;
+        free(pSender->pOldestRetained);
+        pSender->pOldestRetained = pNext;
+    }
+    if (!pSender->pOldestRetained)
+        pSender->pNewestRetained = NULL;
+}
+
+static int      isSequenceAtOrBefore(uint32_t sequence, uint32_t limit)
+{
+    return (int32_t)(sequence - limit) <= 0;
+}
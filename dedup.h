@@ -0,0 +1,85 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef _DEDUP_H_
+#define _DEDUP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "protocol.h"
+
+/* Client side of output deduplication.  Output is cut into chunks wherever a gear hash of the preceding bytes has
+   its top DEDUP_CHUNK_MASK_BITS bits clear, so identical output from different clients is cut at the same places no
+   matter how it was split across reads.  Chunks are at least DEDUP_MIN_CHUNK_SIZE and at most DEDUP_MAX_CHUNK_SIZE
+   bytes, averaging a few kilobytes.
+
+   A DedupSender tracks one server connection.  Each chunk sent by reference is kept until the server acknowledges
+   displaying it, in case the server asks for its data, and chunks go out as data instead while more than
+   DEDUP_MAX_RETAINED_BYTES are waiting on acknowledgements.  References are also given up while most of the recent
+   ones have missed, with one in every DEDUP_PROBE_INTERVAL chunks still sent by reference to notice when the server
+   starts holding the output again. */
+#define DEDUP_MIN_CHUNK_SIZE        1024
+#define DEDUP_MAX_CHUNK_SIZE        (16 * 1024)
+#define DEDUP_CHUNK_MASK_BITS       12
+#define DEDUP_MAX_RETAINED_BYTES    (4 * 1024 * 1024)
+#define DEDUP_PROBE_INTERVAL        16
+
+typedef struct DedupRetainedChunk
+{
+    struct DedupRetainedChunk* pNext;
+    uint32_t                   sequence;
+    uint32_t                   length;
+    char                       data[];
+} DedupRetainedChunk;
+
+typedef struct
+{
+    DedupRetainedChunk* pOldestRetained;
+    DedupRetainedChunk* pNewestRetained;
+    uint64_t            retainedBytes;
+    uint64_t            chunkCount;
+    uint64_t            chunkBytes;
+    uint64_t            referenceCount;
+    uint64_t            referencedBytes;
+    uint64_t            missCount;
+    uint64_t            missedBytes;
+    uint32_t            nextSequence;
+    uint32_t            recentReferences;
+    uint32_t            recentMisses;
+    int                 isRequested;
+    int                 isAccepted;
+} DedupSender;
+
+/* The output after the last cut point in a stream, held until more output arrives to finish its chunk. */
+typedef struct
+{
+    size_t length;
+    char   data[DEDUP_MAX_CHUNK_SIZE];
+} DedupTail;
+
+/* Sets *pChunkLength to the length of the chunk starting at pData and returns 1 if the chunk ends at a boundary
+   chosen by its content, or 0 if the data ran out or the chunk reached DEDUP_MAX_CHUNK_SIZE first. */
+int  Dedup_FindChunk(const char* pData, size_t length, size_t* pChunkLength);
+
+void DedupSender_Init(DedupSender* pSender, int isRequested);
+void DedupSender_Uninit(DedupSender* pSender);
+void DedupSender_Accept(DedupSender* pSender);
+int  DedupSender_IsActive(DedupSender* pSender);
+int  DedupSender_ShouldReference(DedupSender* pSender, size_t length);
+void DedupSender_EncodeReference(DedupSender* pSender, const char* pChunk, size_t length, const uint8_t* pHash,
+                                 char* pReference);
+const DedupRetainedChunk* DedupSender_ProcessMiss(DedupSender* pSender, uint32_t sequence);
+void DedupSender_ProcessAcknowledgement(DedupSender* pSender, uint32_t sequence);
+
+#endif /* _DEDUP_H_ */
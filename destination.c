@@ -0,0 +1,277 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "try_catch.h"
+#include "destination.h"
+#include "timestamp.h"
+#include "trace.h"
+
+
+static void createSocket(Destination* pDestination);
+static void lookupAddress(Destination* pDestination, const char* pHost, uint16_t port);
+static void connectSocket(Destination* pDestination);
+static int  shouldQueueOutput(Destination* pDestination);
+static void queueOutput(Destination* pDestination, FrameType type, StreamType stream, const char* pPayload,
+                        size_t length, int isTraceEnabled, uint64_t readTime);
+static void sendBackloggedFrame(Destination* pDestination, const FrameHeader* pHeader, char* pPayload);
+static void sendFill(Destination* pDestination, const char* pPayload, size_t length);
+
+
+void Destination_Init(Destination* pDestination, const char* pHost, uint16_t port, uint64_t backlogLimit,
+                      int canControl)
+{
+    memset(pDestination, 0, sizeof(*pDestination));
+    pDestination->socket = -1;
+    pDestination->canControl = canControl;
+    snprintf(pDestination->name, sizeof(pDestination->name), "%s:%u", pHost, port);
+    Backlog_Init(&pDestination->backlog, backlogLimit);
+    DedupSender_Init(&pDestination->dedup, 0);
+
+    __try
+    {
+        __throwing_func( createSocket(pDestination) );
+        __throwing_func( lookupAddress(pDestination, pHost, port) );
+        __throwing_func( connectSocket(pDestination) );
+        __throwing_func( FrameReader_Init(&pDestination->frameReader) );
+    }
+    __catch
+    {
+        __rethrow;
+    }
+    Protocol_ConfigureSocket(pDestination->socket);
+}
+
+static void createSocket(Destination* pDestination)
+{
+    pDestination->socket = socket(PF_INET, SOCK_STREAM, 0);
+    if (pDestination->socket < 0)
+        __throw(socketException);
+}
+
+static void lookupAddress(Destination* pDestination, const char* pHost, uint16_t port)
+{
+    struct hostent* pHostEntry = gethostbyname(pHost);
+
+    if (!pHostEntry)
+        __throw(dnsLookupException);
+
+    pDestination->address.sin_family = AF_INET;
+    memcpy(&pDestination->address.sin_addr.s_addr, pHostEntry->h_addr_list[0],
+           sizeof(pDestination->address.sin_addr.s_addr));
+    pDestination->address.sin_port = htons(port);
+}
+
+static void connectSocket(Destination* pDestination)
+{
+    int result = connect(pDestination->socket,
+                         (const struct sockaddr*)&pDestination->address, sizeof(pDestination->address));
+    if (result < 0)
+        __throw(socketException);
+}
+
+void Destination_Uninit(Destination* pDestination)
+{
+    Destination_Disconnect(pDestination);
+    FrameReader_Uninit(&pDestination->frameReader);
+    DedupSender_Uninit(&pDestination->dedup);
+}
+
+void Destination_Disconnect(Destination* pDestination)
+{
+    if (pDestination->socket >= 0)
+        close(pDestination->socket);
+    pDestination->socket = -1;
+    Backlog_Uninit(&pDestination->backlog);
+}
+
+int Destination_IsConnected(Destination* pDestination)
+{
+    return pDestination->socket >= 0;
+}
+
+int Destination_Receive(Destination* pDestination)
+{
+    int bytesRead = -1;
+
+    __try
+        bytesRead = FrameReader_ReceiveTimestamped(&pDestination->frameReader, pDestination->socket,
+                                                   &pDestination->kernelReceiveTime);
+    __catch
+        __rethrow_and_return(-1);
+    pDestination->lastReceiveTime = Timestamp_Now();
+
+    return bytesRead;
+}
+
+void Destination_SendFrame(Destination* pDestination, uint8_t type, uint8_t flags, const void* pPayload,
+                           size_t length)
+{
+    Protocol_SendFrame(pDestination->socket, type, flags, 0, pPayload, length);
+}
+
+void Destination_SendOutput(Destination* pDestination, FrameType type, StreamType stream, const char* pPayload,
+                            size_t length, int isTraceEnabled, uint64_t readTime)
+{
+    char     trace[TRACE_CHUNK_SIZE];
+    uint64_t sendStartTime;
+
+    if (shouldQueueOutput(pDestination))
+    {
+        queueOutput(pDestination, type, stream, pPayload, length, isTraceEnabled, readTime);
+        return;
+    }
+    if (!isTraceEnabled)
+    {
+        Protocol_SendFrame(pDestination->socket, type, stream, 0, pPayload, length);
+        return;
+    }
+
+    sendStartTime = Timestamp_Now();
+    __try
+        Protocol_SendFrame(pDestination->socket, type, stream, 0, pPayload, length);
+    __catch
+        __rethrow;
+    Trace_EncodeChunk(trace, readTime, sendStartTime, Timestamp_Now());
+    Protocol_SendFrame(pDestination->socket, FRAME_TRACE, TRACE_CHUNK, 0, trace, sizeof(trace));
+}
+
+void Destination_EnableDedup(Destination* pDestination)
+{
+    DedupSender_Init(&pDestination->dedup, 1);
+    Protocol_SendFrame(pDestination->socket, FRAME_DEDUP, DEDUP_HELLO, 0, NULL, 0);
+}
+
+void Destination_SendChunk(Destination* pDestination, StreamType stream, const char* pChunk, size_t length,
+                           const uint8_t* pHash, int isTraceEnabled, uint64_t readTime)
+{
+    char reference[DEDUP_REF_SIZE];
+
+    /* A NULL hash marks a chunk which doesn't end at a cut point and so is unlikely to be seen again. */
+    if (!DedupSender_IsActive(&pDestination->dedup) || !pHash)
+    {
+        Destination_SendOutput(pDestination, FRAME_DATA, stream, pChunk, length, isTraceEnabled, readTime);
+        return;
+    }
+    if (!DedupSender_ShouldReference(&pDestination->dedup, length))
+    {
+        Destination_SendOutput(pDestination, FRAME_CHUNK_DATA, stream, pChunk, length, isTraceEnabled, readTime);
+        return;
+    }
+
+    __try
+        DedupSender_EncodeReference(&pDestination->dedup, pChunk, length, pHash, reference);
+    __catch
+        __rethrow;
+    Destination_SendOutput(pDestination, FRAME_CHUNK_REF, stream, reference, sizeof(reference), isTraceEnabled,
+                           readTime);
+}
+
+void Destination_ProcessDedupFrame(Destination* pDestination, const FrameHeader* pHeader, const char* pPayload)
+{
+    if (pHeader->flags == DEDUP_HELLO)
+    {
+        DedupSender_Accept(&pDestination->dedup);
+        return;
+    }
+    if (pHeader->length < DEDUP_SEQUENCE_SIZE)
+        return;
+    if (pHeader->flags == DEDUP_MISS)
+        sendFill(pDestination, pPayload, pHeader->length);
+    else if (pHeader->flags == DEDUP_ACK)
+        DedupSender_ProcessAcknowledgement(&pDestination->dedup, Protocol_GetUint32(pPayload));
+}
+
+static void sendFill(Destination* pDestination, const char* pPayload, size_t length)
+{
+    const DedupRetainedChunk* pRetained = DedupSender_ProcessMiss(&pDestination->dedup, Protocol_GetUint32(pPayload));
+    struct iovec              vectors[2];
+
+    /* The server holds back the rest of this client's output until it has the data, so it can't wait in the
+       backlog, and a reference that has already been acknowledged should never be missed. */
+    if (!pRetained)
+        __throw(serverException);
+    vectors[0].iov_base = (void*)pPayload;
+    vectors[0].iov_len = DEDUP_SEQUENCE_SIZE;
+    vectors[1].iov_base = (void*)pRetained->data;
+    vectors[1].iov_len = pRetained->length;
+    Protocol_SendFrameVector(pDestination->socket, FRAME_DEDUP, DEDUP_FILL, 0, vectors, 2);
+}
+
+static int shouldQueueOutput(Destination* pDestination)
+{
+    /* Once anything is queued, later frames must queue behind it to keep the stream in order. */
+    return !Backlog_IsEmpty(&pDestination->backlog) || !Protocol_IsWritable(pDestination->socket);
+}
+
+static void queueOutput(Destination* pDestination, FrameType type, StreamType stream, const char* pPayload,
+                        size_t length, int isTraceEnabled, uint64_t readTime)
+{
+    char trace[TRACE_CHUNK_SIZE];
+
+    __try
+        Backlog_AppendFrame(&pDestination->backlog, type, stream, 0, pPayload, length);
+    __catch
+        __rethrow;
+    if (!isTraceEnabled)
+        return;
+
+    /* The send end time is filled in by sendBackloggedFrame() when the frame finally leaves the backlog. */
+    Trace_EncodeChunk(trace, readTime, Timestamp_Now(), 0);
+    Backlog_AppendFrame(&pDestination->backlog, FRAME_TRACE, TRACE_CHUNK, 0, trace, sizeof(trace));
+}
+
+void Destination_SendBacklog(Destination* pDestination)
+{
+    FrameHeader header;
+    char*       pPayload = NULL;
+
+    while (Backlog_PeekFrame(&pDestination->backlog, &header, &pPayload) && Protocol_IsWritable(pDestination->socket))
+    {
+        __try
+            sendBackloggedFrame(pDestination, &header, pPayload);
+        __catch
+            __rethrow;
+    }
+}
+
+void Destination_FlushBacklog(Destination* pDestination)
+{
+    FrameHeader header;
+    char*       pPayload = NULL;
+
+    while (Backlog_PeekFrame(&pDestination->backlog, &header, &pPayload))
+    {
+        __try
+            sendBackloggedFrame(pDestination, &header, pPayload);
+        __catch
+            __rethrow;
+    }
+}
+
+static void sendBackloggedFrame(Destination* pDestination, const FrameHeader* pHeader, char* pPayload)
+{
+    if (pHeader->type == FRAME_TRACE && pHeader->flags == TRACE_CHUNK)
+        Trace_SetChunkSendEndTime(pPayload, Timestamp_Now());
+    __try
+        Protocol_SendFrame(pDestination->socket, pHeader->type, pHeader->flags, pHeader->channel,
+                           pPayload, pHeader->length);
+    __catch
+        __rethrow;
+    Backlog_ConsumeFrame(&pDestination->backlog);
+}
@@ -0,0 +1,59 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef _DESTINATION_H_
+#define _DESTINATION_H_
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include "protocol.h"
+#include "backlog.h"
+#include "dedup.h"
+
+/* One server connection of a remote client.  Output for each destination goes out directly while its socket is
+   writable and otherwise waits in that destination's own backlog, so a slow server never holds up the others.  Each
+   destination also negotiates deduplication with its server separately since only some servers may have a cache. */
+typedef struct
+{
+    struct sockaddr_in  address;
+    FrameReader         frameReader;
+    Backlog             backlog;
+    DedupSender         dedup;
+    uint64_t            lastReceiveTime;
+    uint64_t            kernelReceiveTime;
+    char                name[128];
+    int                 socket;
+    int                 canControl;
+    int                 hasSentExitReport;
+    int                 hasExitReportBeenAcknowledged;
+} Destination;
+
+void Destination_Init(Destination* pDestination, const char* pHost, uint16_t port, uint64_t backlogLimit,
+                      int canControl);
+void Destination_Uninit(Destination* pDestination);
+void Destination_Disconnect(Destination* pDestination);
+int  Destination_IsConnected(Destination* pDestination);
+int  Destination_Receive(Destination* pDestination);
+void Destination_SendFrame(Destination* pDestination, uint8_t type, uint8_t flags, const void* pPayload,
+                           size_t length);
+void Destination_SendOutput(Destination* pDestination, FrameType type, StreamType stream, const char* pPayload,
+                            size_t length, int isTraceEnabled, uint64_t readTime);
+void Destination_EnableDedup(Destination* pDestination);
+void Destination_SendChunk(Destination* pDestination, StreamType stream, const char* pChunk, size_t length,
+                           const uint8_t* pHash, int isTraceEnabled, uint64_t readTime);
+void Destination_ProcessDedupFrame(Destination* pDestination, const FrameHeader* pHeader, const char* pPayload);
+void Destination_SendBacklog(Destination* pDestination);
+void Destination_FlushBacklog(Destination* pDestination);
+
+#endif /* _DESTINATION_H_ */
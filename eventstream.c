@@ -0,0 +1,312 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "try_catch.h"
+#include "eventstream.h"
+#include "protocol.h"
+#include "timestamp.h"
+
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t  dataReady;
+    pthread_cond_t  dataWritten;
+    pthread_t       thread;
+    char*           pFillBuffer;
+    char*           pWriteBuffer;
+    size_t          fillLength;
+    uint64_t        droppedEvents;
+    int             fileDescriptor;
+    int             isEnabled;
+    int             isWriting;
+    int             exitThread;
+    int             isThreadRunning;
+} EventStream;
+
+static EventStream g_events = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, 0,
+                                NULL, NULL, 0, 0, -1, 0, 0, 0, 0 };
+
+
+static int   openFile(const char* pPath, int shouldAppend);
+static int   connectToUnixSocket(const char* pPath);
+static void  allocateBuffers(void);
+static void  startWriterThread(void);
+static void  freeResources(void);
+static void  stopWriterThread(void);
+static void  encodeHeader(char* pHeader, EventType type, uint32_t sessionId, uint8_t stream, size_t length);
+static void  appendToFillBuffer(const char* pHeader, const void* pPayload, size_t length);
+static void* writerThreadMain(void* pContext);
+static void  writeCompletely(const char* pBuffer, size_t length);
+
+
+void EventStream_Init(const char* pPath, int shouldAppend)
+{
+    if (!pPath)
+        return;
+
+    if (0 == strncmp(pPath, EVENT_STREAM_UNIX_PREFIX, strlen(EVENT_STREAM_UNIX_PREFIX)))
+        g_events.fileDescriptor = connectToUnixSocket(pPath + strlen(EVENT_STREAM_UNIX_PREFIX));
+    else
+        g_events.fileDescriptor = openFile(pPath, shouldAppend);
+    if (g_events.fileDescriptor < 0)
+        __throw(fileException);
+
+    __try
+    {
+        __throwing_func( allocateBuffers() );
+        __throwing_func( startWriterThread() );
+    }
+    __catch
+    {
+        freeResources();
+        __rethrow;
+    }
+    /* A reader going away should stop the stream rather than kill the server. */
+    signal(SIGPIPE, SIG_IGN);
+    __atomic_store_n(&g_events.isEnabled, 1, __ATOMIC_RELEASE);
+}
+
+static int openFile(const char* pPath, int shouldAppend)
+{
+    return open(pPath, O_WRONLY | O_CREAT | (shouldAppend ? O_APPEND : O_TRUNC), 0644);
+}
+
+static int connectToUnixSocket(const char* pPath)
+{
+    struct sockaddr_un address;
+    int                fileDescriptor = -1;
+    int                savedErrno;
+
+    if (strlen(pPath) >= sizeof(address.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, pPath);
+
+    fileDescriptor = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fileDescriptor < 0)
+        return -1;
+    if (connect(fileDescriptor, (struct sockaddr*)&address, sizeof(address)) < 0)
+    {
+        savedErrno = errno;
+        close(fileDescriptor);
+        errno = savedErrno;
+        return -1;
+    }
+    return fileDescriptor;
+}
+
+static void allocateBuffers(void)
+{
+    g_events.pFillBuffer = malloc(EVENT_STREAM_BUFFER_SIZE);
+    g_events.pWriteBuffer = malloc(EVENT_STREAM_BUFFER_SIZE);
+    if (!g_events.pFillBuffer || !g_events.pWriteBuffer)
+        __throw(outOfMemoryException);
+}
+
+static void startWriterThread(void)
+{
+    sigset_t allSignals;
+    sigset_t previousSignals;
+    int      result = -1;
+
+    /* Signals are left to the console and shard threads. */
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_SETMASK, &allSignals, &previousSignals);
+    result = pthread_create(&g_events.thread, NULL, writerThreadMain, NULL);
+    pthread_sigmask(SIG_SETMASK, &previousSignals, NULL);
+    if (result != 0)
+        __throw(forkException);
+    g_events.isThreadRunning = 1;
+}
+
+static void freeResources(void)
+{
+    int savedErrno = errno;
+
+    if (g_events.fileDescriptor >= 0)
+        close(g_events.fileDescriptor);
+    g_events.fileDescriptor = -1;
+    free(g_events.pFillBuffer);
+    free(g_events.pWriteBuffer);
+    g_events.pFillBuffer = NULL;
+    g_events.pWriteBuffer = NULL;
+    g_events.fillLength = 0;
+    errno = savedErrno;
+}
+
+void EventStream_Uninit(void)
+{
+    __atomic_store_n(&g_events.isEnabled, 0, __ATOMIC_RELEASE);
+    stopWriterThread();
+    if (g_events.droppedEvents > 0)
+    {
+        printf("error: Dropped %llu --events which were sent faster than they could be written.\n",
+               (unsigned long long)g_events.droppedEvents);
+        fflush(stdout);
+        g_events.droppedEvents = 0;
+    }
+    freeResources();
+}
+
+static void stopWriterThread(void)
+{
+    if (!g_events.isThreadRunning)
+        return;
+
+    pthread_mutex_lock(&g_events.mutex);
+    g_events.exitThread = 1;
+    pthread_cond_signal(&g_events.dataReady);
+    pthread_mutex_unlock(&g_events.mutex);
+    pthread_join(g_events.thread, NULL);
+    g_events.isThreadRunning = 0;
+    g_events.exitThread = 0;
+}
+
+int EventStream_IsEnabled(void)
+{
+    return __atomic_load_n(&g_events.isEnabled, __ATOMIC_ACQUIRE);
+}
+
+void EventStream_Write(EventType type, uint32_t sessionId, uint8_t stream, const void* pPayload, size_t length)
+{
+    char header[EVENT_HEADER_SIZE];
+
+    if (!EventStream_IsEnabled())
+        return;
+
+    encodeHeader(header, type, sessionId, stream, length);
+    pthread_mutex_lock(&g_events.mutex);
+    appendToFillBuffer(header, pPayload, length);
+    pthread_mutex_unlock(&g_events.mutex);
+}
+
+static void encodeHeader(char* pHeader, EventType type, uint32_t sessionId, uint8_t stream, size_t length)
+{
+    Protocol_PutUint32(pHeader, (uint32_t)length);
+    pHeader[4] = (char)type;
+    pHeader[5] = (char)stream;
+    pHeader[6] = 0;
+    pHeader[7] = 0;
+    Protocol_PutUint32(pHeader + 8, sessionId);
+    Protocol_PutUint64(pHeader + 12, Timestamp_WallClockNow());
+}
+
+static void appendToFillBuffer(const char* pHeader, const void* pPayload, size_t length)
+{
+    if (g_events.fileDescriptor < 0)
+        return;
+    /* Events are dropped whole so that the reader never sees part of one. */
+    if (g_events.fillLength + EVENT_HEADER_SIZE + length > EVENT_STREAM_BUFFER_SIZE)
+    {
+        g_events.droppedEvents++;
+        return;
+    }
+    memcpy(g_events.pFillBuffer + g_events.fillLength, pHeader, EVENT_HEADER_SIZE);
+    memcpy(g_events.pFillBuffer + g_events.fillLength + EVENT_HEADER_SIZE, pPayload, length);
+    g_events.fillLength += EVENT_HEADER_SIZE + length;
+}
+
+void EventStream_Flush(void)
+{
+    if (!EventStream_IsEnabled())
+        return;
+
+    pthread_mutex_lock(&g_events.mutex);
+    if (g_events.fillLength > 0)
+        pthread_cond_signal(&g_events.dataReady);
+    pthread_mutex_unlock(&g_events.mutex);
+}
+
+void EventStream_Drain(void)
+{
+    if (!EventStream_IsEnabled())
+        return;
+
+    pthread_mutex_lock(&g_events.mutex);
+    pthread_cond_signal(&g_events.dataReady);
+    while (g_events.fileDescriptor >= 0 && (g_events.fillLength > 0 || g_events.isWriting))
+        pthread_cond_wait(&g_events.dataWritten, &g_events.mutex);
+    pthread_mutex_unlock(&g_events.mutex);
+}
+
+static void* writerThreadMain(void* pContext)
+{
+    pthread_mutex_lock(&g_events.mutex);
+    while (!g_events.exitThread || g_events.fillLength > 0)
+    {
+        char*  pBuffer = g_events.pFillBuffer;
+        size_t length = g_events.fillLength;
+
+        /* Anything which gathers while a buffer is being written is picked up here without needing a wake up. */
+        if (length == 0)
+        {
+            pthread_cond_wait(&g_events.dataReady, &g_events.mutex);
+            continue;
+        }
+
+        g_events.pFillBuffer = g_events.pWriteBuffer;
+        g_events.pWriteBuffer = pBuffer;
+        g_events.fillLength = 0;
+        g_events.isWriting = 1;
+        pthread_mutex_unlock(&g_events.mutex);
+        writeCompletely(pBuffer, length);
+        pthread_mutex_lock(&g_events.mutex);
+        g_events.isWriting = 0;
+        pthread_cond_broadcast(&g_events.dataWritten);
+    }
+    pthread_mutex_unlock(&g_events.mutex);
+
+    return NULL;
+}
+
+static void writeCompletely(const char* pBuffer, size_t length)
+{
+    /* Only this thread closes the stream while it runs, so the descriptor can be used without the lock. */
+    while (length > 0 && g_events.fileDescriptor >= 0)
+    {
+        ssize_t bytesWritten = write(g_events.fileDescriptor, pBuffer, length);
+
+        if (bytesWritten < 0 && errno == EINTR)
+            continue;
+        if (bytesWritten <= 0)
+        {
+            printf("error: Stopped writing --events after a write failed.\n");
+            perror("       errno");
+            fflush(stdout);
+            __atomic_store_n(&g_events.isEnabled, 0, __ATOMIC_RELEASE);
+            pthread_mutex_lock(&g_events.mutex);
+            close(g_events.fileDescriptor);
+            g_events.fileDescriptor = -1;
+            pthread_mutex_unlock(&g_events.mutex);
+            return;
+        }
+        pBuffer += bytesWritten;
+        length -= bytesWritten;
+    }
+}
@@ -0,0 +1,59 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef _EVENTSTREAM_H_
+#define _EVENTSTREAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* With --events, remotesvr also writes everything it shows to a machine readable stream of events.  Each event is an
+   EVENT_HEADER_SIZE header followed by its payload.  The header holds, big-endian like the wire protocol:
+       uint32_t payload length
+       uint8_t  EventType
+       uint8_t  StreamType the output came from for EVENT_OUTPUT and 0 otherwise
+       uint16_t reserved, always 0
+       uint32_t session id
+       uint64_t wall clock time the server saw the event, in nanoseconds since the epoch
+   Events from every shard are copied into one of a pair of EVENT_STREAM_BUFFER_SIZE buffers while a writer thread
+   writes the other out, so no shard ever waits on the reader.  EventStream_Flush() at the end of every pass through
+   an event loop wakes the writer, and EventStream_Drain() waits for it to write everything gathered so far.  Should
+   both buffers fill because the reader can't keep up, whole events are dropped and counted rather than stall the
+   shards.  The path may be a file, which is appended to when taking over with --handoff, a named pipe, or "unix:"
+   followed by the path of a listening Unix domain stream socket.  A reader which goes away stops the stream but not
+   the server. */
+#define EVENT_HEADER_SIZE           20
+#define EVENT_STREAM_BUFFER_SIZE    (4 * 1024 * 1024)
+#define EVENT_STREAM_UNIX_PREFIX    "unix:"
+
+typedef enum
+{
+    /* Payload is the client's address as "address:port". */
+    EVENT_CONNECT = 1,
+    /* Payload is empty or, if the server ended the session, the reason why. */
+    EVENT_DISCONNECT,
+    /* Payload is the output exactly as the client sent it, with each line of --lines output in its own event. */
+    EVENT_OUTPUT,
+    /* Payload is the exit report as shown on the console. */
+    EVENT_EXIT
+} EventType;
+
+void EventStream_Init(const char* pPath, int shouldAppend);
+void EventStream_Uninit(void);
+int  EventStream_IsEnabled(void);
+void EventStream_Write(EventType type, uint32_t sessionId, uint8_t stream, const void* pPayload, size_t length);
+void EventStream_Flush(void);
+void EventStream_Drain(void);
+
+#endif /* _EVENTSTREAM_H_ */
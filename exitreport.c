@@ -0,0 +1,84 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include "exitreport.h"
+#include "protocol.h"
+#include "timestamp.h"
+
+
+static size_t formatExitStatus(int status, char* pDest, size_t destSize);
+
+
+void ExitReport_Encode(const ExitReport* pReport, char* pDest)
+{
+    Protocol_PutUint32(pDest, (uint32_t)pReport->status);
+    Protocol_PutUint64(pDest + 4, pReport->elapsedNanoseconds);
+    Protocol_PutUint64(pDest + 12, pReport->userMicroseconds);
+    Protocol_PutUint64(pDest + 20, pReport->systemMicroseconds);
+    Protocol_PutUint64(pDest + 28, pReport->maxResidentKilobytes);
+    Protocol_PutUint64(pDest + 36, pReport->voluntaryContextSwitches);
+    Protocol_PutUint64(pDest + 44, pReport->involuntaryContextSwitches);
+}
+
+int ExitReport_Decode(ExitReport* pReport, const char* pSource, size_t length)
+{
+    if (length < EXIT_REPORT_SIZE)
+        return 0;
+
+    pReport->status = (int)Protocol_GetUint32(pSource);
+    pReport->elapsedNanoseconds = Protocol_GetUint64(pSource + 4);
+    pReport->userMicroseconds = Protocol_GetUint64(pSource + 12);
+    pReport->systemMicroseconds = Protocol_GetUint64(pSource + 20);
+    pReport->maxResidentKilobytes = Protocol_GetUint64(pSource + 28);
+    pReport->voluntaryContextSwitches = Protocol_GetUint64(pSource + 36);
+    pReport->involuntaryContextSwitches = Protocol_GetUint64(pSource + 44);
+    return 1;
+}
+
+void ExitReport_Format(const ExitReport* pReport, char* pDest, size_t destSize)
+{
+    size_t length = formatExitStatus(pReport->status, pDest, destSize);
+
+    if (length >= destSize)
+        return;
+    snprintf(pDest + length, destSize - length,
+             " after %llu.%03llus (user %llu.%03llus, sys %llu.%03llus, max RSS %llu KB, "
+             "%llu voluntary/%llu involuntary context switches)",
+             (unsigned long long)(pReport->elapsedNanoseconds / TIMESTAMP_NANOSECONDS_PER_SECOND),
+             (unsigned long long)(pReport->elapsedNanoseconds % TIMESTAMP_NANOSECONDS_PER_SECOND / 1000000ULL),
+             (unsigned long long)(pReport->userMicroseconds / 1000000ULL),
+             (unsigned long long)(pReport->userMicroseconds % 1000000ULL / 1000ULL),
+             (unsigned long long)(pReport->systemMicroseconds / 1000000ULL),
+             (unsigned long long)(pReport->systemMicroseconds % 1000000ULL / 1000ULL),
+             (unsigned long long)pReport->maxResidentKilobytes,
+             (unsigned long long)pReport->voluntaryContextSwitches,
+             (unsigned long long)pReport->involuntaryContextSwitches);
+}
+
+static size_t formatExitStatus(int status, char* pDest, size_t destSize)
+{
+    int length;
+
+    if (WIFEXITED(status))
+        length = snprintf(pDest, destSize, "Command exited with status %d", WEXITSTATUS(status));
+    else if (WIFSIGNALED(status))
+        length = snprintf(pDest, destSize, "Command killed by signal %d (%s)", WTERMSIG(status), strsignal(WTERMSIG(status)));
+    else
+        length = snprintf(pDest, destSize, "Command stopped with wait status 0x%x", status);
+
+    return length < 0 ? 0 : (size_t)length;
+}
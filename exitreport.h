@@ -0,0 +1,40 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef _EXITREPORT_H_
+#define _EXITREPORT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Sent by remote in a FRAME_EXIT frame once the child has been reaped.  status is the raw wait status and the CPU
+   times come from the child's rusage. */
+#define EXIT_REPORT_SIZE    52
+
+typedef struct
+{
+    uint64_t elapsedNanoseconds;
+    uint64_t userMicroseconds;
+    uint64_t systemMicroseconds;
+    uint64_t maxResidentKilobytes;
+    uint64_t voluntaryContextSwitches;
+    uint64_t involuntaryContextSwitches;
+    int      status;
+} ExitReport;
+
+void ExitReport_Encode(const ExitReport* pReport, char* pDest);
+int  ExitReport_Decode(ExitReport* pReport, const char* pSource, size_t length);
+void ExitReport_Format(const ExitReport* pReport, char* pDest, size_t destSize);
+
+#endif /* _EXITREPORT_H_ */
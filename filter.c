@@ -0,0 +1,271 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include "try_catch.h"
+#include "filter.h"
+#include "linescan.h"
+
+
+static void   clearRules(FilterRules* pRules);
+static void   addRule(FilterRules* pRules, char* pRuleText);
+static int    matchesRule(const FilterRule* pRule, const char* pLine, size_t length);
+static int    matchRegularExpression(const char* pPattern, const char* pText, const char* pTextEnd);
+static int    matchHere(const char* pPattern, const char* pText, const char* pTextEnd);
+static int    matchStar(char c, const char* pPattern, const char* pText, const char* pTextEnd);
+static size_t lineContentLength(const char* pLine, size_t length);
+static size_t appendToPendingLine(LineFilter* pFilter, const char* pSegment, size_t segmentLength);
+static size_t emit(char* pOutput, const char* pSource, size_t length);
+
+
+void FilterRules_Init(FilterRules* pRules)
+{
+    memset(pRules, 0, sizeof(*pRules));
+}
+
+void FilterRules_Uninit(FilterRules* pRules)
+{
+    clearRules(pRules);
+}
+
+static void clearRules(FilterRules* pRules)
+{
+    free(pRules->pRuleText);
+    memset(pRules, 0, sizeof(*pRules));
+}
+
+void FilterRules_Parse(FilterRules* pRules, const char* pText, size_t length)
+{
+    char* pCurrent = NULL;
+    char* pSavePointer = NULL;
+
+    clearRules(pRules);
+    if (length == 0)
+        return;
+
+    pRules->pRuleText = malloc(length + 1);
+    if (!pRules->pRuleText)
+        __throw(outOfMemoryException);
+    memcpy(pRules->pRuleText, pText, length);
+    pRules->pRuleText[length] = '\0';
+
+    for (pCurrent = strtok_r(pRules->pRuleText, "\n", &pSavePointer) ;
+         pCurrent && pRules->ruleCount < FILTER_MAX_RULES ;
+         pCurrent = strtok_r(NULL, "\n", &pSavePointer))
+    {
+        addRule(pRules, pCurrent);
+    }
+}
+
+static void addRule(FilterRules* pRules, char* pRuleText)
+{
+    static const char regularExpressionPrefix[] = "re:";
+    FilterRule*       pRule = &pRules->rules[pRules->ruleCount];
+
+    if (pRuleText[0] != '+' && pRuleText[0] != '-')
+        return;
+    pRule->isInclude = (pRuleText[0] == '+');
+    pRuleText++;
+
+    pRule->isRegularExpression = (0 == strncmp(pRuleText, regularExpressionPrefix, sizeof(regularExpressionPrefix) - 1));
+    if (pRule->isRegularExpression)
+        pRuleText += sizeof(regularExpressionPrefix) - 1;
+    if (*pRuleText == '\0')
+        return;
+
+    pRule->pPattern = pRuleText;
+    pRule->length = strlen(pRuleText);
+    pRules->includeCount += pRule->isInclude;
+    pRules->ruleCount++;
+}
+
+int FilterRules_IsActive(const FilterRules* pRules)
+{
+    return pRules->ruleCount > 0;
+}
+
+int FilterRules_Matches(const FilterRules* pRules, const char* pLine, size_t length)
+{
+    int isIncluded = (pRules->includeCount == 0);
+    int i;
+
+    length = lineContentLength(pLine, length);
+    for (i = 0 ; i < pRules->ruleCount ; i++)
+    {
+        const FilterRule* pRule = &pRules->rules[i];
+
+        if (pRule->isInclude && isIncluded)
+            continue;
+        if (!matchesRule(pRule, pLine, length))
+            continue;
+        if (!pRule->isInclude)
+            return 0;
+        isIncluded = 1;
+    }
+    return isIncluded;
+}
+
+static size_t lineContentLength(const char* pLine, size_t length)
+{
+    if (length > 0 && pLine[length - 1] == '\n')
+        length--;
+    if (length > 0 && pLine[length - 1] == '\r')
+        length--;
+    return length;
+}
+
+static int matchesRule(const FilterRule* pRule, const char* pLine, size_t length)
+{
+    if (pRule->isRegularExpression)
+        return matchRegularExpression(pRule->pPattern, pLine, pLine + length);
+    return memmem(pLine, length, pRule->pPattern, pRule->length) != NULL;
+}
+
+/* Small backtracking matcher in the style of Pike and Kernighan's "A Regular Expression Matcher". */
+static int matchRegularExpression(const char* pPattern, const char* pText, const char* pTextEnd)
+{
+    if (pPattern[0] == '^')
+        return matchHere(pPattern + 1, pText, pTextEnd);
+    do
+    {
+        if (matchHere(pPattern, pText, pTextEnd))
+            return 1;
+    }
+    while (pText++ < pTextEnd);
+
+    return 0;
+}
+
+static int matchHere(const char* pPattern, const char* pText, const char* pTextEnd)
+{
+    if (pPattern[0] == '\0')
+        return 1;
+    if (pPattern[1] == '*')
+        return matchStar(pPattern[0], pPattern + 2, pText, pTextEnd);
+    if (pPattern[0] == '$' && pPattern[1] == '\0')
+        return pText == pTextEnd;
+    if (pText < pTextEnd && (pPattern[0] == '.' || pPattern[0] == *pText))
+        return matchHere(pPattern + 1, pText + 1, pTextEnd);
+    return 0;
+}
+
+static int matchStar(char c, const char* pPattern, const char* pText, const char* pTextEnd)
+{
+    do
+    {
+        if (matchHere(pPattern, pText, pTextEnd))
+            return 1;
+    }
+    while (pText < pTextEnd && (*pText++ == c || c == '.'));
+
+    return 0;
+}
+
+void LineFilter_Init(LineFilter* pFilter, const FilterRules* pRules)
+{
+    pFilter->pRules = pRules;
+    pFilter->bytesIn = 0;
+    pFilter->bytesPassed = 0;
+    pFilter->pendingLength = 0;
+    pFilter->longLineState = LONG_LINE_NONE;
+}
+
+size_t LineFilter_Process(LineFilter* pFilter, const char* pInput, size_t inputLength, char* pOutput)
+{
+    const char* pCurrent = pInput;
+    const char* pEnd = pInput + inputLength;
+    size_t      outputLength = 0;
+
+    while (pCurrent < pEnd)
+    {
+        const char* pNewline = LineScan_FindNewline(pCurrent, pEnd);
+        const char* pSegmentEnd = pNewline ? pNewline + 1 : pEnd;
+        size_t      segmentLength = pSegmentEnd - pCurrent;
+
+        if (pFilter->longLineState != LONG_LINE_NONE)
+        {
+            if (pFilter->longLineState == LONG_LINE_PASSING)
+                outputLength += emit(pOutput + outputLength, pCurrent, segmentLength);
+        }
+        else if (pNewline && pFilter->pendingLength == 0)
+        {
+            if (FilterRules_Matches(pFilter->pRules, pCurrent, segmentLength))
+                outputLength += emit(pOutput + outputLength, pCurrent, segmentLength);
+        }
+        else
+        {
+            size_t bytesAppended = appendToPendingLine(pFilter, pCurrent, segmentLength);
+            int    isLineTooLong = bytesAppended < segmentLength;
+
+            if (pNewline || isLineTooLong)
+            {
+                int isMatch = FilterRules_Matches(pFilter->pRules, pFilter->pendingLine, pFilter->pendingLength);
+
+                if (isMatch)
+                {
+                    outputLength += emit(pOutput + outputLength, pFilter->pendingLine, pFilter->pendingLength);
+                    outputLength += emit(pOutput + outputLength, pCurrent + bytesAppended,
+                                         segmentLength - bytesAppended);
+                }
+                if (isLineTooLong)
+                    pFilter->longLineState = isMatch ? LONG_LINE_PASSING : LONG_LINE_DROPPING;
+                pFilter->pendingLength = 0;
+            }
+        }
+        if (pNewline)
+            pFilter->longLineState = LONG_LINE_NONE;
+
+        pCurrent = pSegmentEnd;
+    }
+
+    pFilter->bytesIn += inputLength;
+    pFilter->bytesPassed += outputLength;
+    return outputLength;
+}
+
+/* Called before the rules change so that a partial line held back under the old rules is judged by them rather
+   than being glued onto output filtered by the new ones.  pOutput needs room for FILTER_MAX_LINE_LENGTH bytes. */
+size_t LineFilter_Flush(LineFilter* pFilter, char* pOutput)
+{
+    size_t outputLength = 0;
+
+    if (pFilter->pendingLength > 0 &&
+        FilterRules_Matches(pFilter->pRules, pFilter->pendingLine, pFilter->pendingLength))
+    {
+        outputLength = emit(pOutput, pFilter->pendingLine, pFilter->pendingLength);
+    }
+    pFilter->pendingLength = 0;
+    pFilter->longLineState = LONG_LINE_NONE;
+
+    pFilter->bytesPassed += outputLength;
+    return outputLength;
+}
+
+static size_t appendToPendingLine(LineFilter* pFilter, const char* pSegment, size_t segmentLength)
+{
+    size_t room = sizeof(pFilter->pendingLine) - pFilter->pendingLength;
+    size_t bytesToCopy = segmentLength < room ? segmentLength : room;
+
+    memcpy(pFilter->pendingLine + pFilter->pendingLength, pSegment, bytesToCopy);
+    pFilter->pendingLength += bytesToCopy;
+    return bytesToCopy;
+}
+
+static size_t emit(char* pOutput, const char* pSource, size_t length)
+{
+    memcpy(pOutput, pSource, length);
+    return length;
+}
@@ -0,0 +1,71 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef _FILTER_H_
+#define _FILTER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Output filters are pushed down from the server as a list of newline separated rules.  Each rule starts with '+'
+   (include) or '-' (exclude) followed by either a plain substring or "re:" and a simple regular expression
+   supporting ^, $, . and *.  A line is sent when it matches any include rule (or there are none) and no exclude
+   rule.  An empty rule list turns filtering off. */
+#define FILTER_MAX_RULES        16
+#define FILTER_MAX_LINE_LENGTH  4096
+
+typedef struct
+{
+    const char* pPattern;
+    size_t      length;
+    int         isInclude;
+    int         isRegularExpression;
+} FilterRule;
+
+typedef struct
+{
+    FilterRule rules[FILTER_MAX_RULES];
+    char*      pRuleText;
+    int        ruleCount;
+    int        includeCount;
+} FilterRules;
+
+typedef enum
+{
+    LONG_LINE_NONE = 0,
+    LONG_LINE_PASSING,
+    LONG_LINE_DROPPING
+} LongLineState;
+
+typedef struct
+{
+    const FilterRules* pRules;
+    uint64_t           bytesIn;
+    uint64_t           bytesPassed;
+    size_t             pendingLength;
+    LongLineState      longLineState;
+    char               pendingLine[FILTER_MAX_LINE_LENGTH];
+} LineFilter;
+
+void   FilterRules_Init(FilterRules* pRules);
+void   FilterRules_Uninit(FilterRules* pRules);
+void   FilterRules_Parse(FilterRules* pRules, const char* pText, size_t length);
+int    FilterRules_IsActive(const FilterRules* pRules);
+int    FilterRules_Matches(const FilterRules* pRules, const char* pLine, size_t length);
+
+void   LineFilter_Init(LineFilter* pFilter, const FilterRules* pRules);
+size_t LineFilter_Process(LineFilter* pFilter, const char* pInput, size_t inputLength, char* pOutput);
+size_t LineFilter_Flush(LineFilter* pFilter, char* pOutput);
+
+#endif /* _FILTER_H_ */
@@ -0,0 +1,499 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "try_catch.h"
+#include "follower.h"
+#include "protocol.h"
+
+
+#define FOLLOWER_WATCH_EVENTS       (IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+#define FOLLOWER_DIRECTORY_EVENTS   (IN_CREATE | IN_MOVED_TO)
+#define FOLLOWER_CHECK_INTERVAL_MS  1000
+#define FOLLOWER_TAIL_SCAN_SIZE     (64 * 1024)
+#define FOLLOWER_NOTICE_SIZE        512
+
+
+static volatile sig_atomic_t g_controlCSignalled;
+
+
+static void flagStructureAsUninitialized(Follower* pFollower);
+static void allocateFiles(Follower* pFollower, Parameters* pParameters);
+static char* copyDirectory(const char* pPath);
+static void createInotify(Follower* pFollower);
+static void watchDirectories(Follower* pFollower);
+static void openFiles(Follower* pFollower);
+static int  openFile(Follower* pFollower, FollowedFile* pFile);
+static void closeFile(Follower* pFollower, FollowedFile* pFile);
+static uint64_t findStartOfLastLines(FollowedFile* pFile, uint64_t size);
+static void controlCSignalHandler(int value);
+static void waitForEvents(Follower* pFollower);
+static void drainInotifyEvents(Follower* pFollower);
+static void checkFiles(Follower* pFollower);
+static void checkFile(Follower* pFollower, FollowedFile* pFile);
+static int  hasBeenReplaced(FollowedFile* pFile);
+static void sendAppendedData(Follower* pFollower, FollowedFile* pFile);
+static uint64_t restartTruncatedFile(Follower* pFollower, FollowedFile* pFile);
+static void sendNotice(Follower* pFollower, FollowedFile* pFile, const char* pMessage);
+static size_t formatFileHeader(Follower* pFollower, FollowedFile* pFile, char* pBuffer, size_t bufferSize);
+static void receiveFromServer(Follower* pFollower);
+static void processFrameFromServer(Follower* pFollower, const FrameHeader* pHeader);
+
+
+void Follower_Init(Follower* pFollower, Parameters* pParameters)
+{
+    flagStructureAsUninitialized(pFollower);
+    memset(&pFollower->destination, 0, sizeof(pFollower->destination));
+    pFollower->destination.socket = -1;
+    pFollower->pFiles = NULL;
+    pFollower->pLastSent = NULL;
+    pFollower->bytesSent = 0;
+    pFollower->fileCount = 0;
+    pFollower->inotifyFileDescriptor = -1;
+    pFollower->exitRunLoop = 0;
+
+    __try
+    {
+        __throwing_func( Destination_Init(&pFollower->destination, Parameters_GetAddress(pParameters),
+                                          Parameters_GetPortNumber(pParameters), 0, 1) );
+        __throwing_func( allocateFiles(pFollower, pParameters) );
+        __throwing_func( createInotify(pFollower) );
+        __throwing_func( watchDirectories(pFollower) );
+    }
+    __catch
+    {
+        __rethrow;
+    }
+}
+
+static void flagStructureAsUninitialized(Follower* pFollower)
+{
+    memset(pFollower, 0xff, sizeof(*pFollower));
+}
+
+static void allocateFiles(Follower* pFollower, Parameters* pParameters)
+{
+    int fileCount = Parameters_GetFollowPathCount(pParameters);
+    int i;
+
+    pFollower->pFiles = calloc(fileCount, sizeof(*pFollower->pFiles));
+    if (!pFollower->pFiles)
+        __throw(outOfMemoryException);
+    for (i = 0 ; i < fileCount ; i++)
+    {
+        FollowedFile* pFile = &pFollower->pFiles[i];
+
+        pFile->pPath = Parameters_GetFollowPath(pParameters, i);
+        pFile->fileDescriptor = -1;
+        pFile->watch = -1;
+        pFollower->fileCount++;
+        pFile->pDirectory = copyDirectory(pFile->pPath);
+        if (!pFile->pDirectory)
+            __throw(outOfMemoryException);
+    }
+}
+
+static char* copyDirectory(const char* pPath)
+{
+    const char* pSlash = strrchr(pPath, '/');
+
+    if (!pSlash)
+        return strdup(".");
+    if (pSlash == pPath)
+        return strdup("/");
+    return strndup(pPath, pSlash - pPath);
+}
+
+static void createInotify(Follower* pFollower)
+{
+    pFollower->inotifyFileDescriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (pFollower->inotifyFileDescriptor < 0)
+        __throw(fileException);
+}
+
+static void watchDirectories(Follower* pFollower)
+{
+    int i;
+
+    /* Watching the same directory twice just hands back the same watch. */
+    for (i = 0 ; i < pFollower->fileCount ; i++)
+    {
+        FollowedFile* pFile = &pFollower->pFiles[i];
+
+        if (inotify_add_watch(pFollower->inotifyFileDescriptor, pFile->pDirectory, FOLLOWER_DIRECTORY_EVENTS) < 0)
+        {
+            printf("error: Can't watch directory %s for %s.\n", pFile->pDirectory, pFile->pPath);
+            __throw(fileException);
+        }
+    }
+}
+
+void Follower_Uninit(Follower* pFollower)
+{
+    int i;
+
+    for (i = 0 ; i < pFollower->fileCount ; i++)
+    {
+        closeFile(pFollower, &pFollower->pFiles[i]);
+        free(pFollower->pFiles[i].pDirectory);
+    }
+    free(pFollower->pFiles);
+    if (pFollower->inotifyFileDescriptor >= 0)
+        close(pFollower->inotifyFileDescriptor);
+    Destination_Uninit(&pFollower->destination);
+
+    flagStructureAsUninitialized(pFollower);
+}
+
+static void closeFile(Follower* pFollower, FollowedFile* pFile)
+{
+    if (pFile->watch >= 0)
+        inotify_rm_watch(pFollower->inotifyFileDescriptor, pFile->watch);
+    if (pFile->fileDescriptor >= 0)
+        close(pFile->fileDescriptor);
+    pFile->watch = -1;
+    pFile->fileDescriptor = -1;
+}
+
+void Follower_Run(Follower* pFollower)
+{
+    g_controlCSignalled = 0;
+    signal(SIGINT, controlCSignalHandler);
+
+    __try
+        openFiles(pFollower);
+    __catch
+        __rethrow;
+
+    while (!pFollower->exitRunLoop && !g_controlCSignalled)
+    {
+        __try
+            waitForEvents(pFollower);
+        __catch
+            __rethrow;
+    }
+}
+
+static void controlCSignalHandler(int value)
+{
+    g_controlCSignalled = 1;
+}
+
+static void openFiles(Follower* pFollower)
+{
+    int i;
+
+    for (i = 0 ; i < pFollower->fileCount ; i++)
+    {
+        FollowedFile* pFile = &pFollower->pFiles[i];
+        struct stat   status;
+
+        if (!openFile(pFollower, pFile))
+        {
+            __try
+                sendNotice(pFollower, pFile, "cannot open file, waiting for it to appear");
+            __catch
+                __rethrow;
+            continue;
+        }
+        /* Like tail, start with the last few lines rather than the whole history. */
+        if (fstat(pFile->fileDescriptor, &status) == 0)
+            pFile->offset = findStartOfLastLines(pFile, status.st_size);
+        __try
+            sendAppendedData(pFollower, pFile);
+        __catch
+            __rethrow;
+    }
+}
+
+static int openFile(Follower* pFollower, FollowedFile* pFile)
+{
+    struct stat status;
+
+    pFile->fileDescriptor = open(pFile->pPath, O_RDONLY | O_CLOEXEC);
+    if (pFile->fileDescriptor < 0)
+        return 0;
+    if (fstat(pFile->fileDescriptor, &status) < 0)
+    {
+        closeFile(pFollower, pFile);
+        return 0;
+    }
+
+    pFile->device = status.st_dev;
+    pFile->inode = status.st_ino;
+    pFile->offset = 0;
+    pFile->watch = inotify_add_watch(pFollower->inotifyFileDescriptor, pFile->pPath, FOLLOWER_WATCH_EVENTS);
+    return 1;
+}
+
+static uint64_t findStartOfLastLines(FollowedFile* pFile, uint64_t size)
+{
+    char     buffer[FOLLOWER_TAIL_SCAN_SIZE];
+    size_t   scanLength = size < sizeof(buffer) ? size : sizeof(buffer);
+    uint64_t scanStart = size - scanLength;
+    ssize_t  bytesRead = pread(pFile->fileDescriptor, buffer, scanLength, scanStart);
+    size_t   end;
+    int      lineCount = 0;
+
+    if (bytesRead != (ssize_t)scanLength)
+        return size;
+
+    /* A final newline ends the last line rather than starting another one. */
+    end = scanLength;
+    if (end > 0 && buffer[end - 1] == '\n')
+        end--;
+    while (end > 0)
+    {
+        const char* pNewline = memrchr(buffer, '\n', end);
+
+        if (!pNewline)
+            break;
+        if (++lineCount == FOLLOWER_INITIAL_LINES)
+            return scanStart + (pNewline - buffer) + 1;
+        end = pNewline - buffer;
+    }
+    /* Fewer lines than wanted in the scanned tail: send all of it, unless it is only part of a very long line. */
+    return scanStart == 0 ? 0 : size;
+}
+
+static void waitForEvents(Follower* pFollower)
+{
+    struct pollfd pollDescriptors[2];
+    int           pollResult = -1;
+
+    pollDescriptors[0].fd = pFollower->inotifyFileDescriptor;
+    pollDescriptors[0].events = POLLIN;
+    pollDescriptors[0].revents = 0;
+    pollDescriptors[1].fd = pFollower->destination.socket;
+    pollDescriptors[1].events = POLLIN;
+    pollDescriptors[1].revents = 0;
+
+    pollResult = poll(pollDescriptors, 2, FOLLOWER_CHECK_INTERVAL_MS);
+    if (pollResult < 0 && errno == EINTR)
+        return;
+    if (pollResult < 0)
+        __throw(selectException);
+
+    __try
+    {
+        if (pollDescriptors[1].revents)
+        {
+            __throwing_func( receiveFromServer(pFollower) );
+        }
+        if (pollDescriptors[0].revents)
+            drainInotifyEvents(pFollower);
+        __throwing_func( checkFiles(pFollower) );
+    }
+    __catch
+    {
+        __rethrow;
+    }
+}
+
+static void drainInotifyEvents(Follower* pFollower)
+{
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    /* Every file is checked after any event so there is no need to work out which ones they were for. */
+    while (read(pFollower->inotifyFileDescriptor, buffer, sizeof(buffer)) > 0)
+    {
+    }
+}
+
+static void checkFiles(Follower* pFollower)
+{
+    int i;
+
+    for (i = 0 ; i < pFollower->fileCount && !pFollower->exitRunLoop ; i++)
+    {
+        __try
+            checkFile(pFollower, &pFollower->pFiles[i]);
+        __catch
+            __rethrow;
+    }
+}
+
+static void checkFile(Follower* pFollower, FollowedFile* pFile)
+{
+    int wasOpen = pFile->fileDescriptor >= 0;
+
+    /* Whatever made it into the old file before it was rotated away is sent before moving on to the new one. */
+    if (wasOpen)
+    {
+        __try
+            sendAppendedData(pFollower, pFile);
+        __catch
+            __rethrow;
+    }
+    if (!hasBeenReplaced(pFile))
+        return;
+
+    closeFile(pFollower, pFile);
+    if (!openFile(pFollower, pFile))
+        return;
+    __try
+    {
+        __throwing_func( sendNotice(pFollower, pFile, wasOpen ? "file has been replaced, following new file" :
+                                                                "file has appeared, following it") );
+        __throwing_func( sendAppendedData(pFollower, pFile) );
+    }
+    __catch
+    {
+        __rethrow;
+    }
+}
+
+static int hasBeenReplaced(FollowedFile* pFile)
+{
+    struct stat status;
+
+    if (stat(pFile->pPath, &status) < 0)
+        return 0;
+    if (pFile->fileDescriptor < 0)
+        return 1;
+    return status.st_dev != pFile->device || status.st_ino != pFile->inode;
+}
+
+static void sendAppendedData(Follower* pFollower, FollowedFile* pFile)
+{
+    char        header[FOLLOWER_NOTICE_SIZE];
+    struct stat status;
+    uint64_t    size;
+
+    if (fstat(pFile->fileDescriptor, &status) < 0)
+        return;
+    size = status.st_size;
+    if (size < pFile->offset)
+    {
+        __try
+            size = restartTruncatedFile(pFollower, pFile);
+        __catch
+            __rethrow;
+    }
+
+    while (pFile->offset < size)
+    {
+        size_t headerLength = formatFileHeader(pFollower, pFile, header, sizeof(header));
+        size_t length = size - pFile->offset;
+        size_t bytesSent = 0;
+
+        if (length > PROTOCOL_MAX_PAYLOAD_SIZE - headerLength)
+            length = PROTOCOL_MAX_PAYLOAD_SIZE - headerLength;
+        __try
+            bytesSent = Protocol_SendFrameWithFileData(pFollower->destination.socket, FRAME_DATA, STREAM_STDOUT, 0,
+                                                       header, headerLength, pFile->fileDescriptor, pFile->offset,
+                                                       length);
+        __catch
+            __rethrow;
+        pFile->offset += bytesSent;
+        pFollower->bytesSent += bytesSent;
+        pFollower->pLastSent = pFile;
+        /* Truncated after fstat() so the frame was padded out to its promised length. */
+        if (bytesSent < length)
+        {
+            __try
+                size = restartTruncatedFile(pFollower, pFile);
+            __catch
+                __rethrow;
+        }
+    }
+}
+
+static uint64_t restartTruncatedFile(Follower* pFollower, FollowedFile* pFile)
+{
+    struct stat status;
+
+    pFile->offset = 0;
+    __try
+        sendNotice(pFollower, pFile, "file truncated");
+    __catch
+        __rethrow_and_return(0);
+    if (fstat(pFile->fileDescriptor, &status) < 0)
+        return 0;
+    return status.st_size;
+}
+
+static void sendNotice(Follower* pFollower, FollowedFile* pFile, const char* pMessage)
+{
+    char notice[FOLLOWER_NOTICE_SIZE];
+    int  length = snprintf(notice, sizeof(notice), "remote: %s: %s\n", pFile->pPath, pMessage);
+
+    if (length >= (int)sizeof(notice))
+        length = sizeof(notice) - 1;
+    __try
+        Protocol_SendFrame(pFollower->destination.socket, FRAME_DATA, STREAM_STDERR, 0, notice, length);
+    __catch
+        __rethrow;
+}
+
+static size_t formatFileHeader(Follower* pFollower, FollowedFile* pFile, char* pBuffer, size_t bufferSize)
+{
+    int length;
+
+    /* As with tail, output from several files is split up by headers naming the file it came from. */
+    if (pFollower->fileCount == 1 || pFile == pFollower->pLastSent)
+        return 0;
+    length = snprintf(pBuffer, bufferSize, "%s==> %s <==\n", pFollower->pLastSent ? "\n" : "", pFile->pPath);
+    if (length >= (int)bufferSize)
+        length = bufferSize - 1;
+    return length;
+}
+
+static void receiveFromServer(Follower* pFollower)
+{
+    FrameHeader header;
+    const char* pPayload = NULL;
+    int         bytesRead = -1;
+
+    __try
+        bytesRead = Destination_Receive(&pFollower->destination);
+    __catch
+        __rethrow;
+    if (bytesRead < 0)
+        return;
+    if (bytesRead == 0)
+    {
+        pFollower->exitRunLoop = 1;
+        return;
+    }
+
+    while (FrameReader_NextFrame(&pFollower->destination.frameReader, &header, &pPayload))
+    {
+        __try
+            processFrameFromServer(pFollower, &header);
+        __catch
+            __rethrow;
+    }
+}
+
+static void processFrameFromServer(Follower* pFollower, const FrameHeader* pHeader)
+{
+    if (pHeader->type != FRAME_CONTROL)
+        return;
+    /* There is no child to take input, so ^C from the server just stops following. */
+    if (pHeader->flags == CONTROL_INTERRUPT)
+        pFollower->exitRunLoop = 1;
+    else if (pHeader->flags == CONTROL_PING)
+        Destination_SendFrame(&pFollower->destination, FRAME_CONTROL, CONTROL_PONG, NULL, 0);
+}
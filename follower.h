@@ -0,0 +1,56 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef _FOLLOWER_H_
+#define _FOLLOWER_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "parameters.h"
+#include "destination.h"
+
+/* remote --follow streams files as they grow, like tail -F, without a child process in between.  Each file is
+   watched with inotify, along with its directory so that a file which is rotated away or deleted is picked up again
+   once it is recreated, and whatever was appended since the last look is sent straight from the page cache with
+   sendfile().  A file which shrinks is taken to have been truncated and is followed again from its start.  As a
+   fallback for filesystems which don't raise inotify events, every file is also looked at once a second. */
+#define FOLLOWER_INITIAL_LINES  10
+
+typedef struct
+{
+    const char* pPath;
+    char*       pDirectory;
+    uint64_t    offset;
+    dev_t       device;
+    ino_t       inode;
+    int         fileDescriptor;
+    int         watch;
+} FollowedFile;
+
+typedef struct
+{
+    Destination   destination;
+    FollowedFile* pFiles;
+    FollowedFile* pLastSent;
+    uint64_t      bytesSent;
+    int           fileCount;
+    int           inotifyFileDescriptor;
+    int           exitRunLoop;
+} Follower;
+
+void Follower_Init(Follower* pFollower, Parameters* pParameters);
+void Follower_Uninit(Follower* pFollower);
+void Follower_Run(Follower* pFollower);
+
+#endif /* _FOLLOWER_H_ */
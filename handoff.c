@@ -0,0 +1,287 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "try_catch.h"
+#include "handoff.h"
+
+
+static void initAddress(Handoff* pHandoff, struct sockaddr_un* pAddress);
+static int  createSocket(void);
+static void closeSocket(int* pSocket);
+static void sendAll(int socket, const void* pBuffer, size_t length);
+static void receiveAll(int socket, void* pBuffer, size_t length);
+static void checkVersion(const HandoffRecord* pRecord);
+static void makeRoomForData(Handoff* pHandoff, size_t length);
+
+
+void Handoff_Init(Handoff* pHandoff, const char* pPath)
+{
+    memset(pHandoff, 0, sizeof(*pHandoff));
+    pHandoff->pPath = pPath;
+    pHandoff->listenSocket = -1;
+    pHandoff->connection = -1;
+}
+
+void Handoff_Uninit(Handoff* pHandoff)
+{
+    /* Remove the path before closing the connection so that a server waiting for it to close can bind in its place. */
+    if (pHandoff->listenSocket >= 0)
+        unlink(pHandoff->pPath);
+    closeSocket(&pHandoff->listenSocket);
+    closeSocket(&pHandoff->connection);
+    free(pHandoff->pData);
+    memset(pHandoff, 0, sizeof(*pHandoff));
+    pHandoff->listenSocket = -1;
+    pHandoff->connection = -1;
+}
+
+static void closeSocket(int* pSocket)
+{
+    if (*pSocket >= 0)
+        close(*pSocket);
+    *pSocket = -1;
+}
+
+int Handoff_IsEnabled(Handoff* pHandoff)
+{
+    return pHandoff->pPath != NULL;
+}
+
+int Handoff_Connect(Handoff* pHandoff)
+{
+    struct sockaddr_un address;
+    int                result = -1;
+
+    initAddress(pHandoff, &address);
+    pHandoff->connection = createSocket();
+    if (pHandoff->connection < 0)
+        __throw_and_return(socketException, 0);
+
+    result = connect(pHandoff->connection, (struct sockaddr*)&address, sizeof(address));
+    if (result < 0 && (errno == ENOENT || errno == ECONNREFUSED))
+    {
+        closeSocket(&pHandoff->connection);
+        return 0;
+    }
+    if (result < 0)
+        __throw_and_return(socketException, 0);
+    return 1;
+}
+
+static void initAddress(Handoff* pHandoff, struct sockaddr_un* pAddress)
+{
+    memset(pAddress, 0, sizeof(*pAddress));
+    pAddress->sun_family = AF_UNIX;
+    strncpy(pAddress->sun_path, pHandoff->pPath, sizeof(pAddress->sun_path) - 1);
+}
+
+static int createSocket(void)
+{
+    return socket(AF_UNIX, SOCK_STREAM, 0);
+}
+
+void Handoff_Listen(Handoff* pHandoff)
+{
+    struct sockaddr_un address;
+    int                result = -1;
+
+    initAddress(pHandoff, &address);
+    pHandoff->listenSocket = createSocket();
+    if (pHandoff->listenSocket < 0)
+        __throw(socketException);
+
+    /* Nothing answered on the path (Handoff_Connect() checked) so anything left there is stale. */
+    unlink(pHandoff->pPath);
+    result = bind(pHandoff->listenSocket, (struct sockaddr*)&address, sizeof(address));
+    if (result < 0)
+    {
+        closeSocket(&pHandoff->listenSocket);
+        __throw(socketException);
+    }
+    result = listen(pHandoff->listenSocket, 1);
+    if (result < 0)
+        __throw(socketException);
+}
+
+void Handoff_Accept(Handoff* pHandoff)
+{
+    pHandoff->connection = accept(pHandoff->listenSocket, NULL, NULL);
+    if (pHandoff->connection < 0)
+        __throw(socketException);
+}
+
+void Handoff_CloseConnection(Handoff* pHandoff)
+{
+    closeSocket(&pHandoff->connection);
+}
+
+void Handoff_InitRecord(HandoffRecord* pRecord, HandoffType type, uint32_t id)
+{
+    memset(pRecord, 0, sizeof(*pRecord));
+    pRecord->version = HANDOFF_VERSION;
+    pRecord->type = type;
+    pRecord->id = id;
+}
+
+void Handoff_Send(Handoff* pHandoff, const HandoffRecord* pRecord, const void* pData, int fileDescriptor)
+{
+    char            control[CMSG_SPACE(sizeof(int))];
+    struct iovec    vector;
+    struct msghdr   message;
+    struct cmsghdr* pControl = NULL;
+    ssize_t         result = -1;
+
+    vector.iov_base = (void*)pRecord;
+    vector.iov_len = sizeof(*pRecord);
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    if (fileDescriptor >= 0)
+    {
+        memset(control, 0, sizeof(control));
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        pControl = CMSG_FIRSTHDR(&message);
+        pControl->cmsg_level = SOL_SOCKET;
+        pControl->cmsg_type = SCM_RIGHTS;
+        pControl->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(pControl), &fileDescriptor, sizeof(int));
+    }
+
+    do
+        result = sendmsg(pHandoff->connection, &message, MSG_NOSIGNAL);
+    while (result < 0 && errno == EINTR);
+    if (result < 0)
+        __throw(socketException);
+
+    __try
+    {
+        __throwing_func( sendAll(pHandoff->connection, (const char*)pRecord + result, sizeof(*pRecord) - result) );
+        __throwing_func( sendAll(pHandoff->connection, pData, pRecord->dataLength) );
+    }
+    __catch
+    {
+        __rethrow;
+    }
+}
+
+static void sendAll(int socket, const void* pBuffer, size_t length)
+{
+    const char* pCurrent = (const char*)pBuffer;
+
+    while (length > 0)
+    {
+        ssize_t result = send(socket, pCurrent, length, MSG_NOSIGNAL);
+
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result < 0)
+            __throw(socketException);
+        pCurrent += result;
+        length -= result;
+    }
+}
+
+int Handoff_Receive(Handoff* pHandoff, HandoffRecord* pRecord, const char** ppData, int* pFileDescriptor)
+{
+    char            control[CMSG_SPACE(sizeof(int))];
+    struct iovec    vector;
+    struct msghdr   message;
+    struct cmsghdr* pControl = NULL;
+    ssize_t         result = -1;
+
+    *pFileDescriptor = -1;
+    vector.iov_base = pRecord;
+    vector.iov_len = sizeof(*pRecord);
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    do
+        result = recvmsg(pHandoff->connection, &message, 0);
+    while (result < 0 && errno == EINTR);
+    if (result == 0)
+        return 0;
+    if (result < 0)
+        __throw_and_return(socketException, 0);
+
+    pControl = CMSG_FIRSTHDR(&message);
+    if (pControl && pControl->cmsg_level == SOL_SOCKET && pControl->cmsg_type == SCM_RIGHTS)
+        memcpy(pFileDescriptor, CMSG_DATA(pControl), sizeof(int));
+
+    __try
+    {
+        __throwing_func( receiveAll(pHandoff->connection, (char*)pRecord + result, sizeof(*pRecord) - result) );
+        __throwing_func( checkVersion(pRecord) );
+        __throwing_func( makeRoomForData(pHandoff, pRecord->dataLength) );
+        __throwing_func( receiveAll(pHandoff->connection, pHandoff->pData, pRecord->dataLength) );
+    }
+    __catch
+    {
+        if (*pFileDescriptor >= 0)
+            close(*pFileDescriptor);
+        *pFileDescriptor = -1;
+        __rethrow_and_return(0);
+    }
+
+    *ppData = pHandoff->pData;
+    return 1;
+}
+
+static void receiveAll(int socket, void* pBuffer, size_t length)
+{
+    char* pCurrent = (char*)pBuffer;
+
+    while (length > 0)
+    {
+        ssize_t result = recv(socket, pCurrent, length, 0);
+
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result < 0)
+            __throw(socketException);
+        if (result == 0)
+            __throw(serverException);
+        pCurrent += result;
+        length -= result;
+    }
+}
+
+static void checkVersion(const HandoffRecord* pRecord)
+{
+    if (pRecord->version != HANDOFF_VERSION)
+        __throw(serverException);
+}
+
+static void makeRoomForData(Handoff* pHandoff, size_t length)
+{
+    char* pNewData = NULL;
+
+    if (length <= pHandoff->dataCapacity)
+        return;
+    pNewData = realloc(pHandoff->pData, length);
+    if (!pNewData)
+        __throw(outOfMemoryException);
+    pHandoff->pData = pNewData;
+    pHandoff->dataCapacity = length;
+}
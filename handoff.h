@@ -0,0 +1,90 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef _HANDOFF_H_
+#define _HANDOFF_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+/* Lets a newly started sharded remotesvr take over from the one already running without dropping sessions.  Both are
+   given the same --handoff path.  The running server listens on that Unix domain socket; the new one connects to it
+   at startup and the old one stops its shards and passes every shard's listening socket and every live session
+   socket across with SCM_RIGHTS, along with any partly received frame, before exiting.  The listening sockets never
+   close so connections arriving during the handoff simply wait in the accept queue.  Each record is a fixed
+   HandoffRecord, optionally carrying one file descriptor, followed by dataLength bytes of data.  Each session record
+   is followed by whatever else that session holds: a HANDOFF_QUEUED_OUTPUT record with what it had queued to send
+   but not yet sent, a HANDOFF_TRACE record with its --trace statistics, a HANDOFF_OUTPUT_INDEX record passing its
+   --index file along with the block table and then, as HANDOFF_PENDING_FRAME records, the frames it was holding
+   back while it waited for a missed deduplicated chunk.  Some state is left behind on purpose.  The deduplication
+   cache is shared by a server's sessions and isn't carried, so references to chunks sent before the handoff miss
+   and are filled again by the client, which keeps every chunk until it has been acknowledged.  File transfers in
+   progress are dropped and have to be started again.  Heartbeat and idle timers and the deficit round robin
+   credit start over. */
+#define HANDOFF_VERSION 3
+
+typedef enum
+{
+    HANDOFF_HELLO = 1,
+    HANDOFF_REFUSED,
+    HANDOFF_LISTENER,
+    HANDOFF_SESSION,
+    HANDOFF_RELAYED_SESSION,
+    HANDOFF_DONE,
+    HANDOFF_ACK,
+    HANDOFF_PENDING_FRAME,
+    HANDOFF_QUEUED_OUTPUT,
+    HANDOFF_TRACE,
+    HANDOFF_OUTPUT_INDEX
+} HandoffType;
+
+typedef struct
+{
+    struct sockaddr_in clientAddress;
+    uint64_t           bytesReceived;
+    uint64_t           firstLineTimestamp;
+    uint32_t           version;
+    uint32_t           type;
+    /* Shard count for HANDOFF_HELLO, shard index for HANDOFF_LISTENER and session id otherwise. */
+    uint32_t           id;
+    uint32_t           relayId;
+    uint32_t           dataLength;
+    uint32_t           weight;
+    uint32_t           lastAcknowledgedReference;
+    uint16_t           channel;
+    uint16_t           isLineContinued;
+} HandoffRecord;
+
+typedef struct
+{
+    const char* pPath;
+    char*       pData;
+    size_t      dataCapacity;
+    int         listenSocket;
+    int         connection;
+} Handoff;
+
+void Handoff_Init(Handoff* pHandoff, const char* pPath);
+void Handoff_Uninit(Handoff* pHandoff);
+int  Handoff_IsEnabled(Handoff* pHandoff);
+int  Handoff_Connect(Handoff* pHandoff);
+void Handoff_Listen(Handoff* pHandoff);
+void Handoff_Accept(Handoff* pHandoff);
+void Handoff_CloseConnection(Handoff* pHandoff);
+void Handoff_InitRecord(HandoffRecord* pRecord, HandoffType type, uint32_t id);
+void Handoff_Send(Handoff* pHandoff, const HandoffRecord* pRecord, const void* pData, int fileDescriptor);
+int  Handoff_Receive(Handoff* pHandoff, HandoffRecord* pRecord, const char** ppData, int* pFileDescriptor);
+
+#endif /* _HANDOFF_H_ */
@@ -0,0 +1,145 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <string.h>
+#include "lineframer.h"
+#include "linescan.h"
+#include "protocol.h"
+
+
+#define LINE_FRAMER_OFFSETS_PER_SCAN    1024
+
+
+static void completeLine(LineFramer* pFramer, const char* pLine, size_t length, uint64_t timestamp,
+                         LineBatch* pBatch);
+static void savePartialLine(LineFramer* pFramer, const char* pPartial, size_t length, uint64_t timestamp,
+                            LineBatch* pBatch);
+static void appendRecord(LineFramer* pFramer, const char* pLine, size_t length, uint32_t flags, uint64_t timestamp,
+                         LineBatch* pBatch);
+
+
+void LineFramer_Init(LineFramer* pFramer, const FilterRules* pRules)
+{
+    pFramer->pRules = pRules;
+    pFramer->lineCount = 0;
+    pFramer->pendingLength = 0;
+}
+
+void LineFramer_Process(LineFramer* pFramer, const char* pInput, size_t inputLength, uint64_t timestamp,
+                        LineBatch* pBatch)
+{
+    uint32_t offsets[LINE_FRAMER_OFFSETS_PER_SCAN];
+    size_t   lineStart = 0;
+
+    while (lineStart < inputLength)
+    {
+        size_t newlineCount = LineScan_FindAllNewlines(pInput + lineStart, inputLength - lineStart,
+                                                       offsets, LINE_FRAMER_OFFSETS_PER_SCAN);
+        size_t scanStart = lineStart;
+        size_t i;
+
+        for (i = 0 ; i < newlineCount ; i++)
+        {
+            size_t lineEnd = scanStart + offsets[i] + 1;
+
+            completeLine(pFramer, pInput + lineStart, lineEnd - lineStart, timestamp, pBatch);
+            lineStart = lineEnd;
+        }
+        if (newlineCount < LINE_FRAMER_OFFSETS_PER_SCAN)
+            break;
+    }
+
+    if (lineStart < inputLength)
+        savePartialLine(pFramer, pInput + lineStart, inputLength - lineStart, timestamp, pBatch);
+}
+
+void LineFramer_Flush(LineFramer* pFramer, uint64_t timestamp, LineBatch* pBatch)
+{
+    if (pFramer->pendingLength == 0)
+        return;
+    appendRecord(pFramer, pFramer->pendingLine, pFramer->pendingLength, 0, timestamp, pBatch);
+    pFramer->pendingLength = 0;
+}
+
+static void completeLine(LineFramer* pFramer, const char* pLine, size_t length, uint64_t timestamp,
+                         LineBatch* pBatch)
+{
+    if (pFramer->pendingLength == 0)
+    {
+        appendRecord(pFramer, pLine, length, 0, timestamp, pBatch);
+        return;
+    }
+
+    if (pFramer->pendingLength + length <= sizeof(pFramer->pendingLine))
+    {
+        memcpy(pFramer->pendingLine + pFramer->pendingLength, pLine, length);
+        appendRecord(pFramer, pFramer->pendingLine, pFramer->pendingLength + length, 0, timestamp, pBatch);
+    }
+    else
+    {
+        appendRecord(pFramer, pFramer->pendingLine, pFramer->pendingLength, LINE_RECORD_CONTINUED, timestamp, pBatch);
+        appendRecord(pFramer, pLine, length, 0, timestamp, pBatch);
+    }
+    pFramer->pendingLength = 0;
+}
+
+static void savePartialLine(LineFramer* pFramer, const char* pPartial, size_t length, uint64_t timestamp,
+                            LineBatch* pBatch)
+{
+    while (pFramer->pendingLength + length > sizeof(pFramer->pendingLine))
+    {
+        size_t room = sizeof(pFramer->pendingLine) - pFramer->pendingLength;
+
+        memcpy(pFramer->pendingLine + pFramer->pendingLength, pPartial, room);
+        appendRecord(pFramer, pFramer->pendingLine, sizeof(pFramer->pendingLine), LINE_RECORD_CONTINUED,
+                     timestamp, pBatch);
+        pFramer->pendingLength = 0;
+        pPartial += room;
+        length -= room;
+    }
+    memcpy(pFramer->pendingLine + pFramer->pendingLength, pPartial, length);
+    pFramer->pendingLength += length;
+}
+
+static void appendRecord(LineFramer* pFramer, const char* pLine, size_t length, uint32_t flags, uint64_t timestamp,
+                         LineBatch* pBatch)
+{
+    char* pRecord = pBatch->pBuffer + pBatch->length;
+
+    if (!(flags & LINE_RECORD_CONTINUED))
+        pFramer->lineCount++;
+    if (FilterRules_IsActive(pFramer->pRules) && !FilterRules_Matches(pFramer->pRules, pLine, length))
+        return;
+    if (pBatch->length + LINE_RECORD_HEADER_SIZE + length > pBatch->capacity)
+        return;
+
+    Protocol_PutUint64(pRecord, timestamp);
+    Protocol_PutUint32(pRecord + 8, (uint32_t)length | flags);
+    memcpy(pRecord + LINE_RECORD_HEADER_SIZE, pLine, length);
+    pBatch->length += LINE_RECORD_HEADER_SIZE + length;
+    pBatch->recordCount++;
+}
+
+void LineBatch_Init(LineBatch* pBatch, char* pBuffer, size_t capacity)
+{
+    pBatch->pBuffer = pBuffer;
+    pBatch->capacity = capacity;
+    LineBatch_Clear(pBatch);
+}
+
+void LineBatch_Clear(LineBatch* pBatch)
+{
+    pBatch->length = 0;
+    pBatch->recordCount = 0;
+}
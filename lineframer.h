@@ -0,0 +1,59 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef _LINEFRAMER_H_
+#define _LINEFRAMER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "filter.h"
+
+/* In line mode the client splits child output into lines and sends them in FRAME_LINES batches.  Each record in a
+   batch is a 12-byte header (monotonic timestamp in nanoseconds of when the line was read from the child and the
+   line length) followed by the line itself, including its '\n'.  A line longer than LINE_FRAMER_MAX_LINE_LENGTH is
+   sent as several records, all but the last having LINE_RECORD_CONTINUED set in their length field. */
+#define LINE_FRAMER_MAX_LINE_LENGTH     (16 * 1024)
+#define LINE_RECORD_HEADER_SIZE         12
+#define LINE_RECORD_CONTINUED           0x80000000U
+#define LINE_RECORD_LENGTH_MASK         0x7FFFFFFFU
+
+/* Worst case batch size produced by one call to LineFramer_Process() for inputLength bytes of input. */
+#define LINE_FRAMER_BATCH_SIZE(inputLength) \
+    ((inputLength) * (LINE_RECORD_HEADER_SIZE + 1) + LINE_FRAMER_MAX_LINE_LENGTH + LINE_RECORD_HEADER_SIZE)
+
+typedef struct
+{
+    char*    pBuffer;
+    size_t   length;
+    size_t   capacity;
+    uint32_t recordCount;
+} LineBatch;
+
+typedef struct
+{
+    const FilterRules* pRules;
+    uint64_t           lineCount;
+    size_t             pendingLength;
+    char               pendingLine[LINE_FRAMER_MAX_LINE_LENGTH];
+} LineFramer;
+
+void LineFramer_Init(LineFramer* pFramer, const FilterRules* pRules);
+void LineFramer_Process(LineFramer* pFramer, const char* pInput, size_t inputLength, uint64_t timestamp,
+                        LineBatch* pBatch);
+void LineFramer_Flush(LineFramer* pFramer, uint64_t timestamp, LineBatch* pBatch);
+
+void LineBatch_Init(LineBatch* pBatch, char* pBuffer, size_t capacity);
+void LineBatch_Clear(LineBatch* pBatch);
+
+#endif /* _LINEFRAMER_H_ */
@@ -0,0 +1,90 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdint.h>
+#include <string.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "linescan.h"
+
+
+const char* LineScan_FindNewline(const char* pStart, const char* pEnd)
+{
+    const char* pCurrent = pStart;
+
+#if defined(__AVX2__)
+    const __m256i newlines = _mm256_set1_epi8('\n');
+
+    while (pEnd - pCurrent >= 32)
+    {
+        __m256i  block = _mm256_loadu_si256((const __m256i*)pCurrent);
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newlines));
+
+        if (mask)
+            return pCurrent + __builtin_ctz(mask);
+        pCurrent += 32;
+    }
+#endif
+#if defined(__SSE2__)
+    {
+        const __m128i newlines = _mm_set1_epi8('\n');
+
+        while (pEnd - pCurrent >= 16)
+        {
+            __m128i  block = _mm_loadu_si128((const __m128i*)pCurrent);
+            uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(block, newlines));
+
+            if (mask)
+                return pCurrent + __builtin_ctz(mask);
+            pCurrent += 16;
+        }
+    }
+#endif
+
+    return memchr(pCurrent, '\n', pEnd - pCurrent);
+}
+
+size_t LineScan_FindAllNewlines(const char* pStart, size_t length, uint32_t* pOffsets, size_t maxOffsets)
+{
+    size_t offset = 0;
+    size_t count = 0;
+
+#if defined(__SSE2__)
+    const __m128i newlines = _mm_set1_epi8('\n');
+
+    while (length - offset >= 16 && count < maxOffsets)
+    {
+        __m128i  block = _mm_loadu_si128((const __m128i*)(pStart + offset));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(block, newlines));
+
+        while (mask && count < maxOffsets)
+        {
+            pOffsets[count++] = (uint32_t)(offset + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+        if (mask)
+            return count;
+        offset += 16;
+    }
+#endif
+    while (offset < length && count < maxOffsets)
+    {
+        if (pStart[offset] == '\n')
+            pOffsets[count++] = (uint32_t)offset;
+        offset++;
+    }
+
+    return count;
+}
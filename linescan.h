@@ -0,0 +1,30 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef _LINESCAN_H_
+#define _LINESCAN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Returns a pointer to the first '\n' in [pStart, pEnd) or NULL if there is none.  Scans 16 (SSE2) or 32 (AVX2)
+   bytes per step when the compiler targets those instruction sets. */
+const char* LineScan_FindNewline(const char* pStart, const char* pEnd);
+
+/* Records the offset of every '\n' in [pStart, pStart + length) into pOffsets, stopping once maxOffsets have been
+   found.  Returns the number of offsets recorded.  This is cheaper than calling LineScan_FindNewline() repeatedly
+   when lines are short since each vector compare is used to find every newline within it. */
+size_t LineScan_FindAllNewlines(const char* pStart, size_t length, uint32_t* pOffsets, size_t maxOffsets);
+
+#endif /* _LINESCAN_H_ */
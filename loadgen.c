@@ -0,0 +1,741 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "try_catch.h"
+#include "protocol.h"
+#include "timestamp.h"
+#include "loadgen.h"
+
+
+#define LOAD_TICK_MILLISECONDS      10
+#define LOAD_MAX_EVENTS             256
+#define LOAD_FRAME_PAYLOAD_SIZE     4096
+#define LOAD_FRAME_SIZE             (PROTOCOL_HEADER_SIZE + LOAD_FRAME_PAYLOAD_SIZE)
+#define LOAD_BURST_DIVISOR          10
+#define LOAD_SPARE_FILE_DESCRIPTORS 16
+
+typedef enum
+{
+    LOAD_SESSION_CLOSED = 0,
+    LOAD_SESSION_CONNECTING,
+    LOAD_SESSION_AWAITING_PONG,
+    LOAD_SESSION_ACTIVE
+} LoadSessionState;
+
+
+static char g_dataFrame[LOAD_FRAME_SIZE];
+static char g_pingFrame[PROTOCOL_HEADER_SIZE];
+
+
+static void flagStructureAsUninitialized(LoadGenerator* pGenerator);
+static void raiseFileDescriptorLimit(int sessionCount);
+static void allocateSessions(LoadGenerator* pGenerator);
+static void createEpoll(LoadGenerator* pGenerator);
+static void buildFrames(void);
+static void initLatencySamples(LatencySamples* pSamples);
+static void freeLatencySamples(LatencySamples* pSamples);
+static void addLatencySample(LatencySamples* pSamples, uint64_t latency);
+static uint64_t latencyPercentile(LatencySamples* pSamples, int percentile);
+static int  compareLatencies(const void* pv1, const void* pv2);
+static void openSession(LoadGenerator* pGenerator, int index);
+static void closeSession(LoadGenerator* pGenerator, int index);
+static void failSession(LoadGenerator* pGenerator, int index);
+static void watchSession(LoadGenerator* pGenerator, int index, uint32_t events, int operation);
+static void processEvents(LoadGenerator* pGenerator, int timeoutMilliseconds);
+static void processSessionEvent(LoadGenerator* pGenerator, int index, uint32_t events);
+static void completeConnect(LoadGenerator* pGenerator, int index);
+static void receiveFromServer(LoadGenerator* pGenerator, int index);
+static void processReceivedBytes(LoadGenerator* pGenerator, int index, const char* pBuffer, size_t length);
+static void processReceivedHeader(LoadGenerator* pGenerator, int index);
+static void tick(LoadGenerator* pGenerator, uint64_t now);
+static void refillSendBudgets(LoadGenerator* pGenerator, uint64_t elapsed);
+static void sendOutput(LoadGenerator* pGenerator, int index);
+static void churnSessions(LoadGenerator* pGenerator, uint64_t elapsed);
+static void reopenClosedSessions(LoadGenerator* pGenerator);
+static void displayReportHeader(void);
+static void displayReport(LoadGenerator* pGenerator, uint64_t now);
+static void displaySummary(LoadGenerator* pGenerator, uint64_t now);
+static int  countSessionsInState(LoadGenerator* pGenerator, LoadSessionState state);
+static double computeFairness(LoadGenerator* pGenerator, uint64_t* pMinimum, uint64_t* pMaximum);
+static void sampleServerUsage(int serverPid, ServerUsage* pUsage);
+static double millisecondsFromNanoseconds(uint64_t nanoseconds);
+
+
+void LoadGenerator_Init(LoadGenerator* pGenerator, const LoadOptions* pOptions)
+{
+    memset(pGenerator, 0, sizeof(*pGenerator));
+    pGenerator->options = *pOptions;
+    pGenerator->epollFileDescriptor = -1;
+    initLatencySamples(&pGenerator->intervalLatencies);
+    initLatencySamples(&pGenerator->totalLatencies);
+    buildFrames();
+
+    __try
+    {
+        __throwing_func( raiseFileDescriptorLimit(pOptions->sessionCount) );
+        __throwing_func( allocateSessions(pGenerator) );
+        __throwing_func( createEpoll(pGenerator) );
+    }
+    __catch
+    {
+        __rethrow;
+    }
+}
+
+static void flagStructureAsUninitialized(LoadGenerator* pGenerator)
+{
+    memset(pGenerator, 0xff, sizeof(*pGenerator));
+}
+
+static void raiseFileDescriptorLimit(int sessionCount)
+{
+    struct rlimit limit;
+    rlim_t        needed = (rlim_t)sessionCount + LOAD_SPARE_FILE_DESCRIPTORS;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0)
+        __throw(socketException);
+    if (limit.rlim_cur >= needed)
+        return;
+    if (limit.rlim_max < needed)
+    {
+        errno = EMFILE;
+        __throw(socketException);
+    }
+    limit.rlim_cur = needed;
+    if (setrlimit(RLIMIT_NOFILE, &limit) < 0)
+        __throw(socketException);
+}
+
+static void allocateSessions(LoadGenerator* pGenerator)
+{
+    int i;
+
+    pGenerator->pSessions = calloc(pGenerator->options.sessionCount, sizeof(*pGenerator->pSessions));
+    if (!pGenerator->pSessions)
+        __throw(outOfMemoryException);
+
+    for (i = 0 ; i < pGenerator->options.sessionCount ; i++)
+    {
+        pGenerator->pSessions[i].socket = -1;
+        pGenerator->pSessions[i].state = LOAD_SESSION_CLOSED;
+        pGenerator->pSessions[i].isIdle = (i % 100) < pGenerator->options.idlePercent;
+    }
+}
+
+static void createEpoll(LoadGenerator* pGenerator)
+{
+    pGenerator->epollFileDescriptor = epoll_create1(EPOLL_CLOEXEC);
+    if (pGenerator->epollFileDescriptor < 0)
+        __throw(socketException);
+}
+
+static void buildFrames(void)
+{
+    static const char line[] = "remoteload synthetic output line 0123456789 abcdefghijklmnopqrstuvwxyz\n";
+    FrameHeader       header;
+    size_t            i;
+
+    header.length = LOAD_FRAME_PAYLOAD_SIZE;
+    header.type = FRAME_DATA;
+    header.flags = STREAM_STDOUT;
+    header.channel = 0;
+    Protocol_EncodeHeader(g_dataFrame, &header);
+    for (i = 0 ; i < LOAD_FRAME_PAYLOAD_SIZE ; i++)
+        g_dataFrame[PROTOCOL_HEADER_SIZE + i] = line[i % (sizeof(line) - 1)];
+    g_dataFrame[LOAD_FRAME_SIZE - 1] = '\n';
+
+    header.length = 0;
+    header.type = FRAME_CONTROL;
+    header.flags = CONTROL_PING;
+    Protocol_EncodeHeader(g_pingFrame, &header);
+}
+
+static void initLatencySamples(LatencySamples* pSamples)
+{
+    memset(pSamples, 0, sizeof(*pSamples));
+}
+
+static void freeLatencySamples(LatencySamples* pSamples)
+{
+    free(pSamples->pSamples);
+    memset(pSamples, 0, sizeof(*pSamples));
+}
+
+static void addLatencySample(LatencySamples* pSamples, uint64_t latency)
+{
+    if (pSamples->count == pSamples->capacity)
+    {
+        size_t    newCapacity = pSamples->capacity ? pSamples->capacity * 2 : 1024;
+        uint64_t* pNew = realloc(pSamples->pSamples, newCapacity * sizeof(*pNew));
+
+        /* Dropping a sample under memory pressure only makes the percentiles a little less precise. */
+        if (!pNew)
+            return;
+        pSamples->pSamples = pNew;
+        pSamples->capacity = newCapacity;
+    }
+    pSamples->pSamples[pSamples->count++] = latency;
+}
+
+static uint64_t latencyPercentile(LatencySamples* pSamples, int percentile)
+{
+    size_t index;
+
+    if (pSamples->count == 0)
+        return 0;
+    qsort(pSamples->pSamples, pSamples->count, sizeof(*pSamples->pSamples), compareLatencies);
+    index = (pSamples->count - 1) * percentile / 100;
+    return pSamples->pSamples[index];
+}
+
+static int compareLatencies(const void* pv1, const void* pv2)
+{
+    uint64_t latency1 = *(const uint64_t*)pv1;
+    uint64_t latency2 = *(const uint64_t*)pv2;
+
+    return (latency1 > latency2) - (latency1 < latency2);
+}
+
+void LoadGenerator_Uninit(LoadGenerator* pGenerator)
+{
+    int i;
+
+    if (pGenerator->pSessions)
+    {
+        for (i = 0 ; i < pGenerator->options.sessionCount ; i++)
+        {
+            if (pGenerator->pSessions[i].socket >= 0)
+                close(pGenerator->pSessions[i].socket);
+        }
+    }
+    free(pGenerator->pSessions);
+    freeLatencySamples(&pGenerator->intervalLatencies);
+    freeLatencySamples(&pGenerator->totalLatencies);
+    if (pGenerator->epollFileDescriptor >= 0)
+        close(pGenerator->epollFileDescriptor);
+    flagStructureAsUninitialized(pGenerator);
+}
+
+void LoadGenerator_Stop(LoadGenerator* pGenerator)
+{
+    pGenerator->exitRunLoop = 1;
+}
+
+void LoadGenerator_Run(LoadGenerator* pGenerator)
+{
+    uint64_t endTime;
+    int      i;
+
+    pGenerator->startTime = Timestamp_Now();
+    pGenerator->lastTickTime = pGenerator->startTime;
+    pGenerator->lastReportTime = pGenerator->startTime;
+    endTime = pGenerator->startTime + pGenerator->options.durationSeconds * TIMESTAMP_NANOSECONDS_PER_SECOND;
+    sampleServerUsage(pGenerator->options.serverPid, &pGenerator->lastServerUsage);
+
+    for (i = 0 ; i < pGenerator->options.sessionCount ; i++)
+        openSession(pGenerator, i);
+
+    displayReportHeader();
+    while (!pGenerator->exitRunLoop)
+    {
+        uint64_t now;
+
+        __try
+            processEvents(pGenerator, LOAD_TICK_MILLISECONDS);
+        __catch
+            __rethrow;
+
+        now = Timestamp_Now();
+        tick(pGenerator, now);
+        if (now - pGenerator->lastReportTime >=
+            pGenerator->options.reportIntervalSeconds * TIMESTAMP_NANOSECONDS_PER_SECOND)
+        {
+            displayReport(pGenerator, now);
+        }
+        if (now >= endTime)
+            break;
+    }
+    displaySummary(pGenerator, Timestamp_Now());
+}
+
+static void openSession(LoadGenerator* pGenerator, int index)
+{
+    LoadSession* pSession = &pGenerator->pSessions[index];
+    int          result = -1;
+
+    pSession->connectStartTime = Timestamp_Now();
+    pSession->intervalBytesSent = 0;
+    pSession->sendBudget = 0;
+    pSession->frameOffset = 0;
+    pSession->receiveHeaderLength = 0;
+    pSession->receivePayloadRemaining = 0;
+    pSession->isWaitingForWritable = 0;
+
+    pSession->socket = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (pSession->socket < 0)
+    {
+        failSession(pGenerator, index);
+        return;
+    }
+    result = connect(pSession->socket,
+                     (const struct sockaddr*)&pGenerator->options.serverAddress,
+                     sizeof(pGenerator->options.serverAddress));
+    if (result < 0 && errno != EINPROGRESS)
+    {
+        failSession(pGenerator, index);
+        return;
+    }
+
+    pSession->state = LOAD_SESSION_CONNECTING;
+    watchSession(pGenerator, index, EPOLLOUT, EPOLL_CTL_ADD);
+}
+
+static void closeSession(LoadGenerator* pGenerator, int index)
+{
+    LoadSession* pSession = &pGenerator->pSessions[index];
+
+    if (pSession->socket >= 0)
+        close(pSession->socket);
+    pSession->socket = -1;
+    pSession->state = LOAD_SESSION_CLOSED;
+}
+
+static void failSession(LoadGenerator* pGenerator, int index)
+{
+    pGenerator->intervalFailures++;
+    pGenerator->totalFailures++;
+    closeSession(pGenerator, index);
+}
+
+static void watchSession(LoadGenerator* pGenerator, int index, uint32_t events, int operation)
+{
+    struct epoll_event event;
+
+    event.events = events;
+    event.data.u32 = (uint32_t)index;
+    if (epoll_ctl(pGenerator->epollFileDescriptor, operation, pGenerator->pSessions[index].socket, &event) < 0)
+        failSession(pGenerator, index);
+}
+
+static void processEvents(LoadGenerator* pGenerator, int timeoutMilliseconds)
+{
+    struct epoll_event events[LOAD_MAX_EVENTS];
+    int                eventCount = -1;
+    int                i;
+
+    eventCount = epoll_wait(pGenerator->epollFileDescriptor, events, LOAD_MAX_EVENTS, timeoutMilliseconds);
+    if (eventCount < 0 && errno == EINTR)
+        return;
+    if (eventCount < 0)
+        __throw(selectException);
+
+    for (i = 0 ; i < eventCount ; i++)
+        processSessionEvent(pGenerator, (int)events[i].data.u32, events[i].events);
+}
+
+static void processSessionEvent(LoadGenerator* pGenerator, int index, uint32_t events)
+{
+    LoadSession* pSession = &pGenerator->pSessions[index];
+
+    if (pSession->state == LOAD_SESSION_CONNECTING)
+    {
+        completeConnect(pGenerator, index);
+        return;
+    }
+    if (events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+        receiveFromServer(pGenerator, index);
+    if (pSession->state == LOAD_SESSION_ACTIVE && (events & EPOLLOUT))
+    {
+        pSession->isWaitingForWritable = 0;
+        watchSession(pGenerator, index, EPOLLIN, EPOLL_CTL_MOD);
+        sendOutput(pGenerator, index);
+    }
+}
+
+static void completeConnect(LoadGenerator* pGenerator, int index)
+{
+    LoadSession* pSession = &pGenerator->pSessions[index];
+    int          error = 0;
+    socklen_t    errorLength = sizeof(error);
+
+    if (getsockopt(pSession->socket, SOL_SOCKET, SO_ERROR, &error, &errorLength) < 0 || error != 0)
+    {
+        failSession(pGenerator, index);
+        return;
+    }
+    Protocol_ConfigureSocket(pSession->socket);
+
+    /* The ping fits in an empty socket buffer so a short send here means the connection is already broken. */
+    if (send(pSession->socket, g_pingFrame, sizeof(g_pingFrame), MSG_NOSIGNAL) != sizeof(g_pingFrame))
+    {
+        failSession(pGenerator, index);
+        return;
+    }
+    pSession->state = LOAD_SESSION_AWAITING_PONG;
+    watchSession(pGenerator, index, EPOLLIN, EPOLL_CTL_MOD);
+}
+
+static void receiveFromServer(LoadGenerator* pGenerator, int index)
+{
+    char    buffer[4096];
+    ssize_t bytesRead = -1;
+
+    bytesRead = recv(pGenerator->pSessions[index].socket, buffer, sizeof(buffer), 0);
+    if (bytesRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return;
+    if (bytesRead <= 0)
+    {
+        pGenerator->intervalDisconnects++;
+        pGenerator->totalDisconnects++;
+        closeSession(pGenerator, index);
+        return;
+    }
+    processReceivedBytes(pGenerator, index, buffer, bytesRead);
+}
+
+static void processReceivedBytes(LoadGenerator* pGenerator, int index, const char* pBuffer, size_t length)
+{
+    LoadSession* pSession = &pGenerator->pSessions[index];
+
+    /* Only frame headers matter here; any payload the server sends is skipped. */
+    while (length > 0)
+    {
+        if (pSession->receivePayloadRemaining > 0)
+        {
+            size_t skip = length < pSession->receivePayloadRemaining ? length : pSession->receivePayloadRemaining;
+
+            pSession->receivePayloadRemaining -= skip;
+            pBuffer += skip;
+            length -= skip;
+            continue;
+        }
+
+        pSession->receiveHeader[pSession->receiveHeaderLength++] = *pBuffer++;
+        length--;
+        if (pSession->receiveHeaderLength == sizeof(pSession->receiveHeader))
+        {
+            processReceivedHeader(pGenerator, index);
+            pSession->receiveHeaderLength = 0;
+        }
+    }
+}
+
+static void processReceivedHeader(LoadGenerator* pGenerator, int index)
+{
+    LoadSession* pSession = &pGenerator->pSessions[index];
+    FrameHeader  header;
+    uint64_t     latency;
+
+    Protocol_DecodeHeader(&header, pSession->receiveHeader);
+    pSession->receivePayloadRemaining = header.length;
+    if (header.type != FRAME_CONTROL || header.flags != CONTROL_PONG ||
+        pSession->state != LOAD_SESSION_AWAITING_PONG)
+    {
+        return;
+    }
+
+    latency = Timestamp_Now() - pSession->connectStartTime;
+    addLatencySample(&pGenerator->intervalLatencies, latency);
+    addLatencySample(&pGenerator->totalLatencies, latency);
+    pGenerator->intervalConnects++;
+    pGenerator->totalConnects++;
+    pSession->state = LOAD_SESSION_ACTIVE;
+}
+
+static void tick(LoadGenerator* pGenerator, uint64_t now)
+{
+    uint64_t elapsed = now - pGenerator->lastTickTime;
+    int      i;
+
+    pGenerator->lastTickTime = now;
+    refillSendBudgets(pGenerator, elapsed);
+    for (i = 0 ; i < pGenerator->options.sessionCount ; i++)
+    {
+        LoadSession* pSession = &pGenerator->pSessions[i];
+
+        if (pSession->state == LOAD_SESSION_ACTIVE && !pSession->isIdle && !pSession->isWaitingForWritable)
+            sendOutput(pGenerator, i);
+    }
+    churnSessions(pGenerator, elapsed);
+    reopenClosedSessions(pGenerator);
+}
+
+static void refillSendBudgets(LoadGenerator* pGenerator, uint64_t elapsed)
+{
+    uint64_t bytesPerSecond = pGenerator->options.bytesPerSecond;
+    int64_t  refill;
+    int64_t  burstLimit;
+    int      i;
+
+    if (bytesPerSecond == 0)
+        return;
+
+    refill = (int64_t)(bytesPerSecond * elapsed / TIMESTAMP_NANOSECONDS_PER_SECOND);
+    burstLimit = (int64_t)(bytesPerSecond / LOAD_BURST_DIVISOR) + LOAD_FRAME_SIZE;
+    for (i = 0 ; i < pGenerator->options.sessionCount ; i++)
+    {
+        LoadSession* pSession = &pGenerator->pSessions[i];
+
+        pSession->sendBudget += refill;
+        if (pSession->sendBudget > burstLimit)
+            pSession->sendBudget = burstLimit;
+    }
+}
+
+static void sendOutput(LoadGenerator* pGenerator, int index)
+{
+    LoadSession* pSession = &pGenerator->pSessions[index];
+    int          isRateLimited = pGenerator->options.bytesPerSecond != 0;
+
+    while (!isRateLimited || pSession->sendBudget > 0)
+    {
+        size_t  length = LOAD_FRAME_SIZE - pSession->frameOffset;
+        ssize_t bytesSent = -1;
+
+        if (isRateLimited && (int64_t)length > pSession->sendBudget)
+            length = (size_t)pSession->sendBudget;
+        bytesSent = send(pSession->socket, g_dataFrame + pSession->frameOffset, length, MSG_NOSIGNAL);
+        if (bytesSent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            pSession->isWaitingForWritable = 1;
+            watchSession(pGenerator, index, EPOLLIN | EPOLLOUT, EPOLL_CTL_MOD);
+            return;
+        }
+        if (bytesSent < 0)
+        {
+            pGenerator->intervalDisconnects++;
+            pGenerator->totalDisconnects++;
+            closeSession(pGenerator, index);
+            return;
+        }
+
+        pSession->frameOffset = (pSession->frameOffset + bytesSent) % LOAD_FRAME_SIZE;
+        pSession->sendBudget -= bytesSent;
+        pSession->bytesSent += bytesSent;
+        pSession->intervalBytesSent += bytesSent;
+        pGenerator->totalBytesSent += bytesSent;
+    }
+}
+
+static void churnSessions(LoadGenerator* pGenerator, uint64_t elapsed)
+{
+    int sessionCount = pGenerator->options.sessionCount;
+
+    pGenerator->churnCredit += pGenerator->options.churnPerSecond * elapsed;
+    while (pGenerator->churnCredit >= TIMESTAMP_NANOSECONDS_PER_SECOND)
+    {
+        int index = pGenerator->nextChurnIndex;
+
+        pGenerator->churnCredit -= TIMESTAMP_NANOSECONDS_PER_SECOND;
+        pGenerator->nextChurnIndex = (index + 1) % sessionCount;
+        if (pGenerator->pSessions[index].state == LOAD_SESSION_ACTIVE)
+            closeSession(pGenerator, index);
+    }
+}
+
+static void reopenClosedSessions(LoadGenerator* pGenerator)
+{
+    int i;
+
+    for (i = 0 ; i < pGenerator->options.sessionCount ; i++)
+    {
+        if (pGenerator->pSessions[i].state == LOAD_SESSION_CLOSED)
+            openSession(pGenerator, i);
+    }
+}
+
+static void displayReportHeader(void)
+{
+    printf("%7s %7s %7s %6s %6s %9s %9s %9s %9s %8s %10s %10s %7s %9s\n",
+           "time", "active", "connect", "fail", "drop", "acc p50", "acc p99", "acc max",
+           "MB/s", "fairness", "min KB/s", "max KB/s", "svr cpu", "svr rss");
+    printf("%7s %7s %7s %6s %6s %9s %9s %9s %9s %8s %10s %10s %7s %9s\n",
+           "(s)", "", "", "", "", "(ms)", "(ms)", "(ms)", "", "", "", "", "(%)", "(MB)");
+}
+
+static void displayReport(LoadGenerator* pGenerator, uint64_t now)
+{
+    double      interval = (double)(now - pGenerator->lastReportTime) / TIMESTAMP_NANOSECONDS_PER_SECOND;
+    uint64_t    intervalBytes = 0;
+    uint64_t    minimum = 0;
+    uint64_t    maximum = 0;
+    double      fairness = computeFairness(pGenerator, &minimum, &maximum);
+    uint64_t    median = latencyPercentile(&pGenerator->intervalLatencies, 50);
+    uint64_t    percentile99 = latencyPercentile(&pGenerator->intervalLatencies, 99);
+    uint64_t    latencyMaximum = latencyPercentile(&pGenerator->intervalLatencies, 100);
+    ServerUsage usage;
+    int         i;
+
+    for (i = 0 ; i < pGenerator->options.sessionCount ; i++)
+        intervalBytes += pGenerator->pSessions[i].intervalBytesSent;
+    sampleServerUsage(pGenerator->options.serverPid, &usage);
+
+    printf("%7.1f %7d %7llu %6llu %6llu %9.2f %9.2f %9.2f %9.2f %8.3f %10.1f %10.1f ",
+           (double)(now - pGenerator->startTime) / TIMESTAMP_NANOSECONDS_PER_SECOND,
+           countSessionsInState(pGenerator, LOAD_SESSION_ACTIVE),
+           (unsigned long long)pGenerator->intervalConnects,
+           (unsigned long long)pGenerator->intervalFailures,
+           (unsigned long long)pGenerator->intervalDisconnects,
+           millisecondsFromNanoseconds(median),
+           millisecondsFromNanoseconds(percentile99),
+           millisecondsFromNanoseconds(latencyMaximum),
+           intervalBytes / interval / (1024.0 * 1024.0),
+           fairness,
+           minimum / interval / 1024.0,
+           maximum / interval / 1024.0);
+    if (usage.isValid && pGenerator->lastServerUsage.isValid)
+    {
+        printf("%7.1f %9.1f\n",
+               (double)(usage.cpuTicks - pGenerator->lastServerUsage.cpuTicks) / sysconf(_SC_CLK_TCK) / interval * 100.0,
+               usage.residentBytes / (1024.0 * 1024.0));
+    }
+    else
+    {
+        printf("%7s %9s\n", "-", "-");
+    }
+    fflush(stdout);
+
+    for (i = 0 ; i < pGenerator->options.sessionCount ; i++)
+        pGenerator->pSessions[i].intervalBytesSent = 0;
+    pGenerator->intervalLatencies.count = 0;
+    pGenerator->intervalConnects = 0;
+    pGenerator->intervalFailures = 0;
+    pGenerator->intervalDisconnects = 0;
+    pGenerator->lastServerUsage = usage;
+    pGenerator->lastReportTime = now;
+}
+
+static void displaySummary(LoadGenerator* pGenerator, uint64_t now)
+{
+    double   elapsed = (double)(now - pGenerator->startTime) / TIMESTAMP_NANOSECONDS_PER_SECOND;
+    uint64_t median = latencyPercentile(&pGenerator->totalLatencies, 50);
+    uint64_t percentile99 = latencyPercentile(&pGenerator->totalLatencies, 99);
+    uint64_t maximum = latencyPercentile(&pGenerator->totalLatencies, 100);
+    uint64_t percentile999 = 0;
+
+    if (pGenerator->totalLatencies.count > 0)
+        percentile999 = pGenerator->totalLatencies.pSamples[(pGenerator->totalLatencies.count - 1) * 999 / 1000];
+
+    printf("\nSummary after %.1f seconds:\n", elapsed);
+    printf("  connects %llu, connect failures %llu, dropped sessions %llu\n",
+           (unsigned long long)pGenerator->totalConnects,
+           (unsigned long long)pGenerator->totalFailures,
+           (unsigned long long)pGenerator->totalDisconnects);
+    printf("  accept latency p50 %.2f ms, p99 %.2f ms, p99.9 %.2f ms, max %.2f ms\n",
+           millisecondsFromNanoseconds(median),
+           millisecondsFromNanoseconds(percentile99),
+           millisecondsFromNanoseconds(percentile999),
+           millisecondsFromNanoseconds(maximum));
+    printf("  sent %.1f MB, %.2f MB/s\n",
+           pGenerator->totalBytesSent / (1024.0 * 1024.0),
+           pGenerator->totalBytesSent / elapsed / (1024.0 * 1024.0));
+}
+
+static int countSessionsInState(LoadGenerator* pGenerator, LoadSessionState state)
+{
+    int count = 0;
+    int i;
+
+    for (i = 0 ; i < pGenerator->options.sessionCount ; i++)
+        count += pGenerator->pSessions[i].state == (int)state;
+    return count;
+}
+
+static double computeFairness(LoadGenerator* pGenerator, uint64_t* pMinimum, uint64_t* pMaximum)
+{
+    double sum = 0.0;
+    double sumOfSquares = 0.0;
+    int    count = 0;
+    int    i;
+
+    /* Jain's fairness index over the sessions which are meant to be sending: 1.0 when every session got the same
+       throughput, falling towards 1/n as a single session takes it all. */
+    *pMinimum = UINT64_MAX;
+    *pMaximum = 0;
+    for (i = 0 ; i < pGenerator->options.sessionCount ; i++)
+    {
+        LoadSession* pSession = &pGenerator->pSessions[i];
+        double       bytes = (double)pSession->intervalBytesSent;
+
+        if (pSession->isIdle || pSession->state != LOAD_SESSION_ACTIVE)
+            continue;
+        sum += bytes;
+        sumOfSquares += bytes * bytes;
+        if (pSession->intervalBytesSent < *pMinimum)
+            *pMinimum = pSession->intervalBytesSent;
+        if (pSession->intervalBytesSent > *pMaximum)
+            *pMaximum = pSession->intervalBytesSent;
+        count++;
+    }
+    if (count == 0)
+        *pMinimum = 0;
+    if (count == 0 || sumOfSquares == 0.0)
+        return 1.0;
+    return (sum * sum) / (count * sumOfSquares);
+}
+
+static void sampleServerUsage(int serverPid, ServerUsage* pUsage)
+{
+    char               path[64];
+    char               buffer[1024];
+    FILE*              pFile = NULL;
+    const char*        pFields = NULL;
+    unsigned long      userTicks = 0;
+    unsigned long      systemTicks = 0;
+    long               residentPages = 0;
+
+    pUsage->isValid = 0;
+    if (serverPid <= 0)
+        return;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", serverPid);
+    pFile = fopen(path, "r");
+    if (!pFile)
+        return;
+    if (!fgets(buffer, sizeof(buffer), pFile))
+    {
+        fclose(pFile);
+        return;
+    }
+    fclose(pFile);
+
+    /* The command name is in parentheses and may contain spaces so parsing starts after its closing one. */
+    pFields = strrchr(buffer, ')');
+    if (!pFields)
+        return;
+    if (sscanf(pFields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %*d %*d %*d %*d %*d %*d %*u %*u %ld",
+               &userTicks, &systemTicks, &residentPages) != 3)
+    {
+        return;
+    }
+
+    pUsage->cpuTicks = (uint64_t)userTicks + systemTicks;
+    pUsage->residentBytes = (uint64_t)residentPages * sysconf(_SC_PAGESIZE);
+    pUsage->isValid = 1;
+}
+
+static double millisecondsFromNanoseconds(uint64_t nanoseconds)
+{
+    return (double)nanoseconds / 1000000.0;
+}
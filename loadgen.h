@@ -0,0 +1,96 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef _LOADGEN_H_
+#define _LOADGEN_H_
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+/* Drives many synthetic remote sessions against a sharded remotesvr from a single epoll loop.  Each session sends
+   FRAME_DATA output at a fixed rate (or as fast as the server will take it), some fraction stay connected but idle
+   and a number are closed and reopened every second.  Accept latency is measured from connect() until the server
+   answers a CONTROL_PING sent as the session's first frame, so it covers the server's accept and session setup and
+   not just the kernel's handshake. */
+typedef struct
+{
+    struct sockaddr_in serverAddress;
+    uint64_t           bytesPerSecond;
+    int                sessionCount;
+    int                idlePercent;
+    int                churnPerSecond;
+    int                durationSeconds;
+    int                reportIntervalSeconds;
+    int                serverPid;
+} LoadOptions;
+
+typedef struct
+{
+    uint64_t connectStartTime;
+    uint64_t bytesSent;
+    uint64_t intervalBytesSent;
+    int64_t  sendBudget;
+    size_t   frameOffset;
+    uint32_t receivePayloadRemaining;
+    uint8_t  receiveHeaderLength;
+    char     receiveHeader[8];
+    int      socket;
+    int      state;
+    int      isIdle;
+    int      isWaitingForWritable;
+} LoadSession;
+
+typedef struct
+{
+    uint64_t* pSamples;
+    size_t    count;
+    size_t    capacity;
+} LatencySamples;
+
+typedef struct
+{
+    uint64_t cpuTicks;
+    uint64_t residentBytes;
+    int      isValid;
+} ServerUsage;
+
+typedef struct
+{
+    LoadOptions    options;
+    LoadSession*   pSessions;
+    LatencySamples intervalLatencies;
+    LatencySamples totalLatencies;
+    ServerUsage    lastServerUsage;
+    uint64_t       startTime;
+    uint64_t       lastTickTime;
+    uint64_t       lastReportTime;
+    uint64_t       churnCredit;
+    uint64_t       totalBytesSent;
+    uint64_t       intervalConnects;
+    uint64_t       intervalFailures;
+    uint64_t       intervalDisconnects;
+    uint64_t       totalConnects;
+    uint64_t       totalFailures;
+    uint64_t       totalDisconnects;
+    int            epollFileDescriptor;
+    int            nextChurnIndex;
+    volatile int   exitRunLoop;
+} LoadGenerator;
+
+void LoadGenerator_Init(LoadGenerator* pGenerator, const LoadOptions* pOptions);
+void LoadGenerator_Uninit(LoadGenerator* pGenerator);
+void LoadGenerator_Run(LoadGenerator* pGenerator);
+void LoadGenerator_Stop(LoadGenerator* pGenerator);
+
+#endif /* _LOADGEN_H_ */
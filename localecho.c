@@ -0,0 +1,250 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "try_catch.h"
+#include "localecho.h"
+
+
+/* The writer is woken early once this much is waiting and otherwise writes whatever has gathered every
+   LOCAL_ECHO_WRITE_INTERVAL_MS. */
+#define LOCAL_ECHO_WRITE_THRESHOLD      (256 * 1024)
+#define LOCAL_ECHO_WRITE_INTERVAL_MS    100
+
+
+static void allocateBuffers(LocalEcho* pEcho);
+static void openFile(LocalEcho* pEcho);
+static void startWriterThread(LocalEcho* pEcho);
+static void freeResources(LocalEcho* pEcho);
+static void stopWriterThread(LocalEcho* pEcho);
+static void appendToFillBuffer(LocalEcho* pEcho, const void* pBuffer, size_t length);
+static void* writerThreadMain(void* pContext);
+static void waitForData(LocalEcho* pEcho);
+static void writeCompletely(LocalEcho* pEcho, const char* pBuffer, size_t length);
+
+
+void LocalEcho_Init(LocalEcho* pEcho, const char* pPath)
+{
+    memset(pEcho, 0, sizeof(*pEcho));
+    pthread_mutex_init(&pEcho->mutex, NULL);
+    pthread_cond_init(&pEcho->dataReady, NULL);
+    pEcho->pPath = pPath;
+    pEcho->fileDescriptor = -1;
+    if (!pPath)
+    {
+        pEcho->type = LOCAL_ECHO_STDOUT;
+        pEcho->fileDescriptor = fileno(stdout);
+        return;
+    }
+    pEcho->type = LOCAL_ECHO_DISCARD;
+    if (0 == strcmp(pPath, LOCAL_ECHO_NONE))
+        return;
+
+    __try
+    {
+        __throwing_func( allocateBuffers(pEcho) );
+        __throwing_func( openFile(pEcho) );
+        __throwing_func( startWriterThread(pEcho) );
+    }
+    __catch
+    {
+        freeResources(pEcho);
+        __rethrow;
+    }
+    pEcho->type = LOCAL_ECHO_FILE;
+}
+
+static void allocateBuffers(LocalEcho* pEcho)
+{
+    pEcho->pFillBuffer = malloc(LOCAL_ECHO_BUFFER_SIZE);
+    pEcho->pWriteBuffer = malloc(LOCAL_ECHO_BUFFER_SIZE);
+    if (!pEcho->pFillBuffer || !pEcho->pWriteBuffer)
+        __throw(outOfMemoryException);
+}
+
+static void openFile(LocalEcho* pEcho)
+{
+    pEcho->fileDescriptor = open(pEcho->pPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (pEcho->fileDescriptor < 0)
+        __throw(fileException);
+}
+
+static void startWriterThread(LocalEcho* pEcho)
+{
+    sigset_t allSignals;
+    sigset_t previousSignals;
+    int      result = -1;
+
+    /* SIGCHLD and SIGINT must keep interrupting the client's select() on the main thread. */
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_SETMASK, &allSignals, &previousSignals);
+    result = pthread_create(&pEcho->thread, NULL, writerThreadMain, pEcho);
+    pthread_sigmask(SIG_SETMASK, &previousSignals, NULL);
+    if (result != 0)
+        __throw(forkException);
+    pEcho->isThreadRunning = 1;
+}
+
+static void freeResources(LocalEcho* pEcho)
+{
+    if (pEcho->type != LOCAL_ECHO_STDOUT && pEcho->fileDescriptor >= 0)
+        close(pEcho->fileDescriptor);
+    pEcho->fileDescriptor = -1;
+    free(pEcho->pFillBuffer);
+    free(pEcho->pWriteBuffer);
+    pEcho->pFillBuffer = NULL;
+    pEcho->pWriteBuffer = NULL;
+    pEcho->fillLength = 0;
+    pEcho->type = LOCAL_ECHO_DISCARD;
+}
+
+void LocalEcho_Uninit(LocalEcho* pEcho)
+{
+    stopWriterThread(pEcho);
+    freeResources(pEcho);
+    pthread_cond_destroy(&pEcho->dataReady);
+    pthread_mutex_destroy(&pEcho->mutex);
+}
+
+static void stopWriterThread(LocalEcho* pEcho)
+{
+    if (!pEcho->isThreadRunning)
+        return;
+
+    pthread_mutex_lock(&pEcho->mutex);
+    pEcho->exitThread = 1;
+    pthread_cond_signal(&pEcho->dataReady);
+    pthread_mutex_unlock(&pEcho->mutex);
+    pthread_join(pEcho->thread, NULL);
+    pEcho->isThreadRunning = 0;
+}
+
+void LocalEcho_Write(LocalEcho* pEcho, const void* pBuffer, size_t length)
+{
+    if (pEcho->type == LOCAL_ECHO_STDOUT)
+        write(pEcho->fileDescriptor, pBuffer, length);
+    else if (pEcho->type == LOCAL_ECHO_FILE)
+        appendToFillBuffer(pEcho, pBuffer, length);
+}
+
+static void appendToFillBuffer(LocalEcho* pEcho, const void* pBuffer, size_t length)
+{
+    size_t room = 0;
+    size_t copyLength = 0;
+
+    pthread_mutex_lock(&pEcho->mutex);
+    if (pEcho->fileDescriptor >= 0)
+        room = LOCAL_ECHO_BUFFER_SIZE - pEcho->fillLength;
+    copyLength = length < room ? length : room;
+    memcpy(pEcho->pFillBuffer + pEcho->fillLength, pBuffer, copyLength);
+    if (pEcho->fillLength < LOCAL_ECHO_WRITE_THRESHOLD && pEcho->fillLength + copyLength >= LOCAL_ECHO_WRITE_THRESHOLD)
+        pthread_cond_signal(&pEcho->dataReady);
+    pEcho->fillLength += copyLength;
+    pEcho->droppedBytes += length - copyLength;
+    pthread_mutex_unlock(&pEcho->mutex);
+}
+
+uint64_t LocalEcho_GetDroppedBytes(LocalEcho* pEcho)
+{
+    uint64_t droppedBytes = 0;
+
+    if (pEcho->type != LOCAL_ECHO_FILE)
+        return 0;
+    pthread_mutex_lock(&pEcho->mutex);
+    droppedBytes = pEcho->droppedBytes;
+    pthread_mutex_unlock(&pEcho->mutex);
+
+    return droppedBytes;
+}
+
+static void* writerThreadMain(void* pContext)
+{
+    LocalEcho* pEcho = (LocalEcho*)pContext;
+
+    pthread_mutex_lock(&pEcho->mutex);
+    while (!pEcho->exitThread || pEcho->fillLength > 0)
+    {
+        char*  pBuffer = pEcho->pFillBuffer;
+        size_t length = pEcho->fillLength;
+
+        if (length == 0)
+        {
+            waitForData(pEcho);
+            continue;
+        }
+
+        pEcho->pFillBuffer = pEcho->pWriteBuffer;
+        pEcho->pWriteBuffer = pBuffer;
+        pEcho->fillLength = 0;
+        pthread_mutex_unlock(&pEcho->mutex);
+        writeCompletely(pEcho, pBuffer, length);
+        pthread_mutex_lock(&pEcho->mutex);
+        if (!pEcho->exitThread && pEcho->fillLength < LOCAL_ECHO_WRITE_THRESHOLD)
+            waitForData(pEcho);
+    }
+    pthread_mutex_unlock(&pEcho->mutex);
+
+    return NULL;
+}
+
+static void waitForData(LocalEcho* pEcho)
+{
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += LOCAL_ECHO_WRITE_INTERVAL_MS * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&pEcho->dataReady, &pEcho->mutex, &deadline);
+}
+
+static void writeCompletely(LocalEcho* pEcho, const char* pBuffer, size_t length)
+{
+    while (length > 0 && pEcho->fileDescriptor >= 0)
+    {
+        ssize_t bytesWritten = write(pEcho->fileDescriptor, pBuffer, length);
+
+        if (bytesWritten < 0 && errno == EINTR)
+            continue;
+        if (bytesWritten <= 0)
+        {
+            printf("error: Stopped writing --echo file after a write failed.\n");
+            perror("       errno");
+            fflush(stdout);
+            pthread_mutex_lock(&pEcho->mutex);
+            close(pEcho->fileDescriptor);
+            pEcho->fileDescriptor = -1;
+            pthread_mutex_unlock(&pEcho->mutex);
+            break;
+        }
+        pBuffer += bytesWritten;
+        length -= bytesWritten;
+    }
+
+    if (length == 0)
+        return;
+    pthread_mutex_lock(&pEcho->mutex);
+    pEcho->droppedBytes += length;
+    pthread_mutex_unlock(&pEcho->mutex);
+}
@@ -0,0 +1,58 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef _LOCALECHO_H_
+#define _LOCALECHO_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Where remote echoes the command's output, and the input and ^C sent to it, on the local side.  By default it is
+   written straight to stdout.  --echo none drops it for headless use.  --echo with a path hands it to a writer thread
+   through a pair of LOCAL_ECHO_BUFFER_SIZE buffers: remote copies into one while the thread writes the other out in
+   one large write, so the file is never waited on.  Should both buffers fill because the disk can't keep up, the
+   overflow is dropped and counted rather than stall the command or the servers. */
+#define LOCAL_ECHO_BUFFER_SIZE  (4 * 1024 * 1024)
+#define LOCAL_ECHO_NONE         "none"
+
+typedef enum
+{
+    LOCAL_ECHO_STDOUT,
+    LOCAL_ECHO_DISCARD,
+    LOCAL_ECHO_FILE
+} LocalEchoType;
+
+typedef struct
+{
+    pthread_t       thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t  dataReady;
+    const char*     pPath;
+    char*           pFillBuffer;
+    char*           pWriteBuffer;
+    size_t          fillLength;
+    uint64_t        droppedBytes;
+    LocalEchoType   type;
+    int             fileDescriptor;
+    int             exitThread;
+    int             isThreadRunning;
+} LocalEcho;
+
+void     LocalEcho_Init(LocalEcho* pEcho, const char* pPath);
+void     LocalEcho_Uninit(LocalEcho* pEcho);
+void     LocalEcho_Write(LocalEcho* pEcho, const void* pBuffer, size_t length);
+uint64_t LocalEcho_GetDroppedBytes(LocalEcho* pEcho);
+
+#endif /* _LOCALECHO_H_ */
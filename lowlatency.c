@@ -0,0 +1,99 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include "lowlatency.h"
+#include "protocol.h"
+#include "timestamp.h"
+
+
+void LowLatency_Init(LowLatency* pLowLatency, int cpu, uint32_t spinMicroseconds)
+{
+    memset(pLowLatency, 0, sizeof(*pLowLatency));
+    pLowLatency->cpu = cpu;
+    pLowLatency->isEnabled = cpu >= 0;
+    pLowLatency->spinBudget = (uint64_t)spinMicroseconds * TIMESTAMP_NANOSECONDS_PER_MICROSECOND;
+}
+
+void LowLatency_PinToCpu(LowLatency* pLowLatency)
+{
+    cpu_set_t cpuSet;
+
+    if (!pLowLatency->isEnabled)
+        return;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(pLowLatency->cpu, &cpuSet);
+    /* Failures are reported by LowLatency_Display() rather than stopping the session. */
+    pLowLatency->isPinned = sched_setaffinity(0, sizeof(cpuSet), &cpuSet) == 0;
+}
+
+void LowLatency_ConfigureSocket(LowLatency* pLowLatency, int socket)
+{
+    int busyPollMicroseconds = (int)(pLowLatency->spinBudget / TIMESTAMP_NANOSECONDS_PER_MICROSECOND);
+
+    if (!pLowLatency->isEnabled)
+        return;
+    Protocol_EnableReceiveTimestamps(socket);
+    if (busyPollMicroseconds == 0)
+        return;
+    pLowLatency->wasBusyPollRefused = setsockopt(socket, SOL_SOCKET, SO_BUSY_POLL,
+                                                 &busyPollMicroseconds, sizeof(busyPollMicroseconds)) < 0;
+}
+
+int LowLatency_IsEnabled(LowLatency* pLowLatency)
+{
+    return pLowLatency->isEnabled;
+}
+
+uint64_t LowLatency_SpinEndTime(LowLatency* pLowLatency, uint64_t now)
+{
+    return now + pLowLatency->spinBudget;
+}
+
+void LowLatency_RecordWakeup(LowLatency* pLowLatency, int wasSpinning)
+{
+    if (wasSpinning)
+        pLowLatency->spinWakeups++;
+    else
+        pLowLatency->sleepWakeups++;
+}
+
+void LowLatency_RecordInput(LowLatency* pLowLatency, uint64_t kernelReceiveTime)
+{
+    if (!pLowLatency->isEnabled || kernelReceiveTime == 0)
+        return;
+    TraceHistogram_Record(&pLowLatency->inputLatency, (int64_t)(Timestamp_WallClockNow() - kernelReceiveTime));
+}
+
+void LowLatency_Display(LowLatency* pLowLatency)
+{
+    uint64_t totalWakeups = pLowLatency->spinWakeups + pLowLatency->sleepWakeups;
+
+    if (!pLowLatency->isEnabled)
+        return;
+
+    printf("Busy polling on cpu %d%s with a %llu us spin budget%s.\n",
+           pLowLatency->cpu, pLowLatency->isPinned ? "" : " (pinning failed)",
+           (unsigned long long)(pLowLatency->spinBudget / TIMESTAMP_NANOSECONDS_PER_MICROSECOND),
+           pLowLatency->wasBusyPollRefused ? " (SO_BUSY_POLL refused, needs CAP_NET_ADMIN)" : "");
+    printf("%llu of %llu wakeups were caught while spinning.\n",
+           (unsigned long long)pLowLatency->spinWakeups, (unsigned long long)totalWakeups);
+    TraceHistogram_DisplayHeader("latency");
+    TraceHistogram_Display("input", &pLowLatency->inputLatency);
+}
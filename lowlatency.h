@@ -0,0 +1,46 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef _LOWLATENCY_H_
+#define _LOWLATENCY_H_
+
+#include <stdint.h>
+#include "trace.h"
+
+/* remote --busy-poll trades a whole core for keystroke latency.  The client is pinned to the given core, the server
+   socket is put in SO_BUSY_POLL mode (which needs CAP_NET_ADMIN) and the run loop spins on zero timeout selects of
+   the pipes and socket for up to the spin budget before it falls back to sleeping.  Latency is measured from the
+   kernel's receive timestamp on the socket to the return of the write of that input to the child's stdin. */
+typedef struct
+{
+    TraceHistogram inputLatency;
+    uint64_t       spinBudget;
+    uint64_t       spinWakeups;
+    uint64_t       sleepWakeups;
+    int            cpu;
+    int            isEnabled;
+    int            isPinned;
+    int            wasBusyPollRefused;
+} LowLatency;
+
+void LowLatency_Init(LowLatency* pLowLatency, int cpu, uint32_t spinMicroseconds);
+void LowLatency_PinToCpu(LowLatency* pLowLatency);
+void LowLatency_ConfigureSocket(LowLatency* pLowLatency, int socket);
+int  LowLatency_IsEnabled(LowLatency* pLowLatency);
+uint64_t LowLatency_SpinEndTime(LowLatency* pLowLatency, uint64_t now);
+void LowLatency_RecordWakeup(LowLatency* pLowLatency, int wasSpinning);
+void LowLatency_RecordInput(LowLatency* pLowLatency, uint64_t kernelReceiveTime);
+void LowLatency_Display(LowLatency* pLowLatency);
+
+#endif /* _LOWLATENCY_H_ */
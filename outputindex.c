@@ -0,0 +1,728 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "outputindex.h"
+#include "timestamp.h"
+
+
+#define OUTPUT_INDEX_INITIAL_CAPACITY   (4 * 1024)
+#define OUTPUT_INDEX_INITIAL_BLOCKS     64
+
+typedef struct
+{
+    uint64_t fileSize;
+    uint64_t firstLine;
+    uint64_t blockCount;
+    uint64_t filterBytes;
+    uint32_t currentLength;
+    uint32_t isFull;
+} SavedIndexHeader;
+
+
+static int         copyToSnapshot(OutputIndex* pIndex, OutputIndex* pSnapshot);
+static int         restoreFromSaved(OutputIndex* pIndex, const char* pData, size_t length);
+static int         allocateCurrentFilter(OutputIndex* pIndex);
+static int         makeRoomInCurrentBlock(OutputIndex* pIndex, size_t length);
+static void        addToFilter(OutputIndex* pIndex, const char* pData, size_t length);
+static uint64_t    hashTrigram(uint32_t trigram);
+static uint32_t    filterBit(uint64_t hash, int hashNumber);
+static void        closeCurrentBlock(OutputIndex* pIndex);
+static uint64_t*   buildBlockFilter(OutputIndex* pIndex, uint32_t* pMask);
+static size_t      countFoldedBits(const uint64_t* pFilter, size_t wordCount);
+static int         writeToFile(OutputIndex* pIndex, size_t length);
+static int         createFile(OutputIndex* pIndex);
+static int         growBlockTable(OutputIndex* pIndex);
+static uint64_t    countNewlines(const char* pData, size_t length);
+static int         mayContain(const OutputIndexBlock* pBlock, const char* pText, size_t textLength);
+static const char* blockData(OutputIndex* pIndex, size_t blockIndex, char* pReadBuffer);
+static const OutputIndexBlock* blockAt(OutputIndex* pIndex, size_t blockIndex);
+static size_t      searchBlock(const OutputIndexBlock* pBlock, const char* pData, const char* pText, size_t textLength,
+                               size_t maxMatches, uint64_t* pLastReportedLine,
+                               OutputIndexLineHandler* pHandler, void* pContext);
+static size_t      findBlockForLine(OutputIndex* pIndex, uint64_t line);
+static size_t      emitLines(const OutputIndexBlock* pBlock, const char* pData, uint64_t* pNextLine, size_t lineCount,
+                             OutputIndexLineHandler* pHandler, void* pContext);
+
+
+void OutputIndex_Init(OutputIndex* pIndex, uint64_t limit)
+{
+    memset(pIndex, 0, sizeof(*pIndex));
+    pIndex->limit = limit;
+    pIndex->fileDescriptor = -1;
+}
+
+void OutputIndex_Uninit(OutputIndex* pIndex)
+{
+    size_t i;
+
+    for (i = 0 ; i < pIndex->blockCount ; i++)
+        free(pIndex->pBlocks[i].pFilter);
+    free(pIndex->pBlocks);
+    free(pIndex->pCurrentData);
+    free(pIndex->current.pFilter);
+    if (pIndex->fileDescriptor >= 0)
+        close(pIndex->fileDescriptor);
+    memset(pIndex, 0, sizeof(*pIndex));
+    pIndex->fileDescriptor = -1;
+}
+
+int OutputIndex_IsEnabled(OutputIndex* pIndex)
+{
+    return pIndex->limit > 0;
+}
+
+int OutputIndex_IsFull(OutputIndex* pIndex)
+{
+    return pIndex->isFull;
+}
+
+uint64_t OutputIndex_GetByteCount(OutputIndex* pIndex)
+{
+    return pIndex->fileSize + pIndex->current.length;
+}
+
+uint64_t OutputIndex_GetLineCount(OutputIndex* pIndex)
+{
+    uint64_t newlineCount = countNewlines(pIndex->pCurrentData, pIndex->current.length);
+    int      hasPartialLine = pIndex->current.length > 0 && pIndex->pCurrentData[pIndex->current.length - 1] != '\n';
+
+    return pIndex->current.firstLine + newlineCount + (hasPartialLine ? 1 : 0);
+}
+
+size_t OutputIndex_GetMemoryUsage(OutputIndex* pIndex)
+{
+    size_t currentFilterBytes = pIndex->current.pFilter ? OUTPUT_INDEX_MAX_FILTER_BITS / 8 : 0;
+
+    return pIndex->currentCapacity + currentFilterBytes + pIndex->filterBytes +
+           pIndex->blockCapacity * sizeof(*pIndex->pBlocks);
+}
+
+/* Copies what a search needs so that it can run on another thread while the session keeps appending.  Blocks
+   already in the file are read through a duplicate descriptor, the block being filled is copied and, having no
+   filter of its own in the copy, is always scanned. */
+int OutputIndex_Snapshot(OutputIndex* pIndex, OutputIndex* pSnapshot)
+{
+    OutputIndex_Init(pSnapshot, pIndex->limit);
+    if (copyToSnapshot(pIndex, pSnapshot))
+        return 1;
+    OutputIndex_Uninit(pSnapshot);
+    return 0;
+}
+
+static int copyToSnapshot(OutputIndex* pIndex, OutputIndex* pSnapshot)
+{
+    size_t i;
+
+    pSnapshot->fileSize = pIndex->fileSize;
+    pSnapshot->isFull = pIndex->isFull;
+    pSnapshot->current = pIndex->current;
+    pSnapshot->current.pFilter = NULL;
+    pSnapshot->current.length = 0;
+
+    if (pIndex->fileDescriptor >= 0 && (pSnapshot->fileDescriptor = dup(pIndex->fileDescriptor)) < 0)
+        return 0;
+    if (pIndex->current.length > 0)
+    {
+        if (!makeRoomInCurrentBlock(pSnapshot, pIndex->current.length))
+            return 0;
+        memcpy(pSnapshot->pCurrentData, pIndex->pCurrentData, pIndex->current.length);
+        pSnapshot->current.length = pIndex->current.length;
+    }
+
+    pSnapshot->pBlocks = malloc(pIndex->blockCount * sizeof(*pSnapshot->pBlocks));
+    if (pIndex->blockCount > 0 && !pSnapshot->pBlocks)
+        return 0;
+    pSnapshot->blockCapacity = pIndex->blockCount;
+    for (i = 0 ; i < pIndex->blockCount ; i++)
+    {
+        OutputIndexBlock block = pIndex->pBlocks[i];
+        size_t           filterBytes = ((size_t)block.filterMask + 1) / 8;
+
+        block.pFilter = malloc(filterBytes);
+        if (!block.pFilter)
+            return 0;
+        memcpy(block.pFilter, pIndex->pBlocks[i].pFilter, filterBytes);
+        pSnapshot->pBlocks[pSnapshot->blockCount++] = block;
+        pSnapshot->filterBytes += filterBytes;
+    }
+    return 1;
+}
+
+/* Flattens everything but the file into one buffer so that a handoff can carry the index to another process: a
+   header, the block table, each block's filter and then the block being filled.  The file itself is passed on by
+   descriptor.  Both ends are the same build on the same host so the structures are copied as they are. */
+size_t OutputIndex_Save(OutputIndex* pIndex, char** ppData)
+{
+    SavedIndexHeader header;
+    size_t           tableBytes = pIndex->blockCount * sizeof(*pIndex->pBlocks);
+    size_t           length = sizeof(header) + tableBytes + pIndex->filterBytes + pIndex->current.length;
+    char*            pDest = NULL;
+    size_t           i;
+
+    *ppData = NULL;
+    if (!OutputIndex_IsEnabled(pIndex))
+        return 0;
+    pDest = malloc(length);
+    if (!pDest)
+        return 0;
+    *ppData = pDest;
+
+    memset(&header, 0, sizeof(header));
+    header.fileSize = pIndex->fileSize;
+    header.firstLine = pIndex->current.firstLine;
+    header.blockCount = pIndex->blockCount;
+    header.filterBytes = pIndex->filterBytes;
+    header.currentLength = pIndex->current.length;
+    header.isFull = pIndex->isFull;
+    memcpy(pDest, &header, sizeof(header));
+    pDest += sizeof(header);
+    if (tableBytes > 0)
+        memcpy(pDest, pIndex->pBlocks, tableBytes);
+    pDest += tableBytes;
+    for (i = 0 ; i < pIndex->blockCount ; i++)
+    {
+        size_t filterBytes = ((size_t)pIndex->pBlocks[i].filterMask + 1) / 8;
+
+        memcpy(pDest, pIndex->pBlocks[i].pFilter, filterBytes);
+        pDest += filterBytes;
+    }
+    if (pIndex->current.length > 0)
+        memcpy(pDest, pIndex->pCurrentData, pIndex->current.length);
+    return length;
+}
+
+/* Rebuilds an index from OutputIndex_Save() into an empty one, taking ownership of fileDescriptor either way.  The
+   filter of the block being filled isn't saved as it is rebuilt from that block's data.  The limit stays the one
+   this index was created with, so an index restored past it is simply full. */
+int OutputIndex_Restore(OutputIndex* pIndex, int fileDescriptor, const char* pData, size_t length)
+{
+    uint64_t limit = pIndex->limit;
+
+    pIndex->fileDescriptor = fileDescriptor;
+    if (OutputIndex_IsEnabled(pIndex) && restoreFromSaved(pIndex, pData, length))
+        return 1;
+    OutputIndex_Uninit(pIndex);
+    OutputIndex_Init(pIndex, limit);
+    return 0;
+}
+
+static int restoreFromSaved(OutputIndex* pIndex, const char* pData, size_t length)
+{
+    const char*      pEnd = pData + length;
+    SavedIndexHeader header;
+    const char*      pFilters;
+    size_t           i;
+
+    if (length < sizeof(header))
+        return 0;
+    memcpy(&header, pData, sizeof(header));
+    pData += sizeof(header);
+    if (header.blockCount > (size_t)(pEnd - pData) / sizeof(*pIndex->pBlocks) ||
+        header.currentLength > OUTPUT_INDEX_MAX_BLOCK_SIZE ||
+        (header.blockCount > 0 && pIndex->fileDescriptor < 0))
+    {
+        return 0;
+    }
+    pFilters = pData + header.blockCount * sizeof(*pIndex->pBlocks);
+    if (header.filterBytes != (size_t)(pEnd - pFilters) - header.currentLength)
+        return 0;
+
+    pIndex->pBlocks = malloc(header.blockCount * sizeof(*pIndex->pBlocks));
+    if (header.blockCount > 0 && !pIndex->pBlocks)
+        return 0;
+    pIndex->blockCapacity = header.blockCount;
+    for (i = 0 ; i < header.blockCount ; i++)
+    {
+        OutputIndexBlock block;
+        size_t           filterBytes;
+
+        memcpy(&block, pData + i * sizeof(block), sizeof(block));
+        filterBytes = ((size_t)block.filterMask + 1) / 8;
+        if (filterBytes < OUTPUT_INDEX_MIN_FILTER_BITS / 8 || filterBytes > OUTPUT_INDEX_MAX_FILTER_BITS / 8 ||
+            (block.filterMask & (block.filterMask + 1)) != 0 || filterBytes > (size_t)(pEnd - pFilters))
+        {
+            return 0;
+        }
+        block.pFilter = malloc(filterBytes);
+        if (!block.pFilter)
+            return 0;
+        memcpy(block.pFilter, pFilters, filterBytes);
+        pFilters += filterBytes;
+        pIndex->pBlocks[pIndex->blockCount++] = block;
+        pIndex->filterBytes += filterBytes;
+    }
+
+    if (!allocateCurrentFilter(pIndex) || !makeRoomInCurrentBlock(pIndex, header.currentLength))
+        return 0;
+    if (header.currentLength > 0)
+        memcpy(pIndex->pCurrentData, pFilters, header.currentLength);
+    pIndex->current.length = header.currentLength;
+    pIndex->current.firstLine = header.firstLine;
+    pIndex->fileSize = header.fileSize;
+    pIndex->trigram = 0;
+    addToFilter(pIndex, pIndex->pCurrentData, pIndex->current.length);
+    pIndex->isFull = header.isFull || OutputIndex_GetByteCount(pIndex) >= pIndex->limit;
+    return 1;
+}
+
+void OutputIndex_Append(OutputIndex* pIndex, const char* pData, size_t length)
+{
+    if (!OutputIndex_IsEnabled(pIndex))
+        return;
+
+    if (!pIndex->current.pFilter && !allocateCurrentFilter(pIndex))
+        return;
+
+    while (length > 0 && !pIndex->isFull)
+    {
+        uint64_t room = pIndex->limit - OutputIndex_GetByteCount(pIndex);
+        size_t   take = OUTPUT_INDEX_MAX_BLOCK_SIZE - pIndex->current.length;
+
+        if (take > length)
+            take = length;
+        if (take >= room)
+        {
+            take = (size_t)room;
+            pIndex->isFull = 1;
+        }
+        if (!makeRoomInCurrentBlock(pIndex, take))
+            return;
+
+        memcpy(pIndex->pCurrentData + pIndex->current.length, pData, take);
+        addToFilter(pIndex, pData, take);
+        pIndex->current.length += take;
+        pData += take;
+        length -= take;
+
+        if (pIndex->current.length >= OUTPUT_INDEX_BLOCK_SIZE)
+            closeCurrentBlock(pIndex);
+    }
+}
+
+static int allocateCurrentFilter(OutputIndex* pIndex)
+{
+    pIndex->current.pFilter = calloc(OUTPUT_INDEX_MAX_FILTER_BITS / 64, sizeof(*pIndex->current.pFilter));
+    if (!pIndex->current.pFilter)
+    {
+        pIndex->isFull = 1;
+        return 0;
+    }
+    pIndex->current.filterMask = OUTPUT_INDEX_MAX_FILTER_BITS - 1;
+    return 1;
+}
+
+static int makeRoomInCurrentBlock(OutputIndex* pIndex, size_t length)
+{
+    size_t needed = pIndex->current.length + length;
+    size_t newCapacity = pIndex->currentCapacity ? pIndex->currentCapacity : OUTPUT_INDEX_INITIAL_CAPACITY;
+    char*  pNewData = NULL;
+
+    if (needed <= pIndex->currentCapacity)
+        return 1;
+    while (newCapacity < needed)
+        newCapacity *= 2;
+    pNewData = realloc(pIndex->pCurrentData, newCapacity);
+    if (!pNewData)
+    {
+        /* An index which can't keep up just stops; the session itself carries on. */
+        pIndex->isFull = 1;
+        return 0;
+    }
+    pIndex->pCurrentData = pNewData;
+    pIndex->currentCapacity = newCapacity;
+    return 1;
+}
+
+static void addToFilter(OutputIndex* pIndex, const char* pData, size_t length)
+{
+    uint64_t* pFilter = pIndex->current.pFilter;
+    uint32_t  trigram = pIndex->trigram;
+    size_t    i;
+
+    for (i = 0 ; i < length ; i++)
+    {
+        uint64_t hash;
+        int      j;
+
+        trigram = ((trigram << 8) | (uint8_t)pData[i]) & 0xFFFFFF;
+        hash = hashTrigram(trigram);
+        for (j = 0 ; j < OUTPUT_INDEX_FILTER_HASHES ; j++)
+        {
+            uint32_t bit = filterBit(hash, j) & (OUTPUT_INDEX_MAX_FILTER_BITS - 1);
+
+            pFilter[bit >> 6] |= 1ULL << (bit & 63);
+        }
+    }
+    pIndex->trigram = trigram;
+}
+
+static uint64_t hashTrigram(uint32_t trigram)
+{
+    /* MurmurHash3's finalizer, so that the low bits kept by a folded filter are as well mixed as the high ones. */
+    uint64_t hash = trigram;
+
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static uint32_t filterBit(uint64_t hash, int hashNumber)
+{
+    /* Double hashing gives each of the OUTPUT_INDEX_FILTER_HASHES bits from one 64-bit hash. */
+    return (uint32_t)(hash >> 32) + (uint32_t)hashNumber * ((uint32_t)hash | 1);
+}
+
+static void closeCurrentBlock(OutputIndex* pIndex)
+{
+    const char*      pLastNewline = memrchr(pIndex->pCurrentData, '\n', pIndex->current.length);
+    uint64_t*        pCurrentFilter = pIndex->current.pFilter;
+    OutputIndexBlock block;
+    size_t           remainder;
+
+    /* Blocks end on a line so that no match is split between two of them, unless a line is too long to fit. */
+    if (!pLastNewline && pIndex->current.length < OUTPUT_INDEX_MAX_BLOCK_SIZE)
+        return;
+
+    block = pIndex->current;
+    block.length = pLastNewline ? (uint32_t)(pLastNewline - pIndex->pCurrentData + 1) : pIndex->current.length;
+    block.fileOffset = pIndex->fileSize;
+    if (!growBlockTable(pIndex) || !writeToFile(pIndex, block.length))
+    {
+        pIndex->isFull = 1;
+        return;
+    }
+    block.pFilter = buildBlockFilter(pIndex, &block.filterMask);
+    if (!block.pFilter)
+    {
+        pIndex->isFull = 1;
+        return;
+    }
+    pIndex->pBlocks[pIndex->blockCount++] = block;
+    pIndex->fileSize += block.length;
+
+    remainder = pIndex->current.length - block.length;
+    memset(&pIndex->current, 0, sizeof(pIndex->current));
+    memset(pCurrentFilter, 0, OUTPUT_INDEX_MAX_FILTER_BITS / 8);
+    pIndex->current.pFilter = pCurrentFilter;
+    pIndex->current.filterMask = OUTPUT_INDEX_MAX_FILTER_BITS - 1;
+    pIndex->current.firstLine = block.firstLine + countNewlines(pIndex->pCurrentData, block.length);
+    memmove(pIndex->pCurrentData, pIndex->pCurrentData + block.length, remainder);
+    pIndex->trigram = 0;
+    pIndex->current.length = remainder;
+    addToFilter(pIndex, pIndex->pCurrentData, remainder);
+}
+
+static uint64_t* buildBlockFilter(OutputIndex* pIndex, uint32_t* pMask)
+{
+    uint64_t* pFilter = pIndex->current.pFilter;
+    uint64_t* pBlockFilter = NULL;
+    size_t    wordCount = OUTPUT_INDEX_MAX_FILTER_BITS / 64;
+    size_t    i;
+
+    /* ORing the top half onto the bottom gives the filter that masking each hash with one less bit would have built,
+       so halve it while the result stays sparse enough to be useful. */
+    while (wordCount * 64 > OUTPUT_INDEX_MIN_FILTER_BITS &&
+           countFoldedBits(pFilter, wordCount) * 100 <= wordCount / 2 * 64 * OUTPUT_INDEX_MAX_FILTER_FILL)
+    {
+        for (i = 0 ; i < wordCount / 2 ; i++)
+            pFilter[i] |= pFilter[i + wordCount / 2];
+        wordCount /= 2;
+    }
+
+    pBlockFilter = malloc(wordCount * sizeof(*pBlockFilter));
+    if (!pBlockFilter)
+        return NULL;
+    memcpy(pBlockFilter, pFilter, wordCount * sizeof(*pBlockFilter));
+    pIndex->filterBytes += wordCount * sizeof(*pBlockFilter);
+    *pMask = (uint32_t)(wordCount * 64 - 1);
+    return pBlockFilter;
+}
+
+static size_t countFoldedBits(const uint64_t* pFilter, size_t wordCount)
+{
+    size_t bitCount = 0;
+    size_t i;
+
+    for (i = 0 ; i < wordCount / 2 ; i++)
+        bitCount += __builtin_popcountll(pFilter[i] | pFilter[i + wordCount / 2]);
+    return bitCount;
+}
+
+static int growBlockTable(OutputIndex* pIndex)
+{
+    size_t            newCapacity = pIndex->blockCapacity ? pIndex->blockCapacity * 2 : OUTPUT_INDEX_INITIAL_BLOCKS;
+    OutputIndexBlock* pNewBlocks = NULL;
+
+    if (pIndex->blockCount < pIndex->blockCapacity)
+        return 1;
+    pNewBlocks = realloc(pIndex->pBlocks, newCapacity * sizeof(*pNewBlocks));
+    if (!pNewBlocks)
+        return 0;
+    pIndex->pBlocks = pNewBlocks;
+    pIndex->blockCapacity = newCapacity;
+    return 1;
+}
+
+static int writeToFile(OutputIndex* pIndex, size_t length)
+{
+    const char* pData = pIndex->pCurrentData;
+    uint64_t    offset = pIndex->fileSize;
+
+    if (pIndex->fileDescriptor < 0 && !createFile(pIndex))
+        return 0;
+    while (length > 0)
+    {
+        ssize_t bytesWritten = pwrite(pIndex->fileDescriptor, pData, length, (off_t)offset);
+
+        if (bytesWritten < 0 && errno == EINTR)
+            continue;
+        if (bytesWritten <= 0)
+            return 0;
+        pData += bytesWritten;
+        offset += bytesWritten;
+        length -= bytesWritten;
+    }
+    return 1;
+}
+
+static int createFile(OutputIndex* pIndex)
+{
+    const char* pDirectory = getenv("TMPDIR");
+    char        path[4096];
+
+    snprintf(path, sizeof(path), "%s/remotesvr-index-XXXXXX", pDirectory && *pDirectory ? pDirectory : "/tmp");
+    pIndex->fileDescriptor = mkstemp(path);
+    if (pIndex->fileDescriptor < 0)
+        return 0;
+    unlink(path);
+    return 1;
+}
+
+static uint64_t countNewlines(const char* pData, size_t length)
+{
+    const char* pEnd = pData + length;
+    uint64_t    count = 0;
+
+    while (pData < pEnd && (pData = memchr(pData, '\n', pEnd - pData)) != NULL)
+    {
+        count++;
+        pData++;
+    }
+    return count;
+}
+
+size_t OutputIndex_Search(OutputIndex* pIndex, const char* pText, size_t textLength, size_t maxMatches,
+                          OutputIndexLineHandler* pHandler, void* pContext, OutputIndexSearchStats* pStats)
+{
+    uint64_t startTime = Timestamp_Now();
+    char*    pReadBuffer = malloc(OUTPUT_INDEX_MAX_BLOCK_SIZE);
+    uint64_t lastReportedLine = 0;
+    size_t   matchCount = 0;
+    size_t   i;
+
+    memset(pStats, 0, sizeof(*pStats));
+    pStats->blockCount = pIndex->blockCount + (pIndex->current.length ? 1 : 0);
+    if (!pReadBuffer || textLength == 0)
+    {
+        free(pReadBuffer);
+        return 0;
+    }
+
+    for (i = 0 ; i <= pIndex->blockCount && matchCount < maxMatches ; i++)
+    {
+        const OutputIndexBlock* pBlock = blockAt(pIndex, i);
+        const char*             pData = NULL;
+
+        if (pBlock->length == 0 || !mayContain(pBlock, pText, textLength))
+            continue;
+        pData = blockData(pIndex, i, pReadBuffer);
+        if (!pData)
+            continue;
+        pStats->blocksScanned++;
+        matchCount += searchBlock(pBlock, pData, pText, textLength, maxMatches - matchCount, &lastReportedLine,
+                                  pHandler, pContext);
+    }
+
+    free(pReadBuffer);
+    pStats->elapsedTime = Timestamp_Now() - startTime;
+    return matchCount;
+}
+
+static const OutputIndexBlock* blockAt(OutputIndex* pIndex, size_t blockIndex)
+{
+    return blockIndex < pIndex->blockCount ? &pIndex->pBlocks[blockIndex] : &pIndex->current;
+}
+
+static int mayContain(const OutputIndexBlock* pBlock, const char* pText, size_t textLength)
+{
+    uint32_t trigram = 0;
+    size_t   i;
+
+    if (!pBlock->pFilter)
+        return 1;
+    for (i = 0 ; i < textLength ; i++)
+    {
+        uint64_t hash;
+        int      j;
+
+        trigram = ((trigram << 8) | (uint8_t)pText[i]) & 0xFFFFFF;
+        if (i < 2)
+            continue;
+        hash = hashTrigram(trigram);
+        for (j = 0 ; j < OUTPUT_INDEX_FILTER_HASHES ; j++)
+        {
+            uint32_t bit = filterBit(hash, j) & pBlock->filterMask;
+
+            if (!(pBlock->pFilter[bit >> 6] & (1ULL << (bit & 63))))
+                return 0;
+        }
+    }
+    return 1;
+}
+
+static const char* blockData(OutputIndex* pIndex, size_t blockIndex, char* pReadBuffer)
+{
+    const OutputIndexBlock* pBlock = blockAt(pIndex, blockIndex);
+    size_t                  bytesRead = 0;
+
+    if (blockIndex == pIndex->blockCount)
+        return pIndex->pCurrentData;
+    while (bytesRead < pBlock->length)
+    {
+        ssize_t result = pread(pIndex->fileDescriptor, pReadBuffer + bytesRead, pBlock->length - bytesRead,
+                               (off_t)(pBlock->fileOffset + bytesRead));
+
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result <= 0)
+            return NULL;
+        bytesRead += result;
+    }
+    return pReadBuffer;
+}
+
+static size_t searchBlock(const OutputIndexBlock* pBlock, const char* pData, const char* pText, size_t textLength,
+                          size_t maxMatches, uint64_t* pLastReportedLine,
+                          OutputIndexLineHandler* pHandler, void* pContext)
+{
+    const char* pEnd = pData + pBlock->length;
+    const char* pLineStart = pData;
+    const char* pSearch = pData;
+    uint64_t    line = pBlock->firstLine;
+    size_t      matchCount = 0;
+
+    while (matchCount < maxMatches && pSearch < pEnd)
+    {
+        const char* pMatch = memmem(pSearch, pEnd - pSearch, pText, textLength);
+        const char* pLineEnd = NULL;
+
+        if (!pMatch)
+            break;
+        line += countNewlines(pLineStart, pMatch - pLineStart);
+        pLineStart = memrchr(pData, '\n', pMatch - pData);
+        pLineStart = pLineStart ? pLineStart + 1 : pData;
+        pLineEnd = memchr(pMatch, '\n', pEnd - pMatch);
+        if (!pLineEnd)
+            pLineEnd = pEnd;
+
+        /* A line too long for one block carries on into the next under the same number; report it once. */
+        if (line + 1 != *pLastReportedLine)
+        {
+            pHandler(pContext, line + 1, pLineStart, pLineEnd - pLineStart);
+            *pLastReportedLine = line + 1;
+            matchCount++;
+        }
+        pSearch = pLineEnd;
+    }
+    return matchCount;
+}
+
+size_t OutputIndex_GetLines(OutputIndex* pIndex, uint64_t firstLine, size_t lineCount,
+                            OutputIndexLineHandler* pHandler, void* pContext)
+{
+    char*    pReadBuffer = malloc(OUTPUT_INDEX_MAX_BLOCK_SIZE);
+    uint64_t nextLine = firstLine > 0 ? firstLine - 1 : 0;
+    size_t   linesEmitted = 0;
+    size_t   i;
+
+    if (!pReadBuffer)
+        return 0;
+
+    for (i = findBlockForLine(pIndex, nextLine) ; i <= pIndex->blockCount && linesEmitted < lineCount ; i++)
+    {
+        const char* pData = blockData(pIndex, i, pReadBuffer);
+
+        if (!pData)
+            break;
+        linesEmitted += emitLines(blockAt(pIndex, i), pData, &nextLine, lineCount - linesEmitted, pHandler, pContext);
+    }
+
+    free(pReadBuffer);
+    return linesEmitted;
+}
+
+static size_t findBlockForLine(OutputIndex* pIndex, uint64_t line)
+{
+    size_t low = 0;
+    size_t high = pIndex->blockCount;
+
+    if (line >= pIndex->current.firstLine)
+        return pIndex->blockCount;
+
+    /* Find the last block starting at or before the line. */
+    while (high - low > 1)
+    {
+        size_t middle = low + (high - low) / 2;
+
+        if (pIndex->pBlocks[middle].firstLine <= line)
+            low = middle;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+static size_t emitLines(const OutputIndexBlock* pBlock, const char* pData, uint64_t* pNextLine, size_t lineCount,
+                        OutputIndexLineHandler* pHandler, void* pContext)
+{
+    const char* pEnd = pData + pBlock->length;
+    uint64_t    line = pBlock->firstLine;
+    size_t      linesEmitted = 0;
+
+    while (pData < pEnd && linesEmitted < lineCount)
+    {
+        const char* pLineEnd = memchr(pData, '\n', pEnd - pData);
+
+        if (!pLineEnd)
+            pLineEnd = pEnd;
+        if (line >= *pNextLine)
+        {
+            pHandler(pContext, line + 1, pData, pLineEnd - pData);
+            linesEmitted++;
+            *pNextLine = line + 1;
+        }
+        line++;
+        pData = pLineEnd + 1;
+    }
+    return linesEmitted;
+}
@@ -0,0 +1,86 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef _OUTPUTINDEX_H_
+#define _OUTPUTINDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Keeps a session's output searchable.  Output is appended to an unlinked temporary file in blocks which always end
+   on a line boundary and only the block table stays in memory: where each block starts in the file and in lines,
+   plus a bloom filter of every 3-byte sequence in it.  A search only reads the blocks whose filter holds all of the
+   query's trigrams, so most blocks are never touched.  The block being filled sets OUTPUT_INDEX_FILTER_HASHES bits
+   per trigram in a filter of OUTPUT_INDEX_MAX_FILTER_BITS and when it closes that filter is folded in half for as
+   long as no more than OUTPUT_INDEX_MAX_FILTER_FILL percent of its bits would be set, so each block keeps a filter
+   sized to the number of distinct trigrams it really holds.  Indexing stops once the limit is reached, keeping the
+   start of a session (where the first error usually is) rather than its end.  Line numbers start at 1. */
+#define OUTPUT_INDEX_BLOCK_SIZE         (256 * 1024)
+#define OUTPUT_INDEX_MAX_BLOCK_SIZE     (2 * OUTPUT_INDEX_BLOCK_SIZE)
+#define OUTPUT_INDEX_FILTER_HASHES      3
+#define OUTPUT_INDEX_MIN_FILTER_BITS    1024
+#define OUTPUT_INDEX_MAX_FILTER_BITS    (1024 * 1024)
+#define OUTPUT_INDEX_MAX_FILTER_FILL    50
+
+typedef struct
+{
+    uint64_t  fileOffset;
+    uint64_t  firstLine;
+    uint64_t* pFilter;
+    uint32_t  filterMask;
+    uint32_t  length;
+} OutputIndexBlock;
+
+typedef struct
+{
+    uint64_t blocksScanned;
+    uint64_t blockCount;
+    uint64_t elapsedTime;
+} OutputIndexSearchStats;
+
+typedef void OutputIndexLineHandler(void* pContext, uint64_t lineNumber, const char* pLine, size_t length);
+
+typedef struct
+{
+    OutputIndexBlock* pBlocks;
+    char*             pCurrentData;
+    OutputIndexBlock  current;
+    uint64_t          limit;
+    uint64_t          fileSize;
+    size_t            filterBytes;
+    size_t            currentCapacity;
+    size_t            blockCount;
+    size_t            blockCapacity;
+    uint32_t          trigram;
+    int               fileDescriptor;
+    int               isFull;
+} OutputIndex;
+
+void     OutputIndex_Init(OutputIndex* pIndex, uint64_t limit);
+void     OutputIndex_Uninit(OutputIndex* pIndex);
+int      OutputIndex_IsEnabled(OutputIndex* pIndex);
+int      OutputIndex_IsFull(OutputIndex* pIndex);
+uint64_t OutputIndex_GetByteCount(OutputIndex* pIndex);
+uint64_t OutputIndex_GetLineCount(OutputIndex* pIndex);
+size_t   OutputIndex_GetMemoryUsage(OutputIndex* pIndex);
+void     OutputIndex_Append(OutputIndex* pIndex, const char* pData, size_t length);
+int      OutputIndex_Snapshot(OutputIndex* pIndex, OutputIndex* pSnapshot);
+size_t   OutputIndex_Save(OutputIndex* pIndex, char** ppData);
+int      OutputIndex_Restore(OutputIndex* pIndex, int fileDescriptor, const char* pData, size_t length);
+size_t   OutputIndex_Search(OutputIndex* pIndex, const char* pText, size_t textLength, size_t maxMatches,
+                            OutputIndexLineHandler* pHandler, void* pContext, OutputIndexSearchStats* pStats);
+size_t   OutputIndex_GetLines(OutputIndex* pIndex, uint64_t firstLine, size_t lineCount,
+                              OutputIndexLineHandler* pHandler, void* pContext);
+
+#endif /* _OUTPUTINDEX_H_ */
@@ -16,39 +16,97 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <string.h>
+#include <getopt.h>
 #include <sys/select.h>
 #include <unistd.h>
 #include "try_catch.h"
 #include "parameters.h"
+#include "backlog.h"
+#include "bufferpool.h"
+#include "console.h"
 
 static void     zeroOutParametersStructure(Parameters* pParameters);
-static void     allocateAndPopulateCommandArguments(Parameters* pParameters, int argc, const char** argv);
+static int      parseServerOptions(Parameters* pParameters, int argc, const char** argv);
+static int      parseShardCount(const char* pShardCountAsString);
+static int      parseConsoleMode(const char* pConsoleModeAsString);
+static int      parseClientOptions(Parameters* pParameters, int argc, const char** argv);
+static uint64_t parseByteCount(const char* pByteCountAsString);
+static void     addMirror(Parameters* pParameters, const char* pMirror);
+static int      parseControlPolicy(const char* pControlPolicyAsString);
+static int      parseNonNegativeInteger(const char* pIntegerAsString, long maximum);
+static void     allocateAndPopulateCommandArguments(Parameters* pParameters, const char* pCommand);
 static int      commandArgumentCount(void);
 static void     allocateCommandArguments(Parameters* pParameters, int numberOfArguments);
-static void     populateCommandArguments(Parameters* pParameters, int argc, const char** argv);
+static void     populateCommandArguments(Parameters* pParameters, const char* pCommand);
 static uint16_t parsePortNumber(const char* pPortNumberAsString);
 static void     displayCommandArguments(Parameters* pParameters);
 
 void Parameters_InitFromServerCommandLine(Parameters* pParameters, int argc, const char** argv)
 {
+    int firstArgument = 0;
+    
     zeroOutParametersStructure(pParameters);
     
-    if (argc < 2)
+    __try
+        firstArgument = parseServerOptions(pParameters, argc, argv);
+    __catch
+        __rethrow;
+    
+    if (argc - firstArgument < 1)
+        __throw(invalidCommandLineException);
+    
+    if (pParameters->pHandoffPath && pParameters->shardCount == 0)
+        __throw(invalidCommandLineException);
+    if ((pParameters->heartbeatSeconds || pParameters->idleTimeoutSeconds) && pParameters->shardCount == 0)
+        __throw(invalidCommandLineException);
+    if (pParameters->sessionMemoryLimit && pParameters->sessionMemoryLimit < BUFFER_POOL_MIN_SIZE)
+        __throw(invalidCommandLineException);
+    if (pParameters->dedupCacheSize && pParameters->shardCount == 0)
+        __throw(invalidCommandLineException);
+    if (pParameters->indexLimit && pParameters->shardCount == 0)
+        __throw(invalidCommandLineException);
+    if ((pParameters->memoryLimit || pParameters->sessionMemoryLimit) && pParameters->shardCount == 0)
         __throw(invalidCommandLineException);
     
-    pParameters->portNumber = parsePortNumber(argv[1]);
+    pParameters->portNumber = parsePortNumber(argv[firstArgument]);
+    if (pParameters->isConsoleAdaptive && !pParameters->pRecordPath)
+        pParameters->pRecordPath = CONSOLE_DEFAULT_RECORD_PATH;
 }
 
 void Parameters_InitFromClientCommandLine(Parameters* pParameters, int argc, const char** argv)
 {
+    int firstArgument = 0;
+    
     zeroOutParametersStructure(pParameters);
+    pParameters->backlogLimit = BACKLOG_DEFAULT_SPILL_LIMIT;
+    pParameters->busyPollCpu = -1;
+    pParameters->spinMicroseconds = PARAMETERS_DEFAULT_SPIN_BUDGET;
+    pParameters->drainSeconds = PARAMETERS_DEFAULT_DRAIN_SECONDS;
+    
+    __try
+        firstArgument = parseClientOptions(pParameters, argc, argv);
+    __catch
+        __rethrow;
     
-    if (argc < 4)
+    if (argc - firstArgument < 3)
+        __throw(invalidCommandLineException);
+    /* Followed files go out as plain output to the primary server only. */
+    if (pParameters->isFollowMode &&
+        (pParameters->mirrorCount || pParameters->isLineMode || pParameters->isDedupEnabled || pParameters->pEchoPath))
+        __throw(invalidCommandLineException);
+    /* Every line carries its own timestamp so lines never repeat. */
+    if (pParameters->isDedupEnabled && pParameters->isLineMode)
         __throw(invalidCommandLineException);
     
-    pParameters->address = argv[1];
-    pParameters->portNumber = parsePortNumber(argv[2]);
-    allocateAndPopulateCommandArguments(pParameters, argc, argv);
+    pParameters->address = argv[firstArgument];
+    pParameters->portNumber = parsePortNumber(argv[firstArgument + 1]);
+    if (pParameters->isFollowMode)
+    {
+        pParameters->ppFollowPaths = &argv[firstArgument + 2];
+        pParameters->followPathCount = argc - firstArgument - 2;
+        return;
+    }
+    allocateAndPopulateCommandArguments(pParameters, argv[firstArgument + 2]);
 }
 
 void Parameters_Uninit(Parameters* pParameters)
@@ -78,20 +136,382 @@ uint16_t Parameters_GetPortNumber(Parameters* pParameters)
     return pParameters->portNumber;
 }
 
+int Parameters_GetShardCount(Parameters* pParameters)
+{
+    return pParameters->shardCount;
+}
+
+int Parameters_IsLineMode(Parameters* pParameters)
+{
+    return pParameters->isLineMode;
+}
+
+int Parameters_IsTraceEnabled(Parameters* pParameters)
+{
+    return pParameters->isTraceEnabled;
+}
+
+uint64_t Parameters_GetBacklogLimit(Parameters* pParameters)
+{
+    return pParameters->backlogLimit;
+}
+
+int Parameters_GetMirrorCount(Parameters* pParameters)
+{
+    return pParameters->mirrorCount;
+}
+
+const char* Parameters_GetMirror(Parameters* pParameters, int index)
+{
+    return pParameters->mirrors[index];
+}
+
+int Parameters_CanMirrorsControl(Parameters* pParameters)
+{
+    return pParameters->canMirrorsControl;
+}
+
+int Parameters_GetBusyPollCpu(Parameters* pParameters)
+{
+    return pParameters->busyPollCpu;
+}
+
+uint32_t Parameters_GetSpinMicroseconds(Parameters* pParameters)
+{
+    return pParameters->spinMicroseconds;
+}
+
+int Parameters_IsConsoleAdaptive(Parameters* pParameters)
+{
+    return pParameters->isConsoleAdaptive;
+}
+
+const char* Parameters_GetRecordPath(Parameters* pParameters)
+{
+    return pParameters->pRecordPath;
+}
+
+uint64_t Parameters_GetIndexLimit(Parameters* pParameters)
+{
+    return pParameters->indexLimit;
+}
+
+const char* Parameters_GetHandoffPath(Parameters* pParameters)
+{
+    return pParameters->pHandoffPath;
+}
+
+uint64_t Parameters_GetMemoryLimit(Parameters* pParameters)
+{
+    return pParameters->memoryLimit;
+}
+
+uint64_t Parameters_GetSessionMemoryLimit(Parameters* pParameters)
+{
+    return pParameters->sessionMemoryLimit;
+}
+
+uint32_t Parameters_GetHeartbeatSeconds(Parameters* pParameters)
+{
+    return pParameters->heartbeatSeconds;
+}
+
+uint32_t Parameters_GetIdleTimeoutSeconds(Parameters* pParameters)
+{
+    return pParameters->idleTimeoutSeconds;
+}
+
+int Parameters_IsFollowMode(Parameters* pParameters)
+{
+    return pParameters->isFollowMode;
+}
+
+uint32_t Parameters_GetDrainSeconds(Parameters* pParameters)
+{
+    return pParameters->drainSeconds;
+}
+
+int Parameters_IsDedupEnabled(Parameters* pParameters)
+{
+    return pParameters->isDedupEnabled;
+}
+
+uint64_t Parameters_GetDedupCacheSize(Parameters* pParameters)
+{
+    return pParameters->dedupCacheSize;
+}
+
+const char* Parameters_GetEventsPath(Parameters* pParameters)
+{
+    return pParameters->pEventsPath;
+}
+
+const char* Parameters_GetEchoPath(Parameters* pParameters)
+{
+    return pParameters->pEchoPath;
+}
+
+int Parameters_GetFollowPathCount(Parameters* pParameters)
+{
+    return pParameters->followPathCount;
+}
+
+const char* Parameters_GetFollowPath(Parameters* pParameters, int index)
+{
+    return pParameters->ppFollowPaths[index];
+}
+
 
 static void zeroOutParametersStructure(Parameters* pParameters)
 {
     memset(pParameters, 0, sizeof(*pParameters));
 }
 
-static void allocateAndPopulateCommandArguments(Parameters* pParameters, int argc, const char** argv)
+static int parseServerOptions(Parameters* pParameters, int argc, const char** argv)
+{
+    static const struct option longOptions[] =
+    {
+        { "shards", required_argument, NULL, 's' },
+        { "console", required_argument, NULL, 'c' },
+        { "record", required_argument, NULL, 'r' },
+        { "index", required_argument, NULL, 'i' },
+        { "handoff", required_argument, NULL, 'h' },
+        { "memory", required_argument, NULL, 'm' },
+        { "session-memory", required_argument, NULL, 'q' },
+        { "heartbeat", required_argument, NULL, 'b' },
+        { "idle-timeout", required_argument, NULL, 't' },
+        { "dedup-cache", required_argument, NULL, 'd' },
+        { "events", required_argument, NULL, 'e' },
+        { NULL, 0, NULL, 0 }
+    };
+    int option = -1;
+    
+    optind = 1;
+    opterr = 0;
+    while ((option = getopt_long(argc, (char* const*)argv, "+s:c:r:i:h:m:q:b:t:d:e:", longOptions, NULL)) != -1)
+    {
+        switch (option)
+        {
+        case 's':
+            pParameters->shardCount = parseShardCount(optarg);
+            break;
+        case 'c':
+            pParameters->isConsoleAdaptive = parseConsoleMode(optarg);
+            break;
+        case 'r':
+            pParameters->pRecordPath = optarg;
+            break;
+        case 'i':
+            pParameters->indexLimit = parseByteCount(optarg);
+            break;
+        case 'h':
+            pParameters->pHandoffPath = optarg;
+            break;
+        case 'm':
+            pParameters->memoryLimit = parseByteCount(optarg);
+            break;
+        case 'q':
+            pParameters->sessionMemoryLimit = parseByteCount(optarg);
+            break;
+        case 'b':
+            pParameters->heartbeatSeconds = (uint32_t)parseNonNegativeInteger(optarg, PARAMETERS_MAX_TIMEOUT_SECONDS);
+            break;
+        case 't':
+            pParameters->idleTimeoutSeconds = (uint32_t)parseNonNegativeInteger(optarg, PARAMETERS_MAX_TIMEOUT_SECONDS);
+            break;
+        case 'd':
+            pParameters->dedupCacheSize = parseByteCount(optarg);
+            break;
+        case 'e':
+            pParameters->pEventsPath = optarg;
+            break;
+        default:
+            __throw_and_return(invalidCommandLineException, argc);
+        }
+        if (getExceptionCode())
+            __rethrow_and_return(argc);
+    }
+    
+    return optind;
+}
+
+static int parseShardCount(const char* pShardCountAsString)
+{
+    int shardCount = -1;
+    
+    if (0 == strcmp(pShardCountAsString, "auto"))
+    {
+        shardCount = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (shardCount < 1)
+        {
+            printf("error: Couldn't count the online CPUs for --shards auto.  Give a shard count instead.\n");
+            __throw_and_return(invalidCommandLineException, 0);
+        }
+        return shardCount < PARAMETERS_MAX_SHARDS ? shardCount : PARAMETERS_MAX_SHARDS;
+    }
+    
+    __try
+        shardCount = parseNonNegativeInteger(pShardCountAsString, PARAMETERS_MAX_SHARDS);
+    __catch
+        __rethrow_and_return(0);
+    if (shardCount < 1)
+        __throw_and_return(invalidCommandLineException, 0);
+    
+    return shardCount;
+}
+
+static int parseConsoleMode(const char* pConsoleModeAsString)
+{
+    if (0 == strcmp(pConsoleModeAsString, "adaptive"))
+        return 1;
+    if (0 != strcmp(pConsoleModeAsString, "direct"))
+        __throw_and_return(invalidCommandLineException, 0);
+    
+    return 0;
+}
+
+static int parseClientOptions(Parameters* pParameters, int argc, const char** argv)
+{
+    static const struct option longOptions[] =
+    {
+        { "lines", no_argument, NULL, 'l' },
+        { "trace", no_argument, NULL, 't' },
+        { "backlog", required_argument, NULL, 'b' },
+        { "mirror", required_argument, NULL, 'm' },
+        { "control", required_argument, NULL, 'c' },
+        { "busy-poll", required_argument, NULL, 'p' },
+        { "spin", required_argument, NULL, 's' },
+        { "follow", no_argument, NULL, 'f' },
+        { "drain", required_argument, NULL, 'd' },
+        { "dedup", no_argument, NULL, 'u' },
+        { "echo", required_argument, NULL, 'e' },
+        { NULL, 0, NULL, 0 }
+    };
+    int option = -1;
+    
+    optind = 1;
+    opterr = 0;
+    while ((option = getopt_long(argc, (char* const*)argv, "+ltb:m:c:p:s:fd:ue:", longOptions, NULL)) != -1)
+    {
+        switch (option)
+        {
+        case 'l':
+            pParameters->isLineMode = 1;
+            break;
+        case 't':
+            pParameters->isTraceEnabled = 1;
+            break;
+        case 'f':
+            pParameters->isFollowMode = 1;
+            break;
+        case 'u':
+            pParameters->isDedupEnabled = 1;
+            break;
+        case 'e':
+            pParameters->pEchoPath = optarg;
+            break;
+        case 'd':
+            pParameters->drainSeconds = (uint32_t)parseNonNegativeInteger(optarg, PARAMETERS_MAX_TIMEOUT_SECONDS);
+            break;
+        case 'b':
+            pParameters->backlogLimit = parseByteCount(optarg);
+            break;
+        case 'm':
+            addMirror(pParameters, optarg);
+            break;
+        case 'c':
+            pParameters->canMirrorsControl = parseControlPolicy(optarg);
+            break;
+        case 'p':
+            pParameters->busyPollCpu = parseNonNegativeInteger(optarg, sysconf(_SC_NPROCESSORS_CONF) - 1);
+            break;
+        case 's':
+            pParameters->spinMicroseconds = (uint32_t)parseNonNegativeInteger(optarg, 1000000);
+            break;
+        default:
+            __throw_and_return(invalidCommandLineException, argc);
+        }
+        if (getExceptionCode())
+            __rethrow_and_return(argc);
+    }
+    
+    return optind;
+}
+
+static uint64_t parseByteCount(const char* pByteCountAsString)
+{
+    char*              pSuffix = NULL;
+    unsigned long long byteCount = strtoull(pByteCountAsString, &pSuffix, 10);
+    
+    if (pSuffix == pByteCountAsString)
+        __throw_and_return(invalidCommandLineException, 0);
+    switch (*pSuffix)
+    {
+    case 'k':
+    case 'K':
+        byteCount <<= 10;
+        pSuffix++;
+        break;
+    case 'm':
+    case 'M':
+        byteCount <<= 20;
+        pSuffix++;
+        break;
+    case 'g':
+    case 'G':
+        byteCount <<= 30;
+        pSuffix++;
+        break;
+    }
+    if (*pSuffix != '\0')
+        __throw_and_return(invalidCommandLineException, 0);
+    
+    return byteCount;
+}
+
+static void addMirror(Parameters* pParameters, const char* pMirror)
+{
+    const char* pColon = strrchr(pMirror, ':');
+    
+    if (pParameters->mirrorCount >= PARAMETERS_MAX_MIRRORS || !pColon || pColon == pMirror)
+        __throw(invalidCommandLineException);
+    __try
+        parsePortNumber(pColon + 1);
+    __catch
+        __rethrow;
+    
+    pParameters->mirrors[pParameters->mirrorCount++] = pMirror;
+}
+
+static int parseControlPolicy(const char* pControlPolicyAsString)
+{
+    if (0 == strcmp(pControlPolicyAsString, "all"))
+        return 1;
+    if (0 != strcmp(pControlPolicyAsString, "primary"))
+        __throw_and_return(invalidCommandLineException, 0);
+    
+    return 0;
+}
+
+static int parseNonNegativeInteger(const char* pIntegerAsString, long maximum)
+{
+    char* pEnd = NULL;
+    long  value = strtol(pIntegerAsString, &pEnd, 10);
+    
+    if (*pIntegerAsString == '\0' || *pEnd != '\0' || value < 0 || value > maximum)
+        __throw_and_return(invalidCommandLineException, 0);
+    
+    return (int)value;
+}
+
+static void allocateAndPopulateCommandArguments(Parameters* pParameters, const char* pCommand)
 {
     __try
         allocateCommandArguments(pParameters, commandArgumentCount());
     __catch
         __rethrow;
     
-    populateCommandArguments(pParameters, argc, argv);
+    populateCommandArguments(pParameters, pCommand);
 }
 
 static int commandArgumentCount(void)
@@ -109,13 +529,13 @@ static void allocateCommandArguments(Parameters* pParameters, int numberOfArgume
         __throw(outOfMemoryException);
 }
 
-static void populateCommandArguments(Parameters* pParameters, int argc, const char** argv)
+static void populateCommandArguments(Parameters* pParameters, const char* pCommand)
 {
     const char**  ppDest = pParameters->ppCommandArguments;
     
     *ppDest++ = "sh";
     *ppDest++ = "-c";
-    *ppDest++ = argv[3];
+    *ppDest++ = pCommand;
     *ppDest++ = NULL;
 }
 
@@ -17,11 +17,43 @@
 
 #include <stdint.h>
 
+#define PARAMETERS_MAX_MIRRORS              4
+#define PARAMETERS_DEFAULT_SPIN_BUDGET      500
+#define PARAMETERS_MAX_TIMEOUT_SECONDS      86400
+#define PARAMETERS_DEFAULT_DRAIN_SECONDS    5
+/* The shard index takes the top 8 bits of every session id. */
+#define PARAMETERS_MAX_SHARDS               256
+
 typedef struct
 {
     const char** ppCommandArguments;
     const char*  address;
+    const char*  mirrors[PARAMETERS_MAX_MIRRORS];
     uint16_t     portNumber;
+    int          shardCount;
+    int          isLineMode;
+    int          isTraceEnabled;
+    uint64_t     backlogLimit;
+    const char*  pRecordPath;
+    int          isConsoleAdaptive;
+    int          mirrorCount;
+    int          canMirrorsControl;
+    int          busyPollCpu;
+    uint32_t     spinMicroseconds;
+    uint64_t     indexLimit;
+    const char*  pHandoffPath;
+    uint64_t     memoryLimit;
+    uint64_t     sessionMemoryLimit;
+    uint32_t     heartbeatSeconds;
+    uint32_t     idleTimeoutSeconds;
+    int          isFollowMode;
+    uint32_t     drainSeconds;
+    int          isDedupEnabled;
+    uint64_t     dedupCacheSize;
+    const char*  pEventsPath;
+    const char*  pEchoPath;
+    const char** ppFollowPaths;
+    int          followPathCount;
 } Parameters;
 
 void         Parameters_InitFromServerCommandLine(Parameters* pParameters, int argc, const char** argv);
@@ -31,5 +63,30 @@ void         Parameters_Display(Parameters* pParameters);
 const char** Parameters_GetCommandArguments(Parameters* pParameters);
 const char*  Parameters_GetAddress(Parameters* pParameters);
 uint16_t     Parameters_GetPortNumber(Parameters* pParameters);
+int          Parameters_GetShardCount(Parameters* pParameters);
+int          Parameters_IsLineMode(Parameters* pParameters);
+int          Parameters_IsTraceEnabled(Parameters* pParameters);
+uint64_t     Parameters_GetBacklogLimit(Parameters* pParameters);
+int          Parameters_GetMirrorCount(Parameters* pParameters);
+const char*  Parameters_GetMirror(Parameters* pParameters, int index);
+int          Parameters_CanMirrorsControl(Parameters* pParameters);
+int          Parameters_GetBusyPollCpu(Parameters* pParameters);
+uint32_t     Parameters_GetSpinMicroseconds(Parameters* pParameters);
+int          Parameters_IsConsoleAdaptive(Parameters* pParameters);
+uint64_t     Parameters_GetIndexLimit(Parameters* pParameters);
+const char*  Parameters_GetHandoffPath(Parameters* pParameters);
+uint64_t     Parameters_GetMemoryLimit(Parameters* pParameters);
+uint64_t     Parameters_GetSessionMemoryLimit(Parameters* pParameters);
+uint32_t     Parameters_GetHeartbeatSeconds(Parameters* pParameters);
+uint32_t     Parameters_GetIdleTimeoutSeconds(Parameters* pParameters);
+int          Parameters_IsFollowMode(Parameters* pParameters);
+uint32_t     Parameters_GetDrainSeconds(Parameters* pParameters);
+int          Parameters_IsDedupEnabled(Parameters* pParameters);
+uint64_t     Parameters_GetDedupCacheSize(Parameters* pParameters);
+const char*  Parameters_GetEventsPath(Parameters* pParameters);
+const char*  Parameters_GetEchoPath(Parameters* pParameters);
+int          Parameters_GetFollowPathCount(Parameters* pParameters);
+const char*  Parameters_GetFollowPath(Parameters* pParameters, int index);
+const char*  Parameters_GetRecordPath(Parameters* pParameters);
 
 #endif /* _PARAMETERS_H_ */
@@ -16,8 +16,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include "try_catch.h"
+#include "timestamp.h"
 #include "process.h"
 
 static void flagProcessStructureAsEmpty(Process* pProcess);
@@ -28,15 +33,20 @@ static void setupPipesInChildProcess(Process* pProcess);
 static void executeNewCommandInChildProcess(Process* pProcess);
 static const char** getCommandArguments(Process* pProcess);
 static void setChildPid(Process* pProcess, int pid);
+static void closeFileDescriptorsUsedByChild(Process* pProcess);
+static int  openPidFileDescriptor(int pid);
 static void setupFileDescriptorsUsedByParentToCommunicateWithChild(Process* pProcess);
 static void closePipeFileDescriptors(Process* pProcess);
 static void closePipeFileDescriptor(int fileDescriptor);
 static void killChildProcess(Process* pProcess);
+static void closePidFileDescriptor(Process* pProcess);
+static int  waitForPidFileDescriptor(Process* pProcess, int timeoutMilliseconds);
 
 void Process_Init(Process* pProcess, Parameters* pParameters)
 {
     flagProcessStructureAsEmpty(pProcess);
     pProcess->pParameters = pParameters;
+    pProcess->isReaped = 0;
 
     __try
     {
@@ -53,9 +63,85 @@ void Process_Uninit(Process* pProcess)
 {
     closePipeFileDescriptors(pProcess);
     killChildProcess(pProcess);
+    closePidFileDescriptor(pProcess);
     flagProcessStructureAsEmpty(pProcess);
 }
 
+int Process_TryReap(Process* pProcess)
+{
+    pid_t result = -1;
+    
+    if (pProcess->isReaped)
+        return 1;
+    
+    result = wait4(pProcess->pid, &pProcess->exitStatus, WNOHANG, &pProcess->usage);
+    if (result != pProcess->pid)
+        return 0;
+    
+    pProcess->exitTime = Timestamp_Now();
+    pProcess->isReaped = 1;
+    return 1;
+}
+
+int Process_WaitForExit(Process* pProcess, int timeoutMilliseconds)
+{
+    static const int pollIntervalMilliseconds = 10;
+    
+    if (Process_TryReap(pProcess))
+        return 1;
+    if (pProcess->pidFileDescriptor >= 0)
+        return waitForPidFileDescriptor(pProcess, timeoutMilliseconds);
+    
+    while (timeoutMilliseconds > 0)
+    {
+        usleep(pollIntervalMilliseconds * 1000);
+        timeoutMilliseconds -= pollIntervalMilliseconds;
+        if (Process_TryReap(pProcess))
+            return 1;
+    }
+    return 0;
+}
+
+static int waitForPidFileDescriptor(Process* pProcess, int timeoutMilliseconds)
+{
+    struct pollfd pollDescriptor;
+    
+    pollDescriptor.fd = pProcess->pidFileDescriptor;
+    pollDescriptor.events = POLLIN;
+    pollDescriptor.revents = 0;
+    while (poll(&pollDescriptor, 1, timeoutMilliseconds) < 0 && errno == EINTR)
+    {
+    }
+    
+    return Process_TryReap(pProcess);
+}
+
+int Process_HasExited(Process* pProcess)
+{
+    return pProcess->isReaped;
+}
+
+void Process_Terminate(Process* pProcess)
+{
+    /* Unlike Process_Uninit() this gives the child a chance to flush and exit on its own. */
+    if (pProcess->pid < 0 || pProcess->isReaped)
+        return;
+    kill(pProcess->pid, SIGTERM);
+}
+
+void Process_GetExitReport(Process* pProcess, ExitReport* pReport)
+{
+    const struct rusage* pUsage = &pProcess->usage;
+    
+    pReport->status = pProcess->exitStatus;
+    pReport->elapsedNanoseconds = pProcess->exitTime - pProcess->startTime;
+    pReport->userMicroseconds = (uint64_t)pUsage->ru_utime.tv_sec * 1000000ULL + pUsage->ru_utime.tv_usec;
+    pReport->systemMicroseconds = (uint64_t)pUsage->ru_stime.tv_sec * 1000000ULL + pUsage->ru_stime.tv_usec;
+    pReport->maxResidentKilobytes = pUsage->ru_maxrss;
+    pReport->voluntaryContextSwitches = pUsage->ru_nvcsw;
+    pReport->involuntaryContextSwitches = pUsage->ru_nivcsw;
+}
+
 static void flagProcessStructureAsEmpty(Process* pProcess)
 {
     memset(pProcess, 0xff, sizeof(*pProcess));
@@ -99,6 +185,7 @@ static void forkNewProcessAndSetupPipes(Process* pProcess)
 {
     int pid = -1;
     
+    pProcess->startTime = Timestamp_Now();
     pid = fork();
     if (pid < 0)
     {
@@ -112,6 +199,7 @@ static void forkNewProcessAndSetupPipes(Process* pProcess)
     else
     {
         setChildPid(pProcess, pid);
+        closeFileDescriptorsUsedByChild(pProcess);
     }
 }
 
@@ -128,6 +216,7 @@ static void setupPipesInChildProcess(Process* pProcess)
     result = dup2(pProcess->pipeFileDescriptors[STDERR_WRITE], fileno(stderr));
     if (result < 0)
         exit(1);
+    closePipeFileDescriptors(pProcess);
 }
 
 static void executeNewCommandInChildProcess(Process* pProcess)
@@ -147,6 +236,28 @@ static const char** getCommandArguments(Process* pProcess)
 static void setChildPid(Process* pProcess, int pid)
 {
     pProcess->pid = pid;
+    pProcess->pidFileDescriptor = openPidFileDescriptor(pid);
+}
+
+static void closeFileDescriptorsUsedByChild(Process* pProcess)
+{
+    /* Only once the parent has let go of the write ends does the child exiting show up as end of file on its
+       output pipes. */
+    closePipeFileDescriptor(pProcess->pipeFileDescriptors[STDIN_READ]);
+    closePipeFileDescriptor(pProcess->pipeFileDescriptors[STDOUT_WRITE]);
+    closePipeFileDescriptor(pProcess->pipeFileDescriptors[STDERR_WRITE]);
+    pProcess->pipeFileDescriptors[STDIN_READ] = -1;
+    pProcess->pipeFileDescriptors[STDOUT_WRITE] = -1;
+    pProcess->pipeFileDescriptors[STDERR_WRITE] = -1;
+}
+
+static int openPidFileDescriptor(int pid)
+{
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    return -1;
+#endif
 }
 
 static void closePipeFileDescriptors(Process* pProcess)
@@ -167,6 +278,15 @@ static void closePipeFileDescriptor(int fileDescriptor)
 
 static void killChildProcess(Process* pProcess)
 {
-    if (pProcess->pid >= 0)
-        kill(pProcess->pid, SIGKILL);
+    if (pProcess->pid < 0 || pProcess->isReaped)
+        return;
+    
+    kill(pProcess->pid, SIGKILL);
+    waitpid(pProcess->pid, NULL, 0);
+}
+
+static void closePidFileDescriptor(Process* pProcess)
+{
+    if (pProcess->pidFileDescriptor >= 0)
+        close(pProcess->pidFileDescriptor);
 }
@@ -15,7 +15,10 @@
 #ifndef _PROCESS_H_
 #define _PROCESS_H_
 
+#include <stdint.h>
+#include <sys/resource.h>
 #include "parameters.h"
+#include "exitreport.h"
 
 typedef enum
 {
@@ -36,9 +39,20 @@ typedef struct
     int         stdout;
     int         stderr;
     int         pid;
+    int         pidFileDescriptor;
+    int         isReaped;
+    int         exitStatus;
+    uint64_t    startTime;
+    uint64_t    exitTime;
+    struct rusage usage;
 } Process;
 
 void Process_Init(Process* pProcess, Parameters* pParameters);
 void Process_Uninit(Process* pProcess);
+int  Process_TryReap(Process* pProcess);
+int  Process_WaitForExit(Process* pProcess, int timeoutMilliseconds);
+int  Process_HasExited(Process* pProcess);
+void Process_Terminate(Process* pProcess);
+void Process_GetExitReport(Process* pProcess, ExitReport* pReport);
 
 #endif /* _PROCESS_H_ */
@@ -0,0 +1,798 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include "try_catch.h"
+#include "protocol.h"
+#include "bufferpool.h"
+
+
+#define FRAME_READER_INITIAL_SIZE   (16 * 1024)
+#define PROTOCOL_MAX_VECTOR_COUNT   8
+
+
+static void   makeRoomForReceive(FrameReader* pReader);
+static void   compactBuffer(FrameReader* pReader);
+static void   growBuffer(FrameReader* pReader);
+static void   growPooledBuffer(FrameReader* pReader, size_t newSize);
+static size_t bytesBuffered(FrameReader* pReader);
+static int    wouldBlock(void);
+static void   writeVector(FrameWriter* pWriter, struct iovec* pVector, int vectorCount, int flags);
+static void   queueVector(FrameWriter* pWriter, const struct iovec* pVector, int vectorCount);
+static char*  reserveQueueSpace(FrameWriter* pWriter, size_t length);
+static size_t writeFileData(FrameWriter* pWriter, int fileDescriptor, uint64_t fileOffset, size_t fileLength);
+static void   failWriter(FrameWriter* pWriter, int exceptionCode);
+static ssize_t sendWithoutBlocking(int socket, struct iovec* pVector, int vectorCount, int flags);
+static void   sendVectorCompletely(int socket, struct iovec* pVector, int vectorCount, int flags);
+static void   advanceVector(struct iovec** ppVector, int* pVectorCount, size_t bytesSent);
+static void   waitForSocketToBeWritable(int socket);
+static size_t sendFileDataCompletely(int socket, int fileDescriptor, uint64_t fileOffset, size_t fileLength);
+static void   sendPaddingCompletely(int socket, size_t length);
+
+
+void FrameReader_Init(FrameReader* pReader)
+{
+    memset(pReader, 0, sizeof(*pReader));
+    pReader->pBuffer = malloc(FRAME_READER_INITIAL_SIZE);
+    if (!pReader->pBuffer)
+        __throw(outOfMemoryException);
+    pReader->bufferSize = FRAME_READER_INITIAL_SIZE;
+}
+
+void FrameReader_InitPooled(FrameReader* pReader, struct BufferPool* pPool)
+{
+    memset(pReader, 0, sizeof(*pReader));
+    pReader->pPool = pPool;
+}
+
+void FrameReader_Uninit(FrameReader* pReader)
+{
+    if (pReader->pPool)
+        BufferPool_Free(pReader->pPool, pReader->pBuffer, pReader->bufferSize);
+    else
+        free(pReader->pBuffer);
+    memset(pReader, 0, sizeof(*pReader));
+}
+
+void FrameReader_ReleaseIdleBuffer(FrameReader* pReader)
+{
+    if (!pReader->pPool || !pReader->pBuffer || bytesBuffered(pReader) > 0)
+        return;
+
+    BufferPool_Free(pReader->pPool, pReader->pBuffer, pReader->bufferSize);
+    pReader->pBuffer = NULL;
+    pReader->bufferSize = 0;
+    pReader->readOffset = pReader->writeOffset = 0;
+}
+
+int FrameReader_Receive(FrameReader* pReader, int socket)
+{
+    return FrameReader_ReceiveAtMost(pReader, socket, SIZE_MAX);
+}
+
+int FrameReader_ReceiveAtMost(FrameReader* pReader, int socket, size_t maximum)
+{
+    size_t  room = 0;
+    ssize_t bytesRead = -1;
+
+    __try
+        makeRoomForReceive(pReader);
+    __catch
+        __rethrow_and_return(-1);
+
+    room = pReader->bufferSize - pReader->writeOffset;
+    bytesRead = recv(socket, pReader->pBuffer + pReader->writeOffset, room < maximum ? room : maximum, 0);
+    if (bytesRead < 0 && wouldBlock())
+        return -1;
+    if (bytesRead < 0)
+        __throw_and_return(socketException, -1);
+
+    pReader->writeOffset += bytesRead;
+    return (int)bytesRead;
+}
+
+int FrameReader_ReceiveTimestamped(FrameReader* pReader, int socket, uint64_t* pKernelReceiveTime)
+{
+    char            control[CMSG_SPACE(sizeof(struct timespec))];
+    struct iovec    vector;
+    struct msghdr   message;
+    struct cmsghdr* pControl = NULL;
+    ssize_t         bytesRead = -1;
+
+    __try
+        makeRoomForReceive(pReader);
+    __catch
+        __rethrow_and_return(-1);
+
+    vector.iov_base = pReader->pBuffer + pReader->writeOffset;
+    vector.iov_len = pReader->bufferSize - pReader->writeOffset;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    bytesRead = recvmsg(socket, &message, 0);
+    if (bytesRead < 0 && wouldBlock())
+        return -1;
+    if (bytesRead < 0)
+        __throw_and_return(socketException, -1);
+
+    /* The timestamp is only there once Protocol_EnableReceiveTimestamps() has been called on the socket. */
+    for (pControl = CMSG_FIRSTHDR(&message) ; pControl ; pControl = CMSG_NXTHDR(&message, pControl))
+    {
+        if (pControl->cmsg_level == SOL_SOCKET && pControl->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            struct timespec receiveTime;
+
+            memcpy(&receiveTime, CMSG_DATA(pControl), sizeof(receiveTime));
+            *pKernelReceiveTime = (uint64_t)receiveTime.tv_sec * 1000000000ULL + receiveTime.tv_nsec;
+        }
+    }
+
+    pReader->writeOffset += bytesRead;
+    return (int)bytesRead;
+}
+
+static void makeRoomForReceive(FrameReader* pReader)
+{
+    if (pReader->writeOffset < pReader->bufferSize)
+        return;
+    if (pReader->readOffset > 0)
+    {
+        compactBuffer(pReader);
+        return;
+    }
+    growBuffer(pReader);
+}
+
+static void compactBuffer(FrameReader* pReader)
+{
+    size_t bytesToMove = bytesBuffered(pReader);
+
+    memmove(pReader->pBuffer, pReader->pBuffer + pReader->readOffset, bytesToMove);
+    pReader->readOffset = 0;
+    pReader->writeOffset = bytesToMove;
+}
+
+static void growBuffer(FrameReader* pReader)
+{
+    size_t newSize = pReader->bufferSize ? pReader->bufferSize * 2 : FRAME_READER_INITIAL_SIZE;
+    char*  pNewBuffer = NULL;
+
+    if (newSize > PROTOCOL_HEADER_SIZE + PROTOCOL_MAX_PAYLOAD_SIZE)
+        newSize = PROTOCOL_HEADER_SIZE + PROTOCOL_MAX_PAYLOAD_SIZE;
+    if (newSize <= pReader->bufferSize)
+        __throw(clientException);
+    if (pReader->pPool)
+    {
+        __try
+            growPooledBuffer(pReader, newSize);
+        __catch
+            __rethrow;
+        return;
+    }
+
+    pNewBuffer = realloc(pReader->pBuffer, newSize);
+    if (!pNewBuffer)
+        __throw(outOfMemoryException);
+    pReader->pBuffer = pNewBuffer;
+    pReader->bufferSize = newSize;
+}
+
+static void growPooledBuffer(FrameReader* pReader, size_t newSize)
+{
+    char* pNewBuffer = NULL;
+
+    newSize = BufferPool_SizeFor(pReader->pPool, newSize);
+    pNewBuffer = BufferPool_Allocate(pReader->pPool, newSize);
+    if (!pNewBuffer)
+        __throw(outOfMemoryException);
+    if (pReader->pBuffer)
+        memcpy(pNewBuffer, pReader->pBuffer + pReader->readOffset, bytesBuffered(pReader));
+    pReader->writeOffset = bytesBuffered(pReader);
+    pReader->readOffset = 0;
+    BufferPool_Free(pReader->pPool, pReader->pBuffer, pReader->bufferSize);
+    pReader->pBuffer = pNewBuffer;
+    pReader->bufferSize = newSize;
+}
+
+static size_t bytesBuffered(FrameReader* pReader)
+{
+    return pReader->writeOffset - pReader->readOffset;
+}
+
+static int wouldBlock(void)
+{
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+int FrameReader_NextFrame(FrameReader* pReader, FrameHeader* pHeader, const char** ppPayload)
+{
+    const char* pCurrent = pReader->pBuffer + pReader->readOffset;
+
+    if (bytesBuffered(pReader) < PROTOCOL_HEADER_SIZE)
+        return 0;
+    Protocol_DecodeHeader(pHeader, pCurrent);
+    if (pHeader->length > PROTOCOL_MAX_PAYLOAD_SIZE)
+        __throw_and_return(clientException, 0);
+    if (bytesBuffered(pReader) < PROTOCOL_HEADER_SIZE + pHeader->length)
+        return 0;
+
+    *ppPayload = pCurrent + PROTOCOL_HEADER_SIZE;
+    pReader->readOffset += PROTOCOL_HEADER_SIZE + pHeader->length;
+    if (pReader->readOffset == pReader->writeOffset)
+        pReader->readOffset = pReader->writeOffset = 0;
+
+    return 1;
+}
+
+size_t FrameReader_GetBuffered(FrameReader* pReader, const char** ppData)
+{
+    *ppData = pReader->pBuffer + pReader->readOffset;
+    return bytesBuffered(pReader);
+}
+
+void FrameReader_Preload(FrameReader* pReader, const char* pData, size_t length)
+{
+    pReader->readOffset = pReader->writeOffset = 0;
+    if (length == 0)
+        return;
+    while (length > pReader->bufferSize)
+    {
+        __try
+            growBuffer(pReader);
+        __catch
+            __rethrow;
+    }
+    memcpy(pReader->pBuffer, pData, length);
+    pReader->writeOffset = length;
+}
+
+void Protocol_EncodeHeader(char* pDest, const FrameHeader* pHeader)
+{
+    Protocol_PutUint32(pDest, pHeader->length);
+    pDest[4] = (char)pHeader->type;
+    pDest[5] = (char)pHeader->flags;
+    pDest[6] = (char)(pHeader->channel >> 8);
+    pDest[7] = (char)pHeader->channel;
+}
+
+void Protocol_DecodeHeader(FrameHeader* pHeader, const char* pSource)
+{
+    const uint8_t* pBytes = (const uint8_t*)pSource;
+
+    pHeader->length = Protocol_GetUint32(pSource);
+    pHeader->type = pBytes[4];
+    pHeader->flags = pBytes[5];
+    pHeader->channel = (uint16_t)((pBytes[6] << 8) | pBytes[7]);
+}
+
+void Protocol_SendFrame(int socket, uint8_t type, uint8_t flags, uint16_t channel, const void* pPayload, size_t length)
+{
+    FrameWriter writer;
+
+    FrameWriter_Init(&writer, socket, 0);
+    FrameWriter_SendFrame(&writer, type, flags, channel, pPayload, length);
+}
+
+void Protocol_SendFrameToChannels(int socket, uint8_t type, uint8_t flags, const uint16_t* pChannels, int channelCount,
+                                  const void* pPayload, size_t length)
+{
+    FrameWriter writer;
+
+    FrameWriter_Init(&writer, socket, 0);
+    FrameWriter_SendFrameToChannels(&writer, type, flags, pChannels, channelCount, pPayload, length);
+}
+
+void Protocol_SendFrameVector(int socket, uint8_t type, uint8_t flags, uint16_t channel,
+                              const struct iovec* pVector, int vectorCount)
+{
+    FrameWriter writer;
+
+    FrameWriter_Init(&writer, socket, 0);
+    FrameWriter_SendFrameVector(&writer, type, flags, channel, pVector, vectorCount);
+}
+
+size_t Protocol_SendFrameWithFileData(int socket, uint8_t type, uint8_t flags, uint16_t channel,
+                                      const void* pPrefix, size_t prefixLength,
+                                      int fileDescriptor, uint64_t fileOffset, size_t fileLength)
+{
+    FrameWriter writer;
+
+    FrameWriter_Init(&writer, socket, 0);
+    return FrameWriter_SendFrameWithFileData(&writer, type, flags, channel, pPrefix, prefixLength,
+                                             fileDescriptor, fileOffset, fileLength);
+}
+
+void FrameWriter_Init(FrameWriter* pWriter, int socket, size_t maxQueued)
+{
+    pWriter->pQueued = NULL;
+    pWriter->queuedOffset = 0;
+    pWriter->queuedLength = 0;
+    pWriter->maxQueued = maxQueued;
+    pWriter->socket = socket;
+    pWriter->exceptionCode = noException;
+}
+
+void FrameWriter_Uninit(FrameWriter* pWriter)
+{
+    free(pWriter->pQueued);
+    pWriter->pQueued = NULL;
+    pWriter->queuedOffset = 0;
+    pWriter->queuedLength = 0;
+}
+
+void FrameWriter_SendFrame(FrameWriter* pWriter, uint8_t type, uint8_t flags, uint16_t channel,
+                           const void* pPayload, size_t length)
+{
+    struct iovec vector;
+
+    vector.iov_base = (void*)pPayload;
+    vector.iov_len = length;
+    FrameWriter_SendFrameVector(pWriter, type, flags, channel, &vector, length ? 1 : 0);
+}
+
+void FrameWriter_SendFrameToChannels(FrameWriter* pWriter, uint8_t type, uint8_t flags,
+                                     const uint16_t* pChannels, int channelCount, const void* pPayload, size_t length)
+{
+    struct iovec vectors[2 * PROTOCOL_MAX_BATCH_FRAMES];
+    char         headerBuffers[PROTOCOL_MAX_BATCH_FRAMES][PROTOCOL_HEADER_SIZE];
+    FrameHeader  header;
+
+    header.length = length;
+    header.type = type;
+    header.flags = flags;
+    while (channelCount > 0)
+    {
+        int batchCount = channelCount < PROTOCOL_MAX_BATCH_FRAMES ? channelCount : PROTOCOL_MAX_BATCH_FRAMES;
+        int vectorCount = 0;
+        int i;
+
+        /* Every copy of the frame points at the same payload; only the headers differ. */
+        for (i = 0 ; i < batchCount ; i++)
+        {
+            header.channel = pChannels[i];
+            Protocol_EncodeHeader(headerBuffers[i], &header);
+            vectors[vectorCount].iov_base = headerBuffers[i];
+            vectors[vectorCount++].iov_len = PROTOCOL_HEADER_SIZE;
+            if (length == 0)
+                continue;
+            vectors[vectorCount].iov_base = (void*)pPayload;
+            vectors[vectorCount++].iov_len = length;
+        }
+        __try
+            writeVector(pWriter, vectors, vectorCount, 0);
+        __catch
+            __rethrow;
+
+        pChannels += batchCount;
+        channelCount -= batchCount;
+    }
+}
+
+void FrameWriter_SendFrameVector(FrameWriter* pWriter, uint8_t type, uint8_t flags, uint16_t channel,
+                                 const struct iovec* pVector, int vectorCount)
+{
+    struct iovec vectors[PROTOCOL_MAX_VECTOR_COUNT + 1];
+    char         headerBuffer[PROTOCOL_HEADER_SIZE];
+    FrameHeader  header;
+    int          i;
+
+    if (vectorCount > PROTOCOL_MAX_VECTOR_COUNT)
+        __throw(socketException);
+
+    header.length = 0;
+    for (i = 0 ; i < vectorCount ; i++)
+    {
+        vectors[i + 1] = pVector[i];
+        header.length += pVector[i].iov_len;
+    }
+    header.type = type;
+    header.flags = flags;
+    header.channel = channel;
+    Protocol_EncodeHeader(headerBuffer, &header);
+    vectors[0].iov_base = headerBuffer;
+    vectors[0].iov_len = sizeof(headerBuffer);
+
+    writeVector(pWriter, vectors, vectorCount + 1, 0);
+}
+
+size_t FrameWriter_SendFrameWithFileData(FrameWriter* pWriter, uint8_t type, uint8_t flags, uint16_t channel,
+                                         const void* pPrefix, size_t prefixLength,
+                                         int fileDescriptor, uint64_t fileOffset, size_t fileLength)
+{
+    struct iovec vectors[2];
+    char         headerBuffer[PROTOCOL_HEADER_SIZE];
+    FrameHeader  header;
+    size_t       bytesSent = 0;
+
+    header.length = prefixLength + fileLength;
+    header.type = type;
+    header.flags = flags;
+    header.channel = channel;
+    Protocol_EncodeHeader(headerBuffer, &header);
+    vectors[0].iov_base = headerBuffer;
+    vectors[0].iov_len = sizeof(headerBuffer);
+    vectors[1].iov_base = (void*)pPrefix;
+    vectors[1].iov_len = prefixLength;
+
+    __try
+    {
+        __throwing_func( writeVector(pWriter, vectors, 2, fileLength ? MSG_MORE : 0) );
+        if (pWriter->maxQueued)
+        {
+            __throwing_func( bytesSent = writeFileData(pWriter, fileDescriptor, fileOffset, fileLength) );
+        }
+        else
+        {
+            __throwing_func( bytesSent = sendFileDataCompletely(pWriter->socket, fileDescriptor, fileOffset,
+                                                                fileLength) );
+            __throwing_func( sendPaddingCompletely(pWriter->socket, fileLength - bytesSent) );
+        }
+    }
+    __catch
+    {
+        __rethrow_and_return(bytesSent);
+    }
+    return bytesSent;
+}
+
+void FrameWriter_Flush(FrameWriter* pWriter)
+{
+    struct iovec vector;
+    ssize_t      bytesSent = -1;
+
+    if (pWriter->exceptionCode != noException)
+        __throw(pWriter->exceptionCode);
+    if (pWriter->queuedLength == 0)
+        return;
+
+    vector.iov_base = pWriter->pQueued + pWriter->queuedOffset;
+    vector.iov_len = pWriter->queuedLength - pWriter->queuedOffset;
+    bytesSent = sendWithoutBlocking(pWriter->socket, &vector, 1, 0);
+    if (bytesSent < 0)
+    {
+        __try
+            failWriter(pWriter, socketException);
+        __catch
+            __rethrow;
+    }
+    pWriter->queuedOffset += bytesSent;
+    if (pWriter->queuedOffset == pWriter->queuedLength)
+        FrameWriter_Uninit(pWriter);
+}
+
+int FrameWriter_HasQueuedData(FrameWriter* pWriter)
+{
+    return pWriter->queuedLength > 0;
+}
+
+int FrameWriter_GetExceptionCode(FrameWriter* pWriter)
+{
+    return pWriter->exceptionCode;
+}
+
+size_t FrameWriter_GetQueued(FrameWriter* pWriter, const char** ppData)
+{
+    if (pWriter->queuedLength == 0)
+    {
+        *ppData = NULL;
+        return 0;
+    }
+    *ppData = pWriter->pQueued + pWriter->queuedOffset;
+    return pWriter->queuedLength - pWriter->queuedOffset;
+}
+
+void FrameWriter_Preload(FrameWriter* pWriter, const char* pData, size_t length)
+{
+    struct iovec vector;
+
+    vector.iov_base = (void*)pData;
+    vector.iov_len = length;
+    __try
+        queueVector(pWriter, &vector, 1);
+    __catch
+        __rethrow;
+}
+
+static void writeVector(FrameWriter* pWriter, struct iovec* pVector, int vectorCount, int flags)
+{
+    ssize_t bytesSent = 0;
+
+    if (pWriter->maxQueued == 0)
+    {
+        __try
+            sendVectorCompletely(pWriter->socket, pVector, vectorCount, flags);
+        __catch
+            __rethrow;
+        return;
+    }
+    if (pWriter->exceptionCode != noException)
+        __throw(pWriter->exceptionCode);
+
+    /* Anything already queued has to go first. */
+    if (pWriter->queuedLength == 0)
+        bytesSent = sendWithoutBlocking(pWriter->socket, pVector, vectorCount, flags);
+    if (bytesSent < 0)
+    {
+        __try
+            failWriter(pWriter, socketException);
+        __catch
+            __rethrow;
+    }
+    advanceVector(&pVector, &vectorCount, bytesSent);
+
+    __try
+        queueVector(pWriter, pVector, vectorCount);
+    __catch
+        __rethrow;
+}
+
+static void queueVector(FrameWriter* pWriter, const struct iovec* pVector, int vectorCount)
+{
+    size_t length = 0;
+    char*  pDest = NULL;
+    int    i;
+
+    for (i = 0 ; i < vectorCount ; i++)
+        length += pVector[i].iov_len;
+    if (length == 0)
+        return;
+
+    __try
+        pDest = reserveQueueSpace(pWriter, length);
+    __catch
+        __rethrow;
+    for (i = 0 ; i < vectorCount ; i++)
+    {
+        memcpy(pDest, pVector[i].iov_base, pVector[i].iov_len);
+        pDest += pVector[i].iov_len;
+    }
+    pWriter->queuedLength += length;
+}
+
+static char* reserveQueueSpace(FrameWriter* pWriter, size_t length)
+{
+    if (!pWriter->pQueued)
+        pWriter->pQueued = malloc(pWriter->maxQueued);
+    if (!pWriter->pQueued || pWriter->queuedLength - pWriter->queuedOffset + length > pWriter->maxQueued)
+    {
+        __try
+            failWriter(pWriter, outOfMemoryException);
+        __catch
+            __rethrow_and_return(NULL);
+    }
+
+    memmove(pWriter->pQueued, pWriter->pQueued + pWriter->queuedOffset, pWriter->queuedLength - pWriter->queuedOffset);
+    pWriter->queuedLength -= pWriter->queuedOffset;
+    pWriter->queuedOffset = 0;
+    return pWriter->pQueued + pWriter->queuedLength;
+}
+
+/* File data goes straight from the page cache for as long as the socket takes it and whatever is left is read into
+   the queue, padded out with zero bytes if the file has been truncated since the frame was sized. */
+static size_t writeFileData(FrameWriter* pWriter, int fileDescriptor, uint64_t fileOffset, size_t fileLength)
+{
+    off_t  offset = (off_t)fileOffset;
+    size_t totalSent = 0;
+    size_t bytesRead = 0;
+    char*  pDest = NULL;
+
+    while (pWriter->queuedLength == 0 && totalSent < fileLength)
+    {
+        ssize_t bytesSent = sendfile(pWriter->socket, fileDescriptor, &offset, fileLength - totalSent);
+        if (bytesSent < 0 && wouldBlock())
+            break;
+        if (bytesSent < 0)
+        {
+            __try
+                failWriter(pWriter, socketException);
+            __catch
+                __rethrow_and_return(totalSent);
+        }
+        if (bytesSent == 0)
+            break;
+        totalSent += bytesSent;
+    }
+    if (totalSent == fileLength)
+        return totalSent;
+
+    __try
+        pDest = reserveQueueSpace(pWriter, fileLength - totalSent);
+    __catch
+        __rethrow_and_return(totalSent);
+    while (totalSent + bytesRead < fileLength)
+    {
+        ssize_t result = pread(fileDescriptor, pDest + bytesRead, fileLength - totalSent - bytesRead,
+                               offset + bytesRead);
+        if (result <= 0)
+            break;
+        bytesRead += result;
+    }
+    memset(pDest + bytesRead, 0, fileLength - totalSent - bytesRead);
+    pWriter->queuedLength += fileLength - totalSent;
+
+    return totalSent + bytesRead;
+}
+
+static void failWriter(FrameWriter* pWriter, int exceptionCode)
+{
+    pWriter->exceptionCode = exceptionCode;
+    __throw(exceptionCode);
+}
+
+static ssize_t sendWithoutBlocking(int socket, struct iovec* pVector, int vectorCount, int flags)
+{
+    struct msghdr message;
+    ssize_t       bytesSent = -1;
+
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = pVector;
+    message.msg_iovlen = vectorCount;
+    bytesSent = sendmsg(socket, &message, MSG_NOSIGNAL | MSG_DONTWAIT | flags);
+    if (bytesSent < 0 && wouldBlock())
+        return 0;
+    return bytesSent;
+}
+
+static void sendVectorCompletely(int socket, struct iovec* pVector, int vectorCount, int flags)
+{
+    while (vectorCount > 0)
+    {
+        struct msghdr message;
+        ssize_t       bytesSent = -1;
+
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = pVector;
+        message.msg_iovlen = vectorCount;
+        bytesSent = sendmsg(socket, &message, MSG_NOSIGNAL | flags);
+        if (bytesSent < 0 && wouldBlock())
+        {
+            waitForSocketToBeWritable(socket);
+            continue;
+        }
+        if (bytesSent < 0)
+            __throw(socketException);
+
+        advanceVector(&pVector, &vectorCount, bytesSent);
+    }
+}
+
+static void advanceVector(struct iovec** ppVector, int* pVectorCount, size_t bytesSent)
+{
+    while (*pVectorCount > 0 && bytesSent >= (*ppVector)->iov_len)
+    {
+        bytesSent -= (*ppVector)->iov_len;
+        (*ppVector)++;
+        (*pVectorCount)--;
+    }
+    if (*pVectorCount > 0)
+    {
+        (*ppVector)->iov_base = (char*)(*ppVector)->iov_base + bytesSent;
+        (*ppVector)->iov_len -= bytesSent;
+    }
+}
+
+static void waitForSocketToBeWritable(int socket)
+{
+    struct pollfd pollDescriptor;
+
+    pollDescriptor.fd = socket;
+    pollDescriptor.events = POLLOUT;
+    pollDescriptor.revents = 0;
+    poll(&pollDescriptor, 1, -1);
+}
+
+static size_t sendFileDataCompletely(int socket, int fileDescriptor, uint64_t fileOffset, size_t fileLength)
+{
+    off_t  offset = (off_t)fileOffset;
+    size_t totalSent = 0;
+
+    while (totalSent < fileLength)
+    {
+        ssize_t bytesSent = sendfile(socket, fileDescriptor, &offset, fileLength - totalSent);
+        if (bytesSent < 0 && wouldBlock())
+        {
+            waitForSocketToBeWritable(socket);
+            continue;
+        }
+        if (bytesSent < 0)
+            __throw_and_return(socketException, totalSent);
+        /* Nothing left to send means the file was truncated after the caller sized the frame. */
+        if (bytesSent == 0)
+            break;
+        totalSent += bytesSent;
+    }
+    return totalSent;
+}
+
+static void sendPaddingCompletely(int socket, size_t length)
+{
+    static const char padding[4096];
+
+    while (length > 0)
+    {
+        struct iovec vector;
+
+        vector.iov_base = (void*)padding;
+        vector.iov_len = length < sizeof(padding) ? length : sizeof(padding);
+        __try
+            sendVectorCompletely(socket, &vector, 1, 0);
+        __catch
+            __rethrow;
+        length -= vector.iov_len;
+    }
+}
+
+void Protocol_ConfigureSocket(int socket)
+{
+    int noDelay = 1;
+    int lowWater = PROTOCOL_NOTSENT_LOW_WATER;
+
+    /* Failures are ignored as these only affect latency. */
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    setsockopt(socket, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowWater, sizeof(lowWater));
+}
+
+void Protocol_EnableReceiveTimestamps(int socket)
+{
+    int enable = 1;
+
+    setsockopt(socket, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable));
+}
+
+int Protocol_IsWritable(int socket)
+{
+    struct pollfd pollDescriptor;
+
+    pollDescriptor.fd = socket;
+    pollDescriptor.events = POLLOUT;
+    pollDescriptor.revents = 0;
+    return poll(&pollDescriptor, 1, 0) > 0 && (pollDescriptor.revents & POLLOUT);
+}
+
+void Protocol_PutUint32(char* pDest, uint32_t value)
+{
+    pDest[0] = (char)(value >> 24);
+    pDest[1] = (char)(value >> 16);
+    pDest[2] = (char)(value >> 8);
+    pDest[3] = (char)value;
+}
+
+void Protocol_PutUint64(char* pDest, uint64_t value)
+{
+    Protocol_PutUint32(pDest, (uint32_t)(value >> 32));
+    Protocol_PutUint32(pDest + 4, (uint32_t)value);
+}
+
+uint32_t Protocol_GetUint32(const char* pSource)
+{
+    const uint8_t* pBytes = (const uint8_t*)pSource;
+
+    return ((uint32_t)pBytes[0] << 24) | ((uint32_t)pBytes[1] << 16) | ((uint32_t)pBytes[2] << 8) | pBytes[3];
+}
+
+uint64_t Protocol_GetUint64(const char* pSource)
+{
+    return ((uint64_t)Protocol_GetUint32(pSource) << 32) | Protocol_GetUint32(pSource + 4);
+}
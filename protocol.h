@@ -0,0 +1,192 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef _PROTOCOL_H_
+#define _PROTOCOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/* Everything sent between remote and remotesvr is wrapped in a frame: an 8-byte header (payload length, frame type,
+   type specific flags and a channel number) followed by the payload.  All multi-byte fields are big endian. */
+#define PROTOCOL_HEADER_SIZE        8
+#define PROTOCOL_MAX_PAYLOAD_SIZE   (256 * 1024)
+
+/* Sockets only report themselves writable while less than this much data is queued unsent in the kernel.  Bulk
+   output is only sent while the socket is writable so that control frames never queue behind more than this. */
+#define PROTOCOL_NOTSENT_LOW_WATER  (64 * 1024)
+
+/* Protocol_SendFrameToChannels() hands the kernel at most this many copies of a frame per sendmsg(). */
+#define PROTOCOL_MAX_BATCH_FRAMES   64
+
+typedef enum
+{
+    FRAME_DATA = 1,
+    FRAME_INPUT,
+    FRAME_CONTROL,
+    FRAME_FILE_PULL,
+    FRAME_FILE_PUSH,
+    FRAME_FILE_CHUNK,
+    FRAME_FILE_ACK,
+    FRAME_FILE_ERROR,
+    FRAME_FILTER,
+    FRAME_LINES,
+    FRAME_EXIT,
+    FRAME_TRACE,
+    FRAME_RELAY,
+    FRAME_CHUNK_DATA,
+    FRAME_CHUNK_REF,
+    FRAME_DEDUP
+} FrameType;
+
+/* Flags values used for FRAME_DATA, FRAME_LINES, FRAME_CHUNK_DATA and FRAME_CHUNK_REF to indicate where the data
+   originated. */
+typedef enum
+{
+    STREAM_STDOUT = 1,
+    STREAM_STDERR,
+    STREAM_CONSOLE
+} StreamType;
+
+/* Flags values used for FRAME_CONTROL.  The server answers FRAME_EXIT with CONTROL_EXIT_ACK once everything before
+   it has been displayed, so the client knows it can close the connection without losing the final output. */
+typedef enum
+{
+    CONTROL_INTERRUPT = 1,
+    CONTROL_PING,
+    CONTROL_PONG,
+    CONTROL_EXIT_ACK
+} ControlType;
+
+/* Flags values used for FRAME_RELAY.  A relay starts its upstream connection with RELAY_HELLO and from then on tags
+   every frame of each of its clients with a channel number (never 0) chosen by the relay.  RELAY_OPEN starts a
+   channel and carries the client's IPv4 address and port in network order.  RELAY_CLOSE ends it. */
+typedef enum
+{
+    RELAY_HELLO = 1,
+    RELAY_OPEN,
+    RELAY_CLOSE
+} RelayType;
+
+#define RELAY_OPEN_SIZE     6
+#define RELAY_MAX_CHANNELS  65536
+
+/* Flags values used for FRAME_DEDUP.  A client which wants to deduplicate its output sends DEDUP_HELLO and a server
+   with a chunk cache answers with DEDUP_HELLO.  From then on the client may split output into content defined chunks
+   and send each as either FRAME_CHUNK_DATA, which the server caches as well as displays, or FRAME_CHUNK_REF, which
+   carries a sequence number, the chunk's length and its SHA-256 hash instead of the data.  A reference the server
+   can't find in its cache is answered with DEDUP_MISS carrying its sequence number and the client replies with
+   DEDUP_FILL, the sequence number followed by the data.  The server holds back the rest of that session's output
+   until then so that everything is still displayed in order.  DEDUP_ACK tells the client every reference up to
+   the given sequence number has been displayed so it can stop keeping their data for a possible DEDUP_FILL. */
+typedef enum
+{
+    DEDUP_HELLO = 1,
+    DEDUP_MISS,
+    DEDUP_FILL,
+    DEDUP_ACK
+} DedupType;
+
+#define DEDUP_HASH_SIZE     32
+#define DEDUP_SEQUENCE_SIZE 4
+#define DEDUP_REF_SIZE      (DEDUP_SEQUENCE_SIZE + 4 + DEDUP_HASH_SIZE)
+
+typedef struct
+{
+    uint32_t length;
+    uint8_t  type;
+    uint8_t  flags;
+    uint16_t channel;
+} FrameHeader;
+
+/* A FrameReader given a BufferPool takes its buffer from the pool only while it holds received data and gives it
+   back whenever FrameReader_ReleaseIdleBuffer() finds it empty, so idle connections hold no buffer at all. */
+struct BufferPool;
+
+typedef struct
+{
+    struct BufferPool* pPool;
+    char*              pBuffer;
+    size_t             bufferSize;
+    size_t             readOffset;
+    size_t             writeOffset;
+} FrameReader;
+
+void FrameReader_Init(FrameReader* pReader);
+void FrameReader_InitPooled(FrameReader* pReader, struct BufferPool* pPool);
+void FrameReader_ReleaseIdleBuffer(FrameReader* pReader);
+void FrameReader_Uninit(FrameReader* pReader);
+int  FrameReader_Receive(FrameReader* pReader, int socket);
+int  FrameReader_ReceiveAtMost(FrameReader* pReader, int socket, size_t maximum);
+int  FrameReader_ReceiveTimestamped(FrameReader* pReader, int socket, uint64_t* pKernelReceiveTime);
+int  FrameReader_NextFrame(FrameReader* pReader, FrameHeader* pHeader, const char** ppPayload);
+size_t FrameReader_GetBuffered(FrameReader* pReader, const char** ppData);
+void FrameReader_Preload(FrameReader* pReader, const char* pData, size_t length);
+
+/* A FrameWriter with a maxQueued of 0 blocks until each frame has gone, just like the Protocol_SendFrame*() functions.
+   Otherwise its socket is non-blocking and whatever the socket won't take straight away is queued, up to maxQueued
+   bytes, for FrameWriter_Flush() to send once the socket polls writable.  A send which fails, or which would take the
+   queue past that limit, throws and leaves the writer failed with that exception code so that its owner can drop the
+   connection.  The queue is freed whenever it empties so idle connections hold none. */
+typedef struct
+{
+    char*  pQueued;
+    size_t queuedOffset;
+    size_t queuedLength;
+    size_t maxQueued;
+    int    socket;
+    int    exceptionCode;
+} FrameWriter;
+
+void   FrameWriter_Init(FrameWriter* pWriter, int socket, size_t maxQueued);
+void   FrameWriter_Uninit(FrameWriter* pWriter);
+void   FrameWriter_SendFrame(FrameWriter* pWriter, uint8_t type, uint8_t flags, uint16_t channel,
+                             const void* pPayload, size_t length);
+void   FrameWriter_SendFrameToChannels(FrameWriter* pWriter, uint8_t type, uint8_t flags, const uint16_t* pChannels,
+                                       int channelCount, const void* pPayload, size_t length);
+void   FrameWriter_SendFrameVector(FrameWriter* pWriter, uint8_t type, uint8_t flags, uint16_t channel,
+                                   const struct iovec* pVector, int vectorCount);
+size_t FrameWriter_SendFrameWithFileData(FrameWriter* pWriter, uint8_t type, uint8_t flags, uint16_t channel,
+                                         const void* pPrefix, size_t prefixLength,
+                                         int fileDescriptor, uint64_t fileOffset, size_t fileLength);
+void   FrameWriter_Flush(FrameWriter* pWriter);
+int    FrameWriter_HasQueuedData(FrameWriter* pWriter);
+int    FrameWriter_GetExceptionCode(FrameWriter* pWriter);
+size_t FrameWriter_GetQueued(FrameWriter* pWriter, const char** ppData);
+void   FrameWriter_Preload(FrameWriter* pWriter, const char* pData, size_t length);
+
+void Protocol_ConfigureSocket(int socket);
+void Protocol_EnableReceiveTimestamps(int socket);
+int  Protocol_IsWritable(int socket);
+
+void Protocol_EncodeHeader(char* pDest, const FrameHeader* pHeader);
+void Protocol_DecodeHeader(FrameHeader* pHeader, const char* pSource);
+void Protocol_SendFrame(int socket, uint8_t type, uint8_t flags, uint16_t channel, const void* pPayload, size_t length);
+void Protocol_SendFrameToChannels(int socket, uint8_t type, uint8_t flags, const uint16_t* pChannels, int channelCount,
+                                  const void* pPayload, size_t length);
+void Protocol_SendFrameVector(int socket, uint8_t type, uint8_t flags, uint16_t channel,
+                              const struct iovec* pVector, int vectorCount);
+/* The header promising fileLength bytes goes out before any are read, so a file which is truncated in the meantime
+   has the rest of its frame padded out with zero bytes.  Returns how many bytes really came from the file. */
+size_t Protocol_SendFrameWithFileData(int socket, uint8_t type, uint8_t flags, uint16_t channel,
+                                      const void* pPrefix, size_t prefixLength,
+                                      int fileDescriptor, uint64_t fileOffset, size_t fileLength);
+
+void     Protocol_PutUint32(char* pDest, uint32_t value);
+void     Protocol_PutUint64(char* pDest, uint64_t value);
+uint32_t Protocol_GetUint32(const char* pSource);
+uint64_t Protocol_GetUint64(const char* pSource);
+
+#endif /* _PROTOCOL_H_ */
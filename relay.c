@@ -0,0 +1,606 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "try_catch.h"
+#include "relay.h"
+
+
+#define RELAY_MAX_EVENTS        256
+#define RELAY_LISTEN_TAG        0
+#define RELAY_UPSTREAM_TAG      RELAY_MAX_CHANNELS
+#define RELAY_LOOP_MILLISECONDS 1000
+
+
+static void flagStructureAsUninitialized(Relay* pRelay);
+static void allocateClientTable(Relay* pRelay);
+static void createEpoll(Relay* pRelay);
+static void createListeningSocket(Relay* pRelay);
+static void connectUpstream(Relay* pRelay);
+static void watchSocket(Relay* pRelay, int socket, uint32_t tag);
+static void processEvent(Relay* pRelay, uint32_t tag, uint32_t events);
+static void acceptNewClients(Relay* pRelay);
+static void addClient(Relay* pRelay, int socket, const struct sockaddr_in* pAddress);
+static uint16_t allocateChannel(Relay* pRelay);
+static void removeClient(Relay* pRelay, uint16_t channel);
+static void closeClient(Relay* pRelay, uint16_t channel);
+static void receiveFromClient(Relay* pRelay, uint16_t channel);
+static void forwardFramesUpstream(Relay* pRelay, uint16_t channel);
+static void receiveFromUpstream(Relay* pRelay);
+static void forwardFrameDownstream(Relay* pRelay, const FrameHeader* pHeader, const char* pPayload);
+static void replyToUpstreamPing(Relay* pRelay);
+static void queueDownstream(Relay* pRelay, uint16_t channel, const struct iovec* pVectors, int vectorCount,
+                            size_t skipLength);
+static void sendQueuedDownstream(Relay* pRelay, uint16_t channel);
+static void setClientEvents(Relay* pRelay, uint16_t channel, uint32_t events);
+static ssize_t sendWithoutBlocking(int socket, const struct iovec* pVectors, int vectorCount);
+
+
+void Relay_Init(Relay* pRelay, const RelayOptions* pOptions)
+{
+    memset(pRelay, 0, sizeof(*pRelay));
+    pRelay->options = *pOptions;
+    pRelay->nextChannel = 1;
+    pRelay->upstreamSocket = -1;
+    pRelay->listenSocket = -1;
+    pRelay->epollFileDescriptor = -1;
+
+    __try
+    {
+        __throwing_func( allocateClientTable(pRelay) );
+        __throwing_func( FrameReader_Init(&pRelay->upstreamReader) );
+        __throwing_func( createEpoll(pRelay) );
+        __throwing_func( connectUpstream(pRelay) );
+        __throwing_func( createListeningSocket(pRelay) );
+    }
+    __catch
+    {
+        __rethrow;
+    }
+}
+
+static void flagStructureAsUninitialized(Relay* pRelay)
+{
+    memset(pRelay, 0xff, sizeof(*pRelay));
+}
+
+static void allocateClientTable(Relay* pRelay)
+{
+    pRelay->ppClients = calloc(RELAY_MAX_CHANNELS, sizeof(*pRelay->ppClients));
+    if (!pRelay->ppClients)
+        __throw(outOfMemoryException);
+}
+
+static void createEpoll(Relay* pRelay)
+{
+    pRelay->epollFileDescriptor = epoll_create1(EPOLL_CLOEXEC);
+    if (pRelay->epollFileDescriptor < 0)
+        __throw(socketException);
+}
+
+static void createListeningSocket(Relay* pRelay)
+{
+    struct sockaddr_in bindAddress;
+    int                optionValue = 1;
+
+    pRelay->listenSocket = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (pRelay->listenSocket < 0)
+        __throw(socketException);
+    setsockopt(pRelay->listenSocket, SOL_SOCKET, SO_REUSEADDR, &optionValue, sizeof(optionValue));
+
+    memset(&bindAddress, 0, sizeof(bindAddress));
+    bindAddress.sin_family = AF_INET;
+    bindAddress.sin_addr.s_addr = htonl(INADDR_ANY);
+    bindAddress.sin_port = htons(pRelay->options.listenPort);
+    if (bind(pRelay->listenSocket, (struct sockaddr*)&bindAddress, sizeof(bindAddress)) < 0)
+        __throw(socketException);
+    if (listen(pRelay->listenSocket, SOMAXCONN) < 0)
+        __throw(socketException);
+
+    __try
+        watchSocket(pRelay, pRelay->listenSocket, RELAY_LISTEN_TAG);
+    __catch
+        __rethrow;
+}
+
+static void connectUpstream(Relay* pRelay)
+{
+    pRelay->upstreamSocket = socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (pRelay->upstreamSocket < 0)
+        __throw(socketException);
+    if (connect(pRelay->upstreamSocket, (struct sockaddr*)&pRelay->options.serverAddress,
+                sizeof(pRelay->options.serverAddress)) < 0)
+    {
+        __throw(socketException);
+    }
+    Protocol_ConfigureSocket(pRelay->upstreamSocket);
+
+    __try
+    {
+        __throwing_func( Protocol_SendFrame(pRelay->upstreamSocket, FRAME_RELAY, RELAY_HELLO, 0, NULL, 0) );
+        __throwing_func( watchSocket(pRelay, pRelay->upstreamSocket, RELAY_UPSTREAM_TAG) );
+    }
+    __catch
+    {
+        __rethrow;
+    }
+}
+
+static void watchSocket(Relay* pRelay, int socket, uint32_t tag)
+{
+    struct epoll_event event;
+
+    event.events = EPOLLIN;
+    event.data.u32 = tag;
+    if (epoll_ctl(pRelay->epollFileDescriptor, EPOLL_CTL_ADD, socket, &event) < 0)
+        __throw(socketException);
+}
+
+void Relay_Uninit(Relay* pRelay)
+{
+    int i;
+
+    if (pRelay->ppClients)
+    {
+        for (i = 1 ; i < RELAY_MAX_CHANNELS ; i++)
+        {
+            if (pRelay->ppClients[i])
+                removeClient(pRelay, (uint16_t)i);
+        }
+    }
+    free(pRelay->ppClients);
+    FrameReader_Uninit(&pRelay->upstreamReader);
+    if (pRelay->upstreamSocket >= 0)
+        close(pRelay->upstreamSocket);
+    if (pRelay->listenSocket >= 0)
+        close(pRelay->listenSocket);
+    if (pRelay->epollFileDescriptor >= 0)
+        close(pRelay->epollFileDescriptor);
+    flagStructureAsUninitialized(pRelay);
+}
+
+void Relay_Stop(Relay* pRelay)
+{
+    pRelay->exitRunLoop = 1;
+}
+
+void Relay_Run(Relay* pRelay)
+{
+    char addressString[INET_ADDRSTRLEN];
+
+    inet_ntop(AF_INET, &pRelay->options.serverAddress.sin_addr, addressString, sizeof(addressString));
+    printf("Relaying clients on port %u to %s:%u.\n",
+           pRelay->options.listenPort, addressString, ntohs(pRelay->options.serverAddress.sin_port));
+    fflush(stdout);
+
+    while (!pRelay->exitRunLoop)
+    {
+        struct epoll_event events[RELAY_MAX_EVENTS];
+        int                eventCount = -1;
+        int                i;
+
+        eventCount = epoll_wait(pRelay->epollFileDescriptor, events, RELAY_MAX_EVENTS, RELAY_LOOP_MILLISECONDS);
+        if (eventCount < 0 && errno == EINTR)
+            continue;
+        if (eventCount < 0)
+            __throw(selectException);
+
+        for (i = 0 ; i < eventCount && !pRelay->exitRunLoop ; i++)
+        {
+            __try
+                processEvent(pRelay, events[i].data.u32, events[i].events);
+            __catch
+                __rethrow;
+        }
+    }
+
+    printf("Relayed %llu clients, %llu bytes upstream and %llu bytes downstream.\n",
+           (unsigned long long)pRelay->totalClients,
+           (unsigned long long)pRelay->bytesSentUpstream,
+           (unsigned long long)pRelay->bytesSentDownstream);
+}
+
+static void processEvent(Relay* pRelay, uint32_t tag, uint32_t events)
+{
+    __try
+    {
+        if (tag == RELAY_LISTEN_TAG)
+        {
+            acceptNewClients(pRelay);
+        }
+        else if (tag == RELAY_UPSTREAM_TAG)
+        {
+            __throwing_func( receiveFromUpstream(pRelay) );
+        }
+        else
+        {
+            if ((events & EPOLLOUT) && pRelay->ppClients[tag])
+            {
+                __throwing_func( sendQueuedDownstream(pRelay, (uint16_t)tag) );
+            }
+            if (pRelay->ppClients[tag])
+            {
+                __throwing_func( receiveFromClient(pRelay, (uint16_t)tag) );
+            }
+        }
+    }
+    __catch
+    {
+        __rethrow;
+    }
+}
+
+static void acceptNewClients(Relay* pRelay)
+{
+    while (1)
+    {
+        struct sockaddr_in clientAddress;
+        socklen_t          addressLength = sizeof(clientAddress);
+        int                socket = -1;
+
+        socket = accept4(pRelay->listenSocket, (struct sockaddr*)&clientAddress, &addressLength,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (socket < 0)
+            return;
+
+        __try
+            addClient(pRelay, socket, &clientAddress);
+        __catch
+        {
+            close(socket);
+            clearExceptionCode();
+        }
+    }
+}
+
+static void addClient(Relay* pRelay, int socket, const struct sockaddr_in* pAddress)
+{
+    char         openPayload[RELAY_OPEN_SIZE];
+    RelayClient* pClient = NULL;
+    uint16_t     channel = allocateChannel(pRelay);
+
+    if (channel == 0)
+        __throw(outOfMemoryException);
+    pClient = malloc(sizeof(*pClient));
+    if (!pClient)
+        __throw(outOfMemoryException);
+    pClient->address = *pAddress;
+    pClient->pQueued = NULL;
+    pClient->queuedOffset = 0;
+    pClient->queuedLength = 0;
+    pClient->socket = socket;
+
+    __try
+        FrameReader_Init(&pClient->frameReader);
+    __catch
+    {
+        free(pClient);
+        __rethrow;
+    }
+    pRelay->ppClients[channel] = pClient;
+    pRelay->clientCount++;
+    pRelay->totalClients++;
+    Protocol_ConfigureSocket(socket);
+
+    memcpy(openPayload, &pAddress->sin_addr.s_addr, 4);
+    memcpy(openPayload + 4, &pAddress->sin_port, 2);
+    __try
+    {
+        __throwing_func( Protocol_SendFrame(pRelay->upstreamSocket, FRAME_RELAY, RELAY_OPEN, channel,
+                                            openPayload, sizeof(openPayload)) );
+        __throwing_func( watchSocket(pRelay, socket, channel) );
+    }
+    __catch
+    {
+        pClient->socket = -1;
+        removeClient(pRelay, channel);
+        __rethrow;
+    }
+}
+
+static uint16_t allocateChannel(Relay* pRelay)
+{
+    int i;
+
+    for (i = 1 ; i < RELAY_MAX_CHANNELS ; i++)
+    {
+        uint16_t channel = (uint16_t)pRelay->nextChannel;
+
+        pRelay->nextChannel = pRelay->nextChannel + 1 < RELAY_MAX_CHANNELS ? pRelay->nextChannel + 1 : 1;
+        if (!pRelay->ppClients[channel])
+            return channel;
+    }
+    return 0;
+}
+
+static void removeClient(Relay* pRelay, uint16_t channel)
+{
+    RelayClient* pClient = pRelay->ppClients[channel];
+
+    if (pClient->socket >= 0)
+    {
+        epoll_ctl(pRelay->epollFileDescriptor, EPOLL_CTL_DEL, pClient->socket, NULL);
+        close(pClient->socket);
+    }
+    FrameReader_Uninit(&pClient->frameReader);
+    free(pClient->pQueued);
+    free(pClient);
+    pRelay->ppClients[channel] = NULL;
+    pRelay->clientCount--;
+}
+
+static void closeClient(Relay* pRelay, uint16_t channel)
+{
+    removeClient(pRelay, channel);
+    __try
+        Protocol_SendFrame(pRelay->upstreamSocket, FRAME_RELAY, RELAY_CLOSE, channel, NULL, 0);
+    __catch
+        __rethrow;
+}
+
+static void receiveFromClient(Relay* pRelay, uint16_t channel)
+{
+    RelayClient* pClient = pRelay->ppClients[channel];
+    int          bytesRead = -1;
+
+    __try
+        bytesRead = FrameReader_Receive(&pClient->frameReader, pClient->socket);
+    __catch
+    {
+        clearExceptionCode();
+        bytesRead = 0;
+    }
+    if (bytesRead < 0)
+        return;
+    __try
+    {
+        if (bytesRead > 0)
+        {
+            __throwing_func( forwardFramesUpstream(pRelay, channel) );
+        }
+        else
+        {
+            __throwing_func( closeClient(pRelay, channel) );
+        }
+    }
+    __catch
+    {
+        __rethrow;
+    }
+}
+
+static void forwardFramesUpstream(Relay* pRelay, uint16_t channel)
+{
+    RelayClient* pClient = pRelay->ppClients[channel];
+    FrameHeader  header;
+    const char*  pPayload = NULL;
+    int          hasFrame = 0;
+
+    while (1)
+    {
+        __try
+            hasFrame = FrameReader_NextFrame(&pClient->frameReader, &header, &pPayload);
+        __catch
+        {
+            /* A frame too large for the protocol ends this client, not the relay. */
+            printf("Client on channel %u sent an invalid frame and was dropped.\n", channel);
+            fflush(stdout);
+            __try
+                closeClient(pRelay, channel);
+            __catch
+                __rethrow;
+            return;
+        }
+        if (!hasFrame)
+            return;
+
+        /* Clients can't open channels of their own. */
+        if (header.type == FRAME_RELAY)
+            continue;
+        __try
+            Protocol_SendFrame(pRelay->upstreamSocket, header.type, header.flags, channel, pPayload, header.length);
+        __catch
+            __rethrow;
+        pRelay->bytesSentUpstream += PROTOCOL_HEADER_SIZE + header.length;
+    }
+}
+
+static void receiveFromUpstream(Relay* pRelay)
+{
+    FrameHeader header;
+    const char* pPayload = NULL;
+    int         bytesRead = -1;
+
+    __try
+        bytesRead = FrameReader_Receive(&pRelay->upstreamReader, pRelay->upstreamSocket);
+    __catch
+        __rethrow;
+    if (bytesRead < 0)
+        return;
+    if (bytesRead == 0)
+    {
+        printf("Server closed the upstream connection.\n");
+        Relay_Stop(pRelay);
+        return;
+    }
+
+    while (FrameReader_NextFrame(&pRelay->upstreamReader, &header, &pPayload))
+    {
+        if (header.channel == 0 && header.type == FRAME_CONTROL && header.flags == CONTROL_PING)
+        {
+            __try
+                replyToUpstreamPing(pRelay);
+            __catch
+                __rethrow;
+        }
+        else
+        {
+            __try
+                forwardFrameDownstream(pRelay, &header, pPayload);
+            __catch
+                __rethrow;
+        }
+    }
+}
+
+static void replyToUpstreamPing(Relay* pRelay)
+{
+    __try
+        Protocol_SendFrame(pRelay->upstreamSocket, FRAME_CONTROL, CONTROL_PONG, 0, NULL, 0);
+    __catch
+        __rethrow;
+}
+
+static void forwardFrameDownstream(Relay* pRelay, const FrameHeader* pHeader, const char* pPayload)
+{
+    RelayClient* pClient = pRelay->ppClients[pHeader->channel];
+    FrameHeader  clientHeader = *pHeader;
+    char         encodedHeader[PROTOCOL_HEADER_SIZE];
+    struct iovec vectors[2];
+    ssize_t      bytesSent = 0;
+
+    if (pHeader->channel == 0 || !pClient)
+        return;
+
+    clientHeader.channel = 0;
+    Protocol_EncodeHeader(encodedHeader, &clientHeader);
+    vectors[0].iov_base = encodedHeader;
+    vectors[0].iov_len = sizeof(encodedHeader);
+    vectors[1].iov_base = (void*)pPayload;
+    vectors[1].iov_len = pHeader->length;
+
+    /* Anything already queued has to go first. */
+    if (pClient->queuedLength == 0)
+        bytesSent = sendWithoutBlocking(pClient->socket, vectors, 2);
+    /* The client's own read will notice that it has gone and tell the server. */
+    if (bytesSent < 0)
+        return;
+    pRelay->bytesSentDownstream += bytesSent;
+    if ((size_t)bytesSent == PROTOCOL_HEADER_SIZE + pHeader->length)
+        return;
+
+    __try
+        queueDownstream(pRelay, pHeader->channel, vectors, 2, bytesSent);
+    __catch
+        __rethrow;
+}
+
+static void queueDownstream(Relay* pRelay, uint16_t channel, const struct iovec* pVectors, int vectorCount,
+                            size_t skipLength)
+{
+    RelayClient* pClient = pRelay->ppClients[channel];
+    int          wasEmpty = (pClient->queuedLength == 0);
+    size_t       length = 0;
+    int          i;
+
+    for (i = 0 ; i < vectorCount ; i++)
+        length += pVectors[i].iov_len;
+    length -= skipLength;
+
+    if (!pClient->pQueued)
+        pClient->pQueued = malloc(RELAY_MAX_QUEUED_DOWNSTREAM);
+    if (!pClient->pQueued || pClient->queuedLength - pClient->queuedOffset + length > RELAY_MAX_QUEUED_DOWNSTREAM)
+    {
+        printf("Client on channel %u fell too far behind and was dropped.\n", channel);
+        fflush(stdout);
+        __try
+            closeClient(pRelay, channel);
+        __catch
+            __rethrow;
+        return;
+    }
+
+    memmove(pClient->pQueued, pClient->pQueued + pClient->queuedOffset, pClient->queuedLength - pClient->queuedOffset);
+    pClient->queuedLength -= pClient->queuedOffset;
+    pClient->queuedOffset = 0;
+    for (i = 0 ; i < vectorCount ; i++)
+    {
+        size_t skip = skipLength < pVectors[i].iov_len ? skipLength : pVectors[i].iov_len;
+
+        memcpy(pClient->pQueued + pClient->queuedLength, (const char*)pVectors[i].iov_base + skip,
+               pVectors[i].iov_len - skip);
+        pClient->queuedLength += pVectors[i].iov_len - skip;
+        skipLength -= skip;
+    }
+
+    if (wasEmpty)
+    {
+        __try
+            setClientEvents(pRelay, channel, EPOLLIN | EPOLLOUT);
+        __catch
+            __rethrow;
+    }
+}
+
+static void sendQueuedDownstream(Relay* pRelay, uint16_t channel)
+{
+    RelayClient* pClient = pRelay->ppClients[channel];
+    struct iovec vector;
+    ssize_t      bytesSent = -1;
+
+    if (pClient->queuedLength == 0)
+        return;
+    vector.iov_base = pClient->pQueued + pClient->queuedOffset;
+    vector.iov_len = pClient->queuedLength - pClient->queuedOffset;
+    bytesSent = sendWithoutBlocking(pClient->socket, &vector, 1);
+    if (bytesSent < 0)
+        return;
+    pRelay->bytesSentDownstream += bytesSent;
+    pClient->queuedOffset += bytesSent;
+    if (pClient->queuedOffset < pClient->queuedLength)
+        return;
+
+    /* Idle clients hold no queue. */
+    free(pClient->pQueued);
+    pClient->pQueued = NULL;
+    pClient->queuedOffset = 0;
+    pClient->queuedLength = 0;
+    __try
+        setClientEvents(pRelay, channel, EPOLLIN);
+    __catch
+        __rethrow;
+}
+
+static void setClientEvents(Relay* pRelay, uint16_t channel, uint32_t events)
+{
+    struct epoll_event event;
+
+    event.events = events;
+    event.data.u32 = channel;
+    if (epoll_ctl(pRelay->epollFileDescriptor, EPOLL_CTL_MOD, pRelay->ppClients[channel]->socket, &event) < 0)
+        __throw(socketException);
+}
+
+static ssize_t sendWithoutBlocking(int socket, const struct iovec* pVectors, int vectorCount)
+{
+    struct msghdr message;
+    ssize_t       bytesSent = -1;
+
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = (struct iovec*)pVectors;
+    message.msg_iovlen = vectorCount;
+    bytesSent = sendmsg(socket, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (bytesSent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return 0;
+    return bytesSent;
+}
@@ -0,0 +1,68 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef _RELAY_H_
+#define _RELAY_H_
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include "protocol.h"
+
+/* Accepts remote clients on a local port and carries all of them to a sharded remotesvr over a single upstream
+   connection.  The relay opens the upstream connection with RELAY_HELLO, gives every client a channel number
+   announced with RELAY_OPEN and then forwards each client frame upstream tagged with that channel.  Frames the
+   server sends back on a channel (input, interrupts, filters, transfers and trace clock requests) are passed down
+   to that client with the channel cleared, so clients need no changes to run behind a relay.  Upstream sends block,
+   which pushes back on clients that have no room to queue, just as a slow server would.  Downstream sends never
+   block: what a client can't take yet is queued for it and a client with more than RELAY_MAX_QUEUED_DOWNSTREAM
+   bytes queued is dropped so that it can't stall the others. */
+#define RELAY_MAX_QUEUED_DOWNSTREAM (16 * (PROTOCOL_HEADER_SIZE + PROTOCOL_MAX_PAYLOAD_SIZE))
+typedef struct
+{
+    struct sockaddr_in serverAddress;
+    uint16_t           listenPort;
+} RelayOptions;
+
+typedef struct
+{
+    FrameReader        frameReader;
+    struct sockaddr_in address;
+    char*              pQueued;
+    size_t             queuedOffset;
+    size_t             queuedLength;
+    int                socket;
+} RelayClient;
+
+typedef struct
+{
+    RelayOptions  options;
+    FrameReader   upstreamReader;
+    RelayClient** ppClients;
+    uint64_t      bytesSentUpstream;
+    uint64_t      bytesSentDownstream;
+    uint64_t      totalClients;
+    uint32_t      nextChannel;
+    int           clientCount;
+    int           upstreamSocket;
+    int           listenSocket;
+    int           epollFileDescriptor;
+    volatile int  exitRunLoop;
+} Relay;
+
+void Relay_Init(Relay* pRelay, const RelayOptions* pOptions);
+void Relay_Uninit(Relay* pRelay);
+void Relay_Run(Relay* pRelay);
+void Relay_Stop(Relay* pRelay);
+
+#endif /* _RELAY_H_ */
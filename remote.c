@@ -18,15 +18,149 @@
 #include "parameters.h"
 #include "process.h"
 #include "client.h"
+#include "follower.h"
 
 
+static void displayExitReport(Process* pProcess)
+{
+    ExitReport report;
+    char       reportText[256];
+    
+    Process_GetExitReport(pProcess, &report);
+    ExitReport_Format(&report, reportText, sizeof(reportText));
+    printf("%s.\n", reportText);
+}
+
+static void displayBacklogReports(Client* pClient)
+{
+    static const double bytesPerMegabyte = 1024.0 * 1024.0;
+    int                 i;
+    
+    for (i = 0 ; i < pClient->destinationCount ; i++)
+    {
+        Destination* pDestination = &pClient->destinations[i];
+        Backlog*     pBacklog = &pDestination->backlog;
+        
+        if (Backlog_GetPeakSize(pBacklog) == 0)
+            continue;
+        printf("Output backlog for %s peaked at %.1f MB with %.1f MB spilled to disk.\n", pDestination->name,
+               Backlog_GetPeakSize(pBacklog) / bytesPerMegabyte, Backlog_GetSpilledBytes(pBacklog) / bytesPerMegabyte);
+    }
+}
+
+static void displayDedupReports(Client* pClient)
+{
+    static const double bytesPerMegabyte = 1024.0 * 1024.0;
+    int                 i;
+    
+    for (i = 0 ; i < pClient->destinationCount ; i++)
+    {
+        Destination* pDestination = &pClient->destinations[i];
+        DedupSender* pDedup = &pDestination->dedup;
+        
+        if (!pDedup->isRequested)
+            continue;
+        if (!pDedup->isAccepted)
+        {
+            printf("Deduplication wasn't enabled by %s.\n", pDestination->name);
+            continue;
+        }
+        printf("Deduplication for %s sent %llu of %llu chunks by reference (%llu missed), saving %.1f of %.1f MB.\n",
+               pDestination->name, (unsigned long long)pDedup->referenceCount, (unsigned long long)pDedup->chunkCount,
+               (unsigned long long)pDedup->missCount,
+               (pDedup->referencedBytes - pDedup->missedBytes) / bytesPerMegabyte,
+               pDedup->chunkBytes / bytesPerMegabyte);
+    }
+}
+
+static void displayEchoReport(Client* pClient)
+{
+    static const double bytesPerMegabyte = 1024.0 * 1024.0;
+    uint64_t            droppedBytes = LocalEcho_GetDroppedBytes(&pClient->echo);
+
+    if (droppedBytes == 0)
+        return;
+    printf("Echo to %s dropped %.1f MB of output which the file couldn't keep up with.\n", pClient->echo.pPath,
+           droppedBytes / bytesPerMegabyte);
+}
+
+static int runFollower(Parameters* pParameters)
+{
+    Follower follower;
+
+    __try
+    {
+        Follower_Init(&follower, pParameters);
+    }
+    __catch
+    {
+        printf("error: Failed to initialize follower (%d).\n", getExceptionCode());
+        perror("       errno");
+        Follower_Uninit(&follower);
+        return 1;
+    }
+
+    __try
+    {
+        Follower_Run(&follower);
+        printf("Connection being shutdown after following %llu bytes.\n", (unsigned long long)follower.bytesSent);
+    }
+    __catch
+    {
+        printf("error: Failed in run (%d).\n", getExceptionCode());
+        perror("       errno");
+    }
+
+    Follower_Uninit(&follower);
+    return 0;
+}
+
 static void displayUsage(void)
 {
-    printf("Usage:   remote server port \"command\"\n"
-           "  Where: server is the TCP/IP address of the server.\n"
+    printf("Usage:   remote [--lines] [--trace] [--backlog size]\n"
+           "                [--mirror server:port ...] [--control primary|all]\n"
+           "                [--busy-poll cpu] [--spin microseconds]\n"
+           "                [--drain seconds] [--dedup] [--echo none|file]\n"
+           "                server port \"command\"\n"
+           "         remote --follow server port file ...\n"
+           "  Where: --lines sends output to the server a line at a time, each\n"
+           "           tagged with the time it was read from the command.\n"
+           "         --trace timestamps each chunk of output as it moves from the\n"
+           "           command to the server's console so that the server can\n"
+           "           report where the latency is.\n"
+           "         --backlog limits how much output (suffix k, m or g) is\n"
+           "           spilled to a temporary file when the server falls\n"
+           "           behind.  Default is 1g.  The command is only stalled\n"
+           "           once this limit is reached.\n"
+           "         --mirror sends the same output to another server as well\n"
+           "           (up to 4).  A mirror which falls further behind than\n"
+           "           the backlog limit is dropped rather than stall the command.\n"
+           "         --control all lets mirrors send input and ^C too.  By\n"
+           "           default only the primary server can.\n"
+           "         --busy-poll pins remote to the given cpu and spins waiting\n"
+           "           for input instead of sleeping, for the lowest keystroke\n"
+           "           latency.  The latency seen is reported at exit.\n"
+           "         --spin is how long to spin before sleeping once idle when\n"
+           "           busy polling.  Default is 500.\n"
+           "         --drain is how long to wait at exit for the command to\n"
+           "           finish and for each server to confirm that it has shown\n"
+           "           all of the output.  Default is 5.\n"
+           "         --dedup sends repeated chunks of output as references to\n"
+           "           data the server already holds, when the server has a\n"
+           "           --dedup-cache.  Can't be used with --lines.\n"
+           "         --echo none stops the command's output, and the input\n"
+           "           sent to it, being echoed to stdout.  Given a file it is\n"
+           "           written there instead by a background thread.  Output\n"
+           "           the disk can't keep up with is dropped from the file\n"
+           "           rather than slow the command.\n"
+           "         server is the TCP/IP address of the server.\n"
            "         port is the TCP/IP port that the server is listening upon.\n"
            "         command is the command to be executed by the shell and\n"
-           "           provide interactive I/O to the remote user.\n");
+           "           provide interactive I/O to the remote user.\n"
+           "         --follow sends the last few lines of each file and then\n"
+           "           anything appended to it, like tail -F, until ^C.\n"
+           "           Rotated, recreated and truncated files are followed.\n"
+           "           --mirror and --lines can't be used with it.\n");
 }
 
 
@@ -46,6 +180,13 @@ int main(int argc, const char** argv)
         displayUsage();
         return 1;
     }
+    if (Parameters_IsFollowMode(&parameters))
+    {
+        int result = runFollower(&parameters);
+
+        Parameters_Uninit(&parameters);
+        return result;
+    }
     
     __try
     {
@@ -64,6 +205,12 @@ int main(int argc, const char** argv)
     {
         __throwing_func( Process_Init(&process, &parameters) );
         __throwing_func( Client_Run(&client, &process) );
+        if (Process_HasExited(&process))
+            displayExitReport(&process);
+        displayBacklogReports(&client);
+        displayDedupReports(&client);
+        displayEchoReport(&client);
+        LowLatency_Display(&client.lowLatency);
         printf("Connection being shutdown.\n");
     }
     __catch
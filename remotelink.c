@@ -0,0 +1,326 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include "try_catch.h"
+#include "remotelink.h"
+#include "backlog.h"
+#include "exitreport.h"
+#include "timestamp.h"
+
+
+static void flagStructureAsUninitialized(RemoteLink* pLink);
+static int  takeExceptionCode(void);
+static void writeChunk(RemoteLink* pLink, StreamType stream, const char* pBuffer, size_t length);
+static void writeLines(RemoteLink* pLink, StreamType stream, const char* pBuffer, size_t length);
+static void flushLines(RemoteLink* pLink, StreamType stream);
+static void flushFilter(RemoteLink* pLink, LineFilter* pFilter, StreamType stream);
+static void receiveFromServer(RemoteLink* pLink);
+static int  isReadable(int socket);
+static void processFrameFromServer(RemoteLink* pLink, const FrameHeader* pHeader, const char* pPayload);
+static void fillExitReport(RemoteLink* pLink, int exitCode, ExitReport* pReport);
+
+
+int RemoteLink_Init(RemoteLink* pLink, const char* pHost, uint16_t port, const RemoteLinkCallbacks* pCallbacks,
+                    int isLineMode)
+{
+    flagStructureAsUninitialized(pLink);
+    memset(&pLink->destination, 0, sizeof(pLink->destination));
+    pLink->destination.socket = -1;
+    memset(&pLink->callbacks, 0, sizeof(pLink->callbacks));
+    if (pCallbacks)
+        pLink->callbacks = *pCallbacks;
+    FilterRules_Init(&pLink->filterRules);
+    LineFilter_Init(&pLink->stdoutFilter, &pLink->filterRules);
+    LineFilter_Init(&pLink->stderrFilter, &pLink->filterRules);
+    LineFramer_Init(&pLink->stdoutFramer, &pLink->filterRules);
+    LineFramer_Init(&pLink->stderrFramer, &pLink->filterRules);
+    pLink->pBatchBuffer = NULL;
+    pLink->startTime = Timestamp_Now();
+    pLink->isLineMode = isLineMode;
+    pLink->hasSentExitStatus = 0;
+
+    if (isLineMode)
+    {
+        pLink->pBatchBuffer = malloc(LINE_FRAMER_BATCH_SIZE(REMOTE_LINK_CHUNK_SIZE));
+        if (!pLink->pBatchBuffer)
+            return outOfMemoryException;
+    }
+    __try
+        Destination_Init(&pLink->destination, pHost, port, BACKLOG_DEFAULT_SPILL_LIMIT, 1);
+    __catch
+        return takeExceptionCode();
+
+    return 0;
+}
+
+static void flagStructureAsUninitialized(RemoteLink* pLink)
+{
+    memset(pLink, 0xff, sizeof(*pLink));
+}
+
+static int takeExceptionCode(void)
+{
+    int exceptionCode = getExceptionCode();
+
+    clearExceptionCode();
+    return exceptionCode;
+}
+
+void RemoteLink_Uninit(RemoteLink* pLink)
+{
+    Destination_Uninit(&pLink->destination);
+    FilterRules_Uninit(&pLink->filterRules);
+    free(pLink->pBatchBuffer);
+
+    flagStructureAsUninitialized(pLink);
+}
+
+int RemoteLink_GetFileDescriptor(RemoteLink* pLink)
+{
+    return pLink->destination.socket;
+}
+
+int RemoteLink_IsConnected(RemoteLink* pLink)
+{
+    return Destination_IsConnected(&pLink->destination);
+}
+
+int RemoteLink_WantsToWrite(RemoteLink* pLink)
+{
+    return RemoteLink_IsConnected(pLink) && !Backlog_IsEmpty(&pLink->destination.backlog);
+}
+
+int RemoteLink_Write(RemoteLink* pLink, StreamType stream, const void* pBuffer, size_t length)
+{
+    const char* pCurrent = (const char*)pBuffer;
+
+    if (!RemoteLink_IsConnected(pLink))
+        return socketException;
+
+    while (length > 0)
+    {
+        size_t chunkLength = length < REMOTE_LINK_CHUNK_SIZE ? length : REMOTE_LINK_CHUNK_SIZE;
+
+        __try
+            writeChunk(pLink, stream, pCurrent, chunkLength);
+        __catch
+            return takeExceptionCode();
+        pCurrent += chunkLength;
+        length -= chunkLength;
+    }
+    return 0;
+}
+
+static void writeChunk(RemoteLink* pLink, StreamType stream, const char* pBuffer, size_t length)
+{
+    char        filteredBuffer[REMOTE_LINK_CHUNK_SIZE + FILTER_MAX_LINE_LENGTH];
+    LineFilter* pFilter = (stream == STREAM_STDERR) ? &pLink->stderrFilter : &pLink->stdoutFilter;
+    size_t      filteredLength = 0;
+
+    if (pLink->isLineMode)
+    {
+        writeLines(pLink, stream, pBuffer, length);
+        return;
+    }
+    if (!FilterRules_IsActive(&pLink->filterRules))
+    {
+        Destination_SendOutput(&pLink->destination, FRAME_DATA, stream, pBuffer, length, 0, 0);
+        return;
+    }
+
+    filteredLength = LineFilter_Process(pFilter, pBuffer, length, filteredBuffer);
+    if (filteredLength > 0)
+        Destination_SendOutput(&pLink->destination, FRAME_DATA, stream, filteredBuffer, filteredLength, 0, 0);
+}
+
+static void writeLines(RemoteLink* pLink, StreamType stream, const char* pBuffer, size_t length)
+{
+    LineFramer* pFramer = (stream == STREAM_STDERR) ? &pLink->stderrFramer : &pLink->stdoutFramer;
+    LineBatch   batch;
+
+    LineBatch_Init(&batch, pLink->pBatchBuffer, LINE_FRAMER_BATCH_SIZE(REMOTE_LINK_CHUNK_SIZE));
+    LineFramer_Process(pFramer, pBuffer, length, Timestamp_Now(), &batch);
+    if (batch.recordCount > 0)
+        Destination_SendOutput(&pLink->destination, FRAME_LINES, stream, batch.pBuffer, batch.length, 0, 0);
+}
+
+int RemoteLink_Service(RemoteLink* pLink)
+{
+    if (!RemoteLink_IsConnected(pLink))
+        return socketException;
+
+    __try
+    {
+        __throwing_func( receiveFromServer(pLink) );
+        if (RemoteLink_IsConnected(pLink))
+        {
+            __throwing_func( Destination_SendBacklog(&pLink->destination) );
+        }
+    }
+    __catch
+    {
+        return takeExceptionCode();
+    }
+    return 0;
+}
+
+static void receiveFromServer(RemoteLink* pLink)
+{
+    FrameHeader header;
+    const char* pPayload = NULL;
+    int         bytesRead = -1;
+
+    /* The caller may only be servicing the link because it became writable. */
+    if (!isReadable(pLink->destination.socket))
+        return;
+
+    __try
+        bytesRead = Destination_Receive(&pLink->destination);
+    __catch
+        __rethrow;
+    if (bytesRead < 0)
+        return;
+    if (bytesRead == 0)
+    {
+        Destination_Disconnect(&pLink->destination);
+        return;
+    }
+
+    while (FrameReader_NextFrame(&pLink->destination.frameReader, &header, &pPayload))
+    {
+        __try
+            processFrameFromServer(pLink, &header, pPayload);
+        __catch
+            __rethrow;
+    }
+}
+
+static int isReadable(int socket)
+{
+    struct pollfd pollDescriptor;
+
+    pollDescriptor.fd = socket;
+    pollDescriptor.events = POLLIN;
+    pollDescriptor.revents = 0;
+    return poll(&pollDescriptor, 1, 0) == 1;
+}
+
+static void processFrameFromServer(RemoteLink* pLink, const FrameHeader* pHeader, const char* pPayload)
+{
+    RemoteLinkCallbacks* pCallbacks = &pLink->callbacks;
+
+    switch (pHeader->type)
+    {
+    case FRAME_INPUT:
+        if (pCallbacks->pInputHandler)
+            pCallbacks->pInputHandler(pCallbacks->pContext, pPayload, pHeader->length);
+        break;
+    case FRAME_CONTROL:
+        if (pHeader->flags == CONTROL_INTERRUPT && pCallbacks->pInterruptHandler)
+            pCallbacks->pInterruptHandler(pCallbacks->pContext);
+        else if (pHeader->flags == CONTROL_PING)
+            Destination_SendFrame(&pLink->destination, FRAME_CONTROL, CONTROL_PONG, NULL, 0);
+        break;
+    case FRAME_FILTER:
+        flushFilter(pLink, &pLink->stdoutFilter, STREAM_STDOUT);
+        flushFilter(pLink, &pLink->stderrFilter, STREAM_STDERR);
+        FilterRules_Parse(&pLink->filterRules, pPayload, pHeader->length);
+        break;
+    default:
+        break;
+    }
+}
+
+int RemoteLink_Flush(RemoteLink* pLink)
+{
+    if (!RemoteLink_IsConnected(pLink))
+        return socketException;
+
+    __try
+    {
+        if (pLink->isLineMode)
+        {
+            __throwing_func( flushLines(pLink, STREAM_STDOUT) );
+            __throwing_func( flushLines(pLink, STREAM_STDERR) );
+        }
+        __throwing_func( Destination_FlushBacklog(&pLink->destination) );
+    }
+    __catch
+    {
+        return takeExceptionCode();
+    }
+    return 0;
+}
+
+static void flushLines(RemoteLink* pLink, StreamType stream)
+{
+    LineFramer* pFramer = (stream == STREAM_STDERR) ? &pLink->stderrFramer : &pLink->stdoutFramer;
+    LineBatch   batch;
+
+    LineBatch_Init(&batch, pLink->pBatchBuffer, LINE_FRAMER_BATCH_SIZE(REMOTE_LINK_CHUNK_SIZE));
+    LineFramer_Flush(pFramer, Timestamp_Now(), &batch);
+    if (batch.recordCount > 0)
+        Destination_SendOutput(&pLink->destination, FRAME_LINES, stream, batch.pBuffer, batch.length, 0, 0);
+}
+
+static void flushFilter(RemoteLink* pLink, LineFilter* pFilter, StreamType stream)
+{
+    char   pendingLine[FILTER_MAX_LINE_LENGTH];
+    size_t length = LineFilter_Flush(pFilter, pendingLine);
+
+    if (length > 0)
+        Destination_SendOutput(&pLink->destination, FRAME_DATA, stream, pendingLine, length, 0, 0);
+}
+
+int RemoteLink_SendExitStatus(RemoteLink* pLink, int exitCode)
+{
+    ExitReport report;
+    char       payload[EXIT_REPORT_SIZE];
+    int        result = -1;
+
+    if (pLink->hasSentExitStatus)
+        return 0;
+    result = RemoteLink_Flush(pLink);
+    if (result)
+        return result;
+
+    fillExitReport(pLink, exitCode, &report);
+    ExitReport_Encode(&report, payload);
+    __try
+        Destination_SendFrame(&pLink->destination, FRAME_EXIT, 0, payload, sizeof(payload));
+    __catch
+        return takeExceptionCode();
+    pLink->hasSentExitStatus = 1;
+    return 0;
+}
+
+static void fillExitReport(RemoteLink* pLink, int exitCode, ExitReport* pReport)
+{
+    struct rusage usage;
+
+    /* There is no child, so the report describes this whole process since the link was opened. */
+    memset(&usage, 0, sizeof(usage));
+    getrusage(RUSAGE_SELF, &usage);
+    pReport->status = (exitCode & 0xff) << 8;
+    pReport->elapsedNanoseconds = Timestamp_Now() - pLink->startTime;
+    pReport->userMicroseconds = (uint64_t)usage.ru_utime.tv_sec * 1000000ULL + usage.ru_utime.tv_usec;
+    pReport->systemMicroseconds = (uint64_t)usage.ru_stime.tv_sec * 1000000ULL + usage.ru_stime.tv_usec;
+    pReport->maxResidentKilobytes = usage.ru_maxrss;
+    pReport->voluntaryContextSwitches = usage.ru_nvcsw;
+    pReport->involuntaryContextSwitches = usage.ru_nivcsw;
+}
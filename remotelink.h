@@ -0,0 +1,72 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef _REMOTELINK_H_
+#define _REMOTELINK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "destination.h"
+#include "filter.h"
+#include "lineframer.h"
+
+/* RemoteLink lets a program stream its own output to remotesvr as if it were the command run by remote, without
+   forking remote and piping through it.  It is built into Debug/libremote.a from the same modules remote uses, so
+   output is framed, filtered and line stamped exactly as remote would, and output which the server can't take yet
+   waits in the same spill-to-disk backlog rather than blocking the caller.
+
+   The link has no thread or loop of its own.  The caller polls RemoteLink_GetFileDescriptor() for input, and for
+   output too while RemoteLink_WantsToWrite() is true, and calls RemoteLink_Service() whenever it is ready.  Input
+   and ^C sent by the server's user are handed to the callbacks from there, heartbeats and output filters are dealt
+   with internally.  Functions return 0 on success and otherwise one of the exception codes from try_catch.h.  A
+   link is used by one thread at a time but separate links may be used from separate threads. */
+#define REMOTE_LINK_CHUNK_SIZE  (16 * 1024)
+
+typedef void RemoteLinkInputHandler(void* pContext, const char* pInput, size_t length);
+typedef void RemoteLinkInterruptHandler(void* pContext);
+
+typedef struct
+{
+    RemoteLinkInputHandler*     pInputHandler;
+    RemoteLinkInterruptHandler* pInterruptHandler;
+    void*                       pContext;
+} RemoteLinkCallbacks;
+
+typedef struct
+{
+    Destination         destination;
+    RemoteLinkCallbacks callbacks;
+    FilterRules         filterRules;
+    LineFilter          stdoutFilter;
+    LineFilter          stderrFilter;
+    LineFramer          stdoutFramer;
+    LineFramer          stderrFramer;
+    char*               pBatchBuffer;
+    uint64_t            startTime;
+    int                 isLineMode;
+    int                 hasSentExitStatus;
+} RemoteLink;
+
+int  RemoteLink_Init(RemoteLink* pLink, const char* pHost, uint16_t port, const RemoteLinkCallbacks* pCallbacks,
+                     int isLineMode);
+void RemoteLink_Uninit(RemoteLink* pLink);
+int  RemoteLink_GetFileDescriptor(RemoteLink* pLink);
+int  RemoteLink_IsConnected(RemoteLink* pLink);
+int  RemoteLink_WantsToWrite(RemoteLink* pLink);
+int  RemoteLink_Write(RemoteLink* pLink, StreamType stream, const void* pBuffer, size_t length);
+int  RemoteLink_Service(RemoteLink* pLink);
+int  RemoteLink_Flush(RemoteLink* pLink);
+int  RemoteLink_SendExitStatus(RemoteLink* pLink, int exitCode);
+
+#endif /* _REMOTELINK_H_ */
@@ -0,0 +1,204 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
+#include <netdb.h>
+#include "try_catch.h"
+#include "loadgen.h"
+
+
+static LoadGenerator g_generator;
+
+
+static void displayUsage(void)
+{
+    printf("Usage:   remoteload [options] server port\n"
+           "  Where: server is the TCP/IP address of a remotesvr started with --shards\n"
+           "           (its output should be redirected away from the terminal).\n"
+           "         port is the TCP/IP port that the server is listening upon.\n"
+           " Options:\n"
+           "         --sessions count     concurrent sessions to keep open (default 1000).\n"
+           "         --rate bytes         output per session per second, with an optional\n"
+           "                              k or m suffix; 0 sends as fast as possible\n"
+           "                              (default 64k).\n"
+           "         --idle percent       sessions that stay connected without sending\n"
+           "                              any output (default 0).\n"
+           "         --churn count        sessions closed and reopened each second\n"
+           "                              (default 0).\n"
+           "         --duration seconds   length of the run (default 30).\n"
+           "         --interval seconds   time between reports (default 1).\n"
+           "         --server-pid pid     remotesvr process to sample for CPU and RSS.\n");
+}
+
+
+static void parseOptions(LoadOptions* pOptions, int argc, char** argv);
+static int  parsePositiveInteger(const char* pString, int minimum, int maximum);
+static uint64_t parseByteCount(const char* pString);
+static void lookupServerAddress(LoadOptions* pOptions, const char* pAddress, const char* pPort);
+static void stopSignalHandler(int value);
+
+
+int main(int argc, char** argv)
+{
+    LoadOptions options;
+
+    __try
+        parseOptions(&options, argc, argv);
+    __catch
+    {
+        displayUsage();
+        return 1;
+    }
+
+    __try
+        LoadGenerator_Init(&g_generator, &options);
+    __catch
+    {
+        printf("error: Failed to initialize load generator (%d).\n", getExceptionCode());
+        perror("       errno");
+        LoadGenerator_Uninit(&g_generator);
+        return 1;
+    }
+
+    signal(SIGINT, stopSignalHandler);
+    signal(SIGTERM, stopSignalHandler);
+    __try
+        LoadGenerator_Run(&g_generator);
+    __catch
+    {
+        printf("error: Failed in run (%d).\n", getExceptionCode());
+        perror("       errno");
+    }
+
+    LoadGenerator_Uninit(&g_generator);
+    return 0;
+}
+
+static void parseOptions(LoadOptions* pOptions, int argc, char** argv)
+{
+    static const struct option longOptions[] =
+    {
+        { "sessions",   required_argument, NULL, 'n' },
+        { "rate",       required_argument, NULL, 'r' },
+        { "idle",       required_argument, NULL, 'i' },
+        { "churn",      required_argument, NULL, 'c' },
+        { "duration",   required_argument, NULL, 'd' },
+        { "interval",   required_argument, NULL, 't' },
+        { "server-pid", required_argument, NULL, 'p' },
+        { NULL, 0, NULL, 0 }
+    };
+    int option = -1;
+
+    memset(pOptions, 0, sizeof(*pOptions));
+    pOptions->sessionCount = 1000;
+    pOptions->bytesPerSecond = 64 * 1024;
+    pOptions->durationSeconds = 30;
+    pOptions->reportIntervalSeconds = 1;
+
+    opterr = 0;
+    while ((option = getopt_long(argc, argv, "+n:r:i:c:d:t:p:", longOptions, NULL)) != -1)
+    {
+        switch (option)
+        {
+        case 'n':
+            pOptions->sessionCount = parsePositiveInteger(optarg, 1, INT_MAX);
+            break;
+        case 'r':
+            pOptions->bytesPerSecond = parseByteCount(optarg);
+            break;
+        case 'i':
+            pOptions->idlePercent = parsePositiveInteger(optarg, 0, 100);
+            break;
+        case 'c':
+            pOptions->churnPerSecond = parsePositiveInteger(optarg, 0, INT_MAX);
+            break;
+        case 'd':
+            pOptions->durationSeconds = parsePositiveInteger(optarg, 1, INT_MAX);
+            break;
+        case 't':
+            pOptions->reportIntervalSeconds = parsePositiveInteger(optarg, 1, INT_MAX);
+            break;
+        case 'p':
+            pOptions->serverPid = parsePositiveInteger(optarg, 1, INT_MAX);
+            break;
+        default:
+            __throw(invalidCommandLineException);
+        }
+        if (getExceptionCode())
+            __rethrow;
+    }
+
+    if (argc - optind != 2)
+        __throw(invalidCommandLineException);
+    lookupServerAddress(pOptions, argv[optind], argv[optind + 1]);
+}
+
+static int parsePositiveInteger(const char* pString, int minimum, int maximum)
+{
+    char* pEnd = NULL;
+    long  value = strtol(pString, &pEnd, 10);
+
+    if (*pString == '\0' || *pEnd != '\0' || value < minimum || value > maximum)
+        __throw_and_return(invalidCommandLineException, minimum);
+    return (int)value;
+}
+
+static uint64_t parseByteCount(const char* pString)
+{
+    char*              pEnd = NULL;
+    unsigned long long value = strtoull(pString, &pEnd, 10);
+
+    if (pEnd == pString)
+        __throw_and_return(invalidCommandLineException, 0);
+    if (*pEnd == 'k' || *pEnd == 'K')
+        value *= 1024;
+    else if (*pEnd == 'm' || *pEnd == 'M')
+        value *= 1024 * 1024;
+    else
+        pEnd--;
+    if (*++pEnd != '\0')
+        __throw_and_return(invalidCommandLineException, 0);
+    return value;
+}
+
+static void lookupServerAddress(LoadOptions* pOptions, const char* pAddress, const char* pPort)
+{
+    struct hostent* pHostEntry = NULL;
+    int             portNumber = -1;
+
+    __try
+        portNumber = parsePositiveInteger(pPort, 1, USHRT_MAX);
+    __catch
+        __rethrow;
+
+    pHostEntry = gethostbyname(pAddress);
+    if (!pHostEntry)
+        __throw(dnsLookupException);
+
+    pOptions->serverAddress.sin_family = AF_INET;
+    memcpy(&pOptions->serverAddress.sin_addr.s_addr, pHostEntry->h_addr_list[0],
+           sizeof(pOptions->serverAddress.sin_addr.s_addr));
+    pOptions->serverAddress.sin_port = htons(portNumber);
+}
+
+static void stopSignalHandler(int value)
+{
+    LoadGenerator_Stop(&g_generator);
+}
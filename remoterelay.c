@@ -0,0 +1,129 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <netdb.h>
+#include "try_catch.h"
+#include "relay.h"
+
+
+static Relay g_relay;
+
+
+static void displayUsage(void)
+{
+    printf("Usage:   remoterelay listenPort server port\n"
+           "  Where: listenPort is the TCP/IP port on which to accept remote clients.\n"
+           "         server is the TCP/IP address of a remotesvr started with --shards.\n"
+           "         port is the TCP/IP port that the server is listening upon.\n");
+}
+
+
+static void parseOptions(RelayOptions* pOptions, int argc, char** argv);
+static int  parsePortNumber(const char* pString);
+static void lookupServerAddress(RelayOptions* pOptions, const char* pAddress, const char* pPort);
+static void stopSignalHandler(int value);
+
+
+int main(int argc, char** argv)
+{
+    RelayOptions options;
+
+    __try
+        parseOptions(&options, argc, argv);
+    __catch
+    {
+        displayUsage();
+        return 1;
+    }
+
+    __try
+        Relay_Init(&g_relay, &options);
+    __catch
+    {
+        printf("error: Failed to initialize relay (%d).\n", getExceptionCode());
+        perror("       errno");
+        Relay_Uninit(&g_relay);
+        return 1;
+    }
+
+    signal(SIGINT, stopSignalHandler);
+    signal(SIGTERM, stopSignalHandler);
+    __try
+        Relay_Run(&g_relay);
+    __catch
+    {
+        printf("error: Failed in run (%d).\n", getExceptionCode());
+        perror("       errno");
+    }
+
+    Relay_Uninit(&g_relay);
+    return 0;
+}
+
+static void parseOptions(RelayOptions* pOptions, int argc, char** argv)
+{
+    memset(pOptions, 0, sizeof(*pOptions));
+    if (argc != 4)
+        __throw(invalidCommandLineException);
+
+    __try
+    {
+        __throwing_func( pOptions->listenPort = (uint16_t)parsePortNumber(argv[1]) );
+        __throwing_func( lookupServerAddress(pOptions, argv[2], argv[3]) );
+    }
+    __catch
+    {
+        __rethrow;
+    }
+}
+
+static int parsePortNumber(const char* pString)
+{
+    char* pEnd = NULL;
+    long  value = strtol(pString, &pEnd, 10);
+
+    if (*pString == '\0' || *pEnd != '\0' || value < 1 || value > USHRT_MAX)
+        __throw_and_return(invalidCommandLineException, 0);
+    return (int)value;
+}
+
+static void lookupServerAddress(RelayOptions* pOptions, const char* pAddress, const char* pPort)
+{
+    struct hostent* pHostEntry = NULL;
+    int             portNumber = -1;
+
+    __try
+        portNumber = parsePortNumber(pPort);
+    __catch
+        __rethrow;
+
+    pHostEntry = gethostbyname(pAddress);
+    if (!pHostEntry)
+        __throw(dnsLookupException);
+
+    pOptions->serverAddress.sin_family = AF_INET;
+    memcpy(&pOptions->serverAddress.sin_addr.s_addr, pHostEntry->h_addr_list[0],
+           sizeof(pOptions->serverAddress.sin_addr.s_addr));
+    pOptions->serverAddress.sin_port = htons(portNumber);
+}
+
+static void stopSignalHandler(int value)
+{
+    Relay_Stop(&g_relay);
+}
@@ -18,15 +18,55 @@
 #include "try_catch.h"
 #include "parameters.h"
 #include "server.h"
+#include "shardgroup.h"
+#include "console.h"
+#include "eventstream.h"
 
 
 static void displayUsage(void)
 {
-    printf("Usage:   remotesvr port\n"
-           "  Where: port is the TCP/IP port for this server to listen upon.\n");
+    printf("Usage:   remotesvr [--shards count] [--console direct|adaptive]\n"
+           "                   [--record file] [--index size] [--handoff path]\n"
+           "                   [--memory size] [--session-memory size]\n"
+           "                   [--heartbeat seconds] [--idle-timeout seconds]\n"
+           "                   [--dedup-cache size] [--events path] port\n"
+           "  Where: port is the TCP/IP port for this server to listen upon.\n"
+           "         --shards runs count (at most 256) event loops (or \"auto\" for\n"
+           "           one per core), each with its own SO_REUSEPORT listener, and\n"
+           "           accepts many clients at once without prompting.\n"
+           "         --console adaptive shows a summary of skipped output and the\n"
+           "           last few lines whenever the terminal can't keep up.  All\n"
+           "           output is still recorded (to " CONSOLE_DEFAULT_RECORD_PATH " by default).\n"
+           "         --record saves all client output to file.\n"
+           "         --index keeps up to size (suffix k, m or g) of each session's\n"
+           "           output in an indexed temporary file for the search and\n"
+           "           show commands.  Needs --shards.\n"
+           "         --handoff takes over the listening port and live sessions from\n"
+           "           a remotesvr already running with the same --handoff path,\n"
+           "           which then exits, so upgrades drop no sessions.  Needs\n"
+           "           --shards with the same count and appends to --record.\n"
+           "         --memory caps the receive buffer memory held by all sessions\n"
+           "           together; a session needing more is disconnected.  Needs\n"
+           "           --shards.\n"
+           "         --session-memory caps the receive buffer of any one session\n"
+           "           (at least 16k); a frame larger than that ends the session.\n"
+           "           Needs --shards.\n"
+           "         --heartbeat pings a session that has sent nothing for that many\n"
+           "           seconds and disconnects it if it is still silent as long\n"
+           "           again later.  Needs --shards.\n"
+           "         --idle-timeout disconnects a session that has sent nothing but\n"
+           "           heartbeat replies for that many seconds.  Needs --shards.\n"
+           "         --dedup-cache keeps up to size of recent output chunks so that\n"
+           "           clients run with --dedup can send repeated output by\n"
+           "           reference.  The dedup command shows how well it works.\n"
+           "           Needs --shards.\n"
+           "         --events writes connections, output and exit reports as a\n"
+           "           stream of length-prefixed binary events to path, which can\n"
+           "           be a file, a named pipe or unix:socketPath.\n");
 }
 
 
+static int runShardedServer(Parameters* pParameters);
 static void displayClientAddress(Server* pServer);
 static int shouldConnectionBeAllowed(void);
 static void eatConsoleInput(void);
@@ -48,6 +88,35 @@ int main(int argc, const char** argv)
         return 1;
     }
     
+    __try
+    {
+        Console_Init(Parameters_IsConsoleAdaptive(&parameters), Parameters_GetRecordPath(&parameters),
+                     Parameters_GetHandoffPath(&parameters) != NULL);
+    }
+    __catch
+    {
+        printf("error: Failed to open %s.\n", Parameters_GetRecordPath(&parameters));
+        perror("       errno");
+        Parameters_Uninit(&parameters);
+        return 1;
+    }
+    
+    __try
+    {
+        EventStream_Init(Parameters_GetEventsPath(&parameters), Parameters_GetHandoffPath(&parameters) != NULL);
+    }
+    __catch
+    {
+        printf("error: Failed to open %s for --events.\n", Parameters_GetEventsPath(&parameters));
+        perror("       errno");
+        Console_Uninit();
+        Parameters_Uninit(&parameters);
+        return 1;
+    }
+    
+    if (Parameters_GetShardCount(&parameters) > 0)
+        return runShardedServer(&parameters);
+    
     __try
     {
         Server_Init(&server, &parameters);
@@ -58,6 +127,8 @@ int main(int argc, const char** argv)
         perror("       errno");
         Parameters_Uninit(&parameters);
         Server_Uninit(&server);
+        EventStream_Uninit();
+        Console_Uninit();
         return 1;
     }
     
@@ -79,6 +150,8 @@ int main(int argc, const char** argv)
         {
             Parameters_Uninit(&parameters);
             Server_Uninit(&server);
+            EventStream_Uninit();
+            Console_Uninit();
             if (getExceptionCode() == userShutdownException)
             {
                 eatConsoleInput();
@@ -93,6 +166,39 @@ int main(int argc, const char** argv)
     }
 }
 
+static int runShardedServer(Parameters* pParameters)
+{
+    ShardGroup group;
+    int        wasHandedOff = 0;
+    
+    __try
+    {
+        ShardGroup_Init(&group, pParameters);
+    }
+    __catch
+    {
+        printf("error: Failed to initialize sharded server (%d).\n", getExceptionCode());
+        perror("       errno");
+        ShardGroup_Uninit(&group);
+        Parameters_Uninit(pParameters);
+        EventStream_Uninit();
+        Console_Uninit();
+        return 1;
+    }
+    
+    ShardGroup_RunConsole(&group);
+    wasHandedOff = ShardGroup_WasHandedOff(&group);
+    
+    ShardGroup_Uninit(&group);
+    Parameters_Uninit(pParameters);
+    EventStream_Uninit();
+    Console_Uninit();
+    if (!wasHandedOff)
+        printf("Shutting down at user's request.\n");
+    
+    return 0;
+}
+
 static void displayClientAddress(Server* pServer)
 {
     printf("Client connection attempt from ");
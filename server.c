@@ -22,6 +22,11 @@
 #include <unistd.h>
 #include "try_catch.h"
 #include "server.h"
+#include "console.h"
+#include "eventstream.h"
+
+
+#define CONSOLE_MAX_ARGUMENTS 32
 
 
 static int g_controlCSignalled = 0;
@@ -50,6 +55,11 @@ static int doesConsoleHaveDataToRead(Server* pServer);
 static int doesClientHaveDataToRead(Server* pServer);
 static void sendDataFromConsoleToClient(Server* pServer);
 static void sendDataFromClientToConsole(Server* pServer);
+static int isConsoleCommand(Server* pServer, const char* pBuffer, int bufferLength);
+static void runConsoleCommand(Server* pServer, char* pCommandLine);
+static void updateConsoleLineStart(Server* pServer, const char* pBuffer, int bufferLength);
+static int splitConsoleCommand(char* pCommandLine, const char** ppArguments);
+static void setOutputFilter(Server* pServer, int ruleCount, const char** ppRules);
 
 
 void Server_Init(Server* pServer, Parameters* pParameters)
@@ -139,7 +149,7 @@ static void saveFileDescriptorForStdinStdout(Server* pServer)
 
 void Server_Uninit(Server* pServer)
 {
-    closeSocket(pServer->acceptSocket);
+    Server_CloseClientConnection(pServer);
     closeSocket(pServer->listenSocket);
 
     flagStructureAsUninitialized(pServer);
@@ -162,6 +172,15 @@ void Server_WaitForClientToConnect(Server* pServer)
     pServer->acceptSocket = accept(pServer->listenSocket, (struct sockaddr*)&pServer->clientAddress, &addressLength);
     if (pServer->acceptSocket < 0)
         __throw(socketException);
+    
+    __try
+        Session_Init(&pServer->session, pServer->acceptSocket, &pServer->clientAddress, 0, NULL);
+    __catch
+    {
+        Server_CloseClientConnection(pServer);
+        __rethrow;
+    }
+    Session_RecordConnection(&pServer->session);
 }
 
 static void waitForConsoleInputOrNewClientConnection(Server* pServer)
@@ -181,12 +200,19 @@ static void waitForConsoleInputOrNewClientConnection(Server* pServer)
 
 void Server_CloseClientConnection(Server* pServer)
 {
-    closeSocket(pServer->acceptSocket);
+    if (pServer->acceptSocket < 0)
+        return;
+    
+    /* The session owns the accepted socket and closes it. */
+    Session_RecordDisconnection(&pServer->session, "");
+    Session_Uninit(&pServer->session);
+    pServer->acceptSocket = -1;
 }
 
 void Server_Run(Server* pServer)
 {
     pServer->exitRunLoop = 0;
+    pServer->isConsoleAtLineStart = 1;
     registerSignalHandlersToNotifyOnCtrlC();
     setHighestReadFileDescriptorNumber(pServer);
     
@@ -237,17 +263,17 @@ static void moveDataBetweenClientAndConsole(Server* pServer)
         __catch
             __rethrow;
     }
+    Console_Service();
+    EventStream_Flush();
 }
 
 static void sendControlCIfSignalled(Server* pServer)
 {
-    static const char controlC = 0x03;
-
     if (g_controlCSignalled == 0)
         return;
         
-    send(pServer->acceptSocket, &controlC, sizeof(controlC), 0);
     g_controlCSignalled = 0;
+    Session_SendInterrupt(&pServer->session);
 }
 
 static int waitForInputFromClientOrConsole(Server* pServer)
@@ -303,9 +329,9 @@ static int doesClientHaveDataToRead(Server* pServer)
 
 static void sendDataFromConsoleToClient(Server* pServer)
 {
-    char buffer[1];
+    char buffer[4096];
     
-    int bytesRead = read(pServer->stdin, buffer, sizeof(buffer));
+    int bytesRead = read(pServer->stdin, buffer, sizeof(buffer) - 1);
 
     if (bytesRead < 0)
         __throw(consoleException);
@@ -315,24 +341,116 @@ static void sendDataFromConsoleToClient(Server* pServer)
         pServer->exitRunLoop = 1;
         return;
     }
-    send(pServer->acceptSocket, buffer, bytesRead, 0);
+    
+    if (isConsoleCommand(pServer, buffer, bytesRead))
+    {
+        buffer[bytesRead] = '\0';
+        runConsoleCommand(pServer, buffer + 1);
+        return;
+    }
+    updateConsoleLineStart(pServer, buffer, bytesRead);
+    
+    /* A doubled escape character at the start of a line sends a single one to the client. */
+    if (bytesRead > 1 && buffer[0] == '~' && buffer[1] == '~')
+        Session_SendInput(&pServer->session, buffer + 1, bytesRead - 1);
+    else
+        Session_SendInput(&pServer->session, buffer, bytesRead);
 }
 
-static void sendDataFromClientToConsole(Server* pServer)
+static int isConsoleCommand(Server* pServer, const char* pBuffer, int bufferLength)
 {
-    char buffer[1];
-    
-    int bytesRead = recv(pServer->acceptSocket, buffer, sizeof(buffer), 0);
+    return pServer->isConsoleAtLineStart && bufferLength > 1 && pBuffer[0] == '~' && pBuffer[1] != '~';
+}
+
+static void runConsoleCommand(Server* pServer, char* pCommandLine)
+{
+    const char* arguments[CONSOLE_MAX_ARGUMENTS];
+    int         argumentCount = splitConsoleCommand(pCommandLine, arguments);
     
-    if (bytesRead < 0)
-        __throw(clientException);
+    if (argumentCount >= 2 && 0 == strcmp(arguments[0], "pull"))
+    {
+        const char* pBaseName = strrchr(arguments[1], '/');
+        const char* pLocalPath = argumentCount >= 3 ? arguments[2] : (pBaseName ? pBaseName + 1 : arguments[1]);
+        
+        __try
+            Session_PullFile(&pServer->session, arguments[1], pLocalPath);
+        __catch
+            perror("~pull failed");
+    }
+    else if (argumentCount >= 3 && 0 == strcmp(arguments[0], "push"))
+    {
+        __try
+            Session_PushFile(&pServer->session, arguments[1], arguments[2]);
+        __catch
+            perror("~push failed");
+    }
+    else if (argumentCount >= 1 && 0 == strcmp(arguments[0], "filter"))
+    {
+        __try
+            setOutputFilter(pServer, argumentCount - 1, arguments + 1);
+        __catch
+            perror("~filter failed");
+    }
+    else if (argumentCount >= 1 && 0 == strcmp(arguments[0], "trace"))
+    {
+        Session_DisplayTrace(&pServer->session);
+    }
+    else
+    {
+        printf("Console commands: ~pull remotePath [localPath]\n"
+               "                  ~push localPath remotePath\n"
+               "                  ~filter [+include|-exclude|+re:regex|-re:regex ...]\n"
+               "                  ~trace\n"
+               "                  ~~ at the start of a line sends a single ~\n");
+    }
+    if (getExceptionCode() == socketException)
+        __rethrow;
+    clearExceptionCode();
+}
 
-    if (bytesRead == 0)
+static int splitConsoleCommand(char* pCommandLine, const char** ppArguments)
+{
+    int   argumentCount = 0;
+    char* pToken = strtok(pCommandLine, " \t\r\n");
+    
+    while (pToken && argumentCount < CONSOLE_MAX_ARGUMENTS)
     {
-        pServer->exitRunLoop = 1;
-        return;
+        ppArguments[argumentCount++] = pToken;
+        pToken = strtok(NULL, " \t\r\n");
     }
-    write(pServer->stdout, buffer, bytesRead);
+    return argumentCount;
+}
+
+static void setOutputFilter(Server* pServer, int ruleCount, const char** ppRules)
+{
+    char   ruleText[1024];
+    size_t ruleTextLength = 0;
+    int    i;
+    
+    for (i = 0 ; i < ruleCount && ruleTextLength + strlen(ppRules[i]) + 1 < sizeof(ruleText) ; i++)
+        ruleTextLength += sprintf(ruleText + ruleTextLength, "%s\n", ppRules[i]);
+    
+    __try
+        Session_SetOutputFilter(&pServer->session, ruleText, ruleTextLength);
+    __catch
+        __rethrow;
+    printf(ruleTextLength ? "Output filter updated.\n" : "Output filter cleared.\n");
+}
+
+static void updateConsoleLineStart(Server* pServer, const char* pBuffer, int bufferLength)
+{
+    pServer->isConsoleAtLineStart = (pBuffer[bufferLength - 1] == '\n');
+}
+
+static void sendDataFromClientToConsole(Server* pServer)
+{
+    __try
+        Session_ReceiveFromClient(&pServer->session);
+    __catch
+        __rethrow;
+
+    if (pServer->session.isClosed)
+        pServer->exitRunLoop = 1;
 }
 
 void Server_PrintClientAddress(Server* pServer)
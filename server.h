@@ -17,10 +17,12 @@
 
 #include <netdb.h>
 #include "parameters.h"
+#include "session.h"
 
 typedef struct
 {
     struct sockaddr_in  clientAddress;
+    Session             session;
     fd_set              selectReadSet;
     int                 listenSocket;
     int                 acceptSocket;
@@ -28,6 +30,7 @@ typedef struct
     int                 stdout;
     int                 exitRunLoop;
     int                 highestReadFileDescriptor;
+    int                 isConsoleAtLineStart;
 } Server;
 
 void Server_Init(Server* pServer, Parameters* pParameters);
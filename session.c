@@ -0,0 +1,927 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "try_catch.h"
+#include "session.h"
+#include "exitreport.h"
+#include "lineframer.h"
+#include "timestamp.h"
+#include "console.h"
+#include "sha256.h"
+#include "eventstream.h"
+
+
+#define SESSION_MAX_PENDING_BYTES   (32 * 1024 * 1024)
+#define SESSION_ACK_INTERVAL        16
+
+
+static void initFields(Session* pSession, int socket, FrameWriter* pWriter, const struct sockaddr_in* pClientAddress,
+                       uint32_t id, uint16_t channel);
+static void flagStructureAsUninitialized(Session* pSession);
+static void freePendingFrames(Session* pSession);
+static void freePendingFrame(Session* pSession, PendingFrame* pFrame);
+static void closeRelayedSessions(Session* pSession);
+static void closeRelayedSession(Session* pRelay, uint16_t channel);
+static void processFrame(Session* pSession, const FrameHeader* pHeader, const char* pPayload);
+static void processRelayFrame(Session* pSession, const FrameHeader* pHeader, const char* pPayload);
+static void enableRelaying(Session* pSession);
+static void openRelayedSession(Session* pRelay, uint16_t channel, const char* pPayload, size_t length);
+static Session* addRelayedSession(Session* pRelay, uint16_t channel, uint32_t id,
+                                  const struct sockaddr_in* pClientAddress);
+static void forwardToRelayedSession(Session* pRelay, const FrameHeader* pHeader, const char* pPayload);
+static void processSessionFrame(Session* pSession, const FrameHeader* pHeader, const char* pPayload);
+static void processDedupFrame(Session* pSession, const FrameHeader* pHeader, const char* pPayload);
+static void processChunkReference(Session* pSession, const FrameHeader* pHeader, const char* pPayload);
+static void queuePendingFrame(Session* pSession, const FrameHeader* pHeader, const char* pPayload,
+                              ChunkCacheEntry* pChunk);
+static void fillMissedReference(Session* pSession, uint32_t sequence, const char* pData, size_t length);
+static PendingFrame* findMissedReference(Session* pSession, uint32_t sequence);
+static void processPendingFrames(Session* pSession);
+static void processOrderedFrame(Session* pSession, const FrameHeader* pHeader, const char* pPayload);
+static void displayReference(Session* pSession, const FrameHeader* pHeader, const char* pReference,
+                             ChunkCacheEntry* pChunk);
+static void displayAndCacheChunk(Session* pSession, const FrameHeader* pHeader, const char* pPayload);
+static void displayChunk(Session* pSession, const FrameHeader* pHeader, const char* pData, size_t length);
+static void displayOutput(Session* pSession, const FrameHeader* pHeader, const char* pPayload);
+static void displayLines(Session* pSession, uint8_t stream, const char* pPayload, size_t length);
+static void processTraceFrame(Session* pSession, const FrameHeader* pHeader, const char* pPayload);
+static size_t formatLinePrefix(Session* pSession, uint64_t timestamp, char* pDest);
+static void displayExitReport(Session* pSession, const char* pPayload, size_t length);
+static size_t formatClientAddress(Session* pSession, char* pDest, size_t destSize);
+
+
+void Session_Init(Session* pSession, int socket, const struct sockaddr_in* pClientAddress, uint32_t id,
+                  BufferPool* pPool)
+{
+    initFields(pSession, socket, &pSession->frameWriter, pClientAddress, id, 0);
+    Protocol_ConfigureSocket(socket);
+
+    if (pPool)
+    {
+        FrameReader_InitPooled(&pSession->frameReader, pPool);
+        return;
+    }
+    __try
+        FrameReader_Init(&pSession->frameReader);
+    __catch
+        __rethrow;
+}
+
+static void initFields(Session* pSession, int socket, FrameWriter* pWriter, const struct sockaddr_in* pClientAddress,
+                       uint32_t id, uint16_t channel)
+{
+    flagStructureAsUninitialized(pSession);
+
+    memset(&pSession->frameReader, 0, sizeof(pSession->frameReader));
+    FrameWriter_Init(&pSession->frameWriter, socket, 0);
+    pSession->clientAddress = *pClientAddress;
+    pSession->bytesReceived = 0;
+    pSession->firstLineTimestamp = 0;
+    pSession->lastReceiveTime = 0;
+    pSession->lastHeartbeatTime = 0;
+    pSession->lastActivityTime = 0;
+    pSession->pongCount = 0;
+    pSession->pendingBytes = 0;
+    pSession->deficit = 0;
+    pSession->pChunkCache = NULL;
+    pSession->pOldestPending = NULL;
+    pSession->pNewestPending = NULL;
+    pSession->pFrameWriter = pWriter;
+    pSession->ppRelayedSessions = NULL;
+    pSession->pRelay = NULL;
+    pSession->pNextReady = NULL;
+    pSession->pAllocateId = NULL;
+    pSession->pAllocatorContext = NULL;
+    pSession->id = id;
+    pSession->lastAcknowledgedReference = 0;
+    pSession->weight = 1;
+    pSession->channel = channel;
+    pSession->socket = socket;
+    pSession->isClosed = 0;
+    pSession->isLineContinued = 0;
+    pSession->isHandedOff = 0;
+    pSession->isAwaitingPong = 0;
+    pSession->isReady = 0;
+    pSession->isWaitingToSend = 0;
+    Timer_Init(&pSession->heartbeatTimer, NULL, NULL);
+    Timer_Init(&pSession->idleTimer, NULL, NULL);
+    TransferSet_Init(&pSession->transfers, pWriter, channel, 0);
+    TraceStats_Init(&pSession->trace);
+    OutputIndex_Init(&pSession->outputIndex, 0);
+}
+
+static void flagStructureAsUninitialized(Session* pSession)
+{
+    memset(pSession, 0xff, sizeof(*pSession));
+}
+
+void Session_Uninit(Session* pSession)
+{
+    closeRelayedSessions(pSession);
+    freePendingFrames(pSession);
+    TransferSet_Uninit(&pSession->transfers);
+    FrameReader_Uninit(&pSession->frameReader);
+    FrameWriter_Uninit(&pSession->frameWriter);
+    OutputIndex_Uninit(&pSession->outputIndex);
+    if (!pSession->pRelay && pSession->socket >= 0)
+        close(pSession->socket);
+
+    flagStructureAsUninitialized(pSession);
+}
+
+static void freePendingFrames(Session* pSession)
+{
+    while (pSession->pOldestPending)
+    {
+        PendingFrame* pFrame = pSession->pOldestPending;
+
+        pSession->pOldestPending = pFrame->pNext;
+        freePendingFrame(pSession, pFrame);
+    }
+    pSession->pNewestPending = NULL;
+}
+
+static void freePendingFrame(Session* pSession, PendingFrame* pFrame)
+{
+    pSession->pendingBytes -= pFrame->length;
+    if (pFrame->pChunk)
+    {
+        pSession->pendingBytes -= pFrame->pChunk->length;
+        ChunkCache_Release(pSession->pChunkCache, pFrame->pChunk);
+    }
+    free(pFrame);
+}
+
+static void closeRelayedSessions(Session* pSession)
+{
+    int i;
+
+    if (!pSession->ppRelayedSessions)
+        return;
+    for (i = 1 ; i < RELAY_MAX_CHANNELS ; i++)
+    {
+        if (pSession->ppRelayedSessions[i])
+            closeRelayedSession(pSession, (uint16_t)i);
+    }
+    free(pSession->ppRelayedSessions);
+    pSession->ppRelayedSessions = NULL;
+}
+
+static void closeRelayedSession(Session* pRelay, uint16_t channel)
+{
+    Session* pSession = pRelay->ppRelayedSessions[channel];
+
+    if (!pRelay->isHandedOff)
+    {
+        printf("Session %08x disconnected.\n", pSession->id);
+        fflush(stdout);
+        Session_RecordDisconnection(pSession, "");
+    }
+    Session_Uninit(pSession);
+    free(pSession);
+    pRelay->ppRelayedSessions[channel] = NULL;
+}
+
+void Session_EnableOutputIndex(Session* pSession, uint64_t limit)
+{
+    OutputIndex_Init(&pSession->outputIndex, limit);
+}
+
+void Session_EnableDedup(Session* pSession, ChunkCache* pCache)
+{
+    pSession->pChunkCache = pCache;
+}
+
+void Session_EnableOutputQueue(Session* pSession, size_t limit)
+{
+    FrameWriter_Init(&pSession->frameWriter, pSession->socket, limit);
+}
+
+int Session_HasQueuedOutput(Session* pSession)
+{
+    return FrameWriter_HasQueuedData(pSession->pFrameWriter);
+}
+
+/* File transfers stop sending while anything is queued so they carry on once the queue has gone. */
+void Session_SendQueuedOutput(Session* pSession)
+{
+    int i;
+
+    __try
+        FrameWriter_Flush(pSession->pFrameWriter);
+    __catch
+        __rethrow;
+    if (FrameWriter_HasQueuedData(pSession->pFrameWriter))
+        return;
+
+    __try
+        TransferSet_ResumeSending(&pSession->transfers);
+    __catch
+        __rethrow;
+    for (i = 1 ; pSession->ppRelayedSessions && i < RELAY_MAX_CHANNELS ; i++)
+    {
+        if (!pSession->ppRelayedSessions[i])
+            continue;
+        __try
+            TransferSet_ResumeSending(&pSession->ppRelayedSessions[i]->transfers);
+        __catch
+            __rethrow;
+    }
+}
+
+void Session_ForEachPendingFrame(Session* pSession, PendingFrameHandler* pHandler, void* pContext)
+{
+    PendingFrame* pFrame;
+
+    for (pFrame = pSession->pOldestPending ; pFrame ; pFrame = pFrame->pNext)
+        pHandler(pContext, pFrame->frame, pFrame->length);
+}
+
+void Session_RestorePendingFrame(Session* pSession, const char* pFrame, size_t length)
+{
+    FrameHeader header;
+
+    /* References are simply processed again.  This process's cache is new, so each is missed and the client, which
+       keeps the data of every reference until it is acknowledged, sends it again. */
+    if (length < PROTOCOL_HEADER_SIZE)
+        return;
+    Protocol_DecodeHeader(&header, pFrame);
+    if (header.length != length - PROTOCOL_HEADER_SIZE)
+        return;
+    __try
+        processSessionFrame(pSession, &header, pFrame + PROTOCOL_HEADER_SIZE);
+    __catch
+        __rethrow;
+}
+
+void Session_AllowRelaying(Session* pSession, SessionIdAllocator* pAllocateId, void* pAllocatorContext)
+{
+    pSession->pAllocateId = pAllocateId;
+    pSession->pAllocatorContext = pAllocatorContext;
+}
+
+Session* Session_FindRelayedSession(Session* pSession, uint32_t id)
+{
+    int i;
+
+    if (!pSession->ppRelayedSessions)
+        return NULL;
+    for (i = 1 ; i < RELAY_MAX_CHANNELS ; i++)
+    {
+        Session* pRelayed = pSession->ppRelayedSessions[i];
+
+        if (pRelayed && pRelayed->id == id)
+            return pRelayed;
+    }
+    return NULL;
+}
+
+void Session_ReceiveFromClient(Session* pSession)
+{
+    Session_ReceiveAtMost(pSession, SIZE_MAX);
+}
+
+int Session_ReceiveAtMost(Session* pSession, size_t maximum)
+{
+    FrameHeader header;
+    const char* pPayload = NULL;
+    int         bytesRead = -1;
+
+    __try
+        bytesRead = FrameReader_ReceiveAtMost(&pSession->frameReader, pSession->socket, maximum);
+    __catch
+        __rethrow_and_return(-1);
+    if (bytesRead < 0)
+    {
+        FrameReader_ReleaseIdleBuffer(&pSession->frameReader);
+        return bytesRead;
+    }
+    if (bytesRead == 0)
+    {
+        pSession->isClosed = 1;
+        return bytesRead;
+    }
+    pSession->bytesReceived += bytesRead;
+    if (pSession->trace.isActive)
+        pSession->lastReceiveTime = Timestamp_Now();
+
+    while (FrameReader_NextFrame(&pSession->frameReader, &header, &pPayload))
+    {
+        __try
+            processFrame(pSession, &header, pPayload);
+        __catch
+            __rethrow_and_return(-1);
+    }
+    FrameReader_ReleaseIdleBuffer(&pSession->frameReader);
+    return bytesRead;
+}
+
+static void processFrame(Session* pSession, const FrameHeader* pHeader, const char* pPayload)
+{
+    __try
+    {
+        if (pHeader->type == FRAME_RELAY)
+            processRelayFrame(pSession, pHeader, pPayload);
+        else if (pHeader->channel != 0)
+            forwardToRelayedSession(pSession, pHeader, pPayload);
+        else
+            processSessionFrame(pSession, pHeader, pPayload);
+    }
+    __catch
+        __rethrow;
+}
+
+static void processRelayFrame(Session* pSession, const FrameHeader* pHeader, const char* pPayload)
+{
+    if (pHeader->flags == RELAY_HELLO)
+    {
+        __try
+            enableRelaying(pSession);
+        __catch
+            __rethrow;
+        return;
+    }
+    if (!pSession->ppRelayedSessions || pHeader->channel == 0)
+        return;
+
+    if (pHeader->flags == RELAY_OPEN)
+    {
+        __try
+            openRelayedSession(pSession, pHeader->channel, pPayload, pHeader->length);
+        __catch
+            __rethrow;
+    }
+    else if (pHeader->flags == RELAY_CLOSE && pSession->ppRelayedSessions[pHeader->channel])
+    {
+        closeRelayedSession(pSession, pHeader->channel);
+    }
+}
+
+static void enableRelaying(Session* pSession)
+{
+    if (pSession->ppRelayedSessions)
+        return;
+    if (!pSession->pAllocateId)
+    {
+        printf("error: Session %08x is a relay but relays are only supported with --shards.\n", pSession->id);
+        fflush(stdout);
+        return;
+    }
+
+    pSession->ppRelayedSessions = calloc(RELAY_MAX_CHANNELS, sizeof(*pSession->ppRelayedSessions));
+    if (!pSession->ppRelayedSessions)
+        __throw(outOfMemoryException);
+    printf("Session %08x is a relay.\n", pSession->id);
+    fflush(stdout);
+}
+
+static void openRelayedSession(Session* pRelay, uint16_t channel, const char* pPayload, size_t length)
+{
+    struct sockaddr_in clientAddress;
+    Session*           pSession = NULL;
+
+    if (length < RELAY_OPEN_SIZE || pRelay->ppRelayedSessions[channel])
+        return;
+
+    memset(&clientAddress, 0, sizeof(clientAddress));
+    clientAddress.sin_family = AF_INET;
+    memcpy(&clientAddress.sin_addr.s_addr, pPayload, 4);
+    memcpy(&clientAddress.sin_port, pPayload + 4, 2);
+
+    __try
+        pSession = addRelayedSession(pRelay, channel, pRelay->pAllocateId(pRelay->pAllocatorContext), &clientAddress);
+    __catch
+        __rethrow;
+
+    printf("Session %08x connected from ", pSession->id);
+    Session_PrintClientAddress(pSession);
+    printf(" via relay %08x.\n", pRelay->id);
+    fflush(stdout);
+    Session_RecordConnection(pSession);
+}
+
+static Session* addRelayedSession(Session* pRelay, uint16_t channel, uint32_t id,
+                                  const struct sockaddr_in* pClientAddress)
+{
+    Session* pSession = malloc(sizeof(*pSession));
+
+    if (!pSession)
+        __throw_and_return(outOfMemoryException, NULL);
+    initFields(pSession, pRelay->socket, pRelay->pFrameWriter, pClientAddress, id, channel);
+    pSession->pRelay = pRelay;
+    pSession->pChunkCache = pRelay->pChunkCache;
+    Session_EnableOutputIndex(pSession, pRelay->outputIndex.limit);
+    pRelay->ppRelayedSessions[channel] = pSession;
+
+    return pSession;
+}
+
+Session* Session_AdoptRelayedSession(Session* pRelay, uint16_t channel, uint32_t id,
+                                     const struct sockaddr_in* pClientAddress)
+{
+    Session* pSession = NULL;
+
+    if (channel == 0)
+        __throw_and_return(serverException, NULL);
+    if (!pRelay->ppRelayedSessions)
+    {
+        pRelay->ppRelayedSessions = calloc(RELAY_MAX_CHANNELS, sizeof(*pRelay->ppRelayedSessions));
+        if (!pRelay->ppRelayedSessions)
+            __throw_and_return(outOfMemoryException, NULL);
+    }
+    if (pRelay->ppRelayedSessions[channel])
+        __throw_and_return(serverException, NULL);
+
+    __try
+        pSession = addRelayedSession(pRelay, channel, id, pClientAddress);
+    __catch
+        __rethrow_and_return(NULL);
+
+    return pSession;
+}
+
+static void forwardToRelayedSession(Session* pRelay, const FrameHeader* pHeader, const char* pPayload)
+{
+    Session* pSession = NULL;
+
+    if (!pRelay->ppRelayedSessions || !pRelay->ppRelayedSessions[pHeader->channel])
+        return;
+
+    pSession = pRelay->ppRelayedSessions[pHeader->channel];
+    pSession->bytesReceived += PROTOCOL_HEADER_SIZE + pHeader->length;
+    if (pSession->trace.isActive)
+        pSession->lastReceiveTime = Timestamp_Now();
+
+    __try
+        processSessionFrame(pSession, pHeader, pPayload);
+    __catch
+        __rethrow;
+}
+
+static void processSessionFrame(Session* pSession, const FrameHeader* pHeader, const char* pPayload)
+{
+    if (pHeader->type == FRAME_CONTROL && pHeader->flags == CONTROL_PING)
+        FrameWriter_SendFrame(pSession->pFrameWriter, FRAME_CONTROL, CONTROL_PONG, pSession->channel, NULL, 0);
+    else if (pHeader->type == FRAME_CONTROL && pHeader->flags == CONTROL_PONG)
+        pSession->pongCount++;
+    else if (pHeader->type == FRAME_DEDUP)
+        processDedupFrame(pSession, pHeader, pPayload);
+    else if (pHeader->type == FRAME_CHUNK_REF)
+        processChunkReference(pSession, pHeader, pPayload);
+    else if (pSession->pOldestPending)
+        queuePendingFrame(pSession, pHeader, pPayload, NULL);
+    else
+        processOrderedFrame(pSession, pHeader, pPayload);
+}
+
+static void processDedupFrame(Session* pSession, const FrameHeader* pHeader, const char* pPayload)
+{
+    if (!pSession->pChunkCache)
+        return;
+
+    if (pHeader->flags == DEDUP_HELLO && ChunkCache_IsEnabled(pSession->pChunkCache))
+    {
+        FrameWriter_SendFrame(pSession->pFrameWriter, FRAME_DEDUP, DEDUP_HELLO, pSession->channel, NULL, 0);
+    }
+    else if (pHeader->flags == DEDUP_FILL && pHeader->length >= DEDUP_SEQUENCE_SIZE)
+    {
+        fillMissedReference(pSession, Protocol_GetUint32(pPayload), pPayload + DEDUP_SEQUENCE_SIZE,
+                            pHeader->length - DEDUP_SEQUENCE_SIZE);
+    }
+}
+
+static void processChunkReference(Session* pSession, const FrameHeader* pHeader, const char* pPayload)
+{
+    ChunkCacheEntry* pChunk = NULL;
+
+    if (!pSession->pChunkCache || pHeader->length != DEDUP_REF_SIZE)
+        return;
+
+    pChunk = ChunkCache_Lookup(pSession->pChunkCache, (const uint8_t*)pPayload + DEDUP_SEQUENCE_SIZE + 4,
+                               Protocol_GetUint32(pPayload + DEDUP_SEQUENCE_SIZE));
+    if (pChunk && !pSession->pOldestPending)
+    {
+        displayReference(pSession, pHeader, pPayload, pChunk);
+        ChunkCache_Release(pSession->pChunkCache, pChunk);
+        return;
+    }
+    if (!pChunk)
+    {
+        FrameWriter_SendFrame(pSession->pFrameWriter, FRAME_DEDUP, DEDUP_MISS, pSession->channel, pPayload,
+                              DEDUP_SEQUENCE_SIZE);
+    }
+
+    /* Everything the client sends after this reference now waits behind it until its data arrives. */
+    __try
+        queuePendingFrame(pSession, pHeader, pPayload, pChunk);
+    __catch
+    {
+        if (pChunk)
+            ChunkCache_Release(pSession->pChunkCache, pChunk);
+        __rethrow;
+    }
+}
+
+static void queuePendingFrame(Session* pSession, const FrameHeader* pHeader, const char* pPayload,
+                              ChunkCacheEntry* pChunk)
+{
+    size_t        length = PROTOCOL_HEADER_SIZE + pHeader->length;
+    size_t        chunkLength = pChunk ? pChunk->length : 0;
+    PendingFrame* pFrame = NULL;
+
+    if (pSession->pendingBytes + length + chunkLength > SESSION_MAX_PENDING_BYTES)
+    {
+        printf("error: Session %08x sent more than %u MB while waiting for a missed chunk.\n", pSession->id,
+               SESSION_MAX_PENDING_BYTES / (1024 * 1024));
+        fflush(stdout);
+        __throw(serverException);
+    }
+    pFrame = malloc(sizeof(*pFrame) + length);
+    if (!pFrame)
+        __throw(outOfMemoryException);
+
+    pFrame->pNext = NULL;
+    pFrame->pChunk = pChunk;
+    pFrame->length = length;
+    Protocol_EncodeHeader(pFrame->frame, pHeader);
+    memcpy(pFrame->frame + PROTOCOL_HEADER_SIZE, pPayload, pHeader->length);
+    if (pSession->pNewestPending)
+        pSession->pNewestPending->pNext = pFrame;
+    else
+        pSession->pOldestPending = pFrame;
+    pSession->pNewestPending = pFrame;
+    pSession->pendingBytes += length + chunkLength;
+}
+
+static void fillMissedReference(Session* pSession, uint32_t sequence, const char* pData, size_t length)
+{
+    PendingFrame* pFrame = findMissedReference(pSession, sequence);
+    const char*   pReference = NULL;
+    uint8_t       hash[DEDUP_HASH_SIZE];
+
+    /* A fill for a reference which isn't waiting is a duplicate from before a handoff and is ignored. */
+    if (!pFrame)
+        return;
+
+    pReference = pFrame->frame + PROTOCOL_HEADER_SIZE;
+    Sha256_Compute(pData, length, hash);
+    if (length != Protocol_GetUint32(pReference + DEDUP_SEQUENCE_SIZE) ||
+        memcmp(hash, pReference + DEDUP_SEQUENCE_SIZE + 4, sizeof(hash)) != 0)
+    {
+        printf("error: Session %08x sent data which doesn't match its chunk reference.\n", pSession->id);
+        fflush(stdout);
+        __throw(serverException);
+    }
+
+    __try
+    {
+        __throwing_func( pFrame->pChunk = ChunkCache_Insert(pSession->pChunkCache, hash, pData, (uint32_t)length) );
+        pSession->pendingBytes += length;
+        __throwing_func( processPendingFrames(pSession) );
+    }
+    __catch
+        __rethrow;
+}
+
+static PendingFrame* findMissedReference(Session* pSession, uint32_t sequence)
+{
+    PendingFrame* pFrame;
+
+    for (pFrame = pSession->pOldestPending ; pFrame ; pFrame = pFrame->pNext)
+    {
+        FrameHeader header;
+
+        Protocol_DecodeHeader(&header, pFrame->frame);
+        if (header.type == FRAME_CHUNK_REF && !pFrame->pChunk &&
+            Protocol_GetUint32(pFrame->frame + PROTOCOL_HEADER_SIZE) == sequence)
+        {
+            return pFrame;
+        }
+    }
+    return NULL;
+}
+
+static void processPendingFrames(Session* pSession)
+{
+    while (pSession->pOldestPending)
+    {
+        PendingFrame* pFrame = pSession->pOldestPending;
+        const char*   pPayload = pFrame->frame + PROTOCOL_HEADER_SIZE;
+        FrameHeader   header;
+
+        Protocol_DecodeHeader(&header, pFrame->frame);
+        if (header.type == FRAME_CHUNK_REF && !pFrame->pChunk)
+            return;
+
+        pSession->pOldestPending = pFrame->pNext;
+        if (!pSession->pOldestPending)
+            pSession->pNewestPending = NULL;
+        __try
+        {
+            if (header.type == FRAME_CHUNK_REF)
+                displayReference(pSession, &header, pPayload, pFrame->pChunk);
+            else
+                processOrderedFrame(pSession, &header, pPayload);
+        }
+        __catch
+        {
+            freePendingFrame(pSession, pFrame);
+            __rethrow;
+        }
+        freePendingFrame(pSession, pFrame);
+    }
+}
+
+static void processOrderedFrame(Session* pSession, const FrameHeader* pHeader, const char* pPayload)
+{
+    if (pHeader->type == FRAME_DATA || pHeader->type == FRAME_LINES)
+        displayOutput(pSession, pHeader, pPayload);
+    else if (pHeader->type == FRAME_CHUNK_DATA)
+        displayAndCacheChunk(pSession, pHeader, pPayload);
+    else if (pHeader->type == FRAME_TRACE)
+        processTraceFrame(pSession, pHeader, pPayload);
+    else if (pHeader->type == FRAME_EXIT)
+        displayExitReport(pSession, pPayload, pHeader->length);
+    else if (TransferSet_IsTransferFrame(pHeader))
+        TransferSet_ProcessFrame(&pSession->transfers, pHeader, pPayload);
+}
+
+static void displayReference(Session* pSession, const FrameHeader* pHeader, const char* pReference,
+                             ChunkCacheEntry* pChunk)
+{
+    uint32_t sequence = Protocol_GetUint32(pReference);
+    char     acknowledgement[DEDUP_SEQUENCE_SIZE];
+
+    displayChunk(pSession, pHeader, pChunk->data, pChunk->length);
+    if (sequence - pSession->lastAcknowledgedReference < SESSION_ACK_INTERVAL)
+        return;
+    Protocol_PutUint32(acknowledgement, sequence);
+    FrameWriter_SendFrame(pSession->pFrameWriter, FRAME_DEDUP, DEDUP_ACK, pSession->channel, acknowledgement,
+                          sizeof(acknowledgement));
+    pSession->lastAcknowledgedReference = sequence;
+}
+
+static void displayAndCacheChunk(Session* pSession, const FrameHeader* pHeader, const char* pPayload)
+{
+    ChunkCacheEntry* pChunk = NULL;
+    uint8_t          hash[DEDUP_HASH_SIZE];
+
+    displayChunk(pSession, pHeader, pPayload, pHeader->length);
+    if (!pSession->pChunkCache || !ChunkCache_IsEnabled(pSession->pChunkCache))
+        return;
+
+    Sha256_Compute(pPayload, pHeader->length, hash);
+    __try
+        pChunk = ChunkCache_Insert(pSession->pChunkCache, hash, pPayload, pHeader->length);
+    __catch
+        __rethrow;
+    ChunkCache_Release(pSession->pChunkCache, pChunk);
+}
+
+static void displayChunk(Session* pSession, const FrameHeader* pHeader, const char* pData, size_t length)
+{
+    FrameHeader header = *pHeader;
+
+    header.type = FRAME_DATA;
+    header.length = (uint32_t)length;
+    displayOutput(pSession, &header, pData);
+}
+
+static void displayOutput(Session* pSession, const FrameHeader* pHeader, const char* pPayload)
+{
+    uint64_t writeStartTime = 0;
+
+    if (pSession->trace.isActive)
+        writeStartTime = Timestamp_Now();
+
+    if (pHeader->type == FRAME_LINES)
+    {
+        displayLines(pSession, pHeader->flags, pPayload, pHeader->length);
+    }
+    else
+    {
+        Console_Write(pPayload, pHeader->length);
+        OutputIndex_Append(&pSession->outputIndex, pPayload, pHeader->length);
+        EventStream_Write(EVENT_OUTPUT, pSession->id, pHeader->flags, pPayload, pHeader->length);
+    }
+
+    if (pSession->trace.isActive)
+        TraceStats_RecordWrite(&pSession->trace, pSession->lastReceiveTime, writeStartTime, Timestamp_Now());
+}
+
+/* Shard threads display concurrently so the output buffer lives on the stack.  The client's line framer never sends a
+   record longer than LINE_FRAMER_MAX_LINE_LENGTH, so a longer one is a protocol error rather than something to fit. */
+static void displayLines(Session* pSession, uint8_t stream, const char* pPayload, size_t length)
+{
+    char        output[64 * 1024];
+    const char* pEnd = pPayload + length;
+    size_t      outputLength = 0;
+
+    while (pEnd - pPayload >= LINE_RECORD_HEADER_SIZE)
+    {
+        uint64_t timestamp = Protocol_GetUint64(pPayload);
+        uint32_t lengthAndFlags = Protocol_GetUint32(pPayload + 8);
+        size_t   lineLength = lengthAndFlags & LINE_RECORD_LENGTH_MASK;
+
+        pPayload += LINE_RECORD_HEADER_SIZE;
+        if (lineLength > (size_t)(pEnd - pPayload))
+            break;
+        if (lineLength > LINE_FRAMER_MAX_LINE_LENGTH)
+        {
+            Console_Write(output, outputLength);
+            __throw(clientException);
+        }
+        if (outputLength + 48 + lineLength > sizeof(output))
+        {
+            Console_Write(output, outputLength);
+            outputLength = 0;
+        }
+
+        if (!pSession->isLineContinued)
+            outputLength += formatLinePrefix(pSession, timestamp, output + outputLength);
+        memcpy(output + outputLength, pPayload, lineLength);
+        outputLength += lineLength;
+        OutputIndex_Append(&pSession->outputIndex, pPayload, lineLength);
+        EventStream_Write(EVENT_OUTPUT, pSession->id, stream, pPayload, lineLength);
+        pSession->isLineContinued = (lengthAndFlags & LINE_RECORD_CONTINUED) != 0;
+        pPayload += lineLength;
+    }
+    Console_Write(output, outputLength);
+}
+
+static size_t formatLinePrefix(Session* pSession, uint64_t timestamp, char* pDest)
+{
+    uint64_t elapsed;
+
+    if (pSession->firstLineTimestamp == 0)
+        pSession->firstLineTimestamp = timestamp;
+    elapsed = timestamp - pSession->firstLineTimestamp;
+
+    return sprintf(pDest, "[%5llu.%06llu] ",
+                   (unsigned long long)(elapsed / TIMESTAMP_NANOSECONDS_PER_SECOND),
+                   (unsigned long long)(elapsed % TIMESTAMP_NANOSECONDS_PER_SECOND / TIMESTAMP_NANOSECONDS_PER_MICROSECOND));
+}
+
+static void displayExitReport(Session* pSession, const char* pPayload, size_t length)
+{
+    ExitReport report;
+    char       reportText[256];
+
+    if (!ExitReport_Decode(&report, pPayload, length))
+        return;
+    ExitReport_Format(&report, reportText, sizeof(reportText));
+    printf("Session %08x: %s.\n", pSession->id, reportText);
+    fflush(stdout);
+    EventStream_Write(EVENT_EXIT, pSession->id, 0, reportText, strlen(reportText));
+    FrameWriter_SendFrame(pSession->pFrameWriter, FRAME_CONTROL, CONTROL_EXIT_ACK, pSession->channel, NULL, 0);
+}
+
+static void processTraceFrame(Session* pSession, const FrameHeader* pHeader, const char* pPayload)
+{
+    char     request[TRACE_CLOCK_REQUEST_SIZE];
+    uint64_t now;
+
+    if (pHeader->flags == TRACE_CLOCK_REPLY)
+    {
+        TraceStats_RecordClockReply(&pSession->trace, pPayload, pHeader->length, pSession->lastReceiveTime);
+        return;
+    }
+    if (pHeader->flags != TRACE_CHUNK)
+        return;
+
+    TraceStats_RecordChunk(&pSession->trace, pPayload, pHeader->length);
+    now = Timestamp_Now();
+    if (!TraceStats_IsClockRequestDue(&pSession->trace, now))
+        return;
+    TraceStats_EncodeClockRequest(&pSession->trace, request, now);
+    FrameWriter_SendFrame(pSession->pFrameWriter, FRAME_TRACE, TRACE_CLOCK_REQUEST, pSession->channel, request,
+                          sizeof(request));
+}
+
+void Session_SendInput(Session* pSession, const void* pBuffer, size_t length)
+{
+    FrameWriter_SendFrame(pSession->pFrameWriter, FRAME_INPUT, 0, pSession->channel, pBuffer, length);
+}
+
+void Session_SendInterrupt(Session* pSession)
+{
+    FrameWriter_SendFrame(pSession->pFrameWriter, FRAME_CONTROL, CONTROL_INTERRUPT, pSession->channel, NULL, 0);
+}
+
+/* A session is sent the frame if selected.  A relay is never sent it itself; instead its selected relayed sessions
+   are, PROTOCOL_MAX_BATCH_FRAMES to a sendmsg() on the relay's socket.  Returns how many sessions it went to. */
+int Session_BroadcastFrame(Session* pSession, SessionSelector* pIsSelected, void* pContext,
+                           uint8_t type, uint8_t flags, const void* pPayload, size_t length)
+{
+    uint16_t channels[PROTOCOL_MAX_BATCH_FRAMES];
+    int      channelCount = 0;
+    int      sentCount = 0;
+    int      i;
+
+    if (!pSession->ppRelayedSessions)
+    {
+        if (!pIsSelected(pSession, pContext))
+            return 0;
+        __try
+            FrameWriter_SendFrame(pSession->pFrameWriter, type, flags, pSession->channel, pPayload, length);
+        __catch
+            __rethrow_and_return(0);
+        return 1;
+    }
+
+    for (i = 1 ; i < RELAY_MAX_CHANNELS ; i++)
+    {
+        Session* pRelayed = pSession->ppRelayedSessions[i];
+
+        if (!pRelayed || !pIsSelected(pRelayed, pContext))
+            continue;
+        channels[channelCount++] = pRelayed->channel;
+        if (channelCount < PROTOCOL_MAX_BATCH_FRAMES)
+            continue;
+        __try
+            FrameWriter_SendFrameToChannels(pSession->pFrameWriter, type, flags, channels, channelCount, pPayload,
+                                            length);
+        __catch
+            __rethrow_and_return(sentCount);
+        sentCount += channelCount;
+        channelCount = 0;
+    }
+    __try
+        FrameWriter_SendFrameToChannels(pSession->pFrameWriter, type, flags, channels, channelCount, pPayload,
+                                        length);
+    __catch
+        __rethrow_and_return(sentCount);
+
+    return sentCount + channelCount;
+}
+
+void Session_PullFile(Session* pSession, const char* pRemotePath, const char* pLocalPath)
+{
+    TransferSet_Pull(&pSession->transfers, pRemotePath, pLocalPath);
+}
+
+void Session_PushFile(Session* pSession, const char* pLocalPath, const char* pRemotePath)
+{
+    TransferSet_Push(&pSession->transfers, pLocalPath, pRemotePath);
+}
+
+void Session_SetOutputFilter(Session* pSession, const char* pRuleText, size_t length)
+{
+    FrameWriter_SendFrame(pSession->pFrameWriter, FRAME_FILTER, 0, pSession->channel, pRuleText, length);
+}
+
+void Session_DisplayTrace(Session* pSession)
+{
+    TraceStats_Display(&pSession->trace);
+}
+
+void Session_PrintClientAddress(Session* pSession)
+{
+    char address[INET_ADDRSTRLEN + 8];
+
+    formatClientAddress(pSession, address, sizeof(address));
+    printf("%s", address);
+}
+
+static size_t formatClientAddress(Session* pSession, char* pDest, size_t destSize)
+{
+    char addressString[INET_ADDRSTRLEN];
+
+    inet_ntop(AF_INET, &pSession->clientAddress.sin_addr, addressString, sizeof(addressString));
+    return snprintf(pDest, destSize, "%s:%u", addressString, ntohs(pSession->clientAddress.sin_port));
+}
+
+void Session_RecordConnection(Session* pSession)
+{
+    char   address[INET_ADDRSTRLEN + 8];
+    size_t length;
+
+    if (!EventStream_IsEnabled())
+        return;
+    length = formatClientAddress(pSession, address, sizeof(address));
+    EventStream_Write(EVENT_CONNECT, pSession->id, 0, address, length);
+}
+
+void Session_RecordDisconnection(Session* pSession, const char* pReason)
+{
+    EventStream_Write(EVENT_DISCONNECT, pSession->id, 0, pReason, strlen(pReason));
+}
@@ -0,0 +1,120 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef _SESSION_H_
+#define _SESSION_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netdb.h>
+#include "protocol.h"
+#include "transfer.h"
+#include "trace.h"
+#include "outputindex.h"
+#include "bufferpool.h"
+#include "timerwheel.h"
+#include "chunkcache.h"
+
+/* A session accepted directly from a client can also turn out to be a remoterelay connection carrying many clients.
+   Each of those gets its own relayed session, indexed by the channel number the relay tagged its frames with, which
+   shares the relay's socket and is given its id by the owner's SessionIdAllocator.  The owner also keeps the
+   session's heartbeat and idle timers, and the activity times they check, in the session itself, along with the
+   weight, deficit and ready list link of its read scheduler; relayed sessions are read through their relay and are
+   scheduled as part of it.  A session given a ChunkCache by Session_EnableDedup() answers a deduplicating client
+   and, while it waits for the data of a reference its cache missed, keeps that client's later frames in order in its
+   pending list.  A session given an output queue by Session_EnableOutputQueue() never blocks sending to its client;
+   what its socket won't take is queued for Session_SendQueuedOutput().  Relayed sessions send through their relay's
+   FrameWriter. */
+typedef uint32_t SessionIdAllocator(void* pContext);
+typedef void     PendingFrameHandler(void* pContext, const char* pFrame, size_t length);
+
+typedef struct PendingFrame
+{
+    struct PendingFrame* pNext;
+    ChunkCacheEntry*     pChunk;
+    size_t               length;
+    char                 frame[];
+} PendingFrame;
+
+typedef struct Session
+{
+    struct sockaddr_in  clientAddress;
+    FrameReader         frameReader;
+    FrameWriter         frameWriter;
+    TransferSet         transfers;
+    TraceStats          trace;
+    OutputIndex         outputIndex;
+    Timer               heartbeatTimer;
+    Timer               idleTimer;
+    uint64_t            bytesReceived;
+    uint64_t            firstLineTimestamp;
+    uint64_t            lastReceiveTime;
+    uint64_t            lastHeartbeatTime;
+    uint64_t            lastActivityTime;
+    uint64_t            pongCount;
+    uint64_t            pendingBytes;
+    uint64_t            deficit;
+    ChunkCache*         pChunkCache;
+    PendingFrame*       pOldestPending;
+    PendingFrame*       pNewestPending;
+    FrameWriter*        pFrameWriter;
+    struct Session**    ppRelayedSessions;
+    struct Session*     pRelay;
+    struct Session*     pNextReady;
+    SessionIdAllocator* pAllocateId;
+    void*               pAllocatorContext;
+    uint32_t            id;
+    uint32_t            lastAcknowledgedReference;
+    uint32_t            weight;
+    uint16_t            channel;
+    int                 socket;
+    int                 isClosed;
+    int                 isLineContinued;
+    int                 isHandedOff;
+    int                 isAwaitingPong;
+    int                 isReady;
+    int                 isWaitingToSend;
+} Session;
+
+typedef int SessionSelector(Session* pSession, void* pContext);
+
+void Session_Init(Session* pSession, int socket, const struct sockaddr_in* pClientAddress, uint32_t id,
+                  BufferPool* pPool);
+void Session_Uninit(Session* pSession);
+void Session_EnableOutputIndex(Session* pSession, uint64_t limit);
+void Session_EnableDedup(Session* pSession, ChunkCache* pCache);
+void Session_EnableOutputQueue(Session* pSession, size_t limit);
+int  Session_HasQueuedOutput(Session* pSession);
+void Session_SendQueuedOutput(Session* pSession);
+void Session_ForEachPendingFrame(Session* pSession, PendingFrameHandler* pHandler, void* pContext);
+void Session_RestorePendingFrame(Session* pSession, const char* pFrame, size_t length);
+void Session_AllowRelaying(Session* pSession, SessionIdAllocator* pAllocateId, void* pAllocatorContext);
+Session* Session_FindRelayedSession(Session* pSession, uint32_t id);
+Session* Session_AdoptRelayedSession(Session* pRelay, uint16_t channel, uint32_t id,
+                                     const struct sockaddr_in* pClientAddress);
+void Session_ReceiveFromClient(Session* pSession);
+int  Session_ReceiveAtMost(Session* pSession, size_t maximum);
+void Session_SendInput(Session* pSession, const void* pBuffer, size_t length);
+void Session_SendInterrupt(Session* pSession);
+int  Session_BroadcastFrame(Session* pSession, SessionSelector* pIsSelected, void* pContext,
+                            uint8_t type, uint8_t flags, const void* pPayload, size_t length);
+void Session_PullFile(Session* pSession, const char* pRemotePath, const char* pLocalPath);
+void Session_PushFile(Session* pSession, const char* pLocalPath, const char* pRemotePath);
+void Session_SetOutputFilter(Session* pSession, const char* pRuleText, size_t length);
+void Session_DisplayTrace(Session* pSession);
+void Session_PrintClientAddress(Session* pSession);
+void Session_RecordConnection(Session* pSession);
+void Session_RecordDisconnection(Session* pSession, const char* pReason);
+
+#endif /* _SESSION_H_ */
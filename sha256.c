@@ -0,0 +1,140 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <string.h>
+#include "sha256.h"
+
+
+#define SHA256_BLOCK_SIZE   64
+
+static const uint32_t g_roundConstants[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static void     processBlock(uint32_t* pState, const uint8_t* pBlock);
+static uint32_t rotateRight(uint32_t value, int count);
+static uint32_t loadBigEndian(const uint8_t* pSource);
+static void     storeBigEndian(uint8_t* pDest, uint32_t value);
+
+
+void Sha256_Compute(const void* pData, size_t length, uint8_t* pDigest)
+{
+    uint32_t       state[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    const uint8_t* pBytes = (const uint8_t*)pData;
+    uint8_t        finalBlocks[2 * SHA256_BLOCK_SIZE];
+    size_t         remaining = length;
+    size_t         finalLength;
+    uint64_t       bitCount = (uint64_t)length * 8;
+    int            i;
+
+    while (remaining >= SHA256_BLOCK_SIZE)
+    {
+        processBlock(state, pBytes);
+        pBytes += SHA256_BLOCK_SIZE;
+        remaining -= SHA256_BLOCK_SIZE;
+    }
+
+    /* The tail, a 1 bit, zero padding and the 64-bit message length fill out one or two more blocks. */
+    memset(finalBlocks, 0, sizeof(finalBlocks));
+    memcpy(finalBlocks, pBytes, remaining);
+    finalBlocks[remaining] = 0x80;
+    finalLength = remaining + 1 + 8 <= SHA256_BLOCK_SIZE ? SHA256_BLOCK_SIZE : 2 * SHA256_BLOCK_SIZE;
+    storeBigEndian(finalBlocks + finalLength - 8, (uint32_t)(bitCount >> 32));
+    storeBigEndian(finalBlocks + finalLength - 4, (uint32_t)bitCount);
+    processBlock(state, finalBlocks);
+    if (finalLength > SHA256_BLOCK_SIZE)
+        processBlock(state, finalBlocks + SHA256_BLOCK_SIZE);
+
+    for (i = 0 ; i < 8 ; i++)
+        storeBigEndian(pDigest + 4 * i, state[i]);
+}
+
+static void processBlock(uint32_t* pState, const uint8_t* pBlock)
+{
+    uint32_t schedule[64];
+    uint32_t a = pState[0];
+    uint32_t b = pState[1];
+    uint32_t c = pState[2];
+    uint32_t d = pState[3];
+    uint32_t e = pState[4];
+    uint32_t f = pState[5];
+    uint32_t g = pState[6];
+    uint32_t h = pState[7];
+    int      i;
+
+    for (i = 0 ; i < 16 ; i++)
+        schedule[i] = loadBigEndian(pBlock + 4 * i);
+    for (i = 16 ; i < 64 ; i++)
+    {
+        uint32_t s0 = rotateRight(schedule[i - 15], 7) ^ rotateRight(schedule[i - 15], 18) ^ (schedule[i - 15] >> 3);
+        uint32_t s1 = rotateRight(schedule[i - 2], 17) ^ rotateRight(schedule[i - 2], 19) ^ (schedule[i - 2] >> 10);
+
+        schedule[i] = schedule[i - 16] + s0 + schedule[i - 7] + s1;
+    }
+
+    for (i = 0 ; i < 64 ; i++)
+    {
+        uint32_t s1 = rotateRight(e, 6) ^ rotateRight(e, 11) ^ rotateRight(e, 25);
+        uint32_t choice = (e & f) ^ (~e & g);
+        uint32_t temp1 = h + s1 + choice + g_roundConstants[i] + schedule[i];
+        uint32_t s0 = rotateRight(a, 2) ^ rotateRight(a, 13) ^ rotateRight(a, 22);
+        uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t temp2 = s0 + majority;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + temp1;
+        d = c;
+        c = b;
+        b = a;
+        a = temp1 + temp2;
+    }
+
+    pState[0] += a;
+    pState[1] += b;
+    pState[2] += c;
+    pState[3] += d;
+    pState[4] += e;
+    pState[5] += f;
+    pState[6] += g;
+    pState[7] += h;
+}
+
+static uint32_t rotateRight(uint32_t value, int count)
+{
+    return (value >> count) | (value << (32 - count));
+}
+
+static uint32_t loadBigEndian(const uint8_t* pSource)
+{
+    return ((uint32_t)pSource[0] << 24) | ((uint32_t)pSource[1] << 16) | ((uint32_t)pSource[2] << 8) | pSource[3];
+}
+
+static void storeBigEndian(uint8_t* pDest, uint32_t value)
+{
+    pDest[0] = (uint8_t)(value >> 24);
+    pDest[1] = (uint8_t)(value >> 16);
+    pDest[2] = (uint8_t)(value >> 8);
+    pDest[3] = (uint8_t)value;
+}
@@ -0,0 +1,934 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "try_catch.h"
+#include "shard.h"
+#include "console.h"
+#include "timestamp.h"
+#include "eventstream.h"
+
+
+#define SHARD_MAX_EVENTS            256
+#define SHARD_SESSION_ID_SHIFT      24
+#define SHARD_SESSION_SEQUENCE_MASK ((1U << SHARD_SESSION_ID_SHIFT) - 1)
+#define SHARD_ACCEPT_RETRY_NS       (100 * 1000 * 1000ULL)
+
+
+static void flagStructureAsUninitialized(Shard* pShard);
+static void createListeningSocket(Shard* pShard, uint16_t portNumber);
+static void createSocket(Shard* pShard);
+static void allowBindToReuseAddressAndPort(Shard* pShard);
+static void bindSocket(Shard* pShard, uint16_t portNumber);
+static void listenOnSocket(Shard* pShard);
+static void createEpoll(Shard* pShard);
+static void createWakeEvent(Shard* pShard);
+static void addToEpoll(Shard* pShard, int fileDescriptor);
+static void closeFileDescriptor(int fileDescriptor);
+static void closeAllSessions(Shard* pShard);
+static void* shardThreadMain(void* pContext);
+static void pinThreadToCore(Shard* pShard);
+static void runEventLoop(Shard* pShard);
+static int  calculateEventLoopTimeout(Shard* pShard);
+static void processEvent(Shard* pShard, struct epoll_event* pEvent);
+static void processSessionEvent(Shard* pShard, Session* pSession, uint32_t events);
+static void acceptNewClients(Shard* pShard);
+static void pauseAccepting(Shard* pShard);
+static void resumeAccepting(Shard* pShard);
+static void acceptTimerExpired(Timer* pTimer, void* pContext);
+static void setListenerEvents(Shard* pShard, uint32_t events);
+static void addSession(Shard* pShard, int socket, const struct sockaddr_in* pClientAddress);
+static Session* createSession(Shard* pShard, int socket, const struct sockaddr_in* pClientAddress, uint32_t sessionId);
+static uint32_t allocateSessionId(void* pContext);
+static void reserveSessionId(Shard* pShard, uint32_t sessionId);
+static void growSessionTable(Shard* pShard, int fileDescriptor);
+static void markSessionReady(Shard* pShard, Session* pSession);
+static Session* takeFirstReadySession(Shard* pShard);
+static void unlinkReadySession(Shard* pShard, Session* pSession);
+static void serviceReadySessions(Shard* pShard);
+static void receiveFromSession(Shard* pShard, Session* pSession);
+static int  receiveWithinDeficit(Session* pSession);
+static void recordSessionActivity(Shard* pShard, Session* pSession, uint64_t bytesBefore, uint64_t pongsBefore);
+static void removeSession(Shard* pShard, Session* pSession);
+static void sendQueuedOutput(Shard* pShard, Session* pSession);
+static void updateAllSessionEvents(Shard* pShard);
+static void updateSessionEvents(Shard* pShard, Session* pSession);
+static void armSessionTimers(Shard* pShard, Session* pSession);
+static void heartbeatTimerExpired(Timer* pTimer, void* pContext);
+static void idleTimerExpired(Timer* pTimer, void* pContext);
+static Session* sessionFromTimer(Timer* pTimer, size_t timerOffset);
+static void drainWakeEvent(Shard* pShard);
+static void runPendingCommand(Shard* pShard);
+static void signalWakeEvent(Shard* pShard);
+
+
+void Shard_Init(Shard* pShard, Parameters* pParameters, int index, int listenSocket, BufferBudget* pBudget,
+                ChunkCache* pChunkCache)
+{
+    flagStructureAsUninitialized(pShard);
+    pShard->ppSessionTable = NULL;
+    pShard->pFirstReady = NULL;
+    pShard->pLastReady = NULL;
+    pShard->pChunkCache = pChunkCache;
+    pShard->pPendingCommand = NULL;
+    pShard->pPendingContext = NULL;
+    pShard->bytesReceived = 0;
+    pShard->nextSessionId = 0;
+    pShard->indexLimit = Parameters_GetIndexLimit(pParameters);
+    pShard->loopTime = Timestamp_Now();
+    pShard->heartbeatInterval = Parameters_GetHeartbeatSeconds(pParameters) * TIMESTAMP_NANOSECONDS_PER_SECOND;
+    pShard->idleTimeout = Parameters_GetIdleTimeoutSeconds(pParameters) * TIMESTAMP_NANOSECONDS_PER_SECOND;
+    pShard->index = index;
+    pShard->listenSocket = listenSocket;
+    pShard->sessionTableSize = 0;
+    pShard->sessionCount = 0;
+    pShard->exitRunLoop = 0;
+    pShard->exceptionCode = noException;
+    pShard->isThreadRunning = 0;
+    pShard->isAcceptPaused = 0;
+    pShard->hasSessionIdWrapped = 0;
+    pthread_mutex_init(&pShard->commandMutex, NULL);
+    pthread_cond_init(&pShard->commandCompleted, NULL);
+    BufferPool_Init(&pShard->bufferPool, pBudget, Parameters_GetSessionMemoryLimit(pParameters));
+    TimerWheel_Init(&pShard->timerWheel, pShard->loopTime);
+    Timer_Init(&pShard->acceptTimer, acceptTimerExpired, pShard);
+
+    __try
+    {
+        if (pShard->listenSocket < 0)
+        {
+            __throwing_func( createListeningSocket(pShard, Parameters_GetPortNumber(pParameters)) );
+        }
+        __throwing_func( createEpoll(pShard) );
+        __throwing_func( createWakeEvent(pShard) );
+        __throwing_func( addToEpoll(pShard, pShard->listenSocket) );
+        __throwing_func( addToEpoll(pShard, pShard->wakeFileDescriptor) );
+    }
+    __catch
+    {
+        __rethrow;
+    }
+}
+
+static void flagStructureAsUninitialized(Shard* pShard)
+{
+    memset(pShard, 0xff, sizeof(*pShard));
+}
+
+static void createListeningSocket(Shard* pShard, uint16_t portNumber)
+{
+    __try
+    {
+        __throwing_func( createSocket(pShard) );
+        __throwing_func( allowBindToReuseAddressAndPort(pShard) );
+        __throwing_func( bindSocket(pShard, portNumber) );
+        __throwing_func( listenOnSocket(pShard) );
+    }
+    __catch
+    {
+        __rethrow;
+    }
+}
+
+static void createSocket(Shard* pShard)
+{
+    pShard->listenSocket = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (pShard->listenSocket < 0)
+        __throw(socketException);
+}
+
+static void allowBindToReuseAddressAndPort(Shard* pShard)
+{
+    int optionValue = 1;
+    int result = -1;
+
+    setsockopt(pShard->listenSocket, SOL_SOCKET, SO_REUSEADDR, &optionValue, sizeof(optionValue));
+    result = setsockopt(pShard->listenSocket, SOL_SOCKET, SO_REUSEPORT, &optionValue, sizeof(optionValue));
+    if (result < 0)
+        __throw(socketException);
+}
+
+static void bindSocket(Shard* pShard, uint16_t portNumber)
+{
+    struct sockaddr_in  bindAddress;
+    int                 result = -1;
+
+    memset(&bindAddress, 0, sizeof(bindAddress));
+    bindAddress.sin_family = AF_INET;
+    bindAddress.sin_addr.s_addr = htonl(INADDR_ANY);
+    bindAddress.sin_port = htons(portNumber);
+
+    result = bind(pShard->listenSocket, (struct sockaddr*)&bindAddress, sizeof(bindAddress));
+    if (result < 0)
+        __throw(socketException);
+}
+
+static void listenOnSocket(Shard* pShard)
+{
+    int result = -1;
+
+    result = listen(pShard->listenSocket, SOMAXCONN);
+    if (result < 0)
+        __throw(socketException);
+}
+
+static void createEpoll(Shard* pShard)
+{
+    pShard->epollFileDescriptor = epoll_create1(EPOLL_CLOEXEC);
+    if (pShard->epollFileDescriptor < 0)
+        __throw(selectException);
+}
+
+static void createWakeEvent(Shard* pShard)
+{
+    pShard->wakeFileDescriptor = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (pShard->wakeFileDescriptor < 0)
+        __throw(pipeException);
+}
+
+static void addToEpoll(Shard* pShard, int fileDescriptor)
+{
+    struct epoll_event event;
+    int                result = -1;
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fileDescriptor;
+    result = epoll_ctl(pShard->epollFileDescriptor, EPOLL_CTL_ADD, fileDescriptor, &event);
+    if (result < 0)
+        __throw(selectException);
+}
+
+void Shard_Uninit(Shard* pShard)
+{
+    Shard_Stop(pShard);
+    closeAllSessions(pShard);
+    closeFileDescriptor(pShard->wakeFileDescriptor);
+    closeFileDescriptor(pShard->epollFileDescriptor);
+    closeFileDescriptor(pShard->listenSocket);
+    free(pShard->ppSessionTable);
+    BufferPool_Uninit(&pShard->bufferPool);
+    pthread_cond_destroy(&pShard->commandCompleted);
+    pthread_mutex_destroy(&pShard->commandMutex);
+
+    flagStructureAsUninitialized(pShard);
+}
+
+static void closeFileDescriptor(int fileDescriptor)
+{
+    if (fileDescriptor >= 0)
+        close(fileDescriptor);
+}
+
+static void closeAllSessions(Shard* pShard)
+{
+    int i;
+
+    if (!pShard->ppSessionTable || pShard->sessionTableSize < 0)
+        return;
+
+    for (i = 0 ; i < pShard->sessionTableSize ; i++)
+    {
+        if (pShard->ppSessionTable[i])
+            removeSession(pShard, pShard->ppSessionTable[i]);
+    }
+}
+
+void Shard_Start(Shard* pShard)
+{
+    int result = -1;
+
+    pShard->exitRunLoop = 0;
+    result = pthread_create(&pShard->thread, NULL, shardThreadMain, pShard);
+    if (result != 0)
+        __throw(forkException);
+    pShard->isThreadRunning = 1;
+}
+
+void Shard_Stop(Shard* pShard)
+{
+    if (pShard->isThreadRunning != 1)
+        return;
+
+    __atomic_store_n(&pShard->exitRunLoop, 1, __ATOMIC_RELEASE);
+    signalWakeEvent(pShard);
+    pthread_join(pShard->thread, NULL);
+    pShard->isThreadRunning = 0;
+}
+
+static void signalWakeEvent(Shard* pShard)
+{
+    uint64_t increment = 1;
+
+    write(pShard->wakeFileDescriptor, &increment, sizeof(increment));
+}
+
+int Shard_GetSessionCount(Shard* pShard)
+{
+    return __atomic_load_n(&pShard->sessionCount, __ATOMIC_RELAXED);
+}
+
+uint64_t Shard_GetBytesReceived(Shard* pShard)
+{
+    return __atomic_load_n(&pShard->bytesReceived, __ATOMIC_RELAXED);
+}
+
+int Shard_GetExceptionCode(Shard* pShard)
+{
+    return __atomic_load_n(&pShard->exceptionCode, __ATOMIC_ACQUIRE);
+}
+
+static void* shardThreadMain(void* pContext)
+{
+    Shard* pShard = (Shard*)pContext;
+
+    pinThreadToCore(pShard);
+    __try
+        runEventLoop(pShard);
+    __catch
+        __atomic_store_n(&pShard->exceptionCode, getExceptionCode(), __ATOMIC_RELEASE);
+
+    return NULL;
+}
+
+static void pinThreadToCore(Shard* pShard)
+{
+    cpu_set_t cpuSet;
+    long      coreCount = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (coreCount < 1)
+        return;
+
+    CPU_ZERO(&cpuSet);
+    CPU_SET(pShard->index % coreCount, &cpuSet);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+}
+
+static void runEventLoop(Shard* pShard)
+{
+    struct epoll_event events[SHARD_MAX_EVENTS];
+
+    /* Sessions taken over from another remotesvr can arrive with output already queued. */
+    updateAllSessionEvents(pShard);
+    while (!__atomic_load_n(&pShard->exitRunLoop, __ATOMIC_ACQUIRE))
+    {
+        int eventCount = -1;
+        int i;
+
+        eventCount = epoll_wait(pShard->epollFileDescriptor, events, SHARD_MAX_EVENTS,
+                                pShard->pFirstReady ? 0 : calculateEventLoopTimeout(pShard));
+        if (eventCount < 0 && errno == EINTR)
+            continue;
+        if (eventCount < 0)
+            __throw(selectException);
+
+        pShard->loopTime = Timestamp_Now();
+        for (i = 0 ; i < eventCount ; i++)
+        {
+            __try
+                processEvent(pShard, &events[i]);
+            __catch
+                __rethrow;
+        }
+        serviceReadySessions(pShard);
+        TimerWheel_Advance(&pShard->timerWheel, pShard->loopTime);
+        Console_Service();
+        EventStream_Flush();
+    }
+}
+
+static int calculateEventLoopTimeout(Shard* pShard)
+{
+    int consoleTimeout = Console_GetServiceTimeout();
+    int timerTimeout = -1;
+
+    if (TimerWheel_GetTimerCount(&pShard->timerWheel) == 0)
+        return consoleTimeout;
+
+    timerTimeout = TimerWheel_GetTimeout(&pShard->timerWheel, Timestamp_Now());
+    if (consoleTimeout < 0 || timerTimeout < consoleTimeout)
+        return timerTimeout;
+    return consoleTimeout;
+}
+
+static void processEvent(Shard* pShard, struct epoll_event* pEvent)
+{
+    int fileDescriptor = pEvent->data.fd;
+
+    if (fileDescriptor == pShard->listenSocket)
+        acceptNewClients(pShard);
+    else if (fileDescriptor == pShard->wakeFileDescriptor)
+        drainWakeEvent(pShard);
+    else if (fileDescriptor < pShard->sessionTableSize && pShard->ppSessionTable[fileDescriptor])
+        processSessionEvent(pShard, pShard->ppSessionTable[fileDescriptor], pEvent->events);
+}
+
+static void processSessionEvent(Shard* pShard, Session* pSession, uint32_t events)
+{
+    if (events & EPOLLOUT)
+        sendQueuedOutput(pShard, pSession);
+    if (events & ~EPOLLOUT)
+        markSessionReady(pShard, pSession);
+}
+
+static void acceptNewClients(Shard* pShard)
+{
+    while (1)
+    {
+        struct sockaddr_in  clientAddress;
+        socklen_t           addressLength = sizeof(clientAddress);
+        int                 socket = -1;
+
+        socket = accept4(pShard->listenSocket, (struct sockaddr*)&clientAddress, &addressLength, SOCK_NONBLOCK);
+        if (socket < 0 && (errno == EMFILE || errno == ENFILE))
+            pauseAccepting(pShard);
+        if (socket < 0)
+            return;
+
+        __try
+            addSession(pShard, socket, &clientAddress);
+        __catch
+        {
+            close(socket);
+            clearExceptionCode();
+            return;
+        }
+    }
+}
+
+/* Out of file descriptors the pending connection can't be taken off the queue, so the level triggered listener would
+   stay readable and spin the loop.  It is left out of epoll until a session closes or SHARD_ACCEPT_RETRY_NS passes. */
+static void pauseAccepting(Shard* pShard)
+{
+    if (pShard->isAcceptPaused)
+        return;
+
+    printf("Shard %d is out of file descriptors and has stopped accepting connections for now.\n", pShard->index);
+    fflush(stdout);
+    setListenerEvents(pShard, 0);
+    pShard->isAcceptPaused = 1;
+    TimerWheel_Arm(&pShard->timerWheel, &pShard->acceptTimer, pShard->loopTime + SHARD_ACCEPT_RETRY_NS);
+}
+
+static void resumeAccepting(Shard* pShard)
+{
+    if (!pShard->isAcceptPaused)
+        return;
+
+    TimerWheel_Cancel(&pShard->timerWheel, &pShard->acceptTimer);
+    setListenerEvents(pShard, EPOLLIN);
+    pShard->isAcceptPaused = 0;
+}
+
+static void acceptTimerExpired(Timer* pTimer, void* pContext)
+{
+    Shard* pShard = (Shard*)pContext;
+
+    setListenerEvents(pShard, EPOLLIN);
+    pShard->isAcceptPaused = 0;
+}
+
+static void setListenerEvents(Shard* pShard, uint32_t events)
+{
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.fd = pShard->listenSocket;
+    epoll_ctl(pShard->epollFileDescriptor, EPOLL_CTL_MOD, pShard->listenSocket, &event);
+}
+
+static void addSession(Shard* pShard, int socket, const struct sockaddr_in* pClientAddress)
+{
+    Session* pSession = NULL;
+
+    __try
+        pSession = createSession(pShard, socket, pClientAddress, allocateSessionId(pShard));
+    __catch
+        __rethrow;
+
+    printf("Session %08x connected from ", pSession->id);
+    Session_PrintClientAddress(pSession);
+    printf(" on shard %d.\n", pShard->index);
+    fflush(stdout);
+    Session_RecordConnection(pSession);
+}
+
+static Session* createSession(Shard* pShard, int socket, const struct sockaddr_in* pClientAddress, uint32_t sessionId)
+{
+    Session* pSession = NULL;
+
+    __try
+        growSessionTable(pShard, socket);
+    __catch
+        __rethrow_and_return(NULL);
+
+    pSession = malloc(sizeof(*pSession));
+    if (!pSession)
+        __throw_and_return(outOfMemoryException, NULL);
+
+    __try
+    {
+        __throwing_func( Session_Init(pSession, socket, pClientAddress, sessionId, &pShard->bufferPool) );
+        __throwing_func( addToEpoll(pShard, socket) );
+        Session_AllowRelaying(pSession, allocateSessionId, pShard);
+        Session_EnableOutputIndex(pSession, pShard->indexLimit);
+        Session_EnableDedup(pSession, pShard->pChunkCache);
+        Session_EnableOutputQueue(pSession, SHARD_MAX_QUEUED_OUTPUT);
+    }
+    __catch
+    {
+        pSession->socket = -1;
+        Session_Uninit(pSession);
+        free(pSession);
+        __rethrow_and_return(NULL);
+    }
+
+    pShard->ppSessionTable[socket] = pSession;
+    __atomic_add_fetch(&pShard->sessionCount, 1, __ATOMIC_RELAXED);
+    armSessionTimers(pShard, pSession);
+
+    return pSession;
+}
+
+/* Ids are unique by construction until the sequence wraps.  From then on any id which a long lived session, or one
+   taken over from another remotesvr, still holds is skipped. */
+static uint32_t allocateSessionId(void* pContext)
+{
+    Shard*   pShard = (Shard*)pContext;
+    uint32_t sessionId;
+
+    do
+    {
+        sessionId = ((uint32_t)pShard->index << SHARD_SESSION_ID_SHIFT) | pShard->nextSessionId;
+        pShard->nextSessionId = (pShard->nextSessionId + 1) & SHARD_SESSION_SEQUENCE_MASK;
+        if (pShard->nextSessionId == 0)
+            pShard->hasSessionIdWrapped = 1;
+    } while (pShard->hasSessionIdWrapped && Shard_FindSession(pShard, sessionId));
+
+    return sessionId;
+}
+
+static void reserveSessionId(Shard* pShard, uint32_t sessionId)
+{
+    uint32_t sequence = sessionId & SHARD_SESSION_SEQUENCE_MASK;
+
+    if (sequence < pShard->nextSessionId)
+        return;
+    pShard->nextSessionId = (sequence + 1) & SHARD_SESSION_SEQUENCE_MASK;
+    if (pShard->nextSessionId == 0)
+        pShard->hasSessionIdWrapped = 1;
+}
+
+static void growSessionTable(Shard* pShard, int fileDescriptor)
+{
+    Session** ppNewTable = NULL;
+    int       newSize = pShard->sessionTableSize ? pShard->sessionTableSize : 64;
+
+    if (fileDescriptor < pShard->sessionTableSize)
+        return;
+
+    while (newSize <= fileDescriptor)
+        newSize *= 2;
+    ppNewTable = realloc(pShard->ppSessionTable, newSize * sizeof(*ppNewTable));
+    if (!ppNewTable)
+        __throw(outOfMemoryException);
+    memset(&ppNewTable[pShard->sessionTableSize], 0,
+           (newSize - pShard->sessionTableSize) * sizeof(*ppNewTable));
+
+    pShard->ppSessionTable = ppNewTable;
+    pShard->sessionTableSize = newSize;
+}
+
+/* epoll is level triggered so a session that still has data after its turn is reported again anyway; the ready
+   list only remembers the order in which they get their turns. */
+static void markSessionReady(Shard* pShard, Session* pSession)
+{
+    if (pSession->isReady)
+        return;
+
+    pSession->isReady = 1;
+    pSession->pNextReady = NULL;
+    if (pShard->pLastReady)
+        pShard->pLastReady->pNextReady = pSession;
+    else
+        pShard->pFirstReady = pSession;
+    pShard->pLastReady = pSession;
+}
+
+static Session* takeFirstReadySession(Shard* pShard)
+{
+    Session* pSession = pShard->pFirstReady;
+
+    pShard->pFirstReady = pSession->pNextReady;
+    if (!pShard->pFirstReady)
+        pShard->pLastReady = NULL;
+    pSession->pNextReady = NULL;
+    pSession->isReady = 0;
+
+    return pSession;
+}
+
+static void unlinkReadySession(Shard* pShard, Session* pSession)
+{
+    Session** ppLink = &pShard->pFirstReady;
+    Session*  pPrevious = NULL;
+
+    if (!pSession->isReady)
+        return;
+
+    while (*ppLink != pSession)
+    {
+        pPrevious = *ppLink;
+        ppLink = &pPrevious->pNextReady;
+    }
+    *ppLink = pSession->pNextReady;
+    if (pShard->pLastReady == pSession)
+        pShard->pLastReady = pPrevious;
+    pSession->pNextReady = NULL;
+    pSession->isReady = 0;
+}
+
+static void serviceReadySessions(Shard* pShard)
+{
+    Session* pLastInRound = pShard->pLastReady;
+    Session* pSession = NULL;
+
+    /* Sessions put back on the list during this round wait for the next one. */
+    while (pShard->pFirstReady && pSession != pLastInRound)
+    {
+        pSession = takeFirstReadySession(pShard);
+        pSession->deficit += (uint64_t)SHARD_QUANTUM_BYTES * pSession->weight;
+        receiveFromSession(pShard, pSession);
+    }
+}
+
+static void receiveFromSession(Shard* pShard, Session* pSession)
+{
+    uint64_t bytesBefore = pSession->bytesReceived;
+    uint64_t pongsBefore = pSession->pongCount;
+    int      bytesRead = -1;
+
+    __try
+        bytesRead = receiveWithinDeficit(pSession);
+    __catch
+    {
+        if (getExceptionCode() == outOfMemoryException && !FrameWriter_GetExceptionCode(&pSession->frameWriter))
+            printf("Session %08x needs more receive buffer memory than --memory or --session-memory allow.\n",
+                   pSession->id);
+        clearExceptionCode();
+        pSession->isClosed = 1;
+    }
+    __atomic_add_fetch(&pShard->bytesReceived, pSession->bytesReceived - bytesBefore, __ATOMIC_RELAXED);
+    recordSessionActivity(pShard, pSession, bytesBefore, pongsBefore);
+
+    if (FrameWriter_GetExceptionCode(&pSession->frameWriter) == outOfMemoryException)
+    {
+        printf("Session %08x disconnected after falling more than %d bytes behind its output.\n", pSession->id,
+               SHARD_MAX_QUEUED_OUTPUT);
+        fflush(stdout);
+        Session_RecordDisconnection(pSession, "output queue full");
+        removeSession(pShard, pSession);
+        return;
+    }
+    if (pSession->isClosed)
+    {
+        printf("Session %08x disconnected.\n", pSession->id);
+        fflush(stdout);
+        Session_RecordDisconnection(pSession, "");
+        removeSession(pShard, pSession);
+        return;
+    }
+    updateSessionEvents(pShard, pSession);
+
+    /* A drained session banks no credit while it is idle. */
+    if (bytesRead < 0)
+        pSession->deficit = 0;
+    else
+        markSessionReady(pShard, pSession);
+}
+
+static int receiveWithinDeficit(Session* pSession)
+{
+    int bytesRead = -1;
+
+    while (pSession->deficit > 0 && !pSession->isClosed)
+    {
+        __try
+            bytesRead = Session_ReceiveAtMost(pSession, pSession->deficit);
+        __catch
+            __rethrow_and_return(-1);
+        if (bytesRead <= 0)
+            return bytesRead;
+        pSession->deficit -= bytesRead;
+    }
+
+    return bytesRead;
+}
+
+static void recordSessionActivity(Shard* pShard, Session* pSession, uint64_t bytesBefore, uint64_t pongsBefore)
+{
+    uint64_t heartbeatBytes = (pSession->pongCount - pongsBefore) * PROTOCOL_HEADER_SIZE;
+
+    if (pSession->bytesReceived == bytesBefore)
+        return;
+    pSession->lastHeartbeatTime = pShard->loopTime;
+    pSession->isAwaitingPong = 0;
+    /* Replies to our own pings keep a session alive but don't stop it from being idle. */
+    if (pSession->bytesReceived - bytesBefore > heartbeatBytes)
+        pSession->lastActivityTime = pShard->loopTime;
+}
+
+static void removeSession(Shard* pShard, Session* pSession)
+{
+    int socket = pSession->socket;
+
+    TimerWheel_Cancel(&pShard->timerWheel, &pSession->heartbeatTimer);
+    TimerWheel_Cancel(&pShard->timerWheel, &pSession->idleTimer);
+    unlinkReadySession(pShard, pSession);
+    epoll_ctl(pShard->epollFileDescriptor, EPOLL_CTL_DEL, socket, NULL);
+    pShard->ppSessionTable[socket] = NULL;
+    __atomic_sub_fetch(&pShard->sessionCount, 1, __ATOMIC_RELAXED);
+
+    Session_Uninit(pSession);
+    free(pSession);
+    resumeAccepting(pShard);
+}
+
+static void sendQueuedOutput(Shard* pShard, Session* pSession)
+{
+    __try
+        Session_SendQueuedOutput(pSession);
+    __catch
+        clearExceptionCode();
+    updateSessionEvents(pShard, pSession);
+}
+
+static void updateAllSessionEvents(Shard* pShard)
+{
+    int i;
+
+    for (i = 0 ; i < pShard->sessionTableSize ; i++)
+    {
+        if (pShard->ppSessionTable[i])
+            updateSessionEvents(pShard, pShard->ppSessionTable[i]);
+    }
+}
+
+/* A session's socket is only watched for writability while it has output queued.  One whose FrameWriter has failed
+   is closed by its next turn on the ready list, which reports why. */
+static void updateSessionEvents(Shard* pShard, Session* pSession)
+{
+    struct epoll_event event;
+    int                isWaitingToSend = Session_HasQueuedOutput(pSession);
+
+    if (FrameWriter_GetExceptionCode(&pSession->frameWriter))
+    {
+        pSession->isClosed = 1;
+        markSessionReady(pShard, pSession);
+        return;
+    }
+    if (isWaitingToSend == pSession->isWaitingToSend)
+        return;
+
+    memset(&event, 0, sizeof(event));
+    event.events = isWaitingToSend ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    event.data.fd = pSession->socket;
+    epoll_ctl(pShard->epollFileDescriptor, EPOLL_CTL_MOD, pSession->socket, &event);
+    pSession->isWaitingToSend = isWaitingToSend;
+}
+
+static void armSessionTimers(Shard* pShard, Session* pSession)
+{
+    uint64_t now = Timestamp_Now();
+
+    pSession->lastHeartbeatTime = now;
+    pSession->lastActivityTime = now;
+    if (pShard->heartbeatInterval)
+    {
+        Timer_Init(&pSession->heartbeatTimer, heartbeatTimerExpired, pShard);
+        TimerWheel_Arm(&pShard->timerWheel, &pSession->heartbeatTimer, now + pShard->heartbeatInterval);
+    }
+    if (pShard->idleTimeout)
+    {
+        Timer_Init(&pSession->idleTimer, idleTimerExpired, pShard);
+        TimerWheel_Arm(&pShard->timerWheel, &pSession->idleTimer, now + pShard->idleTimeout);
+    }
+}
+
+/* Traffic doesn't touch the timers; each one checks the activity time when it expires and, if the session was
+   heard from since it was armed, re-arms itself for the rest of the interval. */
+static void heartbeatTimerExpired(Timer* pTimer, void* pContext)
+{
+    Shard*   pShard = (Shard*)pContext;
+    Session* pSession = sessionFromTimer(pTimer, offsetof(Session, heartbeatTimer));
+    uint64_t deadline = pSession->lastHeartbeatTime + pShard->heartbeatInterval;
+
+    if (pSession->isAwaitingPong)
+    {
+        printf("Session %08x disconnected after missing its heartbeat.\n", pSession->id);
+        fflush(stdout);
+        Session_RecordDisconnection(pSession, "missed heartbeat");
+        removeSession(pShard, pSession);
+        return;
+    }
+    if (deadline > pShard->loopTime)
+    {
+        TimerWheel_Arm(&pShard->timerWheel, pTimer, deadline);
+        return;
+    }
+
+    __try
+        FrameWriter_SendFrame(&pSession->frameWriter, FRAME_CONTROL, CONTROL_PING, 0, NULL, 0);
+    __catch
+        clearExceptionCode();
+    pSession->isAwaitingPong = 1;
+    TimerWheel_Arm(&pShard->timerWheel, pTimer, pShard->loopTime + pShard->heartbeatInterval);
+    updateSessionEvents(pShard, pSession);
+}
+
+static void idleTimerExpired(Timer* pTimer, void* pContext)
+{
+    Shard*   pShard = (Shard*)pContext;
+    Session* pSession = sessionFromTimer(pTimer, offsetof(Session, idleTimer));
+    uint64_t deadline = pSession->lastActivityTime + pShard->idleTimeout;
+
+    /* A relay stays up for as long as any of its clients might still talk. */
+    if (deadline > pShard->loopTime || pSession->ppRelayedSessions)
+    {
+        if (deadline <= pShard->loopTime)
+            deadline = pShard->loopTime + pShard->idleTimeout;
+        TimerWheel_Arm(&pShard->timerWheel, pTimer, deadline);
+        return;
+    }
+
+    printf("Session %08x disconnected after being idle for %llu seconds.\n", pSession->id,
+           (unsigned long long)(pShard->idleTimeout / TIMESTAMP_NANOSECONDS_PER_SECOND));
+    fflush(stdout);
+    Session_RecordDisconnection(pSession, "idle timeout");
+    removeSession(pShard, pSession);
+}
+
+static Session* sessionFromTimer(Timer* pTimer, size_t timerOffset)
+{
+    return (Session*)((char*)pTimer - timerOffset);
+}
+
+static void drainWakeEvent(Shard* pShard)
+{
+    uint64_t count;
+
+    read(pShard->wakeFileDescriptor, &count, sizeof(count));
+    runPendingCommand(pShard);
+    /* Console commands can send to any number of sessions. */
+    updateAllSessionEvents(pShard);
+}
+
+static void runPendingCommand(Shard* pShard)
+{
+    pthread_mutex_lock(&pShard->commandMutex);
+    if (pShard->pPendingCommand)
+    {
+        pShard->pPendingCommand(pShard, pShard->pPendingContext);
+        clearExceptionCode();
+        pShard->pPendingCommand = NULL;
+        pthread_cond_signal(&pShard->commandCompleted);
+    }
+    pthread_mutex_unlock(&pShard->commandMutex);
+}
+
+void Shard_Execute(Shard* pShard, ShardCommand* pCommand, void* pContext)
+{
+    if (pShard->isThreadRunning != 1)
+    {
+        pCommand(pShard, pContext);
+        return;
+    }
+
+    pthread_mutex_lock(&pShard->commandMutex);
+    pShard->pPendingCommand = pCommand;
+    pShard->pPendingContext = pContext;
+    signalWakeEvent(pShard);
+    while (pShard->pPendingCommand)
+        pthread_cond_wait(&pShard->commandCompleted, &pShard->commandMutex);
+    pthread_mutex_unlock(&pShard->commandMutex);
+}
+
+Session* Shard_FindSession(Shard* pShard, uint32_t sessionId)
+{
+    int i;
+
+    for (i = 0 ; i < pShard->sessionTableSize ; i++)
+    {
+        Session* pSession = pShard->ppSessionTable[i];
+        Session* pRelayed = NULL;
+
+        if (!pSession)
+            continue;
+        if (pSession->id == sessionId)
+            return pSession;
+        pRelayed = Session_FindRelayedSession(pSession, sessionId);
+        if (pRelayed)
+            return pRelayed;
+    }
+    return NULL;
+}
+
+Session* Shard_AdoptSession(Shard* pShard, int socket, const struct sockaddr_in* pClientAddress, uint32_t sessionId)
+{
+    Session* pSession = NULL;
+
+    __try
+        pSession = createSession(pShard, socket, pClientAddress, sessionId);
+    __catch
+        __rethrow_and_return(NULL);
+    reserveSessionId(pShard, sessionId);
+
+    printf("Session %08x from ", sessionId);
+    Session_PrintClientAddress(pSession);
+    printf(" taken over on shard %d.\n", pShard->index);
+    fflush(stdout);
+
+    return pSession;
+}
+
+Session* Shard_AdoptRelayedSession(Shard* pShard, Session* pRelay, uint16_t channel, uint32_t sessionId,
+                                   const struct sockaddr_in* pClientAddress)
+{
+    Session* pSession = NULL;
+
+    __try
+        pSession = Session_AdoptRelayedSession(pRelay, channel, sessionId, pClientAddress);
+    __catch
+        __rethrow_and_return(NULL);
+    reserveSessionId(pShard, sessionId);
+
+    return pSession;
+}
+
+int Shard_IndexFromSessionId(uint32_t sessionId)
+{
+    return (int)(sessionId >> SHARD_SESSION_ID_SHIFT);
+}
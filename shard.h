@@ -0,0 +1,99 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef _SHARD_H_
+#define _SHARD_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include "parameters.h"
+#include "session.h"
+#include "bufferpool.h"
+#include "timerwheel.h"
+
+/* A shard is one event loop, pinned to one core, with its own SO_REUSEPORT listening socket and its own session
+   table.  The kernel spreads incoming connections across the shards' listeners so that sessions never need to be
+   shared between threads.  Other threads only touch a shard's sessions through Shard_Execute(), which runs a
+   command on the shard's own thread.  A shard can be given an already listening socket, and sessions with their ids
+   already allocated, when taking over from another remotesvr process.  Session receive buffers come from the shard's
+   own BufferPool, and the --heartbeat and --idle-timeout deadlines of its sessions live in its TimerWheel, which
+   also decides how long the event loop sleeps.  The --dedup-cache ChunkCache is shared by every shard.
+
+   Sessions with data waiting are read by deficit round robin rather than in epoll order.  Each pass of the event
+   loop is one round: every session on the ready list is credited SHARD_QUANTUM_BYTES times its weight and then read
+   until that credit runs out or its socket is drained.  A session still holding data keeps the rest of its credit
+   and goes to the back of the list, so one flooding client can't hold up the others for more than a quantum at a
+   time.  Only bytes read from clients are metered.  What a session displays can be more than that, as a
+   deduplicated chunk reference expands to the whole chunk, and what is sent to it, such as a pushed file, isn't
+   charged to it at all.
+
+   Nothing in the loop waits on a client either.  Frames which a session's socket won't take straight away are queued
+   on the session and sent once epoll reports the socket writable, and a session which lets more than
+   SHARD_MAX_QUEUED_OUTPUT bytes pile up that way is dropped. */
+#define SHARD_QUANTUM_BYTES     (16 * 1024)
+#define SHARD_MAX_WEIGHT        64
+#define SHARD_MAX_QUEUED_OUTPUT (1024 * 1024)
+
+struct Shard;
+typedef void ShardCommand(struct Shard* pShard, void* pContext);
+
+typedef struct Shard
+{
+    pthread_t       thread;
+    pthread_mutex_t commandMutex;
+    pthread_cond_t  commandCompleted;
+    ShardCommand*   pPendingCommand;
+    void*           pPendingContext;
+    Session**       ppSessionTable;
+    Session*        pFirstReady;
+    Session*        pLastReady;
+    ChunkCache*     pChunkCache;
+    BufferPool      bufferPool;
+    TimerWheel      timerWheel;
+    Timer           acceptTimer;
+    uint64_t        loopTime;
+    uint64_t        heartbeatInterval;
+    uint64_t        idleTimeout;
+    uint64_t        bytesReceived;
+    uint64_t        indexLimit;
+    uint32_t        nextSessionId;
+    int             index;
+    int             listenSocket;
+    int             epollFileDescriptor;
+    int             wakeFileDescriptor;
+    int             sessionTableSize;
+    int             sessionCount;
+    int             exitRunLoop;
+    int             exceptionCode;
+    int             isThreadRunning;
+    int             isAcceptPaused;
+    int             hasSessionIdWrapped;
+} Shard;
+
+void     Shard_Init(Shard* pShard, Parameters* pParameters, int index, int listenSocket, BufferBudget* pBudget,
+                    ChunkCache* pChunkCache);
+void     Shard_Uninit(Shard* pShard);
+void     Shard_Start(Shard* pShard);
+void     Shard_Stop(Shard* pShard);
+int      Shard_GetSessionCount(Shard* pShard);
+uint64_t Shard_GetBytesReceived(Shard* pShard);
+int      Shard_GetExceptionCode(Shard* pShard);
+void     Shard_Execute(Shard* pShard, ShardCommand* pCommand, void* pContext);
+Session* Shard_FindSession(Shard* pShard, uint32_t sessionId);
+Session* Shard_AdoptSession(Shard* pShard, int socket, const struct sockaddr_in* pClientAddress, uint32_t sessionId);
+Session* Shard_AdoptRelayedSession(Shard* pShard, Session* pRelay, uint16_t channel, uint32_t sessionId,
+                                   const struct sockaddr_in* pClientAddress);
+int      Shard_IndexFromSessionId(uint32_t sessionId);
+
+#endif /* _SHARD_H_ */
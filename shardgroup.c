@@ -0,0 +1,1531 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdio.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "try_catch.h"
+#include "shardgroup.h"
+#include "eventstream.h"
+
+
+#define CONSOLE_MAX_ARGUMENTS   32
+#define SEARCH_MAX_MATCHES      20
+#define SHOW_DEFAULT_CONTEXT    5
+
+typedef void SessionCommand(Session* pSession, void* pContext);
+
+typedef struct
+{
+    SessionCommand* pCommand;
+    void*           pContext;
+    uint32_t        sessionId;
+    int             wasSessionFound;
+} SessionCommandRequest;
+
+typedef struct
+{
+    const char* pSource;
+    const char* pDestination;
+    int         isPull;
+} TransferCommand;
+
+typedef struct
+{
+    char   ruleText[1024];
+    size_t ruleTextLength;
+} FilterCommand;
+
+typedef struct
+{
+    char   text[1024];
+    size_t textLength;
+} SearchCommand;
+
+typedef struct
+{
+    OutputIndex   snapshot;
+    SearchCommand command;
+} SearchJob;
+
+typedef struct
+{
+    uint64_t line;
+    uint64_t context;
+} ShowCommand;
+
+typedef struct
+{
+    ShardGroup* pGroup;
+    uint32_t    sessionId;
+} PendingFrameHandoff;
+
+typedef struct
+{
+    uint64_t bufferBytes;
+    uint64_t indexBytes;
+    int      idleSessionCount;
+} MemoryCommand;
+
+typedef struct
+{
+    ShardGroup* pGroup;
+    const void* pPayload;
+    size_t      length;
+    uint8_t     type;
+    uint8_t     flags;
+    int         sessionCount;
+    int         failureCount;
+} BroadcastCommand;
+
+
+static void allocateShards(ShardGroup* pGroup);
+static void connectToRunningServer(ShardGroup* pGroup);
+static int  isTakingOver(ShardGroup* pGroup);
+static void initShards(ShardGroup* pGroup);
+static int  receiveListener(ShardGroup* pGroup, int shardIndex);
+static void receiveHandoffRecord(ShardGroup* pGroup, HandoffRecord* pRecord, const char** ppData, int* pSocket);
+static int  adoptSessions(ShardGroup* pGroup);
+static Session* adoptSession(ShardGroup* pGroup, const HandoffRecord* pRecord, const char* pData, int socket);
+static void adoptRelayedSession(ShardGroup* pGroup, Session* pRelay, const HandoffRecord* pRecord);
+static void adoptPendingFrame(Session* pLastSession, const HandoffRecord* pRecord, const char* pData);
+static void adoptQueuedOutput(Session* pLastSession, const HandoffRecord* pRecord, const char* pData);
+static void adoptTrace(Session* pLastSession, const HandoffRecord* pRecord, const char* pData);
+static void adoptOutputIndex(Session* pLastSession, const HandoffRecord* pRecord, const char* pData, int file);
+static Session* findAdoptedSession(Session* pLastSession, uint32_t id);
+static void restoreSessionState(Session* pSession, const HandoffRecord* pRecord);
+static void startShards(ShardGroup* pGroup);
+static void completeTakeOver(ShardGroup* pGroup, int sessionCount);
+static void listenForHandoff(ShardGroup* pGroup);
+static void stopShards(ShardGroup* pGroup);
+static int  waitForConsoleInput(ShardGroup* pGroup);
+static int  handOffToNewServer(ShardGroup* pGroup);
+static void receiveHello(ShardGroup* pGroup);
+static void sendListeners(ShardGroup* pGroup);
+static int  sendSessions(ShardGroup* pGroup);
+static void sendSession(ShardGroup* pGroup, Session* pSession, HandoffType type);
+static void sendQueuedOutput(ShardGroup* pGroup, Session* pSession);
+static void sendTrace(ShardGroup* pGroup, Session* pSession);
+static void sendOutputIndex(ShardGroup* pGroup, Session* pSession);
+static void sendPendingFrames(ShardGroup* pGroup, Session* pSession);
+static void sendPendingFrame(void* pContext, const char* pFrame, size_t length);
+static void sendRecord(ShardGroup* pGroup, HandoffType type);
+static void waitForAcknowledgement(ShardGroup* pGroup);
+static void markSessionsHandedOff(ShardGroup* pGroup);
+static int  splitCommandLine(char* pCommandLine, const char** ppArguments);
+static int  runCommand(ShardGroup* pGroup, int argumentCount, const char** ppArguments);
+static void displayHelp(void);
+static void displayShardStatistics(ShardGroup* pGroup);
+static void displayMemoryUsage(ShardGroup* pGroup);
+static void displayDedupStatistics(ShardGroup* pGroup);
+static void displayShardMemory(Shard* pShard, void* pContext);
+static void displaySessionMemory(Session* pSession, MemoryCommand* pCommand);
+static void runTransferCommand(ShardGroup* pGroup, int argumentCount, const char** ppArguments, int isPull);
+static void transferFile(Session* pSession, void* pContext);
+static void runFilterCommand(ShardGroup* pGroup, int argumentCount, const char** ppArguments);
+static void setOutputFilter(Session* pSession, void* pContext);
+static void runWeightCommand(ShardGroup* pGroup, int argumentCount, const char** ppArguments);
+static void setSessionWeight(Session* pSession, void* pContext);
+static void runGroupCommand(ShardGroup* pGroup, int argumentCount, const char** ppArguments);
+static void clearBroadcastGroup(ShardGroup* pGroup);
+static void addToBroadcastGroup(ShardGroup* pGroup, uint32_t sessionId);
+static void displayBroadcastGroup(ShardGroup* pGroup);
+static void runBroadcastCommand(ShardGroup* pGroup);
+static void broadcastConsoleInput(ShardGroup* pGroup, const char* pLine);
+static int  isConsoleLine(const char* pLine, const char* pText);
+static void runInterruptCommand(ShardGroup* pGroup);
+static int  broadcastToGroup(ShardGroup* pGroup, uint8_t type, uint8_t flags, const void* pPayload, size_t length);
+static void broadcastOnShard(Shard* pShard, void* pContext);
+static int  isInBroadcastGroup(Session* pSession, void* pContext);
+static int  compareSessionIds(const void* pKey, const void* pElement);
+static void runTraceCommand(ShardGroup* pGroup, int argumentCount, const char** ppArguments);
+static void displayTrace(Session* pSession, void* pContext);
+static void runSearchCommand(ShardGroup* pGroup, int argumentCount, const char** ppArguments);
+static void searchOutput(Session* pSession, void* pContext);
+static void* searchThreadMain(void* pContext);
+static void runShowCommand(ShardGroup* pGroup, int argumentCount, const char** ppArguments);
+static void showOutputLines(Session* pSession, void* pContext);
+static void displayOutputLine(void* pContext, uint64_t lineNumber, const char* pLine, size_t length);
+static void executeOnSession(ShardGroup* pGroup, const char* pSessionId, SessionCommand* pCommand, void* pContext);
+static int  parseSessionId(const char* pText, uint32_t* pSessionId);
+static void runSessionCommandOnShard(Shard* pShard, void* pContext);
+
+
+void ShardGroup_Init(ShardGroup* pGroup, Parameters* pParameters)
+{
+    int sessionCount = 0;
+
+    memset(pGroup, 0, sizeof(*pGroup));
+    pGroup->pParameters = pParameters;
+    pGroup->shardCount = Parameters_GetShardCount(pParameters);
+    Handoff_Init(&pGroup->handoff, Parameters_GetHandoffPath(pParameters));
+    BufferBudget_Init(&pGroup->bufferBudget, Parameters_GetMemoryLimit(pParameters));
+
+    __try
+    {
+        __throwing_func( ChunkCache_Init(&pGroup->chunkCache, Parameters_GetDedupCacheSize(pParameters)) );
+        __throwing_func( allocateShards(pGroup) );
+        __throwing_func( connectToRunningServer(pGroup) );
+        __throwing_func( initShards(pGroup) );
+        __throwing_func( sessionCount = adoptSessions(pGroup) );
+        __throwing_func( startShards(pGroup) );
+        __throwing_func( completeTakeOver(pGroup, sessionCount) );
+        __throwing_func( listenForHandoff(pGroup) );
+    }
+    __catch
+    {
+        __rethrow;
+    }
+}
+
+static void allocateShards(ShardGroup* pGroup)
+{
+    pGroup->pShards = calloc(pGroup->shardCount, sizeof(*pGroup->pShards));
+    if (!pGroup->pShards)
+        __throw(outOfMemoryException);
+}
+
+static void connectToRunningServer(ShardGroup* pGroup)
+{
+    HandoffRecord hello;
+
+    if (!Handoff_IsEnabled(&pGroup->handoff))
+        return;
+    __try
+    {
+        if (!Handoff_Connect(&pGroup->handoff))
+            break;
+        printf("Taking over from the remotesvr running at %s.\n", pGroup->handoff.pPath);
+        Handoff_InitRecord(&hello, HANDOFF_HELLO, (uint32_t)pGroup->shardCount);
+        __throwing_func( Handoff_Send(&pGroup->handoff, &hello, NULL, -1) );
+    }
+    __catch
+    {
+        __rethrow;
+    }
+}
+
+static int isTakingOver(ShardGroup* pGroup)
+{
+    return pGroup->handoff.connection >= 0;
+}
+
+static void initShards(ShardGroup* pGroup)
+{
+    int i;
+
+    for (i = 0 ; i < pGroup->shardCount ; i++)
+    {
+        int listenSocket = -1;
+
+        if (isTakingOver(pGroup))
+        {
+            __try
+                listenSocket = receiveListener(pGroup, i);
+            __catch
+                __rethrow;
+        }
+        __try
+            Shard_Init(&pGroup->pShards[i], pGroup->pParameters, i, listenSocket, &pGroup->bufferBudget,
+                       &pGroup->chunkCache);
+        __catch
+        {
+            Shard_Uninit(&pGroup->pShards[i]);
+            __rethrow;
+        }
+        pGroup->initializedCount++;
+    }
+}
+
+static int receiveListener(ShardGroup* pGroup, int shardIndex)
+{
+    HandoffRecord record;
+    const char*   pData = NULL;
+    int           socket = -1;
+
+    __try
+        receiveHandoffRecord(pGroup, &record, &pData, &socket);
+    __catch
+        __rethrow_and_return(-1);
+
+    if (record.type != HANDOFF_LISTENER || record.id != (uint32_t)shardIndex || socket < 0)
+    {
+        if (socket >= 0)
+            close(socket);
+        __throw_and_return(serverException, -1);
+    }
+    return socket;
+}
+
+static void receiveHandoffRecord(ShardGroup* pGroup, HandoffRecord* pRecord, const char** ppData, int* pSocket)
+{
+    int wasReceived = 0;
+
+    __try
+        wasReceived = Handoff_Receive(&pGroup->handoff, pRecord, ppData, pSocket);
+    __catch
+        __rethrow;
+
+    if (!wasReceived)
+    {
+        printf("error: The running remotesvr closed the handoff connection.\n");
+        __throw(serverException);
+    }
+    if (pRecord->type == HANDOFF_REFUSED)
+    {
+        printf("error: The running remotesvr refused the handoff: %.*s\n", (int)pRecord->dataLength, *ppData);
+        __throw(serverException);
+    }
+}
+
+static int adoptSessions(ShardGroup* pGroup)
+{
+    Session* pLastSession = NULL;
+    int      sessionCount = 0;
+
+    while (isTakingOver(pGroup))
+    {
+        HandoffRecord record;
+        const char*   pData = NULL;
+        int           socket = -1;
+
+        __try
+            receiveHandoffRecord(pGroup, &record, &pData, &socket);
+        __catch
+            __rethrow_and_return(sessionCount);
+
+        if (record.type == HANDOFF_DONE)
+            break;
+        if (record.type == HANDOFF_QUEUED_OUTPUT)
+        {
+            __try
+                adoptQueuedOutput(pLastSession, &record, pData);
+            __catch
+                __rethrow_and_return(sessionCount);
+            continue;
+        }
+        if (record.type == HANDOFF_TRACE)
+        {
+            __try
+                adoptTrace(pLastSession, &record, pData);
+            __catch
+                __rethrow_and_return(sessionCount);
+            continue;
+        }
+        if (record.type == HANDOFF_OUTPUT_INDEX)
+        {
+            __try
+                adoptOutputIndex(pLastSession, &record, pData, socket);
+            __catch
+                __rethrow_and_return(sessionCount);
+            continue;
+        }
+        if (record.type == HANDOFF_PENDING_FRAME)
+        {
+            __try
+                adoptPendingFrame(pLastSession, &record, pData);
+            __catch
+                __rethrow_and_return(sessionCount);
+            continue;
+        }
+        sessionCount++;
+        if (record.type == HANDOFF_RELAYED_SESSION)
+        {
+            __try
+                adoptRelayedSession(pGroup, pLastSession, &record);
+            __catch
+                __rethrow_and_return(sessionCount);
+            continue;
+        }
+        if (record.type != HANDOFF_SESSION)
+        {
+            if (socket >= 0)
+                close(socket);
+            __throw_and_return(serverException, sessionCount);
+        }
+
+        __try
+            pLastSession = adoptSession(pGroup, &record, pData, socket);
+        __catch
+            __rethrow_and_return(sessionCount);
+    }
+    return sessionCount;
+}
+
+static Session* adoptSession(ShardGroup* pGroup, const HandoffRecord* pRecord, const char* pData, int socket)
+{
+    int      shardIndex = Shard_IndexFromSessionId(pRecord->id);
+    Session* pSession = NULL;
+
+    if (socket < 0)
+        __throw_and_return(serverException, NULL);
+    if (shardIndex >= pGroup->shardCount)
+    {
+        close(socket);
+        __throw_and_return(serverException, NULL);
+    }
+
+    __try
+        pSession = Shard_AdoptSession(&pGroup->pShards[shardIndex], socket, &pRecord->clientAddress, pRecord->id);
+    __catch
+    {
+        close(socket);
+        __rethrow_and_return(NULL);
+    }
+    restoreSessionState(pSession, pRecord);
+
+    __try
+        FrameReader_Preload(&pSession->frameReader, pData, pRecord->dataLength);
+    __catch
+        __rethrow_and_return(NULL);
+
+    return pSession;
+}
+
+static void adoptRelayedSession(ShardGroup* pGroup, Session* pRelay, const HandoffRecord* pRecord)
+{
+    Session* pSession = NULL;
+
+    if (!pRelay || pRelay->id != pRecord->relayId)
+        __throw(serverException);
+
+    __try
+        pSession = Shard_AdoptRelayedSession(&pGroup->pShards[Shard_IndexFromSessionId(pRelay->id)], pRelay,
+                                             pRecord->channel, pRecord->id, &pRecord->clientAddress);
+    __catch
+        __rethrow;
+    restoreSessionState(pSession, pRecord);
+}
+
+static void adoptPendingFrame(Session* pLastSession, const HandoffRecord* pRecord, const char* pData)
+{
+    Session* pSession = findAdoptedSession(pLastSession, pRecord->id);
+
+    if (!pSession)
+        __throw(serverException);
+
+    __try
+        Session_RestorePendingFrame(pSession, pData, pRecord->dataLength);
+    __catch
+        __rethrow;
+}
+
+static void adoptQueuedOutput(Session* pLastSession, const HandoffRecord* pRecord, const char* pData)
+{
+    if (!pLastSession || pLastSession->id != pRecord->id)
+        __throw(serverException);
+
+    __try
+        FrameWriter_Preload(&pLastSession->frameWriter, pData, pRecord->dataLength);
+    __catch
+        __rethrow;
+}
+
+static void adoptTrace(Session* pLastSession, const HandoffRecord* pRecord, const char* pData)
+{
+    Session* pSession = findAdoptedSession(pLastSession, pRecord->id);
+
+    if (!pSession || pRecord->dataLength != sizeof(pSession->trace))
+        __throw(serverException);
+    memcpy(&pSession->trace, pData, sizeof(pSession->trace));
+}
+
+static void adoptOutputIndex(Session* pLastSession, const HandoffRecord* pRecord, const char* pData, int file)
+{
+    Session* pSession = findAdoptedSession(pLastSession, pRecord->id);
+
+    if (!pSession)
+    {
+        if (file >= 0)
+            close(file);
+        __throw(serverException);
+    }
+    /* A server started without --index just closes the file.  One which can't rebuild the index starts it over. */
+    OutputIndex_Restore(&pSession->outputIndex, file, pData, pRecord->dataLength);
+}
+
+static Session* findAdoptedSession(Session* pLastSession, uint32_t id)
+{
+    if (pLastSession && pLastSession->id != id)
+        return Session_FindRelayedSession(pLastSession, id);
+    return pLastSession;
+}
+
+static void restoreSessionState(Session* pSession, const HandoffRecord* pRecord)
+{
+    pSession->bytesReceived = pRecord->bytesReceived;
+    pSession->firstLineTimestamp = pRecord->firstLineTimestamp;
+    pSession->isLineContinued = pRecord->isLineContinued;
+    pSession->lastAcknowledgedReference = pRecord->lastAcknowledgedReference;
+    if (pRecord->weight >= 1 && pRecord->weight <= SHARD_MAX_WEIGHT)
+        pSession->weight = pRecord->weight;
+}
+
+static void startShards(ShardGroup* pGroup)
+{
+    int i;
+
+    for (i = 0 ; i < pGroup->shardCount ; i++)
+    {
+        __try
+            Shard_Start(&pGroup->pShards[i]);
+        __catch
+            __rethrow;
+    }
+}
+
+static void completeTakeOver(ShardGroup* pGroup, int sessionCount)
+{
+    HandoffRecord record;
+    const char*   pData = NULL;
+    int           socket = -1;
+
+    if (!isTakingOver(pGroup))
+        return;
+
+    __try
+    {
+        __throwing_func( sendRecord(pGroup, HANDOFF_ACK) );
+        /* The old server removes its Unix socket before closing the connection so wait for that before binding. */
+        while (Handoff_Receive(&pGroup->handoff, &record, &pData, &socket))
+        {
+            if (socket >= 0)
+                close(socket);
+        }
+    }
+    __catch
+    {
+        __rethrow;
+    }
+    Handoff_CloseConnection(&pGroup->handoff);
+    printf("Took over %d listeners and %d sessions.\n", pGroup->shardCount, sessionCount);
+}
+
+static void listenForHandoff(ShardGroup* pGroup)
+{
+    if (!Handoff_IsEnabled(&pGroup->handoff))
+        return;
+    __try
+        Handoff_Listen(&pGroup->handoff);
+    __catch
+        __rethrow;
+}
+
+static void stopShards(ShardGroup* pGroup)
+{
+    int i;
+
+    for (i = 0 ; i < pGroup->shardCount ; i++)
+        Shard_Stop(&pGroup->pShards[i]);
+}
+
+void ShardGroup_Uninit(ShardGroup* pGroup)
+{
+    int i;
+
+    for (i = 0 ; i < pGroup->initializedCount ; i++)
+        Shard_Uninit(&pGroup->pShards[i]);
+    free(pGroup->pShards);
+    free(pGroup->pGroupIds);
+    ChunkCache_Uninit(&pGroup->chunkCache);
+    Handoff_Uninit(&pGroup->handoff);
+    memset(pGroup, 0, sizeof(*pGroup));
+}
+
+void ShardGroup_RunConsole(ShardGroup* pGroup)
+{
+    char buffer[1024];
+
+    printf("Listening on port %u with %d shards.  Type \"help\" for a list of commands.\n",
+           Parameters_GetPortNumber(pGroup->pParameters), pGroup->shardCount);
+    /* Console input is polled alongside the handoff socket so stdio mustn't read ahead of the current line. */
+    if (Handoff_IsEnabled(&pGroup->handoff))
+        setvbuf(stdin, NULL, _IONBF, 0);
+    fflush(stdout);
+
+    while (waitForConsoleInput(pGroup) && fgets(buffer, sizeof(buffer), stdin))
+    {
+        const char* arguments[CONSOLE_MAX_ARGUMENTS];
+        int         argumentCount = 0;
+
+        if (pGroup->isBroadcasting)
+        {
+            broadcastConsoleInput(pGroup, buffer);
+            fflush(stdout);
+            continue;
+        }
+        argumentCount = splitCommandLine(buffer, arguments);
+        if (argumentCount > 0 && !runCommand(pGroup, argumentCount, arguments))
+            return;
+        fflush(stdout);
+    }
+}
+
+int ShardGroup_WasHandedOff(ShardGroup* pGroup)
+{
+    return pGroup->wasHandedOff;
+}
+
+static int waitForConsoleInput(ShardGroup* pGroup)
+{
+    while (pGroup->handoff.listenSocket >= 0)
+    {
+        struct pollfd pollFileDescriptors[2];
+        int           result = -1;
+
+        memset(pollFileDescriptors, 0, sizeof(pollFileDescriptors));
+        pollFileDescriptors[0].fd = STDIN_FILENO;
+        pollFileDescriptors[0].events = POLLIN;
+        pollFileDescriptors[1].fd = pGroup->handoff.listenSocket;
+        pollFileDescriptors[1].events = POLLIN;
+        result = poll(pollFileDescriptors, 2, -1);
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result < 0 || pollFileDescriptors[0].revents)
+            return 1;
+        if (handOffToNewServer(pGroup))
+            return 0;
+    }
+    return 1;
+}
+
+static int handOffToNewServer(ShardGroup* pGroup)
+{
+    int sessionCount = 0;
+
+    __try
+    {
+        __throwing_func( Handoff_Accept(&pGroup->handoff) );
+        __throwing_func( receiveHello(pGroup) );
+    }
+    __catch
+    {
+        Handoff_CloseConnection(&pGroup->handoff);
+        clearExceptionCode();
+        return 0;
+    }
+
+    printf("Handing off to a new remotesvr...\n");
+    fflush(stdout);
+    stopShards(pGroup);
+    /* The new server appends to the same --events stream so everything from this one must be written first. */
+    EventStream_Drain();
+    __try
+    {
+        __throwing_func( sendListeners(pGroup) );
+        __throwing_func( sessionCount = sendSessions(pGroup) );
+        __throwing_func( sendRecord(pGroup, HANDOFF_DONE) );
+        __throwing_func( waitForAcknowledgement(pGroup) );
+    }
+    __catch
+    {
+        printf("error: Handoff failed (%d).  Resuming.\n", getExceptionCode());
+        fflush(stdout);
+        Handoff_CloseConnection(&pGroup->handoff);
+        __try
+            startShards(pGroup);
+        __catch
+            return 1;
+        return 0;
+    }
+
+    markSessionsHandedOff(pGroup);
+    Handoff_Uninit(&pGroup->handoff);
+    pGroup->wasHandedOff = 1;
+    printf("Handed off %d listeners and %d sessions.  Exiting.\n", pGroup->shardCount, sessionCount);
+    return 1;
+}
+
+static void receiveHello(ShardGroup* pGroup)
+{
+    HandoffRecord record;
+    const char*   pData = NULL;
+    int           socket = -1;
+    char          reason[128];
+
+    __try
+    {
+        if (!Handoff_Receive(&pGroup->handoff, &record, &pData, &socket))
+            __throw(serverException);
+    }
+    __catch
+    {
+        __rethrow;
+    }
+    if (socket >= 0)
+        close(socket);
+    if (record.type != HANDOFF_HELLO)
+        __throw(serverException);
+    if (record.id == (uint32_t)pGroup->shardCount)
+        return;
+
+    Handoff_InitRecord(&record, HANDOFF_REFUSED, 0);
+    record.dataLength = snprintf(reason, sizeof(reason), "it runs %d shards and both must match.", pGroup->shardCount);
+    Handoff_Send(&pGroup->handoff, &record, reason, -1);
+    printf("error: Refused handoff to a remotesvr with a different shard count.\n");
+    fflush(stdout);
+    __throw(serverException);
+}
+
+static void sendListeners(ShardGroup* pGroup)
+{
+    HandoffRecord record;
+    int           i;
+
+    for (i = 0 ; i < pGroup->shardCount ; i++)
+    {
+        Handoff_InitRecord(&record, HANDOFF_LISTENER, (uint32_t)i);
+        __try
+            Handoff_Send(&pGroup->handoff, &record, NULL, pGroup->pShards[i].listenSocket);
+        __catch
+            __rethrow;
+    }
+}
+
+static int sendSessions(ShardGroup* pGroup)
+{
+    int sessionCount = 0;
+    int i;
+
+    for (i = 0 ; i < pGroup->shardCount ; i++)
+    {
+        Shard* pShard = &pGroup->pShards[i];
+        int    j;
+
+        for (j = 0 ; j < pShard->sessionTableSize ; j++)
+        {
+            Session* pSession = pShard->ppSessionTable[j];
+            int      channel;
+
+            if (!pSession)
+                continue;
+            __try
+                sendSession(pGroup, pSession, HANDOFF_SESSION);
+            __catch
+                __rethrow_and_return(sessionCount);
+            sessionCount++;
+
+            for (channel = 1 ; pSession->ppRelayedSessions && channel < RELAY_MAX_CHANNELS ; channel++)
+            {
+                if (!pSession->ppRelayedSessions[channel])
+                    continue;
+                __try
+                    sendSession(pGroup, pSession->ppRelayedSessions[channel], HANDOFF_RELAYED_SESSION);
+                __catch
+                    __rethrow_and_return(sessionCount);
+                sessionCount++;
+            }
+        }
+    }
+    return sessionCount;
+}
+
+static void sendSession(ShardGroup* pGroup, Session* pSession, HandoffType type)
+{
+    HandoffRecord record;
+    const char*   pData = NULL;
+
+    Handoff_InitRecord(&record, type, pSession->id);
+    record.clientAddress = pSession->clientAddress;
+    record.bytesReceived = pSession->bytesReceived;
+    record.firstLineTimestamp = pSession->firstLineTimestamp;
+    record.isLineContinued = (uint16_t)pSession->isLineContinued;
+    record.weight = pSession->weight;
+    record.lastAcknowledgedReference = pSession->lastAcknowledgedReference;
+    if (type == HANDOFF_RELAYED_SESSION)
+    {
+        record.relayId = pSession->pRelay->id;
+        record.channel = pSession->channel;
+        __try
+            Handoff_Send(&pGroup->handoff, &record, NULL, -1);
+        __catch
+            __rethrow;
+    }
+    else
+    {
+        record.dataLength = (uint32_t)FrameReader_GetBuffered(&pSession->frameReader, &pData);
+        __try
+        {
+            __throwing_func( Handoff_Send(&pGroup->handoff, &record, pData, pSession->socket) );
+            __throwing_func( sendQueuedOutput(pGroup, pSession) );
+        }
+        __catch
+        {
+            __rethrow;
+        }
+    }
+    __try
+    {
+        __throwing_func( sendTrace(pGroup, pSession) );
+        __throwing_func( sendOutputIndex(pGroup, pSession) );
+    }
+    __catch
+    {
+        __rethrow;
+    }
+    sendPendingFrames(pGroup, pSession);
+}
+
+static void sendQueuedOutput(ShardGroup* pGroup, Session* pSession)
+{
+    HandoffRecord record;
+    const char*   pData = NULL;
+
+    Handoff_InitRecord(&record, HANDOFF_QUEUED_OUTPUT, pSession->id);
+    record.dataLength = (uint32_t)FrameWriter_GetQueued(&pSession->frameWriter, &pData);
+    if (record.dataLength == 0)
+        return;
+    Handoff_Send(&pGroup->handoff, &record, pData, -1);
+}
+
+static void sendTrace(ShardGroup* pGroup, Session* pSession)
+{
+    HandoffRecord record;
+
+    if (!pSession->trace.isActive)
+        return;
+    Handoff_InitRecord(&record, HANDOFF_TRACE, pSession->id);
+    record.dataLength = sizeof(pSession->trace);
+    Handoff_Send(&pGroup->handoff, &record, &pSession->trace, -1);
+}
+
+static void sendOutputIndex(ShardGroup* pGroup, Session* pSession)
+{
+    HandoffRecord record;
+    char*         pData = NULL;
+    size_t        length = OutputIndex_Save(&pSession->outputIndex, &pData);
+
+    /* An index too large for one record, or which can't be saved for lack of memory, is left behind. */
+    if (length == 0 || length > UINT32_MAX)
+    {
+        free(pData);
+        return;
+    }
+    Handoff_InitRecord(&record, HANDOFF_OUTPUT_INDEX, pSession->id);
+    record.dataLength = (uint32_t)length;
+    Handoff_Send(&pGroup->handoff, &record, pData, pSession->outputIndex.fileDescriptor);
+    free(pData);
+}
+
+static void sendPendingFrames(ShardGroup* pGroup, Session* pSession)
+{
+    PendingFrameHandoff handoff;
+
+    handoff.pGroup = pGroup;
+    handoff.sessionId = pSession->id;
+    Session_ForEachPendingFrame(pSession, sendPendingFrame, &handoff);
+}
+
+static void sendPendingFrame(void* pContext, const char* pFrame, size_t length)
+{
+    PendingFrameHandoff* pHandoff = (PendingFrameHandoff*)pContext;
+    HandoffRecord        record;
+
+    /* Stop at the first frame which fails to send and leave its exception for sendSessions(). */
+    if (getExceptionCode())
+        return;
+    Handoff_InitRecord(&record, HANDOFF_PENDING_FRAME, pHandoff->sessionId);
+    record.dataLength = (uint32_t)length;
+    Handoff_Send(&pHandoff->pGroup->handoff, &record, pFrame, -1);
+}
+
+static void sendRecord(ShardGroup* pGroup, HandoffType type)
+{
+    HandoffRecord record;
+
+    Handoff_InitRecord(&record, type, 0);
+    Handoff_Send(&pGroup->handoff, &record, NULL, -1);
+}
+
+static void waitForAcknowledgement(ShardGroup* pGroup)
+{
+    HandoffRecord record;
+    const char*   pData = NULL;
+    int           socket = -1;
+    int           wasReceived = 0;
+
+    __try
+        wasReceived = Handoff_Receive(&pGroup->handoff, &record, &pData, &socket);
+    __catch
+        __rethrow;
+    if (socket >= 0)
+        close(socket);
+    if (!wasReceived || record.type != HANDOFF_ACK)
+        __throw(serverException);
+}
+
+static void markSessionsHandedOff(ShardGroup* pGroup)
+{
+    int i;
+
+    for (i = 0 ; i < pGroup->shardCount ; i++)
+    {
+        Shard* pShard = &pGroup->pShards[i];
+        int    j;
+
+        for (j = 0 ; j < pShard->sessionTableSize ; j++)
+        {
+            if (pShard->ppSessionTable[j])
+                pShard->ppSessionTable[j]->isHandedOff = 1;
+        }
+    }
+}
+
+static int splitCommandLine(char* pCommandLine, const char** ppArguments)
+{
+    int   argumentCount = 0;
+    char* pToken = strtok(pCommandLine, " \t\r\n");
+
+    while (pToken && argumentCount < CONSOLE_MAX_ARGUMENTS)
+    {
+        ppArguments[argumentCount++] = pToken;
+        pToken = strtok(NULL, " \t\r\n");
+    }
+    return argumentCount;
+}
+
+static int runCommand(ShardGroup* pGroup, int argumentCount, const char** ppArguments)
+{
+    const char* pCommand = ppArguments[0];
+
+    if (0 == strcmp(pCommand, "quit"))
+        return 0;
+    else if (0 == strcmp(pCommand, "stats"))
+        displayShardStatistics(pGroup);
+    else if (0 == strcmp(pCommand, "memory"))
+        displayMemoryUsage(pGroup);
+    else if (0 == strcmp(pCommand, "dedup"))
+        displayDedupStatistics(pGroup);
+    else if (0 == strcmp(pCommand, "pull"))
+        runTransferCommand(pGroup, argumentCount, ppArguments, 1);
+    else if (0 == strcmp(pCommand, "push"))
+        runTransferCommand(pGroup, argumentCount, ppArguments, 0);
+    else if (0 == strcmp(pCommand, "filter"))
+        runFilterCommand(pGroup, argumentCount, ppArguments);
+    else if (0 == strcmp(pCommand, "weight"))
+        runWeightCommand(pGroup, argumentCount, ppArguments);
+    else if (0 == strcmp(pCommand, "group"))
+        runGroupCommand(pGroup, argumentCount, ppArguments);
+    else if (0 == strcmp(pCommand, "broadcast"))
+        runBroadcastCommand(pGroup);
+    else if (0 == strcmp(pCommand, "interrupt"))
+        runInterruptCommand(pGroup);
+    else if (0 == strcmp(pCommand, "trace"))
+        runTraceCommand(pGroup, argumentCount, ppArguments);
+    else if (0 == strcmp(pCommand, "search"))
+        runSearchCommand(pGroup, argumentCount, ppArguments);
+    else if (0 == strcmp(pCommand, "show"))
+        runShowCommand(pGroup, argumentCount, ppArguments);
+    else
+        displayHelp();
+
+    return 1;
+}
+
+static void displayHelp(void)
+{
+    printf("Commands: stats\n"
+           "          memory\n"
+           "          dedup\n"
+           "          pull sessionId remotePath [localPath]\n"
+           "          push sessionId localPath remotePath\n"
+           "          filter sessionId [+include|-exclude|+re:regex|-re:regex ...]\n"
+           "          weight sessionId [1-64]\n"
+           "          group [all|clear|sessionId ...]\n"
+           "          broadcast\n"
+           "          interrupt\n"
+           "          trace sessionId\n"
+           "          search sessionId text\n"
+           "          show sessionId line [contextLines]\n"
+           "          quit\n");
+}
+
+static void displayShardStatistics(ShardGroup* pGroup)
+{
+    int      totalSessions = 0;
+    uint64_t totalBytes = 0;
+    int      i;
+
+    for (i = 0 ; i < pGroup->shardCount ; i++)
+    {
+        Shard*   pShard = &pGroup->pShards[i];
+        int      sessionCount = Shard_GetSessionCount(pShard);
+        uint64_t bytesReceived = Shard_GetBytesReceived(pShard);
+
+        printf("shard %3d: %6d sessions %14llu bytes received",
+               i, sessionCount, (unsigned long long)bytesReceived);
+        if (Shard_GetExceptionCode(pShard))
+            printf(" (stopped with error %d)", Shard_GetExceptionCode(pShard));
+        printf("\n");
+        totalSessions += sessionCount;
+        totalBytes += bytesReceived;
+    }
+    printf("total:     %6d sessions %14llu bytes received\n", totalSessions, (unsigned long long)totalBytes);
+}
+
+static void displayMemoryUsage(ShardGroup* pGroup)
+{
+    MemoryCommand command;
+    uint64_t      limit = pGroup->bufferBudget.limit;
+    int           i;
+
+    memset(&command, 0, sizeof(command));
+    for (i = 0 ; i < pGroup->shardCount ; i++)
+        Shard_Execute(&pGroup->pShards[i], displayShardMemory, &command);
+
+    printf("total:     %14llu bytes in receive buffers %14llu bytes in output indexes\n",
+           (unsigned long long)command.bufferBytes, (unsigned long long)command.indexBytes);
+    printf("%d sessions hold no memory.  %llu bytes of buffers charged against ",
+           command.idleSessionCount, (unsigned long long)BufferBudget_GetBytesCharged(&pGroup->bufferBudget));
+    if (limit)
+        printf("the %llu byte budget", (unsigned long long)limit);
+    else
+        printf("no budget");
+    printf(", %llu allocations refused.\n", (unsigned long long)BufferBudget_GetRefusals(&pGroup->bufferBudget));
+}
+
+static void displayDedupStatistics(ShardGroup* pGroup)
+{
+    ChunkCacheStats stats;
+    uint64_t        lookups;
+
+    if (!ChunkCache_IsEnabled(&pGroup->chunkCache))
+    {
+        printf("Deduplication is disabled.  Start remotesvr with --dedup-cache to enable it.\n");
+        return;
+    }
+
+    ChunkCache_GetStats(&pGroup->chunkCache, &stats);
+    lookups = stats.hits + stats.misses;
+    printf("cache:     %14llu of %llu bytes in %llu chunks, %llu inserted and %llu evicted\n",
+           (unsigned long long)stats.bytesCached, (unsigned long long)stats.limit,
+           (unsigned long long)stats.chunkCount, (unsigned long long)stats.insertions,
+           (unsigned long long)stats.evictions);
+    printf("lookups:   %14llu hits %14llu misses (%.1f%% hit rate), %llu bytes not sent\n",
+           (unsigned long long)stats.hits, (unsigned long long)stats.misses,
+           lookups ? 100.0 * stats.hits / lookups : 0.0, (unsigned long long)stats.bytesSaved);
+}
+
+static void displayShardMemory(Shard* pShard, void* pContext)
+{
+    MemoryCommand* pCommand = (MemoryCommand*)pContext;
+    BufferPool*    pPool = &pShard->bufferPool;
+    int            i;
+
+    for (i = 0 ; i < pShard->sessionTableSize ; i++)
+    {
+        Session* pSession = pShard->ppSessionTable[i];
+        int      channel;
+
+        if (!pSession)
+            continue;
+        displaySessionMemory(pSession, pCommand);
+        for (channel = 1 ; pSession->ppRelayedSessions && channel < RELAY_MAX_CHANNELS ; channel++)
+        {
+            if (pSession->ppRelayedSessions[channel])
+                displaySessionMemory(pSession->ppRelayedSessions[channel], pCommand);
+        }
+    }
+    printf("shard %3d: %14llu bytes in use %14llu bytes pooled, %llu buffers allocated, %llu reused\n",
+           pShard->index, (unsigned long long)pPool->bytesInUse, (unsigned long long)pPool->bytesFree,
+           (unsigned long long)pPool->allocations, (unsigned long long)pPool->reuses);
+}
+
+static void displaySessionMemory(Session* pSession, MemoryCommand* pCommand)
+{
+    size_t bufferBytes = pSession->frameReader.bufferSize;
+    size_t indexBytes = OutputIndex_GetMemoryUsage(&pSession->outputIndex);
+
+    if (bufferBytes == 0 && indexBytes == 0)
+    {
+        pCommand->idleSessionCount++;
+        return;
+    }
+    printf("  %08x: %14zu bytes in receive buffer  %14zu bytes in output index\n",
+           pSession->id, bufferBytes, indexBytes);
+    pCommand->bufferBytes += bufferBytes;
+    pCommand->indexBytes += indexBytes;
+}
+
+static void runTransferCommand(ShardGroup* pGroup, int argumentCount, const char** ppArguments, int isPull)
+{
+    TransferCommand command;
+
+    if (argumentCount < 3 || (!isPull && argumentCount < 4))
+    {
+        displayHelp();
+        return;
+    }
+
+    command.pSource = ppArguments[2];
+    command.pDestination = argumentCount >= 4 ? ppArguments[3] : NULL;
+    command.isPull = isPull;
+    if (!command.pDestination)
+    {
+        const char* pBaseName = strrchr(command.pSource, '/');
+        command.pDestination = pBaseName ? pBaseName + 1 : command.pSource;
+    }
+
+    executeOnSession(pGroup, ppArguments[1], transferFile, &command);
+}
+
+static void transferFile(Session* pSession, void* pContext)
+{
+    TransferCommand* pCommand = (TransferCommand*)pContext;
+
+    __try
+    {
+        if (pCommand->isPull)
+            Session_PullFile(pSession, pCommand->pSource, pCommand->pDestination);
+        else
+            Session_PushFile(pSession, pCommand->pSource, pCommand->pDestination);
+    }
+    __catch
+    {
+        perror("error: Transfer failed");
+    }
+}
+
+static void runFilterCommand(ShardGroup* pGroup, int argumentCount, const char** ppArguments)
+{
+    FilterCommand command;
+    int           i;
+
+    if (argumentCount < 2)
+    {
+        displayHelp();
+        return;
+    }
+
+    command.ruleTextLength = 0;
+    for (i = 2 ; i < argumentCount && command.ruleTextLength + strlen(ppArguments[i]) + 1 < sizeof(command.ruleText) ; i++)
+        command.ruleTextLength += sprintf(command.ruleText + command.ruleTextLength, "%s\n", ppArguments[i]);
+
+    executeOnSession(pGroup, ppArguments[1], setOutputFilter, &command);
+}
+
+static void setOutputFilter(Session* pSession, void* pContext)
+{
+    FilterCommand* pCommand = (FilterCommand*)pContext;
+
+    __try
+        Session_SetOutputFilter(pSession, pCommand->ruleText, pCommand->ruleTextLength);
+    __catch
+    {
+        perror("error: Filter update failed");
+        return;
+    }
+    printf(pCommand->ruleTextLength ? "Output filter for session %08x updated.\n" :
+                                      "Output filter for session %08x cleared.\n", pSession->id);
+}
+
+static void runWeightCommand(ShardGroup* pGroup, int argumentCount, const char** ppArguments)
+{
+    uint32_t weight = 0;
+
+    if (argumentCount < 2)
+    {
+        displayHelp();
+        return;
+    }
+    if (argumentCount > 2)
+    {
+        weight = (uint32_t)strtoul(ppArguments[2], NULL, 10);
+        if (weight < 1 || weight > SHARD_MAX_WEIGHT)
+        {
+            printf("error: Weight must be between 1 and %d.\n", SHARD_MAX_WEIGHT);
+            return;
+        }
+    }
+    executeOnSession(pGroup, ppArguments[1], setSessionWeight, &weight);
+}
+
+static void setSessionWeight(Session* pSession, void* pContext)
+{
+    uint32_t weight = *(uint32_t*)pContext;
+
+    if (pSession->pRelay)
+    {
+        printf("error: Session %08x is read through relay %08x.  Set the relay's weight instead.\n",
+               pSession->id, pSession->pRelay->id);
+        return;
+    }
+    if (weight)
+        pSession->weight = weight;
+    printf("Session %08x has a weight of %u.\n", pSession->id, pSession->weight);
+}
+
+static void runGroupCommand(ShardGroup* pGroup, int argumentCount, const char** ppArguments)
+{
+    int i;
+
+    if (argumentCount > 1 && 0 == strcmp(ppArguments[1], "clear"))
+    {
+        clearBroadcastGroup(pGroup);
+    }
+    else if (argumentCount > 1 && 0 == strcmp(ppArguments[1], "all"))
+    {
+        clearBroadcastGroup(pGroup);
+        pGroup->isGroupAll = 1;
+    }
+    else
+    {
+        for (i = 1 ; i < argumentCount ; i++)
+        {
+            uint32_t sessionId = 0;
+
+            if (parseSessionId(ppArguments[i], &sessionId))
+                addToBroadcastGroup(pGroup, sessionId);
+            else
+                printf("error: %s is not a session id.\n", ppArguments[i]);
+        }
+    }
+    displayBroadcastGroup(pGroup);
+}
+
+static void clearBroadcastGroup(ShardGroup* pGroup)
+{
+    pGroup->groupIdCount = 0;
+    pGroup->isGroupAll = 0;
+}
+
+static void addToBroadcastGroup(ShardGroup* pGroup, uint32_t sessionId)
+{
+    uint32_t* pNewIds = NULL;
+    int       i = 0;
+
+    pGroup->isGroupAll = 0;
+    while (i < pGroup->groupIdCount && pGroup->pGroupIds[i] < sessionId)
+        i++;
+    if (i < pGroup->groupIdCount && pGroup->pGroupIds[i] == sessionId)
+        return;
+
+    pNewIds = realloc(pGroup->pGroupIds, (pGroup->groupIdCount + 1) * sizeof(*pNewIds));
+    if (!pNewIds)
+    {
+        printf("error: Failed to add session %08x to the broadcast group.\n", sessionId);
+        return;
+    }
+    memmove(&pNewIds[i + 1], &pNewIds[i], (pGroup->groupIdCount - i) * sizeof(*pNewIds));
+    pNewIds[i] = sessionId;
+    pGroup->pGroupIds = pNewIds;
+    pGroup->groupIdCount++;
+}
+
+static void displayBroadcastGroup(ShardGroup* pGroup)
+{
+    int i;
+
+    if (pGroup->isGroupAll)
+    {
+        printf("Broadcast group is every session.\n");
+        return;
+    }
+    if (pGroup->groupIdCount == 0)
+    {
+        printf("Broadcast group is empty.\n");
+        return;
+    }
+    printf("Broadcast group has %d sessions:", pGroup->groupIdCount);
+    for (i = 0 ; i < pGroup->groupIdCount ; i++)
+        printf(" %08x", pGroup->pGroupIds[i]);
+    printf("\n");
+}
+
+static void runBroadcastCommand(ShardGroup* pGroup)
+{
+    if (!pGroup->isGroupAll && pGroup->groupIdCount == 0)
+    {
+        printf("error: Broadcast group is empty.  Add sessions to it with the group command.\n");
+        return;
+    }
+    pGroup->isBroadcasting = 1;
+    printf("Broadcasting console input to the group.  Enter ^C to interrupt it and . to stop broadcasting.\n");
+}
+
+/* Each line read is encoded once and the same buffer is sent to every session in the group. */
+static void broadcastConsoleInput(ShardGroup* pGroup, const char* pLine)
+{
+    if (isConsoleLine(pLine, "."))
+    {
+        pGroup->isBroadcasting = 0;
+        printf("Stopped broadcasting.\n");
+        return;
+    }
+    if (isConsoleLine(pLine, "^C"))
+    {
+        runInterruptCommand(pGroup);
+        return;
+    }
+    if (broadcastToGroup(pGroup, FRAME_INPUT, 0, pLine, strlen(pLine)) == 0)
+        printf("error: No session in the broadcast group is connected.\n");
+}
+
+static int isConsoleLine(const char* pLine, const char* pText)
+{
+    size_t length = strcspn(pLine, "\r\n");
+
+    return length == strlen(pText) && 0 == strncmp(pLine, pText, length);
+}
+
+static void runInterruptCommand(ShardGroup* pGroup)
+{
+    int sessionCount = broadcastToGroup(pGroup, FRAME_CONTROL, CONTROL_INTERRUPT, NULL, 0);
+
+    printf("Interrupted %d sessions.\n", sessionCount);
+}
+
+static int broadcastToGroup(ShardGroup* pGroup, uint8_t type, uint8_t flags, const void* pPayload, size_t length)
+{
+    BroadcastCommand command;
+    int              i;
+
+    command.pGroup = pGroup;
+    command.pPayload = pPayload;
+    command.length = length;
+    command.type = type;
+    command.flags = flags;
+    command.sessionCount = 0;
+    command.failureCount = 0;
+    for (i = 0 ; i < pGroup->shardCount ; i++)
+        Shard_Execute(&pGroup->pShards[i], broadcastOnShard, &command);
+
+    if (command.failureCount)
+        printf("error: Broadcast failed on %d connections.\n", command.failureCount);
+    return command.sessionCount;
+}
+
+static void broadcastOnShard(Shard* pShard, void* pContext)
+{
+    BroadcastCommand* pCommand = (BroadcastCommand*)pContext;
+    int               i;
+
+    for (i = 0 ; i < pShard->sessionTableSize ; i++)
+    {
+        Session* pSession = pShard->ppSessionTable[i];
+        int      sentCount = 0;
+
+        if (!pSession)
+            continue;
+        __try
+            sentCount = Session_BroadcastFrame(pSession, isInBroadcastGroup, pCommand->pGroup,
+                                               pCommand->type, pCommand->flags, pCommand->pPayload, pCommand->length);
+        __catch
+        {
+            clearExceptionCode();
+            pCommand->failureCount++;
+        }
+        pCommand->sessionCount += sentCount;
+    }
+}
+
+static int isInBroadcastGroup(Session* pSession, void* pContext)
+{
+    ShardGroup* pGroup = (ShardGroup*)pContext;
+
+    if (pGroup->isGroupAll)
+        return 1;
+    if (pGroup->groupIdCount == 0)
+        return 0;
+    return NULL != bsearch(&pSession->id, pGroup->pGroupIds, pGroup->groupIdCount, sizeof(*pGroup->pGroupIds),
+                           compareSessionIds);
+}
+
+static int compareSessionIds(const void* pKey, const void* pElement)
+{
+    uint32_t key = *(const uint32_t*)pKey;
+    uint32_t element = *(const uint32_t*)pElement;
+
+    if (key < element)
+        return -1;
+    return key > element;
+}
+
+static void runTraceCommand(ShardGroup* pGroup, int argumentCount, const char** ppArguments)
+{
+    if (argumentCount < 2)
+    {
+        displayHelp();
+        return;
+    }
+    executeOnSession(pGroup, ppArguments[1], displayTrace, NULL);
+}
+
+static void displayTrace(Session* pSession, void* pContext)
+{
+    Session_DisplayTrace(pSession);
+}
+
+static void runSearchCommand(ShardGroup* pGroup, int argumentCount, const char** ppArguments)
+{
+    SearchCommand command;
+    int           i;
+
+    if (argumentCount < 3)
+    {
+        displayHelp();
+        return;
+    }
+
+    command.textLength = 0;
+    for (i = 2 ; i < argumentCount && command.textLength + strlen(ppArguments[i]) + 1 < sizeof(command.text) ; i++)
+        command.textLength += sprintf(command.text + command.textLength, i > 2 ? " %s" : "%s", ppArguments[i]);
+
+    executeOnSession(pGroup, ppArguments[1], searchOutput, &command);
+}
+
+static void searchOutput(Session* pSession, void* pContext)
+{
+    SearchCommand* pCommand = (SearchCommand*)pContext;
+    OutputIndex*   pIndex = &pSession->outputIndex;
+    SearchJob*     pJob = NULL;
+    pthread_t      thread;
+
+    if (!OutputIndex_IsEnabled(pIndex))
+    {
+        printf("error: Output indexing is disabled.  Restart remotesvr with --index.\n");
+        return;
+    }
+
+    /* Reading blocks back from disk can take a while, so the shard only copies the block table and leaves the
+       search itself to a thread of its own. */
+    pJob = malloc(sizeof(*pJob));
+    if (!pJob || !OutputIndex_Snapshot(pIndex, &pJob->snapshot))
+    {
+        printf("error: Not enough memory to search the output of session %08x.\n", pSession->id);
+        free(pJob);
+        return;
+    }
+    pJob->command = *pCommand;
+    if (pthread_create(&thread, NULL, searchThreadMain, pJob) != 0)
+    {
+        printf("error: Failed to start a thread to search the output of session %08x.\n", pSession->id);
+        OutputIndex_Uninit(&pJob->snapshot);
+        free(pJob);
+        return;
+    }
+    pthread_detach(thread);
+}
+
+static void* searchThreadMain(void* pContext)
+{
+    SearchJob*             pJob = (SearchJob*)pContext;
+    OutputIndex*           pIndex = &pJob->snapshot;
+    OutputIndexSearchStats stats;
+    size_t                 matchCount;
+
+    matchCount = OutputIndex_Search(pIndex, pJob->command.text, pJob->command.textLength, SEARCH_MAX_MATCHES,
+                                    displayOutputLine, NULL, &stats);
+    printf("%zu%s matches in %llu lines, %llu of %llu blocks scanned in %.3f ms.\n",
+           matchCount, matchCount == SEARCH_MAX_MATCHES ? " (or more)" : "",
+           (unsigned long long)OutputIndex_GetLineCount(pIndex),
+           (unsigned long long)stats.blocksScanned, (unsigned long long)stats.blockCount,
+           stats.elapsedTime / 1000000.0);
+    if (OutputIndex_IsFull(pIndex))
+        printf("Index is full; only the first %llu bytes of output were indexed.\n",
+               (unsigned long long)OutputIndex_GetByteCount(pIndex));
+    fflush(stdout);
+
+    OutputIndex_Uninit(pIndex);
+    free(pJob);
+    return NULL;
+}
+
+static void runShowCommand(ShardGroup* pGroup, int argumentCount, const char** ppArguments)
+{
+    ShowCommand command;
+
+    if (argumentCount < 3)
+    {
+        displayHelp();
+        return;
+    }
+
+    command.line = strtoull(ppArguments[2], NULL, 10);
+    command.context = argumentCount >= 4 ? strtoull(ppArguments[3], NULL, 10) : SHOW_DEFAULT_CONTEXT;
+    executeOnSession(pGroup, ppArguments[1], showOutputLines, &command);
+}
+
+static void showOutputLines(Session* pSession, void* pContext)
+{
+    ShowCommand* pCommand = (ShowCommand*)pContext;
+    OutputIndex* pIndex = &pSession->outputIndex;
+    uint64_t     firstLine = pCommand->line > pCommand->context ? pCommand->line - pCommand->context : 1;
+
+    if (!OutputIndex_IsEnabled(pIndex))
+    {
+        printf("error: Output indexing is disabled.  Restart remotesvr with --index.\n");
+        return;
+    }
+    if (0 == OutputIndex_GetLines(pIndex, firstLine, pCommand->line + pCommand->context - firstLine + 1,
+                                  displayOutputLine, NULL))
+        printf("error: Line %llu is not in the index (%llu lines indexed).\n",
+               (unsigned long long)pCommand->line, (unsigned long long)OutputIndex_GetLineCount(pIndex));
+}
+
+static void displayOutputLine(void* pContext, uint64_t lineNumber, const char* pLine, size_t length)
+{
+    if (length > 0 && pLine[length - 1] == '\n')
+        length--;
+    printf("%8llu: %.*s\n", (unsigned long long)lineNumber, (int)length, pLine);
+}
+
+static void executeOnSession(ShardGroup* pGroup, const char* pSessionId, SessionCommand* pCommand, void* pContext)
+{
+    SessionCommandRequest request;
+    int                   shardIndex = -1;
+
+    if (!parseSessionId(pSessionId, &request.sessionId))
+    {
+        printf("error: %s is not a session id.\n", pSessionId);
+        return;
+    }
+    request.pCommand = pCommand;
+    request.pContext = pContext;
+    request.wasSessionFound = 0;
+
+    shardIndex = Shard_IndexFromSessionId(request.sessionId);
+    if (shardIndex < pGroup->shardCount)
+        Shard_Execute(&pGroup->pShards[shardIndex], runSessionCommandOnShard, &request);
+    if (!request.wasSessionFound)
+        printf("error: No session %08x.\n", request.sessionId);
+}
+
+static int parseSessionId(const char* pText, uint32_t* pSessionId)
+{
+    char*         pEnd = NULL;
+    unsigned long value = 0;
+
+    errno = 0;
+    value = strtoul(pText, &pEnd, 16);
+    if (pEnd == pText || *pEnd != '\0' || errno == ERANGE || value > UINT32_MAX)
+        return 0;
+    *pSessionId = (uint32_t)value;
+    return 1;
+}
+
+static void runSessionCommandOnShard(Shard* pShard, void* pContext)
+{
+    SessionCommandRequest* pRequest = (SessionCommandRequest*)pContext;
+    Session*               pSession = Shard_FindSession(pShard, pRequest->sessionId);
+
+    if (!pSession)
+        return;
+    pRequest->wasSessionFound = 1;
+    pRequest->pCommand(pSession, pRequest->pContext);
+}
@@ -0,0 +1,50 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef _SHARDGROUP_H_
+#define _SHARDGROUP_H_
+
+#include "parameters.h"
+#include "shard.h"
+#include "handoff.h"
+#include "chunkcache.h"
+
+/* The set of shards making up a sharded remotesvr along with the console which controls them.  Console commands
+   which act upon a session are forwarded to the thread of the shard which owns that session.  With --handoff the
+   group takes over its listeners and sessions from the remotesvr already running, if there is one, and the console
+   hands them on in turn when a newer server asks for them.  The group also owns the --dedup-cache shared by all of
+   its shards, and the console keeps the broadcast group: the sorted ids of the sessions, or all of them, which
+   console input typed in broadcast mode and interrupts are fanned out to. */
+typedef struct
+{
+    Parameters*  pParameters;
+    Shard*       pShards;
+    Handoff      handoff;
+    BufferBudget bufferBudget;
+    ChunkCache   chunkCache;
+    uint32_t*    pGroupIds;
+    int          groupIdCount;
+    int          isGroupAll;
+    int          isBroadcasting;
+    int          shardCount;
+    int          initializedCount;
+    int          wasHandedOff;
+} ShardGroup;
+
+void ShardGroup_Init(ShardGroup* pGroup, Parameters* pParameters);
+void ShardGroup_Uninit(ShardGroup* pGroup);
+void ShardGroup_RunConsole(ShardGroup* pGroup);
+int  ShardGroup_WasHandedOff(ShardGroup* pGroup);
+
+#endif /* _SHARDGROUP_H_ */
@@ -0,0 +1,306 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <limits.h>
+#include <string.h>
+#include "timerwheel.h"
+
+
+#define TIMER_WHEEL_NANOSECONDS_PER_TICK    (1000 * 1000ULL)
+#define TIMER_WHEEL_MAX_TICKS               (1ULL << (TIMER_WHEEL_LEVEL0_BITS + \
+                                                      (TIMER_WHEEL_LEVELS - 1) * TIMER_WHEEL_LEVEL_BITS))
+
+
+static void     initList(Timer* pHead);
+static void     insertTimer(TimerWheel* pWheel, Timer* pTimer);
+static int      levelShift(int level);
+static Timer*   slotHead(TimerWheel* pWheel, int level, int slot);
+static void     markOccupied(TimerWheel* pWheel, int level, int slot);
+static void     markEmptyIfUnused(TimerWheel* pWheel, int level, int slot);
+static void     unlinkTimer(Timer* pTimer);
+static void     detachSlot(TimerWheel* pWheel, int level, int slot, Timer* pList);
+static uint64_t nextEventTick(TimerWheel* pWheel);
+static int      findOccupiedLevel0Slot(TimerWheel* pWheel, int startSlot);
+static uint64_t rotateRight(uint64_t bits, int count);
+static void     processTick(TimerWheel* pWheel, uint64_t tick);
+static void     cascade(TimerWheel* pWheel, int level, int slot);
+
+
+void Timer_Init(Timer* pTimer, TimerCallback* pCallback, void* pContext)
+{
+    memset(pTimer, 0, sizeof(*pTimer));
+    pTimer->pCallback = pCallback;
+    pTimer->pContext = pContext;
+}
+
+int Timer_IsArmed(Timer* pTimer)
+{
+    return pTimer->pNext != NULL;
+}
+
+void TimerWheel_Init(TimerWheel* pWheel, uint64_t now)
+{
+    int level;
+    int slot;
+
+    memset(pWheel, 0, sizeof(*pWheel));
+    pWheel->startTime = now;
+    for (slot = 0 ; slot < TIMER_WHEEL_LEVEL0_SLOTS ; slot++)
+        initList(&pWheel->level0[slot]);
+    for (level = 1 ; level < TIMER_WHEEL_LEVELS ; level++)
+    {
+        for (slot = 0 ; slot < TIMER_WHEEL_SLOTS ; slot++)
+            initList(&pWheel->levels[level - 1][slot]);
+    }
+}
+
+static void initList(Timer* pHead)
+{
+    pHead->pNext = pHead;
+    pHead->pPrevious = pHead;
+}
+
+void TimerWheel_Arm(TimerWheel* pWheel, Timer* pTimer, uint64_t deadline)
+{
+    uint64_t tick = 0;
+
+    if (Timer_IsArmed(pTimer))
+        TimerWheel_Cancel(pWheel, pTimer);
+
+    /* Round up so that a timer never fires before its deadline. */
+    if (deadline > pWheel->startTime)
+        tick = (deadline - pWheel->startTime + TIMER_WHEEL_NANOSECONDS_PER_TICK - 1) / TIMER_WHEEL_NANOSECONDS_PER_TICK;
+    if (tick < pWheel->currentTick)
+        tick = pWheel->currentTick;
+    if (tick - pWheel->currentTick >= TIMER_WHEEL_MAX_TICKS)
+        tick = pWheel->currentTick + TIMER_WHEEL_MAX_TICKS - 1;
+
+    pTimer->expiryTick = tick;
+    insertTimer(pWheel, pTimer);
+    pWheel->timerCount++;
+}
+
+static void insertTimer(TimerWheel* pWheel, Timer* pTimer)
+{
+    uint64_t delta = pTimer->expiryTick - pWheel->currentTick;
+    Timer*   pHead = NULL;
+    int      level = 0;
+
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ULL << levelShift(level + 1)))
+        level++;
+    pTimer->level = level;
+    pTimer->slot = (int)(pTimer->expiryTick >> levelShift(level)) &
+                   (level == 0 ? TIMER_WHEEL_LEVEL0_SLOTS - 1 : TIMER_WHEEL_SLOTS - 1);
+
+    pHead = slotHead(pWheel, pTimer->level, pTimer->slot);
+    pTimer->pNext = pHead;
+    pTimer->pPrevious = pHead->pPrevious;
+    pHead->pPrevious->pNext = pTimer;
+    pHead->pPrevious = pTimer;
+    markOccupied(pWheel, pTimer->level, pTimer->slot);
+}
+
+static int levelShift(int level)
+{
+    return level == 0 ? 0 : TIMER_WHEEL_LEVEL0_BITS + (level - 1) * TIMER_WHEEL_LEVEL_BITS;
+}
+
+static Timer* slotHead(TimerWheel* pWheel, int level, int slot)
+{
+    return level == 0 ? &pWheel->level0[slot] : &pWheel->levels[level - 1][slot];
+}
+
+static void markOccupied(TimerWheel* pWheel, int level, int slot)
+{
+    if (level == 0)
+        pWheel->level0Occupied[slot >> 6] |= 1ULL << (slot & 63);
+    else
+        pWheel->levelOccupied[level - 1] |= 1ULL << slot;
+}
+
+void TimerWheel_Cancel(TimerWheel* pWheel, Timer* pTimer)
+{
+    if (!Timer_IsArmed(pTimer))
+        return;
+    unlinkTimer(pTimer);
+    markEmptyIfUnused(pWheel, pTimer->level, pTimer->slot);
+    pWheel->timerCount--;
+}
+
+static void unlinkTimer(Timer* pTimer)
+{
+    pTimer->pPrevious->pNext = pTimer->pNext;
+    pTimer->pNext->pPrevious = pTimer->pPrevious;
+    pTimer->pNext = NULL;
+    pTimer->pPrevious = NULL;
+}
+
+static void markEmptyIfUnused(TimerWheel* pWheel, int level, int slot)
+{
+    Timer* pHead = slotHead(pWheel, level, slot);
+
+    if (pHead->pNext != pHead)
+        return;
+    if (level == 0)
+        pWheel->level0Occupied[slot >> 6] &= ~(1ULL << (slot & 63));
+    else
+        pWheel->levelOccupied[level - 1] &= ~(1ULL << slot);
+}
+
+void TimerWheel_Advance(TimerWheel* pWheel, uint64_t now)
+{
+    uint64_t nowTick = now > pWheel->startTime ? (now - pWheel->startTime) / TIMER_WHEEL_NANOSECONDS_PER_TICK : 0;
+
+    while (pWheel->currentTick <= nowTick)
+    {
+        uint64_t tick = pWheel->timerCount ? nextEventTick(pWheel) : UINT64_MAX;
+
+        /* Ticks with nothing to expire or cascade are skipped rather than stepped through one at a time. */
+        if (tick > nowTick)
+        {
+            pWheel->currentTick = nowTick + 1;
+            return;
+        }
+        processTick(pWheel, tick);
+    }
+}
+
+static uint64_t nextEventTick(TimerWheel* pWheel)
+{
+    uint64_t nextTick = UINT64_MAX;
+    int      distance = findOccupiedLevel0Slot(pWheel, (int)(pWheel->currentTick & (TIMER_WHEEL_LEVEL0_SLOTS - 1)));
+    int      level;
+
+    if (distance >= 0)
+        nextTick = pWheel->currentTick + distance;
+
+    /* A higher level slot is due when the level below starts the rotation it covers. */
+    for (level = 1 ; level < TIMER_WHEEL_LEVELS ; level++)
+    {
+        uint64_t occupied = pWheel->levelOccupied[level - 1];
+        int      shift = levelShift(level);
+        uint64_t rotation = (pWheel->currentTick + (1ULL << shift) - 1) >> shift;
+        uint64_t rotated;
+        uint64_t cascadeTick;
+
+        if (!occupied)
+            continue;
+        rotated = rotateRight(occupied, (int)(rotation & (TIMER_WHEEL_SLOTS - 1)));
+        cascadeTick = (rotation + __builtin_ctzll(rotated)) << shift;
+        if (cascadeTick < nextTick)
+            nextTick = cascadeTick;
+    }
+    return nextTick;
+}
+
+static int findOccupiedLevel0Slot(TimerWheel* pWheel, int startSlot)
+{
+    int wordCount = TIMER_WHEEL_LEVEL0_SLOTS / 64;
+    int i;
+
+    /* Search circularly from startSlot, coming back round to the start of its own word last. */
+    for (i = 0 ; i <= wordCount ; i++)
+    {
+        int      word = ((startSlot >> 6) + i) % wordCount;
+        uint64_t bits = pWheel->level0Occupied[word];
+
+        if (i == 0)
+            bits &= ~0ULL << (startSlot & 63);
+        else if (i == wordCount)
+            bits &= (1ULL << (startSlot & 63)) - 1;
+        if (bits)
+            return (word * 64 + __builtin_ctzll(bits) - startSlot) & (TIMER_WHEEL_LEVEL0_SLOTS - 1);
+    }
+    return -1;
+}
+
+static uint64_t rotateRight(uint64_t bits, int count)
+{
+    return count == 0 ? bits : (bits >> count) | (bits << (64 - count));
+}
+
+static void processTick(TimerWheel* pWheel, uint64_t tick)
+{
+    Timer expired;
+    int   level;
+
+    pWheel->currentTick = tick;
+    for (level = TIMER_WHEEL_LEVELS - 1 ; level > 0 ; level--)
+    {
+        int shift = levelShift(level);
+
+        if ((tick & ((1ULL << shift) - 1)) == 0)
+            cascade(pWheel, level, (int)(tick >> shift) & (TIMER_WHEEL_SLOTS - 1));
+    }
+
+    /* Timers armed by the callbacks land from the next tick on rather than in the slot being expired. */
+    detachSlot(pWheel, 0, (int)(tick & (TIMER_WHEEL_LEVEL0_SLOTS - 1)), &expired);
+    pWheel->currentTick = tick + 1;
+    while (expired.pNext != &expired)
+    {
+        Timer* pTimer = expired.pNext;
+
+        unlinkTimer(pTimer);
+        pWheel->timerCount--;
+        pTimer->pCallback(pTimer, pTimer->pContext);
+    }
+}
+
+static void cascade(TimerWheel* pWheel, int level, int slot)
+{
+    Timer list;
+
+    detachSlot(pWheel, level, slot, &list);
+    while (list.pNext != &list)
+    {
+        Timer* pTimer = list.pNext;
+
+        unlinkTimer(pTimer);
+        insertTimer(pWheel, pTimer);
+    }
+}
+
+static void detachSlot(TimerWheel* pWheel, int level, int slot, Timer* pList)
+{
+    Timer* pHead = slotHead(pWheel, level, slot);
+
+    initList(pList);
+    if (pHead->pNext == pHead)
+        return;
+    pList->pNext = pHead->pNext;
+    pList->pPrevious = pHead->pPrevious;
+    pList->pNext->pPrevious = pList;
+    pList->pPrevious->pNext = pList;
+    initList(pHead);
+    markEmptyIfUnused(pWheel, level, slot);
+}
+
+int TimerWheel_GetTimeout(TimerWheel* pWheel, uint64_t now)
+{
+    uint64_t deadline;
+    uint64_t milliseconds;
+
+    if (pWheel->timerCount == 0)
+        return -1;
+    deadline = pWheel->startTime + nextEventTick(pWheel) * TIMER_WHEEL_NANOSECONDS_PER_TICK;
+    if (deadline <= now)
+        return 0;
+    milliseconds = (deadline - now + TIMER_WHEEL_NANOSECONDS_PER_TICK - 1) / TIMER_WHEEL_NANOSECONDS_PER_TICK;
+    return milliseconds > INT_MAX ? INT_MAX : (int)milliseconds;
+}
+
+uint64_t TimerWheel_GetTimerCount(TimerWheel* pWheel)
+{
+    return pWheel->timerCount;
+}
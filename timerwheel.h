@@ -0,0 +1,69 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef _TIMERWHEEL_H_
+#define _TIMERWHEEL_H_
+
+#include <stdint.h>
+
+/* A hierarchical timer wheel with millisecond ticks.  The first level has TIMER_WHEEL_LEVEL0_SLOTS slots, one per
+   tick, and each of the TIMER_WHEEL_LEVELS - 1 levels above it has TIMER_WHEEL_SLOTS slots each covering a whole
+   rotation of the level below.  A timer goes straight into the slot for its deadline at the lowest level which can
+   hold it, and whenever a lower level completes a rotation the next slot of the level above is cascaded down, so
+   arming and cancelling are O(1) and each timer is touched at most once per level before it expires.  An occupancy
+   bitmap per level lets TimerWheel_GetTimeout() find the next tick with anything to do without scanning slots, so
+   an event loop can sleep exactly until then.  Deadlines further out than the wheel covers (about 18 hours) are
+   clamped to its end.  Timers are embedded in their owners and expire on the thread calling TimerWheel_Advance(). */
+#define TIMER_WHEEL_LEVEL0_BITS 8
+#define TIMER_WHEEL_LEVEL0_SLOTS (1 << TIMER_WHEEL_LEVEL0_BITS)
+#define TIMER_WHEEL_LEVEL_BITS  6
+#define TIMER_WHEEL_SLOTS       (1 << TIMER_WHEEL_LEVEL_BITS)
+#define TIMER_WHEEL_LEVELS      4
+
+struct Timer;
+typedef void TimerCallback(struct Timer* pTimer, void* pContext);
+
+typedef struct Timer
+{
+    struct Timer*  pNext;
+    struct Timer*  pPrevious;
+    TimerCallback* pCallback;
+    void*          pContext;
+    uint64_t       expiryTick;
+    int            level;
+    int            slot;
+} Timer;
+
+typedef struct
+{
+    Timer    level0[TIMER_WHEEL_LEVEL0_SLOTS];
+    Timer    levels[TIMER_WHEEL_LEVELS - 1][TIMER_WHEEL_SLOTS];
+    uint64_t level0Occupied[TIMER_WHEEL_LEVEL0_SLOTS / 64];
+    uint64_t levelOccupied[TIMER_WHEEL_LEVELS - 1];
+    uint64_t startTime;
+    uint64_t currentTick;
+    uint64_t timerCount;
+} TimerWheel;
+
+void     Timer_Init(Timer* pTimer, TimerCallback* pCallback, void* pContext);
+int      Timer_IsArmed(Timer* pTimer);
+
+void     TimerWheel_Init(TimerWheel* pWheel, uint64_t now);
+void     TimerWheel_Arm(TimerWheel* pWheel, Timer* pTimer, uint64_t deadline);
+void     TimerWheel_Cancel(TimerWheel* pWheel, Timer* pTimer);
+void     TimerWheel_Advance(TimerWheel* pWheel, uint64_t now);
+int      TimerWheel_GetTimeout(TimerWheel* pWheel, uint64_t now);
+uint64_t TimerWheel_GetTimerCount(TimerWheel* pWheel);
+
+#endif /* _TIMERWHEEL_H_ */
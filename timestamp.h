@@ -0,0 +1,41 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef _TIMESTAMP_H_
+#define _TIMESTAMP_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#define TIMESTAMP_NANOSECONDS_PER_SECOND        1000000000ULL
+#define TIMESTAMP_NANOSECONDS_PER_MICROSECOND   1000ULL
+
+static inline uint64_t Timestamp_Now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * TIMESTAMP_NANOSECONDS_PER_SECOND + now.tv_nsec;
+}
+
+/* Wall clock time, for comparing against the kernel's SO_TIMESTAMPNS receive timestamps. */
+static inline uint64_t Timestamp_WallClockNow(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * TIMESTAMP_NANOSECONDS_PER_SECOND + now.tv_nsec;
+}
+
+#endif /* _TIMESTAMP_H_ */
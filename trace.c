@@ -0,0 +1,229 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "protocol.h"
+#include "timestamp.h"
+#include "trace.h"
+
+
+#define TRACE_CLOCK_REQUEST_INTERVAL    TIMESTAMP_NANOSECONDS_PER_SECOND
+#define TRACE_CLOCK_SAMPLES_PER_EPOCH   60
+
+
+static int      bucketFromValue(uint64_t value);
+static uint64_t bucketUpperBound(int bucket);
+static uint64_t histogramPercentile(const TraceHistogram* pHistogram, int percentile);
+static uint64_t toServerTime(TraceStats* pStats, uint64_t clientTime);
+static double   microsecondsFromNanoseconds(uint64_t nanoseconds);
+
+
+void Trace_EncodeChunk(char* pDest, uint64_t readTime, uint64_t sendStartTime, uint64_t sendEndTime)
+{
+    Protocol_PutUint64(pDest, readTime);
+    Protocol_PutUint64(pDest + 8, sendStartTime);
+    Protocol_PutUint64(pDest + 16, sendEndTime);
+}
+
+void Trace_SetChunkSendEndTime(char* pChunk, uint64_t sendEndTime)
+{
+    Protocol_PutUint64(pChunk + 16, sendEndTime);
+}
+
+void Trace_EncodeClockReply(char* pDest, const char* pRequest, uint64_t receiveTime, uint64_t sendTime)
+{
+    memcpy(pDest, pRequest, TRACE_CLOCK_REQUEST_SIZE);
+    Protocol_PutUint64(pDest + 8, receiveTime);
+    Protocol_PutUint64(pDest + 16, sendTime);
+}
+
+void TraceStats_Init(TraceStats* pStats)
+{
+    memset(pStats, 0, sizeof(*pStats));
+    pStats->bestRoundTrip = UINT64_MAX;
+}
+
+void TraceStats_RecordWrite(TraceStats* pStats, uint64_t receiveTime, uint64_t writeStartTime, uint64_t writeEndTime)
+{
+    pStats->chunkReceiveTime = receiveTime;
+    pStats->chunkWriteStartTime = writeStartTime;
+    pStats->chunkWriteEndTime = writeEndTime;
+    pStats->hasPendingChunk = 1;
+}
+
+void TraceStats_RecordChunk(TraceStats* pStats, const char* pPayload, size_t length)
+{
+    uint64_t readTime;
+    uint64_t sendStartTime;
+    uint64_t sendEndTime;
+
+    pStats->isActive = 1;
+    if (length < TRACE_CHUNK_SIZE || !pStats->hasPendingChunk)
+        return;
+    pStats->hasPendingChunk = 0;
+
+    readTime = Protocol_GetUint64(pPayload);
+    sendStartTime = Protocol_GetUint64(pPayload + 8);
+    sendEndTime = Protocol_GetUint64(pPayload + 16);
+
+    TraceHistogram_Record(&pStats->histograms[TRACE_STAGE_CLIENT], (int64_t)(sendStartTime - readTime));
+    TraceHistogram_Record(&pStats->histograms[TRACE_STAGE_SEND], (int64_t)(sendEndTime - sendStartTime));
+    TraceHistogram_Record(&pStats->histograms[TRACE_STAGE_NETWORK],
+                          (int64_t)(pStats->chunkReceiveTime - toServerTime(pStats, sendEndTime)));
+    TraceHistogram_Record(&pStats->histograms[TRACE_STAGE_SERVER],
+                          (int64_t)(pStats->chunkWriteStartTime - pStats->chunkReceiveTime));
+    TraceHistogram_Record(&pStats->histograms[TRACE_STAGE_CONSOLE],
+                          (int64_t)(pStats->chunkWriteEndTime - pStats->chunkWriteStartTime));
+    TraceHistogram_Record(&pStats->histograms[TRACE_STAGE_TOTAL],
+                          (int64_t)(pStats->chunkWriteEndTime - toServerTime(pStats, readTime)));
+}
+
+void TraceHistogram_Record(TraceHistogram* pHistogram, int64_t value)
+{
+    /* Clock offset error can make a cross-host stage come out slightly negative; count it as zero. */
+    uint64_t sample = value < 0 ? 0 : (uint64_t)value;
+
+    pHistogram->counts[bucketFromValue(sample)]++;
+    pHistogram->sampleCount++;
+    pHistogram->sum += sample;
+    if (sample > pHistogram->maximum)
+        pHistogram->maximum = sample;
+}
+
+static int bucketFromValue(uint64_t value)
+{
+    int bucket;
+
+    /* Bucket n holds values in [2^(n-1), 2^n) nanoseconds with bucket 0 holding just 0. */
+    if (value == 0)
+        return 0;
+    bucket = 64 - __builtin_clzll(value);
+    return bucket < TRACE_HISTOGRAM_BUCKETS ? bucket : TRACE_HISTOGRAM_BUCKETS - 1;
+}
+
+static uint64_t bucketUpperBound(int bucket)
+{
+    return bucket >= 63 ? UINT64_MAX : (1ULL << bucket) - 1;
+}
+
+static uint64_t toServerTime(TraceStats* pStats, uint64_t clientTime)
+{
+    return clientTime - pStats->clockOffset;
+}
+
+void TraceStats_RecordClockReply(TraceStats* pStats, const char* pPayload, size_t length, uint64_t receiveTime)
+{
+    uint64_t requestTime;
+    uint64_t clientReceiveTime;
+    uint64_t clientSendTime;
+    uint64_t roundTrip;
+
+    if (length < TRACE_CLOCK_REPLY_SIZE)
+        return;
+    requestTime = Protocol_GetUint64(pPayload);
+    clientReceiveTime = Protocol_GetUint64(pPayload + 8);
+    clientSendTime = Protocol_GetUint64(pPayload + 16);
+
+    /* Start a new epoch now and again so that the estimate follows any drift between the two clocks. */
+    if (pStats->clockSampleCount++ % TRACE_CLOCK_SAMPLES_PER_EPOCH == 0)
+        pStats->bestRoundTrip = UINT64_MAX;
+
+    roundTrip = (receiveTime - requestTime) - (clientSendTime - clientReceiveTime);
+    if (roundTrip > pStats->bestRoundTrip)
+        return;
+    pStats->bestRoundTrip = roundTrip;
+    pStats->clockOffset = ((int64_t)(clientReceiveTime - requestTime) + (int64_t)(clientSendTime - receiveTime)) / 2;
+}
+
+int TraceStats_IsClockRequestDue(TraceStats* pStats, uint64_t now)
+{
+    return pStats->isActive && now - pStats->lastClockRequestTime >= TRACE_CLOCK_REQUEST_INTERVAL;
+}
+
+void TraceStats_EncodeClockRequest(TraceStats* pStats, char* pDest, uint64_t now)
+{
+    pStats->lastClockRequestTime = now;
+    Protocol_PutUint64(pDest, now);
+}
+
+void TraceStats_Display(TraceStats* pStats)
+{
+    static const char* stageNames[TRACE_STAGE_COUNT] =
+    {
+        "client", "send", "network", "server", "console", "total"
+    };
+    int i;
+
+    if (!pStats->isActive)
+    {
+        printf("No trace data; start remote with --trace.\n");
+        return;
+    }
+
+    if (pStats->bestRoundTrip == UINT64_MAX)
+        printf("Clock offset not yet estimated.\n");
+    else
+        printf("Clock offset %+.1f us (+/- %.1f us).\n",
+               (double)pStats->clockOffset / 1000.0, microsecondsFromNanoseconds(pStats->bestRoundTrip / 2));
+    TraceHistogram_DisplayHeader("stage");
+    for (i = 0 ; i < TRACE_STAGE_COUNT ; i++)
+        TraceHistogram_Display(stageNames[i], &pStats->histograms[i]);
+    fflush(stdout);
+}
+
+void TraceHistogram_DisplayHeader(const char* pName)
+{
+    printf("%-8s %10s %12s %12s %12s %12s\n", pName, "samples", "mean (us)", "p50 (us)", "p99 (us)", "max (us)");
+}
+
+void TraceHistogram_Display(const char* pName, const TraceHistogram* pHistogram)
+{
+    uint64_t mean = pHistogram->sampleCount ? pHistogram->sum / pHistogram->sampleCount : 0;
+
+    /* Percentiles are reported as the upper bound of the power of two bucket they fall in. */
+    printf("%-8s %10llu %12.1f %12.1f %12.1f %12.1f\n",
+           pName,
+           (unsigned long long)pHistogram->sampleCount,
+           microsecondsFromNanoseconds(mean),
+           microsecondsFromNanoseconds(histogramPercentile(pHistogram, 50)),
+           microsecondsFromNanoseconds(histogramPercentile(pHistogram, 99)),
+           microsecondsFromNanoseconds(pHistogram->maximum));
+}
+
+static uint64_t histogramPercentile(const TraceHistogram* pHistogram, int percentile)
+{
+    uint64_t threshold = (pHistogram->sampleCount * percentile + 99) / 100;
+    uint64_t cumulative = 0;
+    int      i;
+
+    if (pHistogram->sampleCount == 0)
+        return 0;
+    for (i = 0 ; i < TRACE_HISTOGRAM_BUCKETS ; i++)
+    {
+        cumulative += pHistogram->counts[i];
+        if (cumulative >= threshold)
+            break;
+    }
+    if (i == TRACE_HISTOGRAM_BUCKETS)
+        i--;
+
+    /* Never report more than the largest value actually seen. */
+    return bucketUpperBound(i) < pHistogram->maximum ? bucketUpperBound(i) : pHistogram->maximum;
+}
+
+static double microsecondsFromNanoseconds(uint64_t nanoseconds)
+{
+    return (double)nanoseconds / (double)TIMESTAMP_NANOSECONDS_PER_MICROSECOND;
+}
@@ -0,0 +1,88 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* When remote runs with --trace it follows every chunk of child output it sends with a FRAME_TRACE/TRACE_CHUNK
+   frame carrying its own monotonic timestamps for that chunk: when it was read from the child's pipe and when the
+   send to the server started and finished.  The server adds when it received the chunk and when its console write
+   started and finished, converting client times to its own clock with an offset estimated from periodic
+   TRACE_CLOCK_REQUEST/TRACE_CLOCK_REPLY exchanges (the reply from the lowest round trip seen is trusted most). */
+#define TRACE_CHUNK_SIZE            24
+#define TRACE_CLOCK_REQUEST_SIZE    8
+#define TRACE_CLOCK_REPLY_SIZE      24
+#define TRACE_HISTOGRAM_BUCKETS     64
+
+/* Flags values used for FRAME_TRACE. */
+typedef enum
+{
+    TRACE_CHUNK = 1,
+    TRACE_CLOCK_REQUEST,
+    TRACE_CLOCK_REPLY
+} TraceFrameType;
+
+typedef enum
+{
+    TRACE_STAGE_CLIENT = 0,
+    TRACE_STAGE_SEND,
+    TRACE_STAGE_NETWORK,
+    TRACE_STAGE_SERVER,
+    TRACE_STAGE_CONSOLE,
+    TRACE_STAGE_TOTAL,
+    TRACE_STAGE_COUNT
+} TraceStage;
+
+typedef struct
+{
+    uint64_t counts[TRACE_HISTOGRAM_BUCKETS];
+    uint64_t sampleCount;
+    uint64_t sum;
+    uint64_t maximum;
+} TraceHistogram;
+
+typedef struct
+{
+    TraceHistogram histograms[TRACE_STAGE_COUNT];
+    int64_t        clockOffset;
+    uint64_t       bestRoundTrip;
+    uint64_t       lastClockRequestTime;
+    uint64_t       clockSampleCount;
+    uint64_t       chunkReceiveTime;
+    uint64_t       chunkWriteStartTime;
+    uint64_t       chunkWriteEndTime;
+    int            hasPendingChunk;
+    int            isActive;
+} TraceStats;
+
+void     Trace_EncodeChunk(char* pDest, uint64_t readTime, uint64_t sendStartTime, uint64_t sendEndTime);
+void     Trace_SetChunkSendEndTime(char* pChunk, uint64_t sendEndTime);
+void     Trace_EncodeClockReply(char* pDest, const char* pRequest, uint64_t receiveTime, uint64_t sendTime);
+
+void     TraceHistogram_Record(TraceHistogram* pHistogram, int64_t value);
+void     TraceHistogram_DisplayHeader(const char* pName);
+void     TraceHistogram_Display(const char* pName, const TraceHistogram* pHistogram);
+
+void     TraceStats_Init(TraceStats* pStats);
+void     TraceStats_RecordWrite(TraceStats* pStats, uint64_t receiveTime, uint64_t writeStartTime, uint64_t writeEndTime);
+void     TraceStats_RecordChunk(TraceStats* pStats, const char* pPayload, size_t length);
+void     TraceStats_RecordClockReply(TraceStats* pStats, const char* pPayload, size_t length, uint64_t receiveTime);
+int      TraceStats_IsClockRequestDue(TraceStats* pStats, uint64_t now);
+void     TraceStats_EncodeClockRequest(TraceStats* pStats, char* pDest, uint64_t now);
+void     TraceStats_Display(TraceStats* pStats);
+
+#endif /* _TRACE_H_ */
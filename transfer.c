@@ -0,0 +1,635 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "try_catch.h"
+#include "transfer.h"
+
+
+#define TRANSFER_PULL_HEADER_SIZE   12
+#define TRANSFER_PUSH_HEADER_SIZE   12
+#define TRANSFER_CHUNK_HEADER_SIZE  24
+#define TRANSFER_ACK_SIZE           13
+#define TRANSFER_ERROR_SIZE         8
+#define TRANSFER_UNKNOWN_SIZE       UINT64_MAX
+
+typedef enum
+{
+    ACK_OK = 0,
+    ACK_RETRY
+} AckStatus;
+
+
+static pthread_once_t g_crcTableOnce = PTHREAD_ONCE_INIT;
+static uint32_t       g_crcTable[256];
+
+
+static Transfer* allocateTransfer(TransferSet* pSet, uint32_t id, TransferRole role, const char* pPath);
+static Transfer* findTransfer(TransferSet* pSet, uint32_t id, TransferRole role);
+static void      releaseTransfer(Transfer* pTransfer);
+static int       openPartialFile(Transfer* pTransfer, uint64_t* pResumeOffset);
+static void      buildPartialPath(char* pDest, size_t destSize, const char* pPath);
+static void      handlePullRequest(TransferSet* pSet, const char* pPayload, uint32_t length);
+static void      handlePushRequest(TransferSet* pSet, const char* pPayload, uint32_t length);
+static void      handleChunk(TransferSet* pSet, const char* pPayload, uint32_t length);
+static void      handleAck(TransferSet* pSet, const char* pPayload, uint32_t length);
+static void      handleError(TransferSet* pSet, const char* pPayload, uint32_t length);
+static void      copyPathFromPayload(char* pDest, const char* pSource, uint32_t length);
+static void      pumpSender(TransferSet* pSet, Transfer* pTransfer);
+static void      sendChunk(TransferSet* pSet, Transfer* pTransfer, size_t chunkLength);
+static int       calculateFileCrc(int fileDescriptor, uint64_t offset, size_t length, uint32_t* pCrc);
+static void      sendAck(TransferSet* pSet, uint32_t id, uint64_t offset, AckStatus status);
+static void      sendError(TransferSet* pSet, uint32_t id, int errorNumber);
+static void      failTransfer(TransferSet* pSet, Transfer* pTransfer, int errorNumber);
+static void      completeReceive(Transfer* pTransfer);
+static void      completeSend(Transfer* pTransfer);
+static void      initCrcTable(void);
+static uint32_t  crc32(uint32_t crc, const void* pBuffer, size_t length);
+
+
+void TransferSet_Init(TransferSet* pSet, FrameWriter* pWriter, uint16_t channel, int isServingRequests)
+{
+    int i;
+
+    memset(pSet, 0, sizeof(*pSet));
+    for (i = 0 ; i < TRANSFER_MAX_ACTIVE ; i++)
+    {
+        pSet->transfers[i].fileDescriptor = -1;
+        pSet->transfers[i].role = TRANSFER_IDLE;
+    }
+    pSet->nextId = 1;
+    pSet->pWriter = pWriter;
+    pSet->isServingRequests = isServingRequests;
+    pSet->channel = channel;
+    pthread_once(&g_crcTableOnce, initCrcTable);
+}
+
+void TransferSet_Uninit(TransferSet* pSet)
+{
+    int i;
+
+    for (i = 0 ; i < TRANSFER_MAX_ACTIVE ; i++)
+    {
+        if (pSet->transfers[i].role != TRANSFER_IDLE)
+        {
+            printf("Transfer %u of %s interrupted after %llu bytes.\n", pSet->transfers[i].id,
+                   pSet->transfers[i].path, (unsigned long long)pSet->transfers[i].acknowledgedOffset);
+            releaseTransfer(&pSet->transfers[i]);
+        }
+    }
+    fflush(stdout);
+    pSet->pWriter = NULL;
+}
+
+int TransferSet_ActiveCount(TransferSet* pSet)
+{
+    int count = 0;
+    int i;
+
+    for (i = 0 ; i < TRANSFER_MAX_ACTIVE ; i++)
+        count += pSet->transfers[i].role != TRANSFER_IDLE;
+    return count;
+}
+
+void TransferSet_Pull(TransferSet* pSet, const char* pRemotePath, const char* pLocalPath)
+{
+    char         header[TRANSFER_PULL_HEADER_SIZE];
+    struct iovec vectors[2];
+    Transfer*    pTransfer = NULL;
+    uint64_t     resumeOffset = 0;
+
+    pTransfer = allocateTransfer(pSet, pSet->nextId++, TRANSFER_RECEIVING, pLocalPath);
+    if (!pTransfer)
+        __throw(fileException);
+    if (openPartialFile(pTransfer, &resumeOffset) < 0)
+    {
+        releaseTransfer(pTransfer);
+        __throw(fileException);
+    }
+
+    Protocol_PutUint32(header, pTransfer->id);
+    Protocol_PutUint64(header + 4, resumeOffset);
+    vectors[0].iov_base = header;
+    vectors[0].iov_len = sizeof(header);
+    vectors[1].iov_base = (void*)pRemotePath;
+    vectors[1].iov_len = strlen(pRemotePath);
+
+    printf("Transfer %u: pulling %s into %s", pTransfer->id, pRemotePath, pLocalPath);
+    if (resumeOffset)
+        printf(" (resuming at %llu)", (unsigned long long)resumeOffset);
+    printf(".\n");
+    fflush(stdout);
+
+    __try
+        FrameWriter_SendFrameVector(pSet->pWriter, FRAME_FILE_PULL, 0, pSet->channel, vectors, 2);
+    __catch
+        __rethrow;
+}
+
+void TransferSet_Push(TransferSet* pSet, const char* pLocalPath, const char* pRemotePath)
+{
+    char         header[TRANSFER_PUSH_HEADER_SIZE];
+    struct iovec vectors[2];
+    struct stat  fileStatus;
+    Transfer*    pTransfer = NULL;
+
+    pTransfer = allocateTransfer(pSet, pSet->nextId++, TRANSFER_SENDING, pLocalPath);
+    if (!pTransfer)
+        __throw(fileException);
+    pTransfer->fileDescriptor = open(pLocalPath, O_RDONLY | O_CLOEXEC);
+    if (pTransfer->fileDescriptor < 0 || fstat(pTransfer->fileDescriptor, &fileStatus) < 0)
+    {
+        releaseTransfer(pTransfer);
+        __throw(fileException);
+    }
+    pTransfer->totalSize = fileStatus.st_size;
+
+    Protocol_PutUint32(header, pTransfer->id);
+    Protocol_PutUint64(header + 4, pTransfer->totalSize);
+    vectors[0].iov_base = header;
+    vectors[0].iov_len = sizeof(header);
+    vectors[1].iov_base = (void*)pRemotePath;
+    vectors[1].iov_len = strlen(pRemotePath);
+
+    printf("Transfer %u: pushing %s (%llu bytes) to %s.\n", pTransfer->id, pLocalPath,
+           (unsigned long long)pTransfer->totalSize, pRemotePath);
+    fflush(stdout);
+
+    __try
+        FrameWriter_SendFrameVector(pSet->pWriter, FRAME_FILE_PUSH, 0, pSet->channel, vectors, 2);
+    __catch
+        __rethrow;
+}
+
+static Transfer* allocateTransfer(TransferSet* pSet, uint32_t id, TransferRole role, const char* pPath)
+{
+    int i;
+
+    if (strlen(pPath) >= sizeof(pSet->transfers[0].path) - sizeof(".part"))
+    {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    for (i = 0 ; i < TRANSFER_MAX_ACTIVE ; i++)
+    {
+        Transfer* pTransfer = &pSet->transfers[i];
+
+        if (pTransfer->role == TRANSFER_IDLE)
+        {
+            strcpy(pTransfer->path, pPath);
+            pTransfer->totalSize = TRANSFER_UNKNOWN_SIZE;
+            pTransfer->nextOffset = 0;
+            pTransfer->acknowledgedOffset = 0;
+            pTransfer->id = id;
+            pTransfer->hasSentChunk = 0;
+            pTransfer->isStarted = 0;
+            pTransfer->role = role;
+            return pTransfer;
+        }
+    }
+    errno = EBUSY;
+    return NULL;
+}
+
+static Transfer* findTransfer(TransferSet* pSet, uint32_t id, TransferRole role)
+{
+    int i;
+
+    for (i = 0 ; i < TRANSFER_MAX_ACTIVE ; i++)
+    {
+        if (pSet->transfers[i].role == role && pSet->transfers[i].id == id)
+            return &pSet->transfers[i];
+    }
+    return NULL;
+}
+
+static void releaseTransfer(Transfer* pTransfer)
+{
+    int savedErrno = errno;
+
+    if (pTransfer->fileDescriptor >= 0)
+        close(pTransfer->fileDescriptor);
+    errno = savedErrno;
+    pTransfer->fileDescriptor = -1;
+    pTransfer->role = TRANSFER_IDLE;
+}
+
+static int openPartialFile(Transfer* pTransfer, uint64_t* pResumeOffset)
+{
+    char        partialPath[PATH_MAX];
+    struct stat fileStatus;
+    uint64_t    resumeOffset;
+
+    buildPartialPath(partialPath, sizeof(partialPath), pTransfer->path);
+    pTransfer->fileDescriptor = open(partialPath, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (pTransfer->fileDescriptor < 0 || fstat(pTransfer->fileDescriptor, &fileStatus) < 0)
+        return -1;
+
+    resumeOffset = fileStatus.st_size - fileStatus.st_size % TRANSFER_CHUNK_SIZE;
+    if (ftruncate(pTransfer->fileDescriptor, resumeOffset) < 0)
+        return -1;
+
+    pTransfer->nextOffset = resumeOffset;
+    pTransfer->acknowledgedOffset = resumeOffset;
+    *pResumeOffset = resumeOffset;
+    return 0;
+}
+
+static void buildPartialPath(char* pDest, size_t destSize, const char* pPath)
+{
+    snprintf(pDest, destSize, "%s.part", pPath);
+}
+
+int TransferSet_IsTransferFrame(const FrameHeader* pHeader)
+{
+    return pHeader->type >= FRAME_FILE_PULL && pHeader->type <= FRAME_FILE_ERROR;
+}
+
+void TransferSet_ProcessFrame(TransferSet* pSet, const FrameHeader* pHeader, const char* pPayload)
+{
+    switch (pHeader->type)
+    {
+    case FRAME_FILE_PULL:
+        if (pSet->isServingRequests)
+            handlePullRequest(pSet, pPayload, pHeader->length);
+        break;
+    case FRAME_FILE_PUSH:
+        if (pSet->isServingRequests)
+            handlePushRequest(pSet, pPayload, pHeader->length);
+        break;
+    case FRAME_FILE_CHUNK:
+        handleChunk(pSet, pPayload, pHeader->length);
+        break;
+    case FRAME_FILE_ACK:
+        handleAck(pSet, pPayload, pHeader->length);
+        break;
+    case FRAME_FILE_ERROR:
+        handleError(pSet, pPayload, pHeader->length);
+        break;
+    }
+}
+
+static void handlePullRequest(TransferSet* pSet, const char* pPayload, uint32_t length)
+{
+    char        path[PATH_MAX];
+    struct stat fileStatus;
+    Transfer*   pTransfer = NULL;
+    uint32_t    id;
+    uint64_t    resumeOffset;
+
+    if (length < TRANSFER_PULL_HEADER_SIZE)
+        return;
+    id = Protocol_GetUint32(pPayload);
+    resumeOffset = Protocol_GetUint64(pPayload + 4);
+    copyPathFromPayload(path, pPayload + TRANSFER_PULL_HEADER_SIZE, length - TRANSFER_PULL_HEADER_SIZE);
+
+    pTransfer = allocateTransfer(pSet, id, TRANSFER_SENDING, path);
+    if (!pTransfer)
+    {
+        sendError(pSet, id, EBUSY);
+        return;
+    }
+    pTransfer->fileDescriptor = open(path, O_RDONLY | O_CLOEXEC);
+    if (pTransfer->fileDescriptor < 0 || fstat(pTransfer->fileDescriptor, &fileStatus) < 0)
+    {
+        failTransfer(pSet, pTransfer, errno);
+        return;
+    }
+    if (resumeOffset > (uint64_t)fileStatus.st_size)
+    {
+        failTransfer(pSet, pTransfer, ESPIPE);
+        return;
+    }
+
+    pTransfer->totalSize = fileStatus.st_size;
+    pTransfer->nextOffset = resumeOffset;
+    pTransfer->acknowledgedOffset = resumeOffset;
+    pTransfer->isStarted = 1;
+    pumpSender(pSet, pTransfer);
+}
+
+static void handlePushRequest(TransferSet* pSet, const char* pPayload, uint32_t length)
+{
+    char      path[PATH_MAX];
+    Transfer* pTransfer = NULL;
+    uint32_t  id;
+    uint64_t  resumeOffset = 0;
+
+    if (length < TRANSFER_PUSH_HEADER_SIZE)
+        return;
+    id = Protocol_GetUint32(pPayload);
+    copyPathFromPayload(path, pPayload + TRANSFER_PUSH_HEADER_SIZE, length - TRANSFER_PUSH_HEADER_SIZE);
+
+    pTransfer = allocateTransfer(pSet, id, TRANSFER_RECEIVING, path);
+    if (!pTransfer)
+    {
+        sendError(pSet, id, EBUSY);
+        return;
+    }
+    pTransfer->totalSize = Protocol_GetUint64(pPayload + 4);
+    if (openPartialFile(pTransfer, &resumeOffset) < 0)
+    {
+        failTransfer(pSet, pTransfer, errno);
+        return;
+    }
+    if (resumeOffset > pTransfer->totalSize)
+    {
+        resumeOffset = 0;
+        pTransfer->nextOffset = pTransfer->acknowledgedOffset = 0;
+        if (ftruncate(pTransfer->fileDescriptor, 0) < 0)
+        {
+            failTransfer(pSet, pTransfer, errno);
+            return;
+        }
+    }
+
+    printf("Transfer %u: receiving %s (%llu bytes", id, path, (unsigned long long)pTransfer->totalSize);
+    if (resumeOffset)
+        printf(", resuming at %llu", (unsigned long long)resumeOffset);
+    printf(").\n");
+    fflush(stdout);
+
+    sendAck(pSet, id, resumeOffset, ACK_OK);
+    if (resumeOffset == pTransfer->totalSize)
+        completeReceive(pTransfer);
+}
+
+static void copyPathFromPayload(char* pDest, const char* pSource, uint32_t length)
+{
+    if (length >= PATH_MAX)
+        length = PATH_MAX - 1;
+    memcpy(pDest, pSource, length);
+    pDest[length] = '\0';
+}
+
+static void handleChunk(TransferSet* pSet, const char* pPayload, uint32_t length)
+{
+    Transfer*   pTransfer = NULL;
+    const char* pData = pPayload + TRANSFER_CHUNK_HEADER_SIZE;
+    uint32_t    dataLength;
+    uint64_t    offset;
+    uint32_t    expectedCrc;
+
+    if (length < TRANSFER_CHUNK_HEADER_SIZE)
+        return;
+    dataLength = length - TRANSFER_CHUNK_HEADER_SIZE;
+    pTransfer = findTransfer(pSet, Protocol_GetUint32(pPayload), TRANSFER_RECEIVING);
+    if (!pTransfer)
+        return;
+    offset = Protocol_GetUint64(pPayload + 4);
+    if (offset != pTransfer->nextOffset)
+        return;
+    pTransfer->totalSize = Protocol_GetUint64(pPayload + 12);
+    expectedCrc = Protocol_GetUint32(pPayload + 20);
+
+    if (crc32(0, pData, dataLength) != expectedCrc)
+    {
+        sendAck(pSet, pTransfer->id, pTransfer->nextOffset, ACK_RETRY);
+        return;
+    }
+    if (pwrite(pTransfer->fileDescriptor, pData, dataLength, offset) != (ssize_t)dataLength)
+    {
+        failTransfer(pSet, pTransfer, errno ? errno : ENOSPC);
+        return;
+    }
+    pTransfer->nextOffset += dataLength;
+    pTransfer->acknowledgedOffset = pTransfer->nextOffset;
+
+    sendAck(pSet, pTransfer->id, pTransfer->nextOffset, ACK_OK);
+    if (pTransfer->nextOffset == pTransfer->totalSize)
+        completeReceive(pTransfer);
+}
+
+static void handleAck(TransferSet* pSet, const char* pPayload, uint32_t length)
+{
+    Transfer* pTransfer = NULL;
+    uint64_t  offset;
+
+    if (length < TRANSFER_ACK_SIZE)
+        return;
+    pTransfer = findTransfer(pSet, Protocol_GetUint32(pPayload), TRANSFER_SENDING);
+    if (!pTransfer)
+        return;
+    offset = Protocol_GetUint64(pPayload + 4);
+    if (offset > pTransfer->totalSize)
+    {
+        failTransfer(pSet, pTransfer, ESPIPE);
+        return;
+    }
+
+    pTransfer->acknowledgedOffset = offset;
+    if (!pTransfer->isStarted || pPayload[12] == ACK_RETRY)
+        pTransfer->nextOffset = offset;
+    pTransfer->isStarted = 1;
+
+    if (pTransfer->acknowledgedOffset == pTransfer->totalSize)
+    {
+        completeSend(pTransfer);
+        return;
+    }
+    pumpSender(pSet, pTransfer);
+}
+
+void TransferSet_ResumeSending(TransferSet* pSet)
+{
+    int i;
+
+    for (i = 0 ; i < TRANSFER_MAX_ACTIVE ; i++)
+    {
+        if (pSet->transfers[i].role != TRANSFER_SENDING || !pSet->transfers[i].isStarted)
+            continue;
+        __try
+            pumpSender(pSet, &pSet->transfers[i]);
+        __catch
+            __rethrow;
+    }
+}
+
+static void handleError(TransferSet* pSet, const char* pPayload, uint32_t length)
+{
+    Transfer* pTransfer = NULL;
+    uint32_t  id;
+
+    if (length < TRANSFER_ERROR_SIZE)
+        return;
+    id = Protocol_GetUint32(pPayload);
+    pTransfer = findTransfer(pSet, id, TRANSFER_SENDING);
+    if (!pTransfer)
+        pTransfer = findTransfer(pSet, id, TRANSFER_RECEIVING);
+    if (!pTransfer)
+        return;
+
+    printf("Transfer %u of %s failed on remote side: %s\n", id, pTransfer->path,
+           strerror((int)Protocol_GetUint32(pPayload + 4)));
+    fflush(stdout);
+    releaseTransfer(pTransfer);
+}
+
+static void pumpSender(TransferSet* pSet, Transfer* pTransfer)
+{
+    static const uint64_t windowSize = (uint64_t)TRANSFER_WINDOW_CHUNKS * TRANSFER_CHUNK_SIZE;
+
+    while (pTransfer->role == TRANSFER_SENDING && !FrameWriter_HasQueuedData(pSet->pWriter) &&
+           (pTransfer->nextOffset < pTransfer->totalSize || !pTransfer->hasSentChunk) &&
+           pTransfer->nextOffset - pTransfer->acknowledgedOffset < windowSize)
+    {
+        uint64_t bytesLeft = pTransfer->totalSize - pTransfer->nextOffset;
+        size_t   chunkLength = bytesLeft < TRANSFER_CHUNK_SIZE ? (size_t)bytesLeft : TRANSFER_CHUNK_SIZE;
+
+        __try
+            sendChunk(pSet, pTransfer, chunkLength);
+        __catch
+            __rethrow;
+    }
+}
+
+static void sendChunk(TransferSet* pSet, Transfer* pTransfer, size_t chunkLength)
+{
+    char     header[TRANSFER_CHUNK_HEADER_SIZE];
+    uint32_t crc = 0;
+
+    if (calculateFileCrc(pTransfer->fileDescriptor, pTransfer->nextOffset, chunkLength, &crc) < 0)
+    {
+        failTransfer(pSet, pTransfer, errno);
+        return;
+    }
+
+    Protocol_PutUint32(header, pTransfer->id);
+    Protocol_PutUint64(header + 4, pTransfer->nextOffset);
+    Protocol_PutUint64(header + 12, pTransfer->totalSize);
+    Protocol_PutUint32(header + 20, crc);
+    __try
+    {
+        FrameWriter_SendFrameWithFileData(pSet->pWriter, FRAME_FILE_CHUNK, 0, pSet->channel, header, sizeof(header),
+                                          pTransfer->fileDescriptor, pTransfer->nextOffset, chunkLength);
+    }
+    __catch
+    {
+        __rethrow;
+    }
+
+    pTransfer->nextOffset += chunkLength;
+    pTransfer->hasSentChunk = 1;
+}
+
+static int calculateFileCrc(int fileDescriptor, uint64_t offset, size_t length, uint32_t* pCrc)
+{
+    char     buffer[16 * 1024];
+    uint32_t crc = crc32(0, NULL, 0);
+
+    /* Read rather than mapped since touching a mapping past the end of a file truncated meanwhile raises SIGBUS. */
+    while (length > 0)
+    {
+        size_t  readLength = length < sizeof(buffer) ? length : sizeof(buffer);
+        ssize_t bytesRead = pread(fileDescriptor, buffer, readLength, (off_t)offset);
+
+        if (bytesRead < 0 && errno == EINTR)
+            continue;
+        if (bytesRead < 0)
+            return -1;
+        if (bytesRead == 0)
+        {
+            errno = ESPIPE;
+            return -1;
+        }
+        crc = crc32(crc, buffer, bytesRead);
+        offset += bytesRead;
+        length -= bytesRead;
+    }
+    *pCrc = crc;
+
+    return 0;
+}
+
+static void sendAck(TransferSet* pSet, uint32_t id, uint64_t offset, AckStatus status)
+{
+    char payload[TRANSFER_ACK_SIZE];
+
+    Protocol_PutUint32(payload, id);
+    Protocol_PutUint64(payload + 4, offset);
+    payload[12] = (char)status;
+    FrameWriter_SendFrame(pSet->pWriter, FRAME_FILE_ACK, 0, pSet->channel, payload, sizeof(payload));
+}
+
+static void sendError(TransferSet* pSet, uint32_t id, int errorNumber)
+{
+    char payload[TRANSFER_ERROR_SIZE];
+
+    Protocol_PutUint32(payload, id);
+    Protocol_PutUint32(payload + 4, (uint32_t)errorNumber);
+    FrameWriter_SendFrame(pSet->pWriter, FRAME_FILE_ERROR, 0, pSet->channel, payload, sizeof(payload));
+}
+
+static void failTransfer(TransferSet* pSet, Transfer* pTransfer, int errorNumber)
+{
+    printf("Transfer %u of %s failed: %s\n", pTransfer->id, pTransfer->path, strerror(errorNumber));
+    fflush(stdout);
+    sendError(pSet, pTransfer->id, errorNumber);
+    releaseTransfer(pTransfer);
+}
+
+static void completeReceive(Transfer* pTransfer)
+{
+    char partialPath[PATH_MAX];
+
+    buildPartialPath(partialPath, sizeof(partialPath), pTransfer->path);
+    if (fsync(pTransfer->fileDescriptor) < 0 || rename(partialPath, pTransfer->path) < 0)
+        printf("Transfer %u: failed to finalize %s: %s\n", pTransfer->id, pTransfer->path, strerror(errno));
+    else
+        printf("Transfer %u: received %llu bytes into %s.\n", pTransfer->id,
+               (unsigned long long)pTransfer->totalSize, pTransfer->path);
+    fflush(stdout);
+    releaseTransfer(pTransfer);
+}
+
+static void completeSend(Transfer* pTransfer)
+{
+    printf("Transfer %u: sent %llu bytes of %s.\n", pTransfer->id, (unsigned long long)pTransfer->totalSize,
+           pTransfer->path);
+    fflush(stdout);
+    releaseTransfer(pTransfer);
+}
+
+static void initCrcTable(void)
+{
+    uint32_t i;
+
+    for (i = 0 ; i < 256 ; i++)
+    {
+        uint32_t value = i;
+        int      bit;
+
+        for (bit = 0 ; bit < 8 ; bit++)
+            value = (value & 1) ? (value >> 1) ^ 0xEDB88320 : value >> 1;
+        g_crcTable[i] = value;
+    }
+}
+
+static uint32_t crc32(uint32_t crc, const void* pBuffer, size_t length)
+{
+    const uint8_t* pCurrent = (const uint8_t*)pBuffer;
+
+    crc = ~crc;
+    while (length--)
+        crc = g_crcTable[(crc ^ *pCurrent++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
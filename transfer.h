@@ -0,0 +1,74 @@
+/* Copyright 2012 Adam Green (http://mbed.org/users/AdamGreen/)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef _TRANSFER_H_
+#define _TRANSFER_H_
+
+#include <limits.h>
+#include <stdint.h>
+#include "protocol.h"
+
+/* File transfers are multiplexed over the existing session connection.  The sending side streams fixed size chunks
+   straight from the page cache with sendfile(), each tagged with its offset and CRC-32.  The receiving side writes
+   them to "<path>.part", acknowledges each chunk once it has been written and renames the file when it is complete.
+   Chunks aren't synced before being acknowledged, so an interrupted transfer resumes from the last whole chunk found
+   in the partial file the next time the same transfer is requested rather than from the last acknowledgement.
+
+   Transfers are only ever started from the server console.  A TransferSet which isn't serving requests, as on the
+   server, ignores pull and push requests and only takes chunks, acks and errors for transfers it started itself.
+   Sending stops whenever the FrameWriter has data queued, so a queueing writer never holds more than a chunk per
+   transfer, until TransferSet_ResumeSending() is called once it has been flushed. */
+#define TRANSFER_CHUNK_SIZE     (64 * 1024)
+#define TRANSFER_WINDOW_CHUNKS  16
+#define TRANSFER_MAX_ACTIVE     4
+
+typedef enum
+{
+    TRANSFER_IDLE = 0,
+    TRANSFER_SENDING,
+    TRANSFER_RECEIVING
+} TransferRole;
+
+typedef struct
+{
+    char         path[PATH_MAX];
+    uint64_t     totalSize;
+    uint64_t     nextOffset;
+    uint64_t     acknowledgedOffset;
+    uint32_t     id;
+    int          fileDescriptor;
+    int          hasSentChunk;
+    int          isStarted;
+    TransferRole role;
+} Transfer;
+
+typedef struct
+{
+    Transfer     transfers[TRANSFER_MAX_ACTIVE];
+    FrameWriter* pWriter;
+    uint32_t     nextId;
+    int          isServingRequests;
+    uint16_t     channel;
+} TransferSet;
+
+void TransferSet_Init(TransferSet* pSet, FrameWriter* pWriter, uint16_t channel, int isServingRequests);
+void TransferSet_Uninit(TransferSet* pSet);
+void TransferSet_Pull(TransferSet* pSet, const char* pRemotePath, const char* pLocalPath);
+void TransferSet_Push(TransferSet* pSet, const char* pLocalPath, const char* pRemotePath);
+int  TransferSet_IsTransferFrame(const FrameHeader* pHeader);
+void TransferSet_ProcessFrame(TransferSet* pSet, const FrameHeader* pHeader, const char* pPayload);
+void TransferSet_ResumeSending(TransferSet* pSet);
+int  TransferSet_ActiveCount(TransferSet* pSet);
+
+#endif /* _TRANSFER_H_ */
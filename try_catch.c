@@ -14,4 +14,4 @@
 */
 #include "try_catch.h"
 
-int g_exceptionCode;
+__thread int g_exceptionCode;
@@ -28,8 +28,9 @@ static const int selectException = 9;
 static const int childException = 10;
 static const int serverException = 11;
 static const int userShutdownException = 12;
+static const int fileException = 13;
 
-extern int g_exceptionCode;
+extern __thread int g_exceptionCode;
 
 #define __try \
         do \